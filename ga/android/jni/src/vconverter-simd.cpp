@@ -0,0 +1 @@
+../../../core/vconverter-simd.cpp
\ No newline at end of file
@@ -71,13 +71,21 @@ static RTSPThreadParam rtspThreadParam;
 
 static int relativeMouseMode = 0;
 static int showCursor = 1;
-static int windowSizeX[VIDEO_SOURCE_CHANNEL_MAX];
-static int windowSizeY[VIDEO_SOURCE_CHANNEL_MAX];
-// support resizable window
-static int nativeSizeX[VIDEO_SOURCE_CHANNEL_MAX];
-static int nativeSizeY[VIDEO_SOURCE_CHANNEL_MAX];
+// support resizable window: the sizes of each channel with a window
+typedef struct window_size_s {
+	int windowX, windowY;	/**< Current window size */
+	int nativeX, nativeY;	/**< Video size */
+}	window_size_t;
+static map<int, window_size_t> windowSize;
 static map<unsigned int, int> windowId2ch;
 
+// cursor image and position sent by the server, drawn as the local cursor
+static pthread_mutex_t cursorMutex = PTHREAD_MUTEX_INITIALIZER;
+static ctrlmsg_system_cursorshape_t *cursorShape = NULL;	// received, not applied yet
+static ctrlmsg_system_cursor_t cursorPos;			// the last received position
+static SDL_Cursor *cursor = NULL;
+static long long lastMouseMotion = 0;
+
 // save files
 static FILE *savefp_keyts = NULL;
 
@@ -125,14 +133,115 @@ switch_grab_input(SDL_Window *w) {
 	return;
 }
 
+/* Get the sizes of a channel, or NULL if its window is not created */
+static window_size_t *
+window_size(int ch) {
+	map<int, window_size_t>::iterator mi = windowSize.find(ch);
+	if(mi == windowSize.end())
+		return NULL;
+	return &mi->second;
+}
+
 static int
 xlat_mouseX(int ch, int x) {
-	return (1.0 * nativeSizeX[ch] / windowSizeX[ch]) * x;
+	window_size_t *ws = window_size(ch);
+	if(ws == NULL)
+		return x;
+	return (1.0 * ws->nativeX / ws->windowX) * x;
 }
 
 static int
 xlat_mouseY(int ch, int y) {
-	return (1.0 * nativeSizeY[ch] / windowSizeY[ch]) * y;
+	window_size_t *ws = window_size(ch);
+	if(ws == NULL)
+		return y;
+	return (1.0 * ws->nativeY / ws->windowY) * y;
+}
+
+/* Called by the controller receiver: apply the cursor in the main thread */
+static void
+push_cursor_event() {
+	SDL_Event evt;
+	bzero(&evt, sizeof(evt));
+	evt.user.type = SDL_USEREVENT;
+	evt.user.timestamp = time(0);
+	evt.user.code = SDL_USEREVENT_UPDATE_CURSOR;
+	SDL_PushEvent(&evt);
+	return;
+}
+
+static void
+handle_cursorshape(ctrlmsg_system_t *msg) {
+	ctrlmsg_system_cursorshape_t *shape;
+	if((shape = (ctrlmsg_system_cursorshape_t*) malloc(msg->msgsize)) == NULL)
+		return;
+	bcopy(msg, shape, msg->msgsize);
+	pthread_mutex_lock(&cursorMutex);
+	if(cursorShape != NULL)
+		free(cursorShape);
+	cursorShape = shape;
+	pthread_mutex_unlock(&cursorMutex);
+	push_cursor_event();
+	return;
+}
+
+static void
+handle_cursor(ctrlmsg_system_t *msg) {
+	pthread_mutex_lock(&cursorMutex);
+	bcopy(msg, &cursorPos, sizeof(cursorPos));
+	pthread_mutex_unlock(&cursorMutex);
+	push_cursor_event();
+	return;
+}
+
+static void
+update_cursor() {
+	ctrlmsg_system_cursorshape_t *shape;
+	ctrlmsg_system_cursor_t pos;
+	SDL_Window *w = rtspThreadParam.surface[0];
+	window_size_t *ws;
+	SDL_Surface *s;
+	SDL_Cursor *c;
+	int mx, my, wx, wy;
+	//
+	pthread_mutex_lock(&cursorMutex);
+	shape = cursorShape;
+	cursorShape = NULL;
+	bcopy(&cursorPos, &pos, sizeof(pos));
+	pthread_mutex_unlock(&cursorMutex);
+	// new image: B, G, R, A bytes
+	if(shape != NULL) {
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+		s = SDL_CreateRGBSurfaceFrom(shape->pixels, shape->width, shape->height,
+			32, shape->width * 4, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+#else
+		s = SDL_CreateRGBSurfaceFrom(shape->pixels, shape->width, shape->height,
+			32, shape->width * 4, 0x0000ff00, 0x00ff0000, 0xff000000, 0x000000ff);
+#endif
+		if(s != NULL && (c = SDL_CreateColorCursor(s, shape->xhot, shape->yhot)) != NULL) {
+			SDL_SetCursor(c);
+			if(cursor != NULL)
+				SDL_FreeCursor(cursor);
+			cursor = c;
+		}
+		if(s != NULL)
+			SDL_FreeSurface(s);
+		free(shape);
+	}
+	if(pos.msgsize == 0 || relativeMouseMode != 0 || w == NULL)
+		return;
+	SDL_ShowCursor(pos.visible ? SDL_ENABLE : SDL_DISABLE);
+	// the pointer is moved by the server: follow it, unless the user is moving it
+	if(pos.visible == 0 || (ws = window_size(0)) == NULL
+	|| ga_clock_ns() - lastMouseMotion < 250000000LL
+	|| SDL_GetMouseFocus() != w)
+		return;
+	SDL_GetMouseState(&mx, &my);
+	wx = pos.x * ws->windowX / ws->nativeX;
+	wy = pos.y * ws->windowY / ws->nativeY;
+	if(abs(wx - mx) > 2 || abs(wy - my) > 2)
+		SDL_WarpMouseInWindow(w, wx, wy);
+	return;
 }
 
 static void
@@ -204,8 +313,8 @@ create_overlay(struct RTSPThreadParam *rtspParam, int ch) {
 	}
 	//SDL_SetWindowMaximumSize(surface, w, h);
 	SDL_SetWindowMinimumSize(surface, w>>2, h>>2);
-	nativeSizeX[ch] = windowSizeX[ch] = w;
-	nativeSizeY[ch] = windowSizeY[ch] = h;
+	windowSize[ch].nativeX = windowSize[ch].windowX = w;
+	windowSize[ch].nativeY = windowSize[ch].windowY = h;
 	windowId2ch[SDL_GetWindowID(surface)] = ch;
 	// move mouse to center
 #if 1	// only support SDL2
@@ -414,6 +523,9 @@ ProcessEvent(SDL_Event *event) {
 	map<unsigned int,int>::iterator mi;
 	int ch;
 	struct timeval tv;
+#ifdef ANDROID
+	window_size_t *ws;
+#endif
 	//
 	switch(event->type) {
 	case SDL_KEYUP:
@@ -497,6 +609,7 @@ ProcessEvent(SDL_Event *event) {
 		}
 		break;
 	case SDL_MOUSEMOTION:
+		lastMouseMotion = ga_clock_ns();
 		mi = windowId2ch.find(event->motion.windowID);
 		if(mi != windowId2ch.end() && rtspconf->ctrlenable && rtspconf->sendmousemotion) {
 			ch = mi->second;
@@ -523,13 +636,13 @@ ProcessEvent(SDL_Event *event) {
 		(etf).type, (etf).x, (etf).y, (etf).dx, (etf).dy, (etf).pressure);
 	case SDL_FINGERDOWN:
 		// window size has not been registered
-		if(nativeSizeX[0] == 0)
+		if((ws = window_size(0)) == NULL)
 			break;
 		//DEBUG_FINGER(event->tfinger);
 		if(rtspconf->ctrlenable) {
 		unsigned short mapx, mapy;
-		mapx = (unsigned short) (1.0 * (nativeSizeX[0]-1) * event->tfinger.x / 32767.0);
-		mapy = (unsigned short) (1.0 * (nativeSizeY[0]-1) * event->tfinger.y / 32767.0);
+		mapx = (unsigned short) (1.0 * (ws->nativeX-1) * event->tfinger.x / 32767.0);
+		mapy = (unsigned short) (1.0 * (ws->nativeY-1) * event->tfinger.y / 32767.0);
 		sdlmsg_mousemotion(&m, mapx, mapy, 0, 0, 0, 0);
 		ctrl_client_sendmsg(&m, sizeof(sdlmsg_mouse_t));
 		//
@@ -539,13 +652,13 @@ ProcessEvent(SDL_Event *event) {
 		break;
 	case SDL_FINGERUP:
 		// window size has not been registered
-		if(nativeSizeX[0] == 0)
+		if((ws = window_size(0)) == NULL)
 			break;
 		//DEBUG_FINGER(event->tfinger);
 		if(rtspconf->ctrlenable) {
 		unsigned short mapx, mapy;
-		mapx = (unsigned short) (1.0 * (nativeSizeX[0]-1) * event->tfinger.x / 32767.0);
-		mapy = (unsigned short) (1.0 * (nativeSizeY[0]-1) * event->tfinger.y / 32767.0);
+		mapx = (unsigned short) (1.0 * (ws->nativeX-1) * event->tfinger.x / 32767.0);
+		mapy = (unsigned short) (1.0 * (ws->nativeY-1) * event->tfinger.y / 32767.0);
 		sdlmsg_mousemotion(&m, mapx, mapy, 0, 0, 0, 0);
 		ctrl_client_sendmsg(&m, sizeof(sdlmsg_mouse_t));
 		//
@@ -555,13 +668,13 @@ ProcessEvent(SDL_Event *event) {
 		break;
 	case SDL_FINGERMOTION:
 		// window size has not been registered
-		if(nativeSizeX[0] == 0)
+		if((ws = window_size(0)) == NULL)
 			break;
 		//DEBUG_FINGER(event->tfinger);
 		if(rtspconf->ctrlenable) {
 		unsigned short mapx, mapy;
-		mapx = (unsigned short) (1.0 * (nativeSizeX[0]-1) * event->tfinger.x / 32767.0);
-		mapy = (unsigned short) (1.0 * (nativeSizeY[0]-1) * event->tfinger.y / 32767.0);
+		mapx = (unsigned short) (1.0 * (ws->nativeX-1) * event->tfinger.x / 32767.0);
+		mapy = (unsigned short) (1.0 * (ws->nativeY-1) * event->tfinger.y / 32767.0);
 		sdlmsg_mousemotion(&m, mapx, mapy, 0, 0, 0, 0);
 		ctrl_client_sendmsg(&m, sizeof(sdlmsg_mouse_t));
 		}
@@ -579,8 +692,8 @@ ProcessEvent(SDL_Event *event) {
 				char title[64];
 				w = event->window.data1;
 				h = event->window.data2;
-				windowSizeX[ch] = w;
-				windowSizeY[ch] = h;
+				windowSize[ch].windowX = w;
+				windowSize[ch].windowY = h;
 				snprintf(title, sizeof(title), WINDOW_TITLE, ch, w, h);
 				SDL_SetWindowTitle(rtspThreadParam.surface[ch], title);
 				rtsperror("event window #%d(%x) resized: w=%d h=%d\n",
@@ -605,6 +718,10 @@ ProcessEvent(SDL_Event *event) {
 				(AVCodecContext*) event->user.data2);
 			break;
 		}
+		if(event->user.code == SDL_USEREVENT_UPDATE_CURSOR) {
+			update_cursor();
+			break;
+		}
 		if(event->user.code == SDL_USEREVENT_RENDER_TEXT) {
 			//SDL_SetAlpha()
 			SDL_SetRenderDrawColor(rtspThreadParam.renderer[0], 0, 0, 0, 192/*SDL_ALPHA_OPAQUE/2*/);
@@ -768,6 +885,9 @@ main(int argc, char *argv[]) {
 			rtspconf->ctrlenable = 0;
 			break;
 		}
+		// the cursor is sent by the server
+		ctrlsys_set_handler(CTRL_MSGSYS_SUBTYPE_CURSORSHAPE, handle_cursorshape);
+		ctrlsys_set_handler(CTRL_MSGSYS_SUBTYPE_CURSOR, handle_cursor);
 		if(pthread_create(&ctrlthread, NULL, ctrl_client_thread, rtspconf) != 0) {
 			rtsperror("Cannot create controller thread, controller disabled.\n");
 			rtspconf->ctrlenable = 0;
@@ -295,7 +295,7 @@ init_vdecoder(int channel, const char *sprop) {
 	AVFrame *frame;
 	const char **names = NULL;
 	//
-	if(channel > VIDEO_SOURCE_CHANNEL_MAX) {
+	if(channel >= VIDEO_SOURCE_CHANNEL_MAX) {
 		rtsperror("video decoder(%d): too many decoders.\n", channel);
 		return -1;
 	}
@@ -903,51 +903,71 @@ struct decoder_buffer {
 	unsigned char *privbuf_unaligned;
 };
 
-static struct decoder_buffer db[VIDEO_SOURCE_CHANNEL_MAX];
+// decoder buffers of the set up channels, only used by the live555 thread
+static struct decoder_buffer **db = NULL;
+static int ndb = 0;
 
 static void
 deinit_decoder_buffer() {
 	int i;
-	for(i = 0; i < VIDEO_SOURCE_CHANNEL_MAX; i++) {
-		if(db[i].privbuf_unaligned != NULL) {
-			free(db[i].privbuf_unaligned);
+	for(i = 0; i < ndb; i++) {
+		if(db[i] == NULL)
+			continue;
+		if(db[i]->privbuf_unaligned != NULL) {
+			free(db[i]->privbuf_unaligned);
 		}
+		free(db[i]);
 	}
-	bzero(db, sizeof(db));
+	free(db);
+	db = NULL;
+	ndb = 0;
 	return;
 }
 
+/* Allocate the private buffer of a video channel, when its decoder is created */
 static int
-init_decoder_buffer() {
-	int i;
-	//
-	deinit_decoder_buffer();
-	//
-	for(i = 0; i < VIDEO_SOURCE_CHANNEL_MAX; i++) {
-		db[i].privbuf_unaligned = (unsigned char*) malloc(PRIVATE_BUFFER_SIZE+16);
-		if(db[i].privbuf_unaligned == NULL) {
-			rtsperror("FATAL: cannot allocate private buffer (%d:%d bytes): %s\n",
-				i, PRIVATE_BUFFER_SIZE, strerror(errno));
-			goto adb_failed;
+init_decoder_buffer(int i) {
+	struct decoder_buffer *pdb;
+	if(i < 0)
+		return -1;
+	if(i >= ndb) {
+		struct decoder_buffer **newdb;
+		if((newdb = (struct decoder_buffer**) realloc(db, (i+1) * sizeof(struct decoder_buffer*))) == NULL) {
+			rtsperror("FATAL: cannot allocate decoder buffer table (%d channels)\n", i+1);
+			return -1;
 		}
+		db = newdb;
+		while(ndb <= i)
+			db[ndb++] = NULL;
+	}
+	if(db[i] != NULL)
+		return 0;
+	if((pdb = (struct decoder_buffer*) calloc(1, sizeof(struct decoder_buffer))) == NULL
+	|| (pdb->privbuf_unaligned = (unsigned char*) malloc(PRIVATE_BUFFER_SIZE+16)) == NULL) {
+		rtsperror("FATAL: cannot allocate private buffer (%d:%d bytes): %s\n",
+			i, PRIVATE_BUFFER_SIZE, strerror(errno));
+		free(pdb);
+		return -1;
+	}
 #ifdef __LP64__ /* 64-bit */
-		db[i].offset = 16 - (((unsigned long long) db[i].privbuf_unaligned) & 0x0f);
+	pdb->offset = 16 - (((unsigned long long) pdb->privbuf_unaligned) & 0x0f);
 #else
-		db[i].offset = 16 - (((unsigned) db[i].privbuf_unaligned) & 0x0f);
+	pdb->offset = 16 - (((unsigned) pdb->privbuf_unaligned) & 0x0f);
 #endif
-		db[i].privbuf = db[i].privbuf_unaligned + db[i].offset;
-	}
+	pdb->privbuf = pdb->privbuf_unaligned + pdb->offset;
+	db[i] = pdb;
 	return 0;
-adb_failed:
-	deinit_decoder_buffer();
-	return -1;
 }
 
 static void
 play_video(int channel, unsigned char *buffer, int bufsize, struct timeval pts, bool marker) {
-	struct decoder_buffer *pdb = &db[channel];
+	struct decoder_buffer *pdb;
 	int left;
 	//
+	if(channel < 0 || channel >= ndb || (pdb = db[channel]) == NULL) {
+		rtsperror("video decoder(%d): channel is not set up\n", channel);
+		return;
+	}
 	if(bufsize <= 0 || buffer == NULL) {
 		rtsperror("empty buffer?\n");
 		return;
@@ -966,6 +986,9 @@ play_video(int channel, unsigned char *buffer, int bufsize, struct timeval pts,
 	} else {
 	//////// Work with ffmpeg
 #endif
+	// the channel has no decoder
+	if(pdb->privbuf == NULL)
+		return;
 	if(pts.tv_sec != pdb->lastpts.tv_sec
 	|| pts.tv_usec != pdb->lastpts.tv_usec) {
 		if(pdb->privbuflen > 0) {
@@ -1318,10 +1341,8 @@ rtsp_thread(void *param) {
 	rtspParam = (RTSPThreadParam*) param;
 	rtspParam->videostate = RTSP_VIDEOSTATE_NULL;
 	//
-	if(init_decoder_buffer() < 0) {
-		rtsperror("init decode buffer failed.\n");
-		return NULL;
-	}
+	// decoder buffers are allocated by init_vdecoder() for each channel
+	deinit_decoder_buffer();
 	//
 	if(qos_init(env) < 0) {
 		deinit_decoder_buffer();
@@ -1539,7 +1560,8 @@ setupNextSubsession(RTSPClient* rtspClient) {
 					} else {
 						pvparam = NULL;
 					}
-					if(init_vdecoder(cid, pvparam/*scs.subsession->fmtp_spropparametersets()*/) < 0) {
+					if(init_vdecoder(cid, pvparam/*scs.subsession->fmtp_spropparametersets()*/) < 0
+					|| init_decoder_buffer(cid) < 0) {
 						rtsperror("cannot initialize video decoder(%d)\n", cid);
 						rtspParam->quitLive555 = 1;
 						return;
@@ -36,6 +36,7 @@
 #define	SDL_USEREVENT_OPEN_AUDIO	0x0002
 #define	SDL_USEREVENT_RENDER_IMAGE	0x0004
 #define	SDL_USEREVENT_RENDER_TEXT	0x0008
+#define	SDL_USEREVENT_UPDATE_CURSOR	0x0010
 
 #define SDL_AUDIO_BUFFER_SIZE		2048
 
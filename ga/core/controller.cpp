@@ -49,6 +49,25 @@ static unsigned char *qbuffer = NULL;
 
 static msgfunc replay = NULL;
 
+// server: the client receiving server-to-client messages
+static pthread_mutex_t peer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int peerproto = 0;
+static int peersocket = -1;		// TCP: the accepted socket
+static struct sockaddr_in peersin;	// UDP: the client address
+static int peerid = 0;			// connection id, 0 if not connected
+static int peerlast = 0;
+// TCP: the unsent tail of a partially sent message
+static char *pendbuf = NULL;
+static int pendsize = 0;
+static int pendhead = 0;
+static int pendlen = 0;
+
+#ifdef MSG_NOSIGNAL
+#define	CTRL_SEND_FLAGS	MSG_NOSIGNAL
+#else
+#define	CTRL_SEND_FLAGS	0
+#endif
+
 #ifdef WIN32
 static unsigned long
 #else
@@ -248,6 +267,54 @@ error:
 	return -1;
 }
 
+/*
+ * Receive the messages sent by ctrl_server_sendmsg().
+ * Only system messages are expected, and they are dispatched
+ * to the handlers registered with ctrlsys_set_handler().
+ */
+static void *
+ctrl_client_recv_thread(void *rtspconf) {
+	struct RTSPConf *conf = (struct RTSPConf*) rtspconf;
+	unsigned char *buf;
+	int bufsize = 2 * 65536;
+	int buflen = 0, bufhead, rlen, msglen;
+	//
+	if((buf = (unsigned char*) malloc(bufsize)) == NULL)
+		return NULL;
+	while(ctrlsocket >= 0) {
+		if(conf->ctrlproto == IPPROTO_TCP) {
+			if((rlen = recv(ctrlsocket, (char*) buf+buflen, bufsize-buflen, 0)) <= 0)
+				break;
+			buflen += rlen;
+		} else {
+			if((buflen = recvfrom(ctrlsocket, (char*) buf, bufsize, 0, NULL, NULL)) < 0)
+				break;
+		}
+		for(bufhead = 0; buflen - bufhead >= 2; bufhead += msglen) {
+			msglen = ntohs(*((unsigned short*) (buf + bufhead)));
+			if(msglen < 2) {
+				ga_error("controller client: invalid server message, receiver terminated.\n");
+				goto quit;
+			}
+			if(buflen - bufhead < msglen)
+				break;
+			if(ctrlsys_handle_message(buf+bufhead, msglen) == 0)
+				ga_error("controller client: unknown server message (type %02x).\n", buf[bufhead+2]);
+		}
+		if(conf->ctrlproto == IPPROTO_TCP) {
+			// keep the partial message
+			if(bufhead > 0 && bufhead < buflen)
+				memmove(buf, buf+bufhead, buflen-bufhead);
+			buflen -= bufhead;
+		} else {
+			buflen = 0;
+		}
+	}
+quit:
+	free(buf);
+	return NULL;
+}
+
 void*
 ctrl_client_thread(void *rtspconf) {
 	struct RTSPConf *conf = (struct RTSPConf*) rtspconf;
@@ -261,6 +328,14 @@ ctrl_client_thread(void *rtspconf) {
 	}
 
 	ga_error("controller client-thread started: tid=%ld.\n", ga_gettid());
+	do {
+		pthread_t t;
+		if(pthread_create(&t, NULL, ctrl_client_recv_thread, conf) != 0) {
+			ga_error("controller client: cannot receive server messages.\n");
+			break;
+		}
+		pthread_detach(t);
+	} while(0);
 
 	while(true) {
 		struct queuemsg *qm;
@@ -365,6 +440,151 @@ ctrl_server_setreplay(msgfunc callback) {
 	return old;
 }
 
+/* Register the client receiving ctrl_server_sendmsg() messages */
+static void
+ctrl_server_set_peer(int proto, int socket, struct sockaddr_in *sin) {
+	pthread_mutex_lock(&peer_mutex);
+	peerproto = proto;
+	peersocket = socket;
+	bcopy(sin, &peersin, sizeof(peersin));
+	peerid = ++peerlast;
+	pendlen = 0;
+	pthread_mutex_unlock(&peer_mutex);
+	return;
+}
+
+/* Unregister the client, must be called before its socket is closed */
+static void
+ctrl_server_clear_peer() {
+	pthread_mutex_lock(&peer_mutex);
+	peersocket = -1;
+	peerid = 0;
+	pendlen = 0;
+	pthread_mutex_unlock(&peer_mutex);
+	return;
+}
+
+/**
+ * Get the connection id of the current client.
+ *
+ * @return A non-zero id that changes with each new client connection,
+ *	or 0 if no client is connected.
+ *
+ * A server sending state to the client, e.g., the cursor image,
+ * should send it again when the id changes.
+ */
+int
+ctrl_server_client() {
+	int id;
+	pthread_mutex_lock(&peer_mutex);
+	id = peerid;
+	pthread_mutex_unlock(&peer_mutex);
+	return id;
+}
+
+/*
+ * Send to the TCP client without blocking, peer_mutex must be held.
+ * Return the number of bytes sent, 0 if the socket is not writable,
+ * or -1 on error.
+ */
+static int
+ctrl_server_send_nowait(const char *ptr, int len) {
+	int wlen;
+#ifdef MSG_DONTWAIT
+	if((wlen = send(peersocket, ptr, len, CTRL_SEND_FLAGS | MSG_DONTWAIT)) < 0
+	&& (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+#else
+	fd_set wfds;
+	struct timeval tv = { 0, 0 };
+	FD_ZERO(&wfds);
+	FD_SET(peersocket, &wfds);
+	if(select(peersocket+1, NULL, &wfds, NULL, &tv) <= 0)
+		return 0;
+	wlen = send(peersocket, ptr, len, CTRL_SEND_FLAGS);
+#endif
+	if(wlen < 0)
+		ga_error("controller server-send(tcp): %s\n", strerror(errno));
+	return wlen;
+}
+
+/*
+ * Send the tail of a partially sent message, peer_mutex must be held.
+ * Return 0 if no tail is left, or -1 if it is not completely sent.
+ */
+static int
+ctrl_server_flush() {
+	int wlen;
+	while(pendlen > 0) {
+		if((wlen = ctrl_server_send_nowait(pendbuf + pendhead, pendlen)) <= 0)
+			return -1;
+		pendhead += wlen;
+		pendlen -= wlen;
+	}
+	return 0;
+}
+
+/**
+ * Send a message from the server to the client.
+ *
+ * @param msg [in] The message, which must begin with a 16-bit message size
+ *	in network byte order, e.g., a system control message.
+ * @param msglen [in] Size of the message.
+ * @return \a msglen on success, or -1 if no client is connected or
+ *	the message cannot be sent without blocking.
+ *
+ * The client dispatches the message to the handler
+ * registered with \em ctrlsys_set_handler.
+ *
+ * This function never blocks. Over TCP, the unsent tail of a partially
+ * sent message is queued and flushed by the next calls, which fail until
+ * the tail is sent, so that messages are never interleaved.
+ */
+int
+ctrl_server_sendmsg(void *msg, int msglen) {
+	int ret = -1, wlen, left = msglen;
+	char *ptr = (char*) msg;
+	pthread_mutex_lock(&peer_mutex);
+	if(peerid == 0)
+		goto quit;
+	if(peerproto == IPPROTO_TCP) {
+		if(ctrl_server_flush() < 0)
+			goto quit;
+		while(left > 0) {
+			if((wlen = ctrl_server_send_nowait(ptr, left)) <= 0)
+				break;
+			ptr += wlen;
+			left -= wlen;
+		}
+		if(left == msglen)
+			goto quit;
+		ret = msglen;
+		if(left == 0)
+			goto quit;
+		// queue the rest of the message
+		if(pendsize < left) {
+			char *newbuf = (char*) realloc(pendbuf, left);
+			if(newbuf == NULL) {
+				// the stream is broken: drop the connection
+				ga_error("controller server-send(tcp): no memory for %d bytes, disconnect the client.\n", left);
+				shutdown(peersocket, 2);
+				ret = -1;
+				goto quit;
+			}
+			pendbuf = newbuf;
+			pendsize = left;
+		}
+		bcopy(ptr, pendbuf, left);
+		pendhead = 0;
+		pendlen = left;
+	} else if(sendto(ctrlsocket, ptr, left, 0, (struct sockaddr*) &peersin, sizeof(peersin)) == msglen) {
+		ret = msglen;
+	}
+quit:
+	pthread_mutex_unlock(&peer_mutex);
+	return ret;
+}
+
 void*
 ctrl_server_thread(void *rtspconf) {
 	struct RTSPConf *conf = (struct RTSPConf*) rtspconf;
@@ -422,6 +642,7 @@ restart:
 		}
 		ga_error("controller server-thread: receiving events ...\n");
 		clientaccepted = 1;
+		ctrl_server_set_peer(IPPROTO_TCP, socket, &csin);
 	}
 
 	buflen = 0;
@@ -436,6 +657,7 @@ tcp_readmore:
 			if((rlen = recv(socket, (char*) buf+buflen, sizeof(buf)-buflen, 0)) <= 0) {
 				ga_error("controller server-read: %s\n", strerror(errno));
 				ga_error("controller server-thread: conenction closed.\n");
+				ctrl_server_clear_peer();
 				close(socket);
 				goto restart;
 			}
@@ -452,9 +674,11 @@ tcp_readmore:
 			if(clientaccepted == 0) {
 				bcopy(&xsin, &csin, sizeof(csin));
 				clientaccepted = 1;
+				ctrl_server_set_peer(IPPROTO_UDP, ctrlsocket, &csin);
 			} else if(memcmp(&csin, &xsin, sizeof(csin)) != 0) {
 				ga_error("controller server-thread: NOTICE - UDP client reconnected?\n");
 				bcopy(&xsin, &csin, sizeof(csin));
+				ctrl_server_set_peer(IPPROTO_UDP, ctrlsocket, &csin);
 				//continue;
 			}
 		}
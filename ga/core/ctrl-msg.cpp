@@ -22,6 +22,7 @@
  */
 
 #include <stdio.h>
+#include <stddef.h>
 #ifndef WIN32
 #include <arpa/inet.h>
 #endif
@@ -32,7 +33,9 @@
 static ctrlsys_handler_t ctrlsys_handler_list[] = {
 	NULL,	/* 0 = CTRL_MSGSYS_SUBTYPE_NULL */
 	NULL,	/* 1 = CTRL_MSGSYS_SUBTYPE_SHUTDOWN */
-	NULL	/* 2 = CTRL_MSGSYS_SUBTYPE_NETREPORT */
+	NULL,	/* 2 = CTRL_MSGSYS_SUBTYPE_NETREPORT */
+	NULL,	/* 3 = CTRL_MSGSYS_SUBTYPE_CURSOR */
+	NULL	/* 4 = CTRL_MSGSYS_SUBTYPE_CURSORSHAPE */
 };
 
 ctrlsys_handler_t
@@ -58,6 +61,8 @@ ctrlsys_set_handler(unsigned char subtype, ctrlsys_handler_t handler) {
 static int 
 ctrlsys_ntoh(ctrlmsg_system_t *msg) {
 	ctrlmsg_system_netreport_t *netreport;
+	ctrlmsg_system_cursor_t *cursor;
+	ctrlmsg_system_cursorshape_t *shape;
 	msg->msgsize = ntohs(msg->msgsize);
 	switch(msg->subtype) {
 	/* no conversion needed, and no size checking */
@@ -75,6 +80,27 @@ ctrlsys_ntoh(ctrlmsg_system_t *msg) {
 		netreport->bytecount = htonl(netreport->bytecount);
 		netreport->capacity = htonl(netreport->capacity);
 		break;
+	case CTRL_MSGSYS_SUBTYPE_CURSOR:
+		if(msg->msgsize != sizeof(ctrlmsg_system_cursor_t))
+			return -1;
+		cursor = (ctrlmsg_system_cursor_t*) msg;
+		cursor->serial = ntohl(cursor->serial);
+		cursor->x = (short) ntohs((unsigned short) cursor->x);
+		cursor->y = (short) ntohs((unsigned short) cursor->y);
+		break;
+	case CTRL_MSGSYS_SUBTYPE_CURSORSHAPE:
+		if(msg->msgsize < offsetof(ctrlmsg_system_cursorshape_t, pixels))
+			return -1;
+		shape = (ctrlmsg_system_cursorshape_t*) msg;
+		shape->serial = ntohl(shape->serial);
+		shape->width = ntohs(shape->width);
+		shape->height = ntohs(shape->height);
+		shape->xhot = ntohs(shape->xhot);
+		shape->yhot = ntohs(shape->yhot);
+		if(shape->width > CTRL_CURSOR_MAXSIZE || shape->height > CTRL_CURSOR_MAXSIZE
+		|| msg->msgsize != offsetof(ctrlmsg_system_cursorshape_t, pixels) + shape->width * shape->height * 4)
+			return -1;
+		break;
 	default:
 		return -1;
 	}
@@ -140,3 +166,58 @@ ctrlsys_netreport(ctrlmsg_t *msg, unsigned int duration,
 	return msg;
 }
 
+/**
+ * Build a cursor position message, which is sent from a server to a client
+ *
+ * @param msg [in]	The structure to store the built message.
+ *			The size of the structure must be at least \a sizeof(ctrlmsg_system_cursor_t)
+ * @param serial [in]	Serial number of the current cursor image, see \a ctrlsys_cursorshape.
+ * @param x [in]	Horizontal cursor position in the video frame.
+ * @param y [in]	Vertical cursor position in the video frame.
+ * @param visible [in]	Non-zero if the cursor is visible in the video frame.
+ */
+ctrlmsg_t *
+ctrlsys_cursor(ctrlmsg_t *msg, unsigned int serial, int x, int y, int visible) {
+	ctrlmsg_system_cursor_t *msgc = (ctrlmsg_system_cursor_t*) msg;
+	bzero(msg, sizeof(ctrlmsg_system_cursor_t));
+	msgc->msgsize = htons(sizeof(ctrlmsg_system_cursor_t));
+	msgc->msgtype = CTRL_MSGTYPE_SYSTEM;
+	msgc->subtype = CTRL_MSGSYS_SUBTYPE_CURSOR;
+	msgc->serial = htonl(serial);
+	msgc->x = (short) htons((unsigned short) x);
+	msgc->y = (short) htons((unsigned short) y);
+	msgc->visible = visible ? 1 : 0;
+	return msg;
+}
+
+/**
+ * Build a cursor image message, which is sent from a server to a client
+ *
+ * @param msg [in]	The structure to store the built message.
+ * @param serial [in]	Serial number of the cursor image.
+ * @param width [in]	Image width, at most CTRL_CURSOR_MAXSIZE.
+ * @param height [in]	Image height, at most CTRL_CURSOR_MAXSIZE.
+ * @param xhot [in]	Horizontal hotspot position in the image.
+ * @param yhot [in]	Vertical hotspot position in the image.
+ * @param pixels [in]	\a width x \a height pixels, in B, G, R, A byte order.
+ * @return The size of the message to be sent, or -1 if the image is too large.
+ */
+int
+ctrlsys_cursorshape(ctrlmsg_system_cursorshape_t *msg, unsigned int serial,
+		int width, int height, int xhot, int yhot,
+		const unsigned char *pixels) {
+	int size = offsetof(ctrlmsg_system_cursorshape_t, pixels) + width * height * 4;
+	if(width < 0 || width > CTRL_CURSOR_MAXSIZE || height < 0 || height > CTRL_CURSOR_MAXSIZE)
+		return -1;
+	msg->msgsize = htons(size);
+	msg->msgtype = CTRL_MSGTYPE_SYSTEM;
+	msg->subtype = CTRL_MSGSYS_SUBTYPE_CURSORSHAPE;
+	msg->serial = htonl(serial);
+	msg->width = htons(width);
+	msg->height = htons(height);
+	msg->xhot = htons(xhot);
+	msg->yhot = htons(yhot);
+	bcopy(pixels, msg->pixels, width * height * 4);
+	return size;
+}
+
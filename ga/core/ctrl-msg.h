@@ -32,7 +32,11 @@
 #define	CTRL_MSGSYS_SUBTYPE_NULL	0	/* system control message: NULL */
 #define	CTRL_MSGSYS_SUBTYPE_SHUTDOWN	1	/* system control message: shutdown */
 #define	CTRL_MSGSYS_SUBTYPE_NETREPORT	2	/* system control message: report networking */
-#define	CTRL_MSGSYS_SUBTYPE_MAX		2	/* must equal to the last sub message type */
+#define	CTRL_MSGSYS_SUBTYPE_CURSOR	3	/* system control message: cursor position (server to client) */
+#define	CTRL_MSGSYS_SUBTYPE_CURSORSHAPE	4	/* system control message: cursor image (server to client) */
+#define	CTRL_MSGSYS_SUBTYPE_MAX		4	/* must equal to the last sub message type */
+
+#define	CTRL_CURSOR_MAXSIZE		64	/* maximum width and height of a cursor image */
 
 #ifdef WIN32
 #define	BEGIN_CTRL_MESSAGE_STRUCT	__pragma(pack(push, 1))	/* equal to #pragma pack(push, 1) */
@@ -89,6 +93,41 @@ typedef struct ctrlmsg_system_netreport_s ctrlmsg_system_netreport_t;
 
 ////////////////////////////////////////////////////////////////////////////
 
+BEGIN_CTRL_MESSAGE_STRUCT
+struct ctrlmsg_system_cursor_s {
+	unsigned short msgsize;		/*< size of this message, including this field */
+	unsigned char msgtype;		/*< must be CTRL_MSGTYPE_SYSTEM */
+	unsigned char subtype;		/*< must be CTRL_MSGSYS_SUBTYPE_CURSOR */
+	unsigned int serial;		/*< serial number of the current cursor image */
+	short x;			/*< cursor position in the video frame */
+	short y;
+	unsigned char visible;		/*< non-zero if the cursor is visible in the video frame */
+	unsigned char padding[3];
+}
+END_CTRL_MESSAGE_STRUCT
+typedef struct ctrlmsg_system_cursor_s ctrlmsg_system_cursor_t;
+
+////////////////////////////////////////////////////////////////////////////
+
+BEGIN_CTRL_MESSAGE_STRUCT
+struct ctrlmsg_system_cursorshape_s {
+	unsigned short msgsize;		/*< size of this message, including this field and the used pixels */
+	unsigned char msgtype;		/*< must be CTRL_MSGTYPE_SYSTEM */
+	unsigned char subtype;		/*< must be CTRL_MSGSYS_SUBTYPE_CURSORSHAPE */
+	unsigned int serial;		/*< serial number of the cursor image */
+	unsigned short width;		/*< image width, at most CTRL_CURSOR_MAXSIZE */
+	unsigned short height;		/*< image height, at most CTRL_CURSOR_MAXSIZE */
+	unsigned short xhot;		/*< hotspot position in the image */
+	unsigned short yhot;
+	unsigned char pixels[CTRL_CURSOR_MAXSIZE*CTRL_CURSOR_MAXSIZE*4];	/*< width x height pixels,
+					 * in B, G, R, A byte order (alpha not premultiplied).
+					 * Only the used pixels are sent */
+}
+END_CTRL_MESSAGE_STRUCT
+typedef struct ctrlmsg_system_cursorshape_s ctrlmsg_system_cursorshape_t;
+
+////////////////////////////////////////////////////////////////////////////
+
 typedef void (*ctrlsys_handler_t)(ctrlmsg_system_t *);
 
 EXPORT int ctrlsys_handle_message(unsigned char *buf, unsigned int size);
@@ -96,5 +135,7 @@ EXPORT	ctrlsys_handler_t ctrlsys_set_handler(unsigned char subtype, ctrlsys_hand
 
 // functions for building message data structure
 EXPORT ctrlmsg_t * ctrlsys_netreport(ctrlmsg_t *msg, unsigned int duration, unsigned int framecount, unsigned int pktcount, unsigned int pktloss, unsigned int bytecount, unsigned int capacity);
+EXPORT ctrlmsg_t * ctrlsys_cursor(ctrlmsg_t *msg, unsigned int serial, int x, int y, int visible);
+EXPORT int ctrlsys_cursorshape(ctrlmsg_system_cursorshape_t *msg, unsigned int serial, int width, int height, int xhot, int yhot, const unsigned char *pixels);
 
 #endif	/* __CTRL_MSG_H__ */
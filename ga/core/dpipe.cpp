@@ -21,6 +21,20 @@
  * dpipe implementation: pipe for delivering discrete frames
  */
 #include "dpipe.h"
+#include "ga-conf.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
 
 #include <map>
 #include <string>
@@ -29,63 +43,1153 @@ using namespace std;
 /** Store the mapping between pipe-name and pipe structure */
 static pthread_mutex_t dpipemap_mutex = PTHREAD_MUTEX_INITIALIZER;
 static map<string,dpipe_t*> dpipemap;
+/** Periodic statistics dump, enabled by the dpipe-stats-interval parameter */
+static int dpipe_stats_started = 0;
+/** Memory accounting of all pipes, see dpipe_memory_stats() */
+static pthread_mutex_t dpipe_mem_mutex = PTHREAD_MUTEX_INITIALIZER;
+static dpipe_memstats_t dpipe_mem;
+static int dpipe_mem_initialized = 0;
+/** Lazy pipes release frames left unused for this long, in microseconds, or 0 */
+static long long dpipe_shrink_interval = 0;
+/** ga_malloc() allocates this many more bytes for the alignment */
+#define	DPIPE_MALLOC_PAD	64LL
+
+#ifdef __GNUC__
+/** Lock-free rings are available with GCC-compatible atomic builtins */
+#define	DPIPE_HAVE_SPSC
+#define	ATOMIC_LOAD(p, m)		__atomic_load_n(p, m)
+#define	ATOMIC_STORE(p, v, m)		__atomic_store_n(p, v, m)
+#define	ATOMIC_ADD(p, v)		__atomic_add_fetch(p, v, __ATOMIC_RELAXED)
+#define	ATOMIC_FENCE()			__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+#if defined(DPIPE_HAVE_SPSC) && defined(__linux__)
+/** Shared-memory pipes are available on Linux */
+#define	DPIPE_HAVE_SHM
+#define	DPIPE_SHM_MAGIC		0x50444147	/* "GADP" */
+#define	DPIPE_SHM_PREFIX	"/ga-dpipe-"
+
+/**
+ * Header of a shared-memory pipe. It is followed by the ring slots and
+ * the frames. The region holds only offsets, so each process maps it at
+ * any address and keeps its own buffer descriptors, see dpipe_shm_handle().
+ */
+struct dpipe_shm_s {
+	unsigned int magic;	/**< DPIPE_SHM_MAGIC */
+	int nframe;		/**< number of frames */
+	int framesize;		/**< size of each frame, aligned to a cache line */
+	size_t mapsize;		/**< size of the region */
+	size_t dataoff;		/**< offset of the first frame from the region */
+	dpipe_ring_t free_ring;	/**< free frames, filled by the consumer */
+	dpipe_ring_t out_ring;	/**< occupied frames, filled by the producer */
+	int sleeping;		/**< non-zero if the consumer is waiting on \a wakeseq */
+	unsigned int wakeseq;	/**< futex word, increased on each wakeup */
+	int in_waiting;		/**< non-zero if the producer is waiting on \a putseq */
+	unsigned int putseq;	/**< futex word, increased when a frame is returned to a waiting producer */
+	char userdata[DPIPE_SHM_USERDATA];	/**< application data, see dpipe_shm_userdata() */
+};
+#endif
+
+#ifdef DPIPE_HAVE_SPSC
+/* The slots of a ring, placed right after the ring */
+#define	RING_SLOT(ring)	((uintptr_t*) (((char*) (ring)) + (ring)->slotoff))
+
+static dpipe_ring_t *
+ring_create(int nframe) {
+	dpipe_ring_t *ring;
+	unsigned int capacity = 1;
+	// never full: capacity is not less than the number of frames
+	while(capacity < (unsigned int) nframe)
+		capacity <<= 1;
+	if((ring = (dpipe_ring_t*) calloc(1, sizeof(dpipe_ring_t) + capacity * sizeof(uintptr_t))) == NULL)
+		return NULL;
+	ring->mask = capacity - 1;
+	ring->slotoff = sizeof(dpipe_ring_t);
+	return ring;
+}
+
+static void
+ring_destroy(dpipe_ring_t *ring) {
+	free(ring);
+	return;
+}
+
+/* Append a buffer. A ring must have only one writer.
+ * Slots keep the buffer address relative to \a ringbase of the pipe. */
+static void
+ring_push(dpipe_t *dpipe, dpipe_ring_t *ring, dpipe_buffer_t *buffer) {
+	unsigned int head = ATOMIC_LOAD(&ring->head, __ATOMIC_RELAXED);
+	ATOMIC_STORE(&RING_SLOT(ring)[head & ring->mask],
+		(uintptr_t) buffer - (uintptr_t) dpipe->ringbase, __ATOMIC_RELAXED);
+	ATOMIC_STORE(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return;
+}
+
+/* Remove the eldest buffer. Safe to be called from more than one thread,
+ * so that the producer can steal frames from the output ring. */
+static dpipe_buffer_t *
+ring_pop(dpipe_t *dpipe, dpipe_ring_t *ring) {
+	unsigned int tail = ATOMIC_LOAD(&ring->tail, __ATOMIC_RELAXED);
+	uintptr_t offset;
+	do {
+		if(tail == ATOMIC_LOAD(&ring->head, __ATOMIC_ACQUIRE))
+			return NULL;
+		offset = ATOMIC_LOAD(&RING_SLOT(ring)[tail & ring->mask], __ATOMIC_RELAXED);
+	} while(!__atomic_compare_exchange_n(&ring->tail, &tail, tail + 1,
+			true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+	return (dpipe_buffer_t*) ((uintptr_t) dpipe->ringbase + offset);
+}
+
+/* Convert an absolute CLOCK_REALTIME time to a relative timeout.
+ * Return -1 if the time is already reached. */
+static int
+spsc_timeout(const struct timespec *abstime, struct timespec *timeout) {
+	struct timeval now;
+	long long us;
+	gettimeofday(&now, NULL);
+	us = (abstime->tv_sec - now.tv_sec) * 1000000LL
+		+ (abstime->tv_nsec / 1000 - now.tv_usec);
+	if(us <= 0)
+		return -1;
+	timeout->tv_sec = us / 1000000LL;
+	timeout->tv_nsec = (us % 1000000LL) * 1000;
+	return 0;
+}
+
+/* Wake up the consumer, only if it is sleeping in dpipe_load() */
+static void
+spsc_wakeup(dpipe_t *dpipe) {
+	ATOMIC_FENCE();
+#ifdef DPIPE_HAVE_SHM
+	if(dpipe->shm != NULL) {
+		if(ATOMIC_LOAD(&dpipe->shm->sleeping, __ATOMIC_RELAXED) == 0)
+			return;
+		__atomic_add_fetch(&dpipe->shm->wakeseq, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &dpipe->shm->wakeseq, FUTEX_WAKE, 1, NULL, NULL, 0);
+		return;
+	}
+#endif
+	if(ATOMIC_LOAD(&dpipe->sleeping, __ATOMIC_RELAXED) == 0)
+		return;
+#ifdef __linux__
+	if(dpipe->wakefd >= 0) {
+		uint64_t one = 1;
+		if(write(dpipe->wakefd, &one, sizeof(one)) < 0) {
+			// counter overflow is not possible: always drained by the consumer
+		}
+		return;
+	}
+#endif
+	pthread_mutex_lock(&dpipe->cond_mutex);
+	pthread_cond_signal(&dpipe->cond);
+	pthread_mutex_unlock(&dpipe->cond_mutex);
+	return;
+}
+
+/* No frame to reuse: both rings are empty */
+static int
+spsc_exhausted(dpipe_t *dpipe) {
+	return ATOMIC_LOAD(&dpipe->free_ring->head, __ATOMIC_ACQUIRE)
+		== ATOMIC_LOAD(&dpipe->free_ring->tail, __ATOMIC_RELAXED)
+	&& ATOMIC_LOAD(&dpipe->out_ring->head, __ATOMIC_ACQUIRE)
+		== ATOMIC_LOAD(&dpipe->out_ring->tail, __ATOMIC_RELAXED);
+}
+
+/* Return a frame to the free ring, and wake up the producer
+ * only if it is waiting in dpipe_get() */
+static void
+spsc_put(dpipe_t *dpipe, dpipe_buffer_t *vbuf) {
+	ring_push(dpipe, dpipe->free_ring, vbuf);
+	ATOMIC_ADD(&dpipe->in_count, 1);
+	ATOMIC_FENCE();
+#ifdef DPIPE_HAVE_SHM
+	if(dpipe->shm != NULL) {
+		if(ATOMIC_LOAD(&dpipe->shm->in_waiting, __ATOMIC_RELAXED) == 0)
+			return;
+		__atomic_add_fetch(&dpipe->shm->putseq, 1, __ATOMIC_RELEASE);
+		syscall(SYS_futex, &dpipe->shm->putseq, FUTEX_WAKE, 1, NULL, NULL, 0);
+		return;
+	}
+#endif
+	if(ATOMIC_LOAD(&dpipe->in_waiting, __ATOMIC_RELAXED) == 0)
+		return;
+	pthread_mutex_lock(&dpipe->io_mutex);
+	pthread_cond_signal(&dpipe->in_cond);
+	pthread_mutex_unlock(&dpipe->io_mutex);
+	return;
+}
+
+/* Block the producer until the consumer returns a frame with dpipe_put() */
+static void
+spsc_wait_free(dpipe_t *dpipe) {
+#ifdef DPIPE_HAVE_SHM
+	if(dpipe->shm != NULL) {
+		struct dpipe_shm_s *shm = dpipe->shm;
+		unsigned int seq = ATOMIC_LOAD(&shm->putseq, __ATOMIC_ACQUIRE);
+		ATOMIC_STORE(&shm->in_waiting, 1, __ATOMIC_RELAXED);
+		ATOMIC_FENCE();
+		// returns immediately if a frame has been put after reading seq
+		if(spsc_exhausted(dpipe))
+			syscall(SYS_futex, &shm->putseq, FUTEX_WAIT, seq, NULL, NULL, 0);
+		ATOMIC_STORE(&shm->in_waiting, 0, __ATOMIC_RELAXED);
+		return;
+	}
+#endif
+	pthread_mutex_lock(&dpipe->io_mutex);
+	ATOMIC_STORE(&dpipe->in_waiting, 1, __ATOMIC_RELAXED);
+	ATOMIC_FENCE();
+	// spsc_put() signals with io_mutex held, so the signal is not lost
+	if(spsc_exhausted(dpipe))
+		pthread_cond_wait(&dpipe->in_cond, &dpipe->io_mutex);
+	ATOMIC_STORE(&dpipe->in_waiting, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&dpipe->io_mutex);
+	return;
+}
+
+/* Skip to the newest frame if the policy is DPIPE_POLICY_LATEST */
+static dpipe_buffer_t *
+spsc_skip(dpipe_t *dpipe, dpipe_buffer_t *vbuf) {
+	dpipe_buffer_t *next;
+	if(vbuf != NULL)
+		dpipe->stats.loaded++;
+	if(vbuf == NULL || dpipe->policy != DPIPE_POLICY_LATEST)
+		return vbuf;
+	while((next = ring_pop(dpipe, dpipe->out_ring)) != NULL) {
+		ATOMIC_ADD(&dpipe->out_count, -1);
+		spsc_put(dpipe, vbuf);
+		ATOMIC_ADD(&dpipe->drop_count, 1);
+		vbuf = next;
+	}
+	return vbuf;
+}
+
+/* Block the consumer until a frame is stored or \a abstime is reached.
+ * Return -1 on timed out. */
+static int
+spsc_sleep(dpipe_t *dpipe, const struct timespec *abstime) {
+	int ret = 0;
+#ifdef DPIPE_HAVE_SHM
+	if(dpipe->shm != NULL) {
+		struct dpipe_shm_s *shm = dpipe->shm;
+		struct timespec timeout, *pto = NULL;
+		unsigned int seq = ATOMIC_LOAD(&shm->wakeseq, __ATOMIC_ACQUIRE);
+		if(abstime != NULL) {
+			if(spsc_timeout(abstime, &timeout) < 0)
+				return -1;
+			pto = &timeout;
+		}
+		ATOMIC_STORE(&shm->sleeping, 1, __ATOMIC_RELAXED);
+		ATOMIC_FENCE();
+		if(ATOMIC_LOAD(&dpipe->out_ring->head, __ATOMIC_ACQUIRE)
+		== ATOMIC_LOAD(&dpipe->out_ring->tail, __ATOMIC_RELAXED)
+		&& ATOMIC_LOAD(&dpipe->interrupted, __ATOMIC_RELAXED) == 0) {
+			// returns immediately if a wakeup has been posted after reading seq
+			if(syscall(SYS_futex, &shm->wakeseq, FUTEX_WAIT, seq, pto, NULL, 0) < 0
+			&& errno == ETIMEDOUT)
+				ret = -1;
+		}
+		ATOMIC_STORE(&shm->sleeping, 0, __ATOMIC_RELAXED);
+		return ret;
+	}
+#endif
+#ifdef __linux__
+	if(dpipe->wakefd >= 0) {
+		struct pollfd pfd;
+		struct timespec timeout, *pto = NULL;
+		uint64_t counter;
+		if(abstime != NULL) {
+			if(spsc_timeout(abstime, &timeout) < 0)
+				return -1;
+			pto = &timeout;
+		}
+		pfd.fd = dpipe->wakefd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		ATOMIC_STORE(&dpipe->sleeping, 1, __ATOMIC_RELAXED);
+		ATOMIC_FENCE();
+		if(ATOMIC_LOAD(&dpipe->out_ring->head, __ATOMIC_ACQUIRE)
+		== ATOMIC_LOAD(&dpipe->out_ring->tail, __ATOMIC_RELAXED)
+		&& ATOMIC_LOAD(&dpipe->interrupted, __ATOMIC_RELAXED) == 0) {
+			if(ppoll(&pfd, 1, pto, NULL) == 0)
+				ret = -1;
+		}
+		ATOMIC_STORE(&dpipe->sleeping, 0, __ATOMIC_RELAXED);
+		// drain the counter, wakefd is non-blocking
+		if(read(dpipe->wakefd, &counter, sizeof(counter)) < 0) {
+			// nothing to drain
+		}
+		return ret;
+	}
+#endif
+	pthread_mutex_lock(&dpipe->cond_mutex);
+	ATOMIC_STORE(&dpipe->sleeping, 1, __ATOMIC_RELAXED);
+	ATOMIC_FENCE();
+	if(ATOMIC_LOAD(&dpipe->out_ring->head, __ATOMIC_ACQUIRE)
+	== ATOMIC_LOAD(&dpipe->out_ring->tail, __ATOMIC_RELAXED)
+	&& ATOMIC_LOAD(&dpipe->interrupted, __ATOMIC_RELAXED) == 0) {
+		if(abstime == NULL) {
+			pthread_cond_wait(&dpipe->cond, &dpipe->cond_mutex);
+		} else if(pthread_cond_timedwait(&dpipe->cond, &dpipe->cond_mutex, abstime) != 0) {
+			ret = -1;
+		}
+	}
+	ATOMIC_STORE(&dpipe->sleeping, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&dpipe->cond_mutex);
+	return ret;
+}
+#endif	/* DPIPE_HAVE_SPSC */
+
+/* Timestamps for statistics, in microseconds */
+static long long
+stats_now() {
+	return ga_clock_us();
+}
+
+static void
+stats_store(dpipe_t *dpipe, int out_count) {
+	dpipe->stats.stored++;
+	if(out_count >= DPIPE_STATS_DEPTH)
+		out_count = DPIPE_STATS_DEPTH - 1;
+	if(out_count >= 0)
+		dpipe->stats.depth[out_count]++;
+	return;
+}
+
+/* The mutex protecting the pools. Subscribers share the one of the source. */
+static pthread_mutex_t *
+pool_mutex(dpipe_t *dpipe) {
+	return dpipe->source != NULL ? &dpipe->source->io_mutex : &dpipe->io_mutex;
+}
+
+/* The following functions must be called with pool_mutex() held */
+static void
+in_push(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	buffer->next = dpipe->in;
+	dpipe->in = buffer;
+	dpipe->in_count++;
+	return;
+}
+
+static dpipe_buffer_t *
+in_pop(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf;
+	if((vbuf = dpipe->in) != NULL) {
+		dpipe->in = vbuf->next;
+		vbuf->next = NULL;
+		dpipe->in_count--;
+	}
+	return vbuf;
+}
+
+/* Keep pollfd readable if and only if the output pool is not empty */
+static void
+poll_update(dpipe_t *dpipe) {
+#ifdef __linux__
+	uint64_t counter = 1;
+	if(dpipe->pollfd < 0 || (dpipe->out_count > 0) == dpipe->pollready)
+		return;
+	if(dpipe->pollready == 0) {
+		if(write(dpipe->pollfd, &counter, sizeof(counter)) < 0) {
+			// counter overflow is not possible: always drained when empty
+		}
+	} else if(read(dpipe->pollfd, &counter, sizeof(counter)) < 0) {
+		// pollfd is non-blocking
+	}
+	dpipe->pollready = !dpipe->pollready;
+#endif
+	return;
+}
+
+static void
+out_append(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	if(dpipe->out_tail != NULL) {
+		dpipe->out_tail->next = buffer;
+		dpipe->out_tail = buffer;
+	} else {
+		dpipe->out = dpipe->out_tail = buffer;
+	}
+	buffer->next = NULL;
+	dpipe->out_count++;
+	stats_store(dpipe, dpipe->out_count);
+	poll_update(dpipe);
+	return;
+}
+
+static dpipe_buffer_t *
+out_pop(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf;
+	if((vbuf = dpipe->out) != NULL) {
+		dpipe->out = vbuf->next;
+		vbuf->next = NULL;
+		if(dpipe->out == NULL)
+			dpipe->out_tail = NULL;
+		dpipe->out_count--;
+		poll_update(dpipe);
+	}
+	return vbuf;
+}
+
+/* Drop a reference to a frame; the last one returns it to the input pool */
+static void
+frame_release(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	if(--buffer->refcnt > 0)
+		return;
+	buffer->refcnt = 0;
+	in_push(dpipe, buffer);
+	if(dpipe->in_waiting > 0)
+		pthread_cond_signal(&dpipe->in_cond);
+	return;
+}
+
+/* Return a loaded or dropped frame: subscribers release the referenced frame */
+static void
+frame_discard(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	if(dpipe->source == NULL) {
+		frame_release(dpipe, buffer);
+		return;
+	}
+	frame_release(dpipe->source, buffer->ref);
+	buffer->ref = NULL;
+	buffer->pointer = NULL;
+	in_push(dpipe, buffer);
+	return;
+}
+
+/* Drop the eldest frame referenced by a subscriber, return 1 if dropped */
+static int
+subscriber_drop(dpipe_t *dpipe) {
+	dpipe_buffer_t *node;
+	if((node = out_pop(dpipe)) == NULL)
+		return 0;
+	frame_discard(dpipe, node);
+	return 1;
+}
+
+/* Load a frame from the output pool according to the drop policy */
+static dpipe_buffer_t *
+out_load(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf = out_pop(dpipe);
+	if(vbuf != NULL)
+		dpipe->stats.loaded++;
+	if(vbuf == NULL || dpipe->policy != DPIPE_POLICY_LATEST)
+		return vbuf;
+	// skip to the newest frame
+	while(dpipe->out != NULL) {
+		frame_discard(dpipe, vbuf);
+		vbuf = out_pop(dpipe);
+		dpipe->drop_count++;
+	}
+	return vbuf;
+}
+
+/* Read the memory parameters, once before the first pipe is created */
+static void
+mem_init() {
+	char buf[64];
+	pthread_mutex_lock(&dpipe_mem_mutex);
+	if(dpipe_mem_initialized == 0) {
+		dpipe_mem_initialized = 1;
+		// a budget set by dpipe_set_memory_budget() is kept
+		if(dpipe_mem.budget == 0)
+			dpipe_mem.budget = ga_conf_readint("dpipe-memory-budget") * 1048576LL;
+		if(dpipe_mem.budget < 0)
+			dpipe_mem.budget = 0;
+		dpipe_shrink_interval = DPIPE_DEF_SHRINK_INTERVAL * 1000000LL;
+		if(ga_conf_readv("dpipe-shrink-interval", buf, sizeof(buf)) != NULL)
+			dpipe_shrink_interval = ga_conf_readint("dpipe-shrink-interval") * 1000000LL;
+	}
+	pthread_mutex_unlock(&dpipe_mem_mutex);
+	return;
+}
+
+/* Charge \a size bytes to a pipe. Return -1 if the budget
+ * would be exceeded, unless \a force is set. */
+static int
+mem_charge(dpipe_t *dpipe, long long size, int force) {
+	unsigned long long n;
+	int ret = 0;
+	pthread_mutex_lock(&dpipe_mem_mutex);
+	if(dpipe_mem.budget > 0 && dpipe_mem.used + size > dpipe_mem.budget) {
+		if(force == 0) {
+			dpipe_mem.denied++;
+			ret = -1;
+			goto quit;
+		}
+		// log the 1st, 2nd, 4th, 8th, ... ones
+		n = ++dpipe_mem.overcommitted;
+		if((n & (n - 1)) == 0) {
+			ga_error("dpipe: '%s' exceeds the memory budget (%lld KB used, %llu times)\n",
+				dpipe->name, dpipe_mem.used / 1024, n);
+		}
+	}
+	dpipe_mem.used += size;
+	if(dpipe_mem.used > dpipe_mem.peak)
+		dpipe_mem.peak = dpipe_mem.used;
+	dpipe->memsize += size;
+quit:
+	pthread_mutex_unlock(&dpipe_mem_mutex);
+	return ret;
+}
+
+/* Return non-zero if the frame buffers exceed the budget */
+static int
+mem_over_budget() {
+	int over;
+	pthread_mutex_lock(&dpipe_mem_mutex);
+	over = dpipe_mem.budget > 0 && dpipe_mem.used > dpipe_mem.budget;
+	pthread_mutex_unlock(&dpipe_mem_mutex);
+	return over;
+}
+
+static void
+mem_uncharge(dpipe_t *dpipe, long long size) {
+	pthread_mutex_lock(&dpipe_mem_mutex);
+	dpipe_mem.used -= size;
+	dpipe->memsize -= size;
+	pthread_mutex_unlock(&dpipe_mem_mutex);
+	return;
+}
+
+/* Release the data of a frame buffer */
+static void
+frame_free(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	if(buffer->internal == NULL)
+		return;
+	free(buffer->internal);
+	mem_uncharge(dpipe, buffer->size + DPIPE_MALLOC_PAD);
+	buffer->internal = buffer->pointer = NULL;
+	buffer->offset = buffer->size = 0;
+	return;
+}
+
+/* Allocate the data of a frame buffer, and initialize it with \a frame_init.
+ * Return -1 if out of memory or budget, unless \a force is set. */
+static int
+frame_alloc(dpipe_t *dpipe, dpipe_buffer_t *buffer, int size, int force) {
+	if(mem_charge(dpipe, size + DPIPE_MALLOC_PAD, force) < 0)
+		return -1;
+	if(ga_malloc(size, &buffer->internal, &buffer->offset) < 0) {
+		mem_uncharge(dpipe, size + DPIPE_MALLOC_PAD);
+		buffer->internal = NULL;
+		return -1;
+	}
+	buffer->pointer = (void*) (((char*) buffer->internal) + buffer->offset);
+	buffer->size = size;
+	if(dpipe->frame_init != NULL
+	&& dpipe->frame_init(dpipe, buffer, dpipe->frame_init_arg) < 0) {
+		frame_free(dpipe, buffer);
+		return -1;
+	}
+	return 0;
+}
+
+/* The following functions are called by the producer,
+ * with pool_mutex() held unless the pipe is spsc */
+
+/* Lazy pipes: allocate one more frame buffer. Return NULL if the pipe
+ * is full, or the budget is exceeded and \a force is not set. */
+static dpipe_buffer_t *
+frame_grow(dpipe_t *dpipe, int force) {
+	dpipe_buffer_t *vbuf;
+	if(dpipe->lazy == 0 || dpipe->nalloc >= dpipe->nframe)
+		return NULL;
+	if((vbuf = (dpipe_buffer_t*) calloc(1, sizeof(dpipe_buffer_t))) == NULL)
+		return NULL;
+	if(frame_alloc(dpipe, vbuf, dpipe->framesize, force) < 0) {
+		free(vbuf);
+		return NULL;
+	}
+	dpipe->nalloc++;
+	// spsc: 'in' links all the buffers
+	if(dpipe->spsc) {
+		vbuf->next = dpipe->in;
+		dpipe->in = vbuf;
+	}
+	return vbuf;
+}
+
+/* Lazy pipes: reallocate a free frame buffer sized for an old frame size */
+static void
+frame_fit(dpipe_t *dpipe, dpipe_buffer_t *vbuf) {
+	dpipe_buffer_t old;
+	if(dpipe->lazy == 0 || vbuf->size == dpipe->framesize)
+		return;
+	old = *vbuf;
+	if(frame_alloc(dpipe, vbuf, dpipe->framesize, 1) < 0) {
+		// keep the old one
+		vbuf->internal = old.internal;
+		vbuf->pointer = old.pointer;
+		vbuf->offset = old.offset;
+		vbuf->size = old.size;
+		return;
+	}
+	free(old.internal);
+	mem_uncharge(dpipe, old.size + DPIPE_MALLOC_PAD);
+	return;
+}
+
+/* Remove a free frame buffer from the pool */
+static dpipe_buffer_t *
+frame_pop_free(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf, **pp;
+#ifdef DPIPE_HAVE_SPSC
+	if(dpipe->spsc) {
+		if((vbuf = ring_pop(dpipe, dpipe->free_ring)) == NULL)
+			return NULL;
+		ATOMIC_ADD(&dpipe->in_count, -1);
+		for(pp = &dpipe->in; *pp != NULL; pp = &(*pp)->next) {
+			if(*pp == vbuf) {
+				*pp = vbuf->next;
+				break;
+			}
+		}
+		return vbuf;
+	}
+#endif
+	return in_pop(dpipe);
+}
+
+/* Lazy pipes: release the free frames that were not needed during
+ * a whole shrink period, or all the free frames if over the budget */
+static void
+frame_shrink(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf;
+	long long now;
+	int nfree, n, released = 0;
+	//
+	if(dpipe->lazy == 0)
+		return;
+#ifdef DPIPE_HAVE_SPSC
+	if(dpipe->spsc)
+		nfree = ATOMIC_LOAD(&dpipe->in_count, __ATOMIC_RELAXED);
+	else
+#endif
+	nfree = dpipe->in_count;
+	now = stats_now();
+	if(nfree > 0 && mem_over_budget()) {
+		dpipe->idle_min = nfree;
+	} else {
+		if(dpipe_shrink_interval <= 0)
+			return;
+		if(dpipe->idle_start == 0 || nfree < dpipe->idle_min)
+			dpipe->idle_min = nfree;
+		if(dpipe->idle_start == 0)
+			dpipe->idle_start = now;
+		if(now - dpipe->idle_start < dpipe_shrink_interval)
+			return;
+	}
+	for(n = dpipe->idle_min; n > 0; n--) {
+		if((vbuf = frame_pop_free(dpipe)) == NULL)
+			break;
+		frame_free(dpipe, vbuf);
+		free(vbuf);
+		dpipe->nalloc--;
+		released++;
+	}
+	dpipe->idle_start = now;
+	dpipe->idle_min = nfree - released;
+	if(released > 0) {
+		ga_error("dpipe: '%s' released %d idle frame(s), %d/%d frames allocated (%lld KB)\n",
+			dpipe->name, released, dpipe->nalloc, dpipe->nframe, dpipe->memsize / 1024);
+	}
+	return;
+}
+
+/* Print the statistics of all pipes every dpipe-stats-interval seconds */
+static void *
+dpipe_stats_threadproc(void *arg) {
+	int interval = *((int*) arg);
+	map<string,dpipe_stats_t> last;
+	map<string,dpipe_t*>::iterator mi;
+	//
+	free(arg);
+	ga_error("dpipe: statistics dump started, interval = %ds\n", interval);
+	while(true) {
+#ifdef WIN32
+		Sleep(interval * 1000);
+#else
+		sleep(interval);
+#endif
+		pthread_mutex_lock(&dpipemap_mutex);
+		for(mi = dpipemap.begin(); mi != dpipemap.end(); mi++) {
+			dpipe_stats_t curr, delta;
+			dpipe_stats_t &prev = last[mi->first];
+			int i;
+			if(dpipe_stats(mi->second, &curr) < 0)
+				continue;
+			// report the last interval only
+			delta = curr;
+			delta.stored -= prev.stored;
+			delta.loaded -= prev.loaded;
+			delta.overwritten -= prev.overwritten;
+			delta.dropped -= prev.dropped;
+			delta.wait_us -= prev.wait_us;
+			delta.hold_us -= prev.hold_us;
+			for(i = 0; i < DPIPE_STATS_DEPTH; i++)
+				delta.depth[i] -= prev.depth[i];
+			prev = curr;
+			dpipe_stats_print("dpipe-stats", mi->second, &delta);
+		}
+		pthread_mutex_unlock(&dpipemap_mutex);
+		dpipe_memory_report("dpipe-memory");
+	}
+	return NULL;
+}
+
+static void
+dpipe_stats_autostart() {
+	pthread_t t;
+	int *interval;
+	//
+	pthread_mutex_lock(&dpipemap_mutex);
+	if(dpipe_stats_started != 0) {
+		pthread_mutex_unlock(&dpipemap_mutex);
+		return;
+	}
+	dpipe_stats_started = 1;
+	pthread_mutex_unlock(&dpipemap_mutex);
+	//
+	if(ga_conf_readint("dpipe-stats-interval") <= 0)
+		return;
+	if((interval = (int*) malloc(sizeof(int))) == NULL)
+		return;
+	*interval = ga_conf_readint("dpipe-stats-interval");
+	if(pthread_create(&t, NULL, dpipe_stats_threadproc, interval) != 0) {
+		ga_error("dpipe: cannot create statistics thread\n");
+		free(interval);
+		return;
+	}
+	pthread_detach(t);
+	return;
+}
+
+static dpipe_t *
+dpipe_create_internal(int id, const char *name, int nframe, int maxframesize, int spsc,
+		dpipe_frame_init_t init, void *arg) {
+	int i;
+	dpipe_t *dpipe;
+	// sanity checks
+	if(name == NULL || id < 0 || nframe <= 0 || maxframesize <= 0)
+		return NULL;
+	// existing?
+	if((dpipe = dpipe_lookup(name)) != NULL)
+		return NULL;
+	mem_init();
+	// allocate the space
+	if((dpipe = (dpipe_t*) malloc(sizeof(dpipe_t))) == NULL)
+		return NULL;
+	//
+	bzero(dpipe, sizeof(dpipe_t));
+	dpipe->channel_id = id;
+	dpipe->wakefd = -1;
+	dpipe->pollfd = -1;
+	pthread_mutex_init(&dpipe->cond_mutex, NULL);
+	pthread_cond_init(&dpipe->cond, NULL);
+	pthread_cond_init(&dpipe->in_cond, NULL);
+	pthread_mutex_init(&dpipe->io_mutex, NULL);
+	dpipe->nframe = nframe;
+	dpipe->framesize = dpipe->maxframesize = maxframesize;
+	dpipe->lazy = (init != NULL);
+	dpipe->frame_init = init;
+	dpipe->frame_init_arg = arg;
+	if((dpipe->name = strdup(name)) == NULL)
+		goto err_create;
+#ifdef DPIPE_HAVE_SPSC
+	if(spsc) {
+		dpipe->spsc = 1;
+		if((dpipe->free_ring = ring_create(nframe)) == NULL
+		|| (dpipe->out_ring = ring_create(nframe)) == NULL)
+			goto err_create;
+#ifdef __linux__
+		dpipe->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+	}
+#endif
+	// alloc and init frame buffers, lazy pipes allocate them in dpipe_get()
+	for(i = 0; dpipe->lazy == 0 && i < nframe; i++) {
+		dpipe_buffer_t* dbuffer;
+		if((dbuffer = (dpipe_buffer_t*) calloc(1, sizeof(dpipe_buffer_t))) == NULL)
+			goto err_create;
+		if(frame_alloc(dpipe, dbuffer, maxframesize, 1) < 0) {
+			free(dbuffer);
+			goto err_create;
+		}
+		dpipe->nalloc++;
+		dbuffer->next = dpipe->in;
+		dpipe->in = dbuffer;
+		dpipe->in_count++;
+#ifdef DPIPE_HAVE_SPSC
+		// spsc: 'in' keeps linking all the buffers and is never modified
+		if(dpipe->spsc)
+			ring_push(dpipe, dpipe->free_ring, dbuffer);
+#endif
+	}
+	//
+	pthread_mutex_lock(&dpipemap_mutex);
+	dpipemap[dpipe->name] = dpipe;
+	pthread_mutex_unlock(&dpipemap_mutex);
+	ga_error("dpipe: '%s' initialized, %d frames, framesize = %d%s%s\n",
+		dpipe->name, nframe, maxframesize,
+		dpipe->spsc ? ", lock-free spsc" : "",
+		dpipe->lazy ? ", allocated on demand" : "");
+	dpipe_stats_autostart();
+	return dpipe;
+	// failure cases
+err_create:
+	dpipe_destroy(dpipe);
+	return NULL;
+}
+
+/**
+ * Create and register a new video pipe.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe, must be unique
+ * @param nframe [in] Number of frame buffers in the pipe
+ * @param maxframesize [in] The maximum frame buffer size
+ * @return Pointer to a created dpipe, or NULL on failure
+ *
+ * Note: dpipe_create() also returns NULL if the requesting name is existed.
+ */
+dpipe_t *
+dpipe_create(int id, const char *name, int nframe, int maxframesize) {
+	return dpipe_create_internal(id, name, nframe, maxframesize, 0, NULL, NULL);
+}
+
+/**
+ * Create and register a new lock-free single-producer/single-consumer pipe.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe, must be unique
+ * @param nframe [in] Number of frame buffers in the pipe
+ * @param maxframesize [in] The maximum frame buffer size
+ * @return Pointer to a created dpipe, or NULL on failure
+ *
+ * The pipe is used with the same dpipe_get(), dpipe_store(), dpipe_load(),
+ * and dpipe_put() functions, but no mutex is taken on the data path.
+ * Only one thread may call dpipe_get()/dpipe_store() and only one thread
+ * may call dpipe_load()/dpipe_put().
+ * A blocked consumer is woken up through an eventfd (Linux),
+ * and the producer only signals when the consumer is actually sleeping.
+ * The frame buffers can be enumerated from \a dpipe->in as usual,
+ * but the list is not the free pool of a spsc pipe.
+ *
+ * Note: It falls back to dpipe_create() if atomic builtins are not available.
+ */
+dpipe_t *
+dpipe_create_spsc(int id, const char *name, int nframe, int maxframesize) {
+	return dpipe_create_internal(id, name, nframe, maxframesize, 1, NULL, NULL);
+}
+
+/**
+ * Create and register a pipe that allocates its frame buffers on demand.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe, must be unique
+ * @param nframe [in] Maximum number of frame buffers in the pipe
+ * @param maxframesize [in] The maximum frame buffer size
+ * @param spsc [in] Non-zero to create a lock-free pipe, see dpipe_create_spsc()
+ * @param init [in] Callback to initialize each allocated frame buffer, must not be NULL
+ * @param arg [in] Argument passed to \a init
+ * @return Pointer to a created dpipe, or NULL on failure
+ *
+ * No frame buffer is allocated when the pipe is created. dpipe_get() allocates
+ * a new buffer of \a framesize bytes if no free buffer is left, until there
+ * are \a nframe buffers or the process exceeds \em dpipe-memory-budget.
+ * Over the budget, the eldest stored frame is reused as usual,
+ * and a buffer is allocated anyway only if there is nothing to reuse.
+ * Buffers that were never needed during \em dpipe-shrink-interval seconds
+ * are released, and free buffers of an outdated size are reallocated
+ * after dpipe_set_framesize(). Frame buffers cannot be enumerated from
+ * \a dpipe->in, they must be initialized by \a init instead.
+ */
+dpipe_t *
+dpipe_create_lazy(int id, const char *name, int nframe, int maxframesize, int spsc,
+		dpipe_frame_init_t init, void *arg) {
+	if(init == NULL)
+		return NULL;
+	return dpipe_create_internal(id, name, nframe, maxframesize, spsc, init, arg);
+}
+
+/**
+ * Create and register a pipe that receives the frames stored into another pipe.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe, must be unique
+ * @param source [in] The pipe owning the frame buffers
+ * @return Pointer to a created dpipe, or NULL on failure
+ *
+ * Each frame stored into \a source is delivered to all its subscribers
+ * by reference, without copying the frame data. Consumers must treat
+ * the loaded frames as read-only, and release them with dpipe_put()
+ * on the pipe they were loaded from. A frame goes back to the
+ * input pool of \a source only after all its consumers released it.
+ * Nothing can be stored into a subscriber pipe.
+ */
+dpipe_t *
+dpipe_create_subscriber(int id, const char *name, dpipe_t *source) {
+	int i, nframe;
+	dpipe_t *dpipe, **subscriber;
+	//
+	if(source == NULL || source->spsc || source->source != NULL)
+		return NULL;
+	// one reference node for each frame the source may allocate
+	nframe = source->nframe;
+	// reference nodes carry no frame data
+	if((dpipe = dpipe_create_internal(id, name, nframe, 1, 0, NULL, NULL)) == NULL)
+		return NULL;
+	for(i = 0; i < nframe; i++) {
+		dpipe_buffer_t *node = in_pop(dpipe);
+		frame_free(dpipe, node);
+		in_push(dpipe, node);
+	}
+	//
+	pthread_mutex_lock(&source->io_mutex);
+	subscriber = (dpipe_t**) realloc(source->subscriber,
+			(source->nsubscriber + 1) * sizeof(dpipe_t*));
+	if(subscriber == NULL) {
+		pthread_mutex_unlock(&source->io_mutex);
+		dpipe_destroy(dpipe);
+		return NULL;
+	}
+	subscriber[source->nsubscriber++] = dpipe;
+	source->subscriber = subscriber;
+	dpipe->source = source;
+	pthread_mutex_unlock(&source->io_mutex);
+	ga_error("dpipe: '%s' subscribes to '%s'\n", dpipe->name, source->name);
+	return dpipe;
+}
+
+#ifdef DPIPE_HAVE_SHM
+/* Create a local handle of a shared-memory pipe mapped at \a shm.
+ * The rings keep frame offsets relative to the descriptors of each process. */
+static dpipe_t *
+dpipe_shm_handle(int id, const char *name, struct dpipe_shm_s *shm) {
+	dpipe_t *dpipe;
+	int i;
+	if((dpipe = (dpipe_t*) malloc(sizeof(dpipe_t))) == NULL)
+		return NULL;
+	bzero(dpipe, sizeof(dpipe_t));
+	if((dpipe->shmbuffer = (dpipe_buffer_t*) calloc(shm->nframe, sizeof(dpipe_buffer_t))) == NULL) {
+		free(dpipe);
+		return NULL;
+	}
+	dpipe->channel_id = id;
+	dpipe->wakefd = -1;
+	dpipe->pollfd = -1;
+	pthread_mutex_init(&dpipe->cond_mutex, NULL);
+	pthread_cond_init(&dpipe->cond, NULL);
+	pthread_cond_init(&dpipe->in_cond, NULL);
+	pthread_mutex_init(&dpipe->io_mutex, NULL);
+	if((dpipe->name = strdup(name)) == NULL) {
+		free(dpipe->shmbuffer);
+		free(dpipe);
+		return NULL;
+	}
+	dpipe->spsc = 1;
+	dpipe->shm = shm;
+	dpipe->free_ring = &shm->free_ring;
+	dpipe->out_ring = &shm->out_ring;
+	dpipe->ringbase = dpipe->shmbuffer;
+	dpipe->nframe = dpipe->nalloc = shm->nframe;
+	dpipe->framesize = dpipe->maxframesize = shm->framesize;
+	for(i = 0; i < shm->nframe; i++) {
+		dpipe_buffer_t *dbuffer = &dpipe->shmbuffer[i];
+		dbuffer->pointer = ((char*) shm) + shm->dataoff + (size_t) i * shm->framesize;
+		dbuffer->size = shm->framesize;
+		dbuffer->next = dpipe->in;
+		dpipe->in = dbuffer;
+		dpipe->in_count++;
+	}
+	return dpipe;
+}
+#endif
 
 /**
- * Create and register a new video pipe.
+ * Create and register a lock-free pipe whose frames are in shared memory.
  *
  * @param id [in] The video channel id
  * @param name [in] The name of the dpipe, must be unique
  * @param nframe [in] Number of frame buffers in the pipe
  * @param maxframesize [in] The maximum frame buffer size
+ * @param userdata [in] Application data published with the pipe, can be NULL
+ * @param usersize [in] Size of \a userdata, at most DPIPE_SHM_USERDATA
  * @return Pointer to a created dpipe, or NULL on failure
  *
- * Note: dpipe_create() also returns NULL if the requesting name is existed.
+ * The frames, the buffer rings, and a futex for wakeups are placed in a
+ * POSIX shared memory object named after the pipe. Another process
+ * attaches the same pipe with dpipe_attach_shm() and loads frames
+ * without copying. The creating process is the producer and the
+ * attaching process is the consumer, following the rules of
+ * dpipe_create_spsc().
+ *
+ * Note: Only supported on Linux.
  */
 dpipe_t *
-dpipe_create(int id, const char *name, int nframe, int maxframesize) {
-	int i;
+dpipe_create_shm(int id, const char *name, int nframe, int maxframesize, const void *userdata, int usersize) {
+#ifdef DPIPE_HAVE_SHM
+	char shmname[128];
+	char *base;
 	dpipe_t *dpipe;
-	// sanity checks
+	struct dpipe_shm_s *shm;
+	unsigned int capacity = 1;
+	size_t hdrsize, mapsize;
+	int i, fd, framesize;
+	//
 	if(name == NULL || id < 0 || nframe <= 0 || maxframesize <= 0)
 		return NULL;
-	// existing?
-	if((dpipe = dpipe_lookup(name)) != NULL)
+	if(usersize < 0 || usersize > DPIPE_SHM_USERDATA)
 		return NULL;
-	// allocate the space
-	if((dpipe = (dpipe_t*) malloc(sizeof(dpipe_t))) == NULL)
+	if(dpipe_lookup(name) != NULL)
+		return NULL;
+	while(capacity < (unsigned int) nframe)
+		capacity <<= 1;
+	framesize = (maxframesize + 63) & ~63;
+	hdrsize = sizeof(struct dpipe_shm_s) + 2 * capacity * sizeof(uintptr_t);
+	hdrsize = (hdrsize + 4095) & ~((size_t) 4095);
+	mapsize = hdrsize + (size_t) nframe * framesize;
+	// remove a stale one left by a crashed process
+	snprintf(shmname, sizeof(shmname), DPIPE_SHM_PREFIX "%s", name);
+	shm_unlink(shmname);
+	if((fd = shm_open(shmname, O_RDWR | O_CREAT | O_EXCL, 0600)) < 0) {
+		ga_error("dpipe: shm_open(%s) failed, err = %d\n", shmname, errno);
+		return NULL;
+	}
+	if(ftruncate(fd, mapsize) < 0) {
+		ga_error("dpipe: cannot allocate %lu bytes for '%s'\n", (unsigned long) mapsize, name);
+		close(fd);
+		shm_unlink(shmname);
+		return NULL;
+	}
+	base = (char*) mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		ga_error("dpipe: mmap(%s) failed, err = %d\n", shmname, errno);
+		shm_unlink(shmname);
+		return NULL;
+	}
+	// the region is zero-filled
+	shm = (struct dpipe_shm_s*) base;
+	shm->nframe = nframe;
+	shm->framesize = framesize;
+	shm->mapsize = mapsize;
+	shm->dataoff = hdrsize;
+	shm->free_ring.mask = shm->out_ring.mask = capacity - 1;
+	// ring slots follow the header
+	shm->free_ring.slotoff = (base + sizeof(struct dpipe_shm_s)) - (char*) &shm->free_ring;
+	shm->out_ring.slotoff = (base + sizeof(struct dpipe_shm_s)
+		+ capacity * sizeof(uintptr_t)) - (char*) &shm->out_ring;
+	if((dpipe = dpipe_shm_handle(id, name, shm)) == NULL) {
+		munmap(base, mapsize);
+		shm_unlink(shmname);
 		return NULL;
+	}
+	dpipe->shm_owner = 1;
+	// the creating process accounts for the region
+	mem_init();
+	mem_charge(dpipe, mapsize, 1);
+	for(i = 0; i < nframe; i++)
+		ring_push(dpipe, dpipe->free_ring, &dpipe->shmbuffer[i]);
+	if(userdata != NULL)
+		bcopy(userdata, shm->userdata, usersize);
+	ATOMIC_STORE(&shm->magic, DPIPE_SHM_MAGIC, __ATOMIC_RELEASE);
 	//
-	bzero(dpipe, sizeof(dpipe_t));
-	dpipe->channel_id = id;
-	if((dpipe->name = strdup(name)) == NULL)
-		goto err_create;
-	pthread_mutex_init(&dpipe->cond_mutex, NULL);
-	pthread_cond_init(&dpipe->cond, NULL);
-	pthread_mutex_init(&dpipe->io_mutex, NULL);
-	// alloc and init frame buffers
-	for(i = 0; i < nframe; i++) {
-		dpipe_buffer_t* dbuffer;
-		if((dbuffer = (dpipe_buffer_t*) malloc(sizeof(dpipe_buffer_t))) == NULL)
-			goto err_create;
-		if(ga_malloc(maxframesize, &dbuffer->internal, &dbuffer->offset) < 0) {
-			free(dbuffer);
-			goto err_create;
-		}
-		dbuffer->pointer = (void*) (((char*) dbuffer->internal) + dbuffer->offset);
-		dbuffer->next = dpipe->in;
-		dpipe->in = dbuffer;
-		dpipe->in_count++;
+	pthread_mutex_lock(&dpipemap_mutex);
+	dpipemap[dpipe->name] = dpipe;
+	pthread_mutex_unlock(&dpipemap_mutex);
+	ga_error("dpipe: '%s' initialized, %d frames, framesize = %d, shared memory %s at %p\n",
+		dpipe->name, nframe, maxframesize, shmname, base);
+	dpipe_stats_autostart();
+	return dpipe;
+#else
+	ga_error("dpipe: shared-memory pipe is not supported.\n");
+	return NULL;
+#endif
+}
+
+/**
+ * Attach and register a shared-memory pipe created by another process.
+ *
+ * @param id [in] The video channel id
+ * @param name [in] The name of the dpipe given to dpipe_create_shm()
+ * @return Pointer to the attached dpipe, or NULL on failure
+ *
+ * The region can be mapped at any address: the rings keep frame offsets,
+ * and the dpipe_buffer_t::pointer of each frame is valid in this process.
+ * Data stored in the frames must not carry absolute addresses.
+ * It fails if the pipe has not been created yet.
+ * The attaching process is the consumer of the pipe.
+ */
+dpipe_t *
+dpipe_attach_shm(int id, const char *name) {
+#ifdef DPIPE_HAVE_SHM
+	char shmname[128];
+	void *base;
+	size_t mapsize;
+	dpipe_t *dpipe;
+	struct dpipe_shm_s *hdr;
+	int fd;
+	//
+	if(name == NULL || id < 0)
+		return NULL;
+	if(dpipe_lookup(name) != NULL)
+		return NULL;
+	snprintf(shmname, sizeof(shmname), DPIPE_SHM_PREFIX "%s", name);
+	if((fd = shm_open(shmname, O_RDWR, 0)) < 0)
+		return NULL;
+	// read the header first
+	hdr = (struct dpipe_shm_s*) mmap(NULL, sizeof(struct dpipe_shm_s), PROT_READ, MAP_SHARED, fd, 0);
+	if(hdr == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	if(ATOMIC_LOAD(&hdr->magic, __ATOMIC_ACQUIRE) != DPIPE_SHM_MAGIC) {
+		munmap(hdr, sizeof(struct dpipe_shm_s));
+		close(fd);
+		return NULL;
+	}
+	mapsize = hdr->mapsize;
+	munmap(hdr, sizeof(struct dpipe_shm_s));
+	//
+	base = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(base == MAP_FAILED) {
+		ga_error("dpipe: mmap(%s) failed, err = %d\n", shmname, errno);
+		return NULL;
+	}
+	if((dpipe = dpipe_shm_handle(id, name, (struct dpipe_shm_s*) base)) == NULL) {
+		munmap(base, mapsize);
+		return NULL;
 	}
 	//
 	pthread_mutex_lock(&dpipemap_mutex);
 	dpipemap[dpipe->name] = dpipe;
 	pthread_mutex_unlock(&dpipemap_mutex);
-	ga_error("dpipe: '%s' initialized, %d frames, framesize = %d\n",
-		dpipe->name, dpipe->in_count, maxframesize);
+	ga_error("dpipe: '%s' attached, shared memory %s at %p\n",
+		dpipe->name, shmname, base);
+	dpipe_stats_autostart();
 	return dpipe;
-	// failure cases
-err_create:
-	dpipe_destroy(dpipe);
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * Get the application data area of a shared-memory pipe
+ *
+ * @param dpipe [in] Pointer to the dpipe structure
+ * @return Pointer to DPIPE_SHM_USERDATA bytes shared by all the processes
+ * attached to the pipe, or NULL if it is not a shared-memory pipe.
+ *
+ * The area holds the \a userdata given to dpipe_create_shm(), which is
+ * visible to an attaching process as soon as dpipe_attach_shm() succeeds.
+ */
+void *
+dpipe_shm_userdata(dpipe_t *dpipe) {
+#ifdef DPIPE_HAVE_SHM
+	if(dpipe != NULL && dpipe->shm != NULL)
+		return dpipe->shm->userdata;
+#endif
 	return NULL;
 }
 
@@ -118,6 +1222,41 @@ dpipe_destroy(dpipe_t *dpipe) {
 	dpipe_buffer_t *vbuf, *next;
 	if(dpipe == NULL)
 		return 0;
+	if(dpipe->source != NULL) {
+		dpipe_t *source = dpipe->source;
+		int i;
+		pthread_mutex_lock(&source->io_mutex);
+		while(subscriber_drop(dpipe))
+			;
+		for(i = 0; i < source->nsubscriber; i++) {
+			if(source->subscriber[i] != dpipe)
+				continue;
+			source->subscriber[i] = source->subscriber[--source->nsubscriber];
+			break;
+		}
+		pthread_mutex_unlock(&source->io_mutex);
+	} else if(dpipe->nsubscriber > 0) {
+		ga_error("dpipe: '%s' destroyed with %d subscriber(s) left\n",
+			dpipe->name, dpipe->nsubscriber);
+	}
+	free(dpipe->subscriber);
+#ifdef DPIPE_HAVE_SHM
+	if(dpipe->shm != NULL) {
+		// frames and rings are in the region
+		if(dpipe->shm_owner && dpipe->name != NULL) {
+			char shmname[128];
+			snprintf(shmname, sizeof(shmname), DPIPE_SHM_PREFIX "%s", dpipe->name);
+			shm_unlink(shmname);
+		}
+		munmap(dpipe->shm, dpipe->shm->mapsize);
+		free(dpipe->shmbuffer);
+		dpipe->shm = NULL;
+		dpipe->shmbuffer = NULL;
+		dpipe->free_ring = dpipe->out_ring = NULL;
+		dpipe->in = NULL;
+		dpipe->spare = NULL;
+	}
+#endif
 	if(dpipe->name) {
 		pthread_mutex_lock(&dpipemap_mutex);
 		dpipemap.erase(dpipe->name);
@@ -126,8 +1265,19 @@ dpipe_destroy(dpipe_t *dpipe) {
 	}
 	pthread_mutex_destroy(&dpipe->cond_mutex);
 	pthread_cond_destroy(&dpipe->cond);
+	pthread_cond_destroy(&dpipe->in_cond);
 	pthread_mutex_destroy(&dpipe->io_mutex);
 	//
+#ifdef DPIPE_HAVE_SPSC
+	ring_destroy(dpipe->free_ring);
+	ring_destroy(dpipe->out_ring);
+#endif
+#ifdef __linux__
+	if(dpipe->pollfd >= 0 && dpipe->pollfd != dpipe->wakefd)
+		close(dpipe->pollfd);
+	if(dpipe->wakefd >= 0)
+		close(dpipe->wakefd);
+#endif
 	for(vbuf = dpipe->in; vbuf != NULL; vbuf = next) {
 		next = vbuf->next;
 		free(vbuf->internal);
@@ -138,49 +1288,352 @@ dpipe_destroy(dpipe_t *dpipe) {
 		free(vbuf->internal);
 		free(vbuf);
 	}
+	// including the frames still held by the producer or the consumers
+	mem_uncharge(dpipe, dpipe->memsize);
 	//
 	free(dpipe);
 	return 0;
 }
 
+/**
+ * Get the runtime statistics of a pipe
+ *
+ * @param dpipe [in] Pointer to the dpipe structure
+ * @param stats [out] The statistics since the pipe is created
+ * @return 0 on success, or -1 on error
+ *
+ * Counters of a lock-free pipe are updated by the producer and
+ * the consumer without a lock, so the snapshot may be slightly off.
+ */
+int
+dpipe_stats(dpipe_t *dpipe, dpipe_stats_t *stats) {
+	if(dpipe == NULL || stats == NULL)
+		return -1;
+	pthread_mutex_lock(pool_mutex(dpipe));
+	*stats = dpipe->stats;
+	stats->dropped = dpipe->drop_count;
+	pthread_mutex_unlock(pool_mutex(dpipe));
+	return 0;
+}
+
+/**
+ * Print the statistics of a pipe with ga_error()
+ *
+ * @param prefix [in] Prefix of the log message
+ * @param dpipe [in] Pointer to the dpipe structure
+ * @param stats [in] The statistics, e.g., obtained from dpipe_stats()
+ */
+void
+dpipe_stats_print(const char *prefix, dpipe_t *dpipe, const dpipe_stats_t *stats) {
+	char histogram[DPIPE_STATS_DEPTH * 16] = "";
+	int i, len = 0;
+	for(i = 0; i < DPIPE_STATS_DEPTH; i++) {
+		if(stats->depth[i] == 0)
+			continue;
+		len += snprintf(histogram + len, sizeof(histogram) - len,
+			" %d%s:%u", i, i == DPIPE_STATS_DEPTH - 1 ? "+" : "", stats->depth[i]);
+	}
+	ga_error("%s: %s stored=%llu loaded=%llu overwritten=%llu dropped=%llu wait=%.2fms/load hold=%.2fms/store out_count={%s }\n",
+		prefix, dpipe->name,
+		stats->stored, stats->loaded, stats->overwritten, stats->dropped,
+		stats->loaded ? 0.001 * stats->wait_us / stats->loaded : 0.0,
+		stats->stored ? 0.001 * stats->hold_us / stats->stored : 0.0,
+		histogram);
+	return;
+}
+
+/**
+ * Set the frame drop policy of a pipe
+ *
+ * @param dpipe [in] Pointer to the dpipe structure
+ * @param policy [in] The frame drop policy, one of DPIPE_POLICY_*
+ * @return 0 on success, or -1 on error
+ *
+ * The default policy is DPIPE_POLICY_FIFO. The policy is usually set
+ * right after a pipe is created, or by the consumer before it starts
+ * loading frames. Use DPIPE_POLICY_MAILBOX or DPIPE_POLICY_LATEST to
+ * limit the queueing delay to one frame when the consumer falls behind.
+ * Dropped frames are counted in \a dpipe->drop_count.
+ */
+int
+dpipe_set_policy(dpipe_t *dpipe, dpipe_policy_t policy) {
+	if(dpipe == NULL || dpipe_policy_name(policy) == NULL)
+		return -1;
+	pthread_mutex_lock(pool_mutex(dpipe));
+	dpipe->policy = policy;
+	pthread_mutex_unlock(pool_mutex(dpipe));
+	ga_error("dpipe: '%s' policy = %s\n", dpipe->name, dpipe_policy_name(policy));
+	return 0;
+}
+
+/**
+ * Lookup a frame drop policy by its name
+ *
+ * @param name [in] Name of the policy: fifo, mailbox, or latest
+ * @return The policy, or -1 if the name is unknown
+ */
+int
+dpipe_policy_byname(const char *name) {
+	int policy;
+	const char *pname;
+	if(name == NULL)
+		return -1;
+	for(policy = DPIPE_POLICY_FIFO; (pname = dpipe_policy_name((dpipe_policy_t) policy)) != NULL; policy++) {
+		if(strcasecmp(name, pname) == 0)
+			return policy;
+	}
+	return -1;
+}
+
+/**
+ * Get the name of a frame drop policy
+ *
+ * @param policy [in] The frame drop policy
+ * @return Name of the policy, or NULL if the policy is invalid
+ */
+const char *
+dpipe_policy_name(dpipe_policy_t policy) {
+	switch(policy) {
+	case DPIPE_POLICY_FIFO:
+		return "fifo";
+	case DPIPE_POLICY_MAILBOX:
+		return "mailbox";
+	case DPIPE_POLICY_LATEST:
+		return "latest";
+	}
+	return NULL;
+}
+
+/**
+ * Set the size of the frame buffers allocated by a lazy pipe
+ *
+ * @param dpipe [in] Pointer to a pipe created by dpipe_create_lazy()
+ * @param framesize [in] The new frame buffer size, at most \a maxframesize
+ * @return 0 on success, or -1 on error
+ *
+ * Buffers of another size are reallocated when dpipe_get() returns them,
+ * so frames already stored are not affected. Set it for the current
+ * resolution, and again before producing frames of a larger size.
+ * For a lock-free pipe, this must be called by the producer.
+ */
+int
+dpipe_set_framesize(dpipe_t *dpipe, int framesize) {
+	if(dpipe == NULL || dpipe->lazy == 0)
+		return -1;
+	if(framesize <= 0 || framesize > dpipe->maxframesize)
+		return -1;
+	pthread_mutex_lock(pool_mutex(dpipe));
+	dpipe->framesize = framesize;
+	pthread_mutex_unlock(pool_mutex(dpipe));
+	return 0;
+}
+
+/**
+ * Allocate all the frame buffers of a lazy pipe
+ *
+ * @param dpipe [in] Pointer to a pipe created by dpipe_create_lazy()
+ * @return 0 on success, or -1 on error
+ *
+ * After this call, the pipe behaves like a pipe created by dpipe_create()
+ * or dpipe_create_spsc(): the buffers can be enumerated from \a dpipe->in,
+ * and they are neither released nor reallocated.
+ * This must be called before any frame is produced.
+ */
+int
+dpipe_preallocate(dpipe_t *dpipe) {
+	dpipe_buffer_t *vbuf;
+	int ret = 0;
+	if(dpipe == NULL || dpipe->lazy == 0)
+		return dpipe == NULL ? -1 : 0;
+	pthread_mutex_lock(pool_mutex(dpipe));
+	while(dpipe->nalloc < dpipe->nframe) {
+		if((vbuf = frame_grow(dpipe, 1)) == NULL) {
+			ret = -1;
+			break;
+		}
+#ifdef DPIPE_HAVE_SPSC
+		if(dpipe->spsc) {
+			ring_push(dpipe, dpipe->free_ring, vbuf);
+			ATOMIC_ADD(&dpipe->in_count, 1);
+			continue;
+		}
+#endif
+		in_push(dpipe, vbuf);
+	}
+	dpipe->lazy = 0;
+	pthread_mutex_unlock(pool_mutex(dpipe));
+	return ret;
+}
+
+/**
+ * Set the memory budget of the frame buffers of all pipes
+ *
+ * @param budget [in] The budget in bytes, or 0 for unlimited
+ * @return 0 on success, or -1 on error
+ *
+ * The default budget is read from \em dpipe-memory-budget (in MB).
+ * Only lazy pipes are limited by the budget, see dpipe_create_lazy().
+ */
+int
+dpipe_set_memory_budget(long long budget) {
+	if(budget < 0)
+		return -1;
+	pthread_mutex_lock(&dpipe_mem_mutex);
+	dpipe_mem.budget = budget;
+	pthread_mutex_unlock(&dpipe_mem_mutex);
+	mem_init();
+	return 0;
+}
+
+/**
+ * Get the memory accounting of all pipes
+ *
+ * @param stats [out] The memory usage of the frame buffers
+ * @return 0 on success, or -1 on error
+ *
+ * The usage of each pipe is in \a dpipe->memsize.
+ */
+int
+dpipe_memory_stats(dpipe_memstats_t *stats) {
+	if(stats == NULL)
+		return -1;
+	pthread_mutex_lock(&dpipe_mem_mutex);
+	*stats = dpipe_mem;
+	pthread_mutex_unlock(&dpipe_mem_mutex);
+	return 0;
+}
+
+/**
+ * Print the memory used by each pipe, i.e., each pipeline stage, with ga_error()
+ *
+ * @param prefix [in] Prefix of the log messages
+ *
+ * It is printed with the statistics every \em dpipe-stats-interval seconds.
+ */
+void
+dpipe_memory_report(const char *prefix) {
+	map<string,dpipe_t*>::iterator mi;
+	dpipe_memstats_t mem;
+	//
+	pthread_mutex_lock(&dpipemap_mutex);
+	pthread_mutex_lock(&dpipe_mem_mutex);
+	for(mi = dpipemap.begin(); mi != dpipemap.end(); mi++) {
+		dpipe_t *dpipe = mi->second;
+		ga_error("%s: %s %d/%d frames, framesize = %d, %.1f KB%s\n",
+			prefix, dpipe->name,
+			dpipe->nalloc, dpipe->nframe, dpipe->framesize,
+			dpipe->memsize / 1024.0,
+			dpipe->source != NULL ? ", frames of the source" :
+			(dpipe->lazy ? ", on demand" : ""));
+	}
+	mem = dpipe_mem;
+	pthread_mutex_unlock(&dpipe_mem_mutex);
+	pthread_mutex_unlock(&dpipemap_mutex);
+	ga_error("%s: total %.1f MB, peak %.1f MB, budget %.1f MB%s, denied %llu, overcommitted %llu\n",
+		prefix, mem.used / 1048576.0, mem.peak / 1048576.0,
+		mem.budget / 1048576.0, mem.budget > 0 ? "" : " (unlimited)",
+		mem.denied, mem.overcommitted);
+	return;
+}
+
 /**
  * Get a free frame buffer from the pipe
  *
  * @param dpipe [in] The pipe to get a free frame
- * @return Pointer to the frame buffer structure
+ * @return Pointer to the frame buffer structure, or NULL for a subscriber pipe
  *
  * Note: Data should be stored in vbuf->pointer, with a maximum size
- * of \a maxframesize given when creating the pipe.
- * This function should always success.
+ * of \a maxframesize given when creating the pipe, or \a vbuf->size
+ * for a lazy pipe.
+ * This function always succeeds on a pipe owning its frames.
  * In case there is no availabe free frame buffer, this function
  * returns the eldest frame buffer in the output pool.
+ * For a pipe with subscribers, the eldest frame of every consumer
+ * is dropped until one of the frames is no longer referenced.
+ * Frames held by dpipe_store_hold() are never returned.
+ * If every frame is still loaded by a consumer or held by the producer,
+ * it blocks until one of them is released with dpipe_put().
+ * A subscriber pipe owns no frame, so it always returns NULL.
  * 
  */
 dpipe_buffer_t *
 dpipe_get(dpipe_t *dpipe) {
 	dpipe_buffer_t *vbuf = NULL;
 	//
+#ifdef DPIPE_HAVE_SPSC
+	if(dpipe->spsc) {
+		while(vbuf == NULL) {
+			if((vbuf = dpipe->spare) != NULL) {
+				dpipe->spare = NULL;
+				ATOMIC_ADD(&dpipe->in_count, -1);
+			} else if((vbuf = ring_pop(dpipe, dpipe->free_ring)) != NULL) {
+				ATOMIC_ADD(&dpipe->in_count, -1);
+			} else if((vbuf = frame_grow(dpipe, 0)) != NULL) {
+				// lazy: a new frame within the budget
+			} else if((vbuf = ring_pop(dpipe, dpipe->out_ring)) != NULL) {
+				ATOMIC_ADD(&dpipe->out_count, -1);
+				ATOMIC_ADD(&dpipe->drop_count, 1);
+				dpipe->stats.overwritten++;
+			} else if((vbuf = frame_grow(dpipe, 1)) != NULL) {
+				// nothing to reuse: over the budget
+			} else {
+				// the consumer has loaded all the frames: wait for a dpipe_put()
+				spsc_wait_free(dpipe);
+			}
+		}
+		frame_fit(dpipe, vbuf);
+		frame_shrink(dpipe);
+		vbuf->tget = stats_now();
+		return vbuf;
+	}
+#endif
+	if(dpipe->source != NULL) {
+		ga_error("dpipe: cannot get a frame from subscriber '%s'\n", dpipe->name);
+		return NULL;
+	}
 	pthread_mutex_lock(&dpipe->io_mutex);
-	if(dpipe->in != NULL) {
-		// quick path: has available frame buffers
-		if((vbuf = dpipe->in) != NULL) {
-			dpipe->in = vbuf->next;
-			vbuf->next = NULL;
-			dpipe->in_count--;
+	while(vbuf == NULL) {
+		if(dpipe->in != NULL) {
+			// quick path: has available frame buffers
+			vbuf = in_pop(dpipe);
+			break;
 		}
-	} else {
-		// no available buffers: drop the eldest frame buffer from output pool
-		if((vbuf = dpipe->out) != NULL) {
-			dpipe->out = vbuf->next;
-			vbuf->next = NULL;
-			if(dpipe->out == NULL) {
-				dpipe->out_tail = NULL;
+		if((vbuf = frame_grow(dpipe, 0)) != NULL)
+			break;
+		// drop the eldest frame (of every consumer, if broadcasting)
+		// until a frame is no longer referenced
+		while(dpipe->in == NULL) {
+			int i, dropped = 0;
+			if((vbuf = out_pop(dpipe)) != NULL) {
+				frame_release(dpipe, vbuf);
+				dpipe->drop_count++;
+				dpipe->stats.overwritten++;
+				dropped++;
+			}
+			for(i = 0; i < dpipe->nsubscriber; i++) {
+				if(subscriber_drop(dpipe->subscriber[i]) == 0)
+					continue;
+				dpipe->subscriber[i]->drop_count++;
+				dpipe->subscriber[i]->stats.overwritten++;
+				dropped++;
 			}
-			dpipe->out_count--;
+			if(dropped == 0)
+				break;
 		}
+		// nothing to reuse: over the budget
+		if((vbuf = in_pop(dpipe)) != NULL
+		|| (vbuf = frame_grow(dpipe, 1)) != NULL)
+			break;
+		// all the frames are loaded by consumers or held by the producer
+		dpipe->in_waiting++;
+		pthread_cond_wait(&dpipe->in_cond, &dpipe->io_mutex);
+		dpipe->in_waiting--;
 	}
+	frame_fit(dpipe, vbuf);
+	frame_shrink(dpipe);
 	pthread_mutex_unlock(&dpipe->io_mutex);
 	//
+	vbuf->tget = stats_now();
 	return vbuf;
 }
 
@@ -192,10 +1645,20 @@ dpipe_get(dpipe_t *dpipe) {
  */
 void
 dpipe_put(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+#ifdef DPIPE_HAVE_SPSC
+	if(dpipe->spsc) {
+		spsc_put(dpipe, buffer);
+		return;
+	}
+#endif
+	if(dpipe->source != NULL) {
+		pthread_mutex_lock(&dpipe->source->io_mutex);
+		frame_discard(dpipe, buffer);
+		pthread_mutex_unlock(&dpipe->source->io_mutex);
+		return;
+	}
 	pthread_mutex_lock(&dpipe->io_mutex);
-	buffer->next = dpipe->in;
-	dpipe->in = buffer;
-	dpipe->in_count++;
+	frame_release(dpipe, buffer);
 	pthread_mutex_unlock(&dpipe->io_mutex);
 	return;
 }
@@ -211,31 +1674,52 @@ dpipe_put(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
  * If \a abstime is NULL, this function blocks until a frame buffer
  * is available in the output pool.
  * If \a abstime is given, it returns NULL on timed out.
+ * It also returns NULL if no frame is available and the pipe is
+ * woken up by dpipe_wakeup().
  */
 dpipe_buffer_t *
 dpipe_load(dpipe_t *dpipe, const struct timespec *abstime) {
 	dpipe_buffer_t *vbuf = NULL;
 	int failed = 0;
 	//
-	pthread_mutex_lock(&dpipe->io_mutex);
+#ifdef DPIPE_HAVE_SPSC
+	if(dpipe->spsc) {
+		while((vbuf = ring_pop(dpipe, dpipe->out_ring)) == NULL) {
+			if(ATOMIC_LOAD(&dpipe->interrupted, __ATOMIC_RELAXED) != 0) {
+				ATOMIC_STORE(&dpipe->interrupted, 0, __ATOMIC_RELAXED);
+				return NULL;
+			}
+			if(failed)
+				return NULL;
+			long long t0 = stats_now();
+			if(spsc_sleep(dpipe, abstime) < 0)
+				failed = 1;
+			dpipe->stats.wait_us += stats_now() - t0;
+		}
+		ATOMIC_ADD(&dpipe->out_count, -1);
+		return spsc_skip(dpipe, vbuf);
+	}
+#endif
+	pthread_mutex_lock(pool_mutex(dpipe));
 again:
 	if(dpipe->out != NULL) {
-		vbuf = dpipe->out;
-		dpipe->out = vbuf->next;
-		vbuf->next = NULL;
-		if(dpipe->out == NULL)
-			dpipe->out_tail = NULL;
-		dpipe->out_count--;
+		vbuf = out_load(dpipe);
+	} else if(dpipe->interrupted) {
+		dpipe->interrupted = 0;
 	} else if(abstime == NULL) {
 		// no frame buffered
-		pthread_cond_wait(&dpipe->cond, &dpipe->io_mutex);
+		long long t0 = stats_now();
+		pthread_cond_wait(&dpipe->cond, pool_mutex(dpipe));
+		dpipe->stats.wait_us += stats_now() - t0;
 		goto again;
 	} else if(failed == 0) {
-		pthread_cond_timedwait(&dpipe->cond, &dpipe->io_mutex, abstime);
+		long long t0 = stats_now();
+		pthread_cond_timedwait(&dpipe->cond, pool_mutex(dpipe), abstime);
+		dpipe->stats.wait_us += stats_now() - t0;
 		failed = 1;
 		goto again;
 	}
-	pthread_mutex_unlock(&dpipe->io_mutex);
+	pthread_mutex_unlock(pool_mutex(dpipe));
 	//
 	return vbuf;
 }
@@ -253,42 +1737,199 @@ dpipe_buffer_t *
 dpipe_load_nowait(dpipe_t *dpipe) {
 	dpipe_buffer_t *vbuf = NULL;
 	//
-	pthread_mutex_lock(&dpipe->io_mutex);
-	if(dpipe->out != NULL) {
-		vbuf = dpipe->out;
-		dpipe->out = vbuf->next;
-		vbuf->next = NULL;
-		if(dpipe->out == NULL)
-			dpipe->out_tail = NULL;
-		dpipe->out_count--;
+#ifdef DPIPE_HAVE_SPSC
+	if(dpipe->spsc) {
+		vbuf = ring_pop(dpipe, dpipe->out_ring);
+#ifdef __linux__
+		// pollfd: ask the producer for a wakeup before reporting empty
+		if(vbuf == NULL && dpipe->pollfd >= 0) {
+			uint64_t counter;
+			if(read(dpipe->pollfd, &counter, sizeof(counter)) < 0) {
+				// nothing to drain
+			}
+			ATOMIC_STORE(&dpipe->sleeping, 1, __ATOMIC_RELAXED);
+			ATOMIC_FENCE();
+			vbuf = ring_pop(dpipe, dpipe->out_ring);
+		}
+		if(vbuf != NULL && dpipe->pollfd >= 0)
+			ATOMIC_STORE(&dpipe->sleeping, 0, __ATOMIC_RELAXED);
+#endif
+		if(vbuf != NULL)
+			ATOMIC_ADD(&dpipe->out_count, -1);
+		return spsc_skip(dpipe, vbuf);
 	}
-	pthread_mutex_unlock(&dpipe->io_mutex);
+#endif
+	pthread_mutex_lock(pool_mutex(dpipe));
+	vbuf = out_load(dpipe);
+	pthread_mutex_unlock(pool_mutex(dpipe));
 	//
 	return vbuf;
 }
 
 /**
- * Store a frame into the output pool of the pipe.
- * This function also notifies the receiver that is attempting to load a buffer.
+ * Get a file descriptor to wait for frames with poll(), select(), or epoll.
  *
- * @param dpipe [in] The involved pipe
- * @param buffer [in] Pointer to the buffer to be stored.
+ * @param dpipe [in] Pointer to the pipe
+ * @return The file descriptor, or -1 if it is not supported.
+ *
+ * The descriptor becomes readable when frames are stored into the pipe.
+ * Once it is readable, the consumer should call dpipe_load_nowait()
+ * until it returns NULL before waiting on the descriptor again.
+ * The descriptor is owned by the pipe, do not read or close it.
+ *
+ * Note: Only supported on Linux, and not on shared-memory pipes.
+ */
+int
+dpipe_pollfd(dpipe_t *dpipe) {
+#ifdef __linux__
+	if(dpipe == NULL || dpipe->shm != NULL)
+		return -1;
+	if(dpipe->spsc) {
+		// the consumer's eventfd is used
+		dpipe->pollfd = dpipe->wakefd;
+		return dpipe->pollfd;
+	}
+	pthread_mutex_lock(pool_mutex(dpipe));
+	if(dpipe->pollfd < 0) {
+		dpipe->pollfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		dpipe->pollready = 0;
+		poll_update(dpipe);
+	}
+	pthread_mutex_unlock(pool_mutex(dpipe));
+	return dpipe->pollfd;
+#else
+	return -1;
+#endif
+}
+
+/**
+ * Wake up the consumer waiting in dpipe_load()
+ *
+ * @param dpipe [in] Pointer to the pipe
+ *
+ * The waiting dpipe_load() returns NULL immediately if there is no
+ * frame in the output pool. If the consumer is not waiting, the next
+ * dpipe_load() that finds no frame returns NULL without waiting.
+ * This is used to stop or reconfigure a consumer thread
+ * without polling with a timeout.
  */
 void
-dpipe_store(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+dpipe_wakeup(dpipe_t *dpipe) {
+	if(dpipe == NULL)
+		return;
+#ifdef DPIPE_HAVE_SPSC
+	if(dpipe->spsc) {
+		ATOMIC_STORE(&dpipe->interrupted, 1, __ATOMIC_RELAXED);
+		spsc_wakeup(dpipe);
+		return;
+	}
+#endif
+	pthread_mutex_lock(pool_mutex(dpipe));
+	dpipe->interrupted = 1;
+	pthread_mutex_unlock(pool_mutex(dpipe));
+	pthread_cond_broadcast(&dpipe->cond);
+	return;
+}
+
+/* Store a frame; the producer keeps \a hold extra references to it */
+static int
+dpipe_store_internal(dpipe_t *dpipe, dpipe_buffer_t *buffer, int hold) {
+#ifdef DPIPE_HAVE_SPSC
+	if(dpipe->spsc) {
+		dpipe_buffer_t *old;
+		// mailbox: take back the pending frame before storing the new one
+		if(dpipe->policy == DPIPE_POLICY_MAILBOX && dpipe->spare == NULL
+		&& (old = ring_pop(dpipe, dpipe->out_ring)) != NULL) {
+			dpipe->spare = old;
+			ATOMIC_ADD(&dpipe->out_count, -1);
+			ATOMIC_ADD(&dpipe->in_count, 1);
+			ATOMIC_ADD(&dpipe->drop_count, 1);
+		}
+		dpipe->stats.hold_us += stats_now() - buffer->tget;
+		ring_push(dpipe, dpipe->out_ring, buffer);
+		ATOMIC_ADD(&dpipe->out_count, 1);
+		stats_store(dpipe, ATOMIC_LOAD(&dpipe->out_count, __ATOMIC_RELAXED));
+		spsc_wakeup(dpipe);
+		// frames of a ring are not reference counted
+		return hold > 0 ? -1 : 0;
+	}
+#endif
+	int i;
+	if(dpipe->source != NULL) {
+		ga_error("dpipe: cannot store a frame into subscriber '%s'\n", dpipe->name);
+		return -1;
+	}
 	pthread_mutex_lock(&dpipe->io_mutex);
+	// mailbox: replace the pending frame
+	if(dpipe->policy == DPIPE_POLICY_MAILBOX) {
+		dpipe_buffer_t *old;
+		while((old = out_pop(dpipe)) != NULL) {
+			frame_release(dpipe, old);
+			dpipe->drop_count++;
+		}
+	}
 	// put at the end
-	if(dpipe->out_tail != NULL) {
-		dpipe->out_tail->next = buffer;
-		dpipe->out_tail = buffer;
-	} else {
-		dpipe->out = dpipe->out_tail = buffer;
+	dpipe->stats.hold_us += stats_now() - buffer->tget;
+	buffer->refcnt = 1 + hold + dpipe->nsubscriber;
+	out_append(dpipe, buffer);
+	// deliver a reference to each subscriber
+	for(i = 0; i < dpipe->nsubscriber; i++) {
+		dpipe_t *sub = dpipe->subscriber[i];
+		dpipe_buffer_t *node;
+		if(sub->policy == DPIPE_POLICY_MAILBOX) {
+			while(subscriber_drop(sub) != 0)
+				sub->drop_count++;
+		} else if(sub->in == NULL && subscriber_drop(sub) != 0) {
+			sub->drop_count++;
+		}
+		if((node = in_pop(sub)) == NULL) {
+			buffer->refcnt--;
+			continue;
+		}
+		node->ref = buffer;
+		node->pointer = buffer->pointer;
+		out_append(sub, node);
 	}
-	buffer->next = NULL;
-	dpipe->out_count++;
 	//
 	pthread_mutex_unlock(&dpipe->io_mutex);
 	pthread_cond_signal(&dpipe->cond);
+	for(i = 0; i < dpipe->nsubscriber; i++)
+		pthread_cond_signal(&dpipe->subscriber[i]->cond);
+	return 0;
+}
+
+/**
+ * Store a frame into the output pool of the pipe.
+ * This function also notifies the receiver that is attempting to load a buffer.
+ * A reference to the frame is also delivered to all the subscribers.
+ *
+ * @param dpipe [in] The involved pipe
+ * @param buffer [in] Pointer to the buffer to be stored.
+ */
+void
+dpipe_store(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	dpipe_store_internal(dpipe, buffer, 0);
 	return;
 }
 
+/**
+ * Store a frame and keep a reference to it.
+ *
+ * @param dpipe [in] The involved pipe
+ * @param buffer [in] Pointer to the buffer to be stored.
+ * @return 0 on success, or -1 if the pipe cannot keep references.
+ *
+ * This function works like dpipe_store(), but the frame is not reused
+ * by dpipe_get() until the producer releases it with dpipe_put(),
+ * so the producer can read the frame content after it has been delivered,
+ * e.g., to repeat the last frame without keeping a copy.
+ * The frame must not be modified while it is referenced.
+ * Lock-free and shared-memory pipes do not count references:
+ * the frame is still stored, but -1 is returned and
+ * the producer must not access nor release the frame.
+ */
+int
+dpipe_store_hold(dpipe_t *dpipe, dpipe_buffer_t *buffer) {
+	return dpipe_store_internal(dpipe, buffer, 1);
+}
+
@@ -36,9 +36,79 @@ typedef struct dpipe_buffer_s {
 	void *pointer;		/**< pointer to a frame buffer. Aligned to 8-byte address: is equivalent to internal + offset */
 	void *internal;		/**< internal pointer to the allocated buffer space. Used with malloc() and free(). */
 	int offset;		/**< data pointer offset from internal */
+	int size;		/**< usable size of the frame buffer at \a pointer */
+	int refcnt;		/**< number of pipes and consumers still referencing the frame */
+	long long tget;		/**< time when the producer got the frame, in microseconds */
+	struct dpipe_buffer_s *ref;	/**< subscriber pipe: the shared frame buffer referenced by this buffer */
 	struct dpipe_buffer_s *next;	/**< pointer to the next dpipe frame buffer */
 }	dpipe_buffer_t;
 
+/**
+ * frame drop policies of a dpipe
+ */
+typedef enum dpipe_policy_e {
+	DPIPE_POLICY_FIFO = 0,	/**< deliver frames in order; the producer reuses the eldest frame if no free frame is left */
+	DPIPE_POLICY_MAILBOX,	/**< keep at most one pending frame: a stored frame replaces the pending one */
+	DPIPE_POLICY_LATEST,	/**< the consumer loads the newest frame and returns the skipped ones */
+}	dpipe_policy_t;
+
+/** Number of buckets in the output pool occupancy histogram */
+#define	DPIPE_STATS_DEPTH	16
+
+/**
+ * runtime statistics of a dpipe
+ */
+typedef struct dpipe_stats_s {
+	unsigned long long stored;	/**< number of frames stored */
+	unsigned long long loaded;	/**< number of frames loaded */
+	unsigned long long overwritten;	/**< number of frames taken back by dpipe_get() before loaded */
+	unsigned long long dropped;	/**< number of frames dropped, including overwritten ones */
+	long long wait_us;		/**< total time consumers blocked in dpipe_load() */
+	long long hold_us;		/**< total time producers held frames between dpipe_get() and dpipe_store() */
+	unsigned int depth[DPIPE_STATS_DEPTH];	/**< histogram of \a out_count sampled at each store,
+					 * the last bucket counts all larger values */
+}	dpipe_stats_t;
+
+/** Default period after which unused frames of a lazy dpipe are released, in seconds */
+#define	DPIPE_DEF_SHRINK_INTERVAL	10
+
+/** Size of the application data area of a shared-memory dpipe */
+#define	DPIPE_SHM_USERDATA	4096
+
+struct dpipe_shm_s;
+struct dpipe_s;
+
+/**
+ * Callback to initialize a frame buffer allocated by a lazy dpipe,
+ * see dpipe_create_lazy(). Return 0 on success, or -1 on error.
+ */
+typedef int (*dpipe_frame_init_t)(struct dpipe_s *dpipe, dpipe_buffer_t *buffer, void *arg);
+
+/**
+ * memory accounting of all the dpipes in the process
+ */
+typedef struct dpipe_memstats_s {
+	long long used;			/**< bytes allocated for frame buffers */
+	long long peak;			/**< maximum of \a used */
+	long long budget;		/**< memory budget in bytes, or 0 if unlimited */
+	unsigned long long denied;	/**< number of lazy frame allocations refused by the budget */
+	unsigned long long overcommitted;	/**< number of frames allocated over the budget, because
+					 * a producer had no frame to reuse */
+}	dpipe_memstats_t;
+
+/**
+ * ring of frame buffers used by lock-free dpipes.
+ * It holds no pointers, so a ring in shared memory is valid at any address.
+ */
+typedef struct dpipe_ring_s {
+	unsigned int mask;		/**< ring capacity - 1, capacity is a power of two */
+	size_t slotoff;			/**< offset of the ring slots from the ring, each slot keeps
+					 * a buffer address relative to \a ringbase of the dpipe */
+	unsigned int head;		/**< write index, only advanced by the writer */
+	char pad[64];			/**< keep \a head and \a tail on different cache lines */
+	unsigned int tail;		/**< read index */
+}	dpipe_ring_t;
+
 typedef struct dpipe_s {
 	int channel_id;		/**< channel id for the dpipe */
 	char *name;		/**< name of the dpipe */
@@ -51,16 +121,70 @@ typedef struct dpipe_s {
 	dpipe_buffer_t *out;		/**< output pool: pointer to the first frame buffer in output pool (occupied frames) */
 	dpipe_buffer_t *out_tail;	/**< output pool: pointer to the last frame buffer in output pool (occupied frames) */
 	int in_count;			/**< number of unused frame buffers */
+	pthread_cond_t in_cond;		/**< signaled when a frame is released while a producer waits in dpipe_get() */
+	int in_waiting;			/**< number of producers waiting on \a in_cond, see also spsc_wait_free() */
 	int out_count;			/**< number of occupied frames */
+	dpipe_policy_t policy;		/**< frame drop policy */
+	unsigned int drop_count;	/**< number of frames dropped, see \a policy */
+	dpipe_stats_t stats;		/**< runtime statistics, read with dpipe_stats() */
+	int pollfd;			/**< eventfd readable while frames are available, see dpipe_pollfd() */
+	int pollready;			/**< non-zero if \a pollfd is signaled */
+	int interrupted;		/**< set by dpipe_wakeup(), consumed by dpipe_load() */
+	// lock-free single-producer/single-consumer mode
+	int spsc;			/**< non-zero if the pipe is created by dpipe_create_spsc() */
+	dpipe_ring_t *free_ring;	/**< spsc: free frame buffers, filled by dpipe_put() */
+	dpipe_ring_t *out_ring;		/**< spsc: occupied frame buffers, filled by dpipe_store() */
+	int sleeping;			/**< spsc: non-zero if the consumer is blocked in dpipe_load() */
+	int wakefd;			/**< spsc: eventfd to wake up the consumer, or -1 to use \a cond */
+	dpipe_buffer_t *spare;		/**< spsc: frame replaced in mailbox mode, reused by the producer */
+	void *ringbase;			/**< spsc: base address of the buffers kept in the rings, NULL for absolute addresses */
+	struct dpipe_shm_s *shm;	/**< shared-memory spsc pipe: the region mapped in this process, or NULL */
+	dpipe_buffer_t *shmbuffer;	/**< shared-memory spsc pipe: the buffer descriptors of this process */
+	int shm_owner;			/**< non-zero if the region is created by this process */
+	// broadcast: one producer, many consumers
+	struct dpipe_s *source;		/**< subscriber: the pipe owning the frames, its \a io_mutex is shared */
+	struct dpipe_s **subscriber;	/**< source: pipes receiving a reference to each stored frame */
+	int nsubscriber;		/**< source: number of subscribers */
+	// memory
+	int nframe;			/**< maximum number of frame buffers */
+	int nalloc;			/**< number of allocated frame buffers */
+	int framesize;			/**< size of newly allocated frame buffers */
+	int maxframesize;		/**< maximum frame buffer size */
+	long long memsize;		/**< bytes allocated for the frame buffers */
+	// lazy allocation, see dpipe_create_lazy()
+	int lazy;			/**< non-zero if frame buffers are allocated on demand */
+	dpipe_frame_init_t frame_init;	/**< lazy: initializes each allocated frame buffer */
+	void *frame_init_arg;		/**< lazy: argument passed to \a frame_init */
+	int idle_min;			/**< lazy: fewest free frames seen in the current shrink period */
+	long long idle_start;		/**< lazy: start of the current shrink period, in microseconds */
 }	dpipe_t;
 
 EXPORT dpipe_t *	dpipe_create(int id, const char *name, int nframe, int maxframesize);
+EXPORT dpipe_t *	dpipe_create_spsc(int id, const char *name, int nframe, int maxframesize);
+EXPORT dpipe_t *	dpipe_create_lazy(int id, const char *name, int nframe, int maxframesize, int spsc, dpipe_frame_init_t init, void *arg);
+EXPORT dpipe_t *	dpipe_create_subscriber(int id, const char *name, dpipe_t *source);
+EXPORT dpipe_t *	dpipe_create_shm(int id, const char *name, int nframe, int maxframesize, const void *userdata, int usersize);
+EXPORT dpipe_t *	dpipe_attach_shm(int id, const char *name);
+EXPORT void *		dpipe_shm_userdata(dpipe_t *dpipe);
 EXPORT dpipe_t *	dpipe_lookup(const char *name);
 EXPORT int		dpipe_destroy(dpipe_t *dpipe);
+EXPORT int		dpipe_set_policy(dpipe_t *dpipe, dpipe_policy_t policy);
+EXPORT int		dpipe_policy_byname(const char *name);
+EXPORT const char *	dpipe_policy_name(dpipe_policy_t policy);
+EXPORT int		dpipe_stats(dpipe_t *dpipe, dpipe_stats_t *stats);
+EXPORT void		dpipe_stats_print(const char *prefix, dpipe_t *dpipe, const dpipe_stats_t *stats);
+EXPORT int		dpipe_set_framesize(dpipe_t *dpipe, int framesize);
+EXPORT int		dpipe_preallocate(dpipe_t *dpipe);
+EXPORT int		dpipe_set_memory_budget(long long budget);
+EXPORT int		dpipe_memory_stats(dpipe_memstats_t *stats);
+EXPORT void		dpipe_memory_report(const char *prefix);
 EXPORT dpipe_buffer_t *	dpipe_get(dpipe_t *dpipe);
 EXPORT void		dpipe_put(dpipe_t *dpipe, dpipe_buffer_t *buffer);
 EXPORT dpipe_buffer_t *	dpipe_load(dpipe_t *dpipe, const struct timespec *abstime);
 EXPORT dpipe_buffer_t *	dpipe_load_nowait(dpipe_t *dpipe);
+EXPORT int		dpipe_pollfd(dpipe_t *dpipe);
+EXPORT void		dpipe_wakeup(dpipe_t *dpipe);
 EXPORT void		dpipe_store(dpipe_t *dpipe, dpipe_buffer_t *buffer);
+EXPORT int		dpipe_store_hold(dpipe_t *dpipe, dpipe_buffer_t *buffer);
 
 #endif	/* __GA_DPIPE_H__ */
@@ -24,8 +24,10 @@
 #include <pthread.h>
 #include <map>
 #include <list>
+#include <deque>
 
 #include "vsource.h"
+#include "ga-conf.h"
 #include "encoder-common.h"
 
 using namespace std;
@@ -38,7 +40,7 @@ static bool threadLaunched = false;	/**< Encoder thread is running? */
 // for pts sync between encoders
 static pthread_mutex_t syncmutex = PTHREAD_MUTEX_INITIALIZER;
 static bool sync_reset = true;
-static struct timeval synctv;
+static long long syncclock;
 
 // list of encoders
 static ga_module_t *vencoder = NULL;	/**< Video encoder instance */
@@ -58,21 +60,19 @@ static void *aencoder_param = NULL;	/**< Audio encoder parameter */
  */
 int	// XXX: need to be int64_t ?
 encoder_pts_sync(int samplerate) {
-	struct timeval tv;
-	long long us;
+	long long ns;
 	int ret;
 	//
 	pthread_mutex_lock(&syncmutex);
 	if(sync_reset) {
-		gettimeofday(&synctv, NULL);
+		syncclock = ga_clock_ns();
 		sync_reset = false; 
 		pthread_mutex_unlock(&syncmutex);
 		return 0;
 	}
-	gettimeofday(&tv, NULL);
-	us = tvdiff_us(&tv, &synctv);
+	ns = ga_clock_ns() - syncclock;
 	pthread_mutex_unlock(&syncmutex);
-	ret = (int) (0.000001 * us * samplerate);
+	ret = (int) (1.0 * ns * samplerate / GA_NSEC_PER_SEC);
 	return ret > 0 ? ret : 0;
 }
 
@@ -186,6 +186,35 @@ encoder_get_sinkserver() {
 	return sinkserver;
 }
 
+/**
+ * Get the channel id of the audio track.
+ *
+ * @return The channel id, or -1 if audio is disabled by \em enable-audio.
+ *
+ * Video tracks use channel ids 0 to \a N-1, where \a N is the number of
+ * video channels that have been setup, and the audio track is the next one.
+ * Modules should not assume the id of the audio track,
+ * since the number of video channels is configurable.
+ */
+int
+encoder_audio_channel() {
+	if(ga_conf_readbool("enable-audio", 1) == 0)
+		return -1;
+	return video_source_channels();
+}
+
+/**
+ * Get the number of channels, i.e., tracks, delivered to sink servers.
+ *
+ * @return The number of video channels, plus the audio channel if enabled.
+ *
+ * This is the number of packet queues passed to \em encoder_pktqueue_init.
+ */
+int
+encoder_channels() {
+	return video_source_channels() + (encoder_audio_channel() >= 0 ? 1 : 0);
+}
+
 /**
  * Register an encoder client, and start encoder modules if necessary.
  *
@@ -293,26 +322,59 @@ encoder_unregister_client(void /*RTSPContext*/ *rtsp) {
  * @param channelId [in] Channel id.
  * @param pkt [in] The packet to be delivery.
  * @param encoderPts [in] Encoder presentation timestamp in an integer.
- * @param ptv [in] Encoder presentation timestamp in \a timeval structure.
+ * @param ptsns [in] Capture time of the packet on the GA clock
+ *	(in nanoseconds), or 0 to use the current time.
  * @return 0 on success, or -1 on error.
  *
  * \a channelId is used to identify whether this packet is an audio packet or
- * a video packet. A video packet usually uses a channel id ranges
+ * a video packet. A video packet uses a channel id ranges
  * from 0 to \a N-1, where \a N is the number of video tracks (usually 1).
- * A audio packet usually uses a channel id of \a N.
+ * A audio packet uses the channel id returned by \em encoder_audio_channel.
  */
 int
-encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
+encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns) {
 	if(sinkserver) {
-		return sinkserver->send_packet(prefix, channelId, pkt, encoderPts, ptv);
+		return sinkserver->send_packet(prefix, channelId, pkt, encoderPts, ptsns);
 	}
 	ga_error("encoder: no sink server registered.\n");
 	return -1;
 }
 
-// encoder pts to ptv mapping function
-#define	MAX_PTS_QUEUE	8
-static list<encoder_pts_t> pts_queue[MAX_PTS_QUEUE];	// up to 8 queues
+// encoder pts to capture time mapping function
+#define	MAX_PTS_QUEUE	(VIDEO_SOURCE_CHANNEL_MAX+1)	/* video channels and audio */
+#define	PTS_RING_SIZE	256	/* must be a power of 2 */
+static encoder_pts_t *pts_ring[MAX_PTS_QUEUE];	/* allocated on first use */
+static encoder_pts_t pts_last[MAX_PTS_QUEUE];
+static pthread_mutex_t pts_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Invalidate all the records of a pts queue */
+static void
+pts_ring_reset(unsigned queueid) {
+	int i;
+	for(i = 0; i < PTS_RING_SIZE; i++) {
+		pts_ring[queueid][i].pts = -1LL;
+		pts_ring[queueid][i].clock = 0LL;
+	}
+	pts_last[queueid].pts = -1LL;
+	pts_last[queueid].clock = 0LL;
+}
+
+/* Allocate a pts queue: records are never matched before put */
+static int
+pts_ring_setup(unsigned queueid) {
+	int ret = 0;
+	pthread_mutex_lock(&pts_ring_mutex);
+	if(pts_ring[queueid] == NULL) {
+		if((pts_ring[queueid] = (encoder_pts_t*) malloc(PTS_RING_SIZE * sizeof(encoder_pts_t))) == NULL) {
+			ga_error("encoder: allocate pts queue #%u failed.\n", queueid);
+			ret = -1;
+		} else {
+			pts_ring_reset(queueid);
+		}
+	}
+	pthread_mutex_unlock(&pts_ring_mutex);
+	return ret;
+}
 
 /**
  * Clear all pts records in a pts queue.
@@ -321,87 +383,330 @@ static list<encoder_pts_t> pts_queue[MAX_PTS_QUEUE];	// up to 8 queues
  */
 int
 encoder_pts_clear(unsigned queueid) {
-	if(queueid >= MAX_PTS_QUEUE)
+	if(queueid >= MAX_PTS_QUEUE || pts_ring_setup(queueid) < 0)
 		return -1;
-	pts_queue[queueid].clear();
+	pts_ring_reset(queueid);
 	return 0;
 }
 
 /**
- * Append a pts to ptv record into a pts queue.
+ * Record the capture time of a pts into a pts queue.
  *
  * @param queueid [in] The id of the pts queue.
  * @param pts [in] The pts value.
- * @param ptv [in] The correspond ptv value for the \a pts.
+ * @param clock [in] The capture time for the \a pts, on the GA clock
+ *	(in nanoseconds).
  * @return 0 on success, or -1 on failure.
+ *
+ * A pts queue is a preallocated ring indexed by the pts value,
+ * so both recording and retrieval take constant time.
+ * A record is overwritten by a later pts that maps to the same slot,
+ * i.e., only the most recent \a PTS_RING_SIZE pts values are kept.
  */
 int
-encoder_pts_put(unsigned queueid, long long pts, struct timeval *ptv) {
-	encoder_pts_t p;
-	if(queueid >= MAX_PTS_QUEUE)
+encoder_pts_put(unsigned queueid, long long pts, long long clock) {
+	encoder_pts_t *p;
+	if(queueid >= MAX_PTS_QUEUE || pts < 0)
 		return -1;
-	p.pts = pts;
-	p.ptv = *ptv;
-	pts_queue[queueid].push_back(p);
+	if(pts_ring[queueid] == NULL && pts_ring_setup(queueid) < 0)
+		return -1;
+	p = &pts_ring[queueid][pts & (PTS_RING_SIZE-1)];
+	p->pts = pts;
+	p->clock = clock;
+	if(pts >= pts_last[queueid].pts)
+		pts_last[queueid] = *p;
 	return 0;
 }
 
 /**
- * Retrieve the ptv value for a given pts.
+ * Retrieve the capture time for a given pts.
  *
  * @param queueid [in] The id of the pts queue.
  * @param pts [in] The pts value.
- * @param ptv [out] Store the retrieved ptv value.
- * @param interpolation [in] Use interpolation to get an approximate ptv value.
- * @return The \a ptv pointer if success, or NULL on failure.
+ * @param interpolation [in] Use interpolation to get an approximate
+ *	capture time if \a pts has not been recorded.
+ * @return The capture time on the GA clock (in nanoseconds),
+ *	or -1 on failure.
  *
  * Note that the interpolation feature may be only required for audio packets.
- * The \a interpolation value should be the sample rate of audio frames.
+ * The \a interpolation value should be the sample rate of audio frames,
+ * and the capture time is extrapolated from the most recent record.
  */
-struct timeval *
-encoder_ptv_get(unsigned queueid, long long pts, struct timeval *ptv, int interpolation) {
-	if(ptv == NULL)
-		return NULL;
-	if(queueid >= MAX_PTS_QUEUE)
-		return NULL;
-	while(pts_queue[queueid].size() > 0) {
-		if(pts > pts_queue[queueid].front().pts) {
-			pts_queue[queueid].pop_front();
-			continue;
-		}
-		if(pts_queue[queueid].front().pts == pts) {
-			*ptv = pts_queue[queueid].front().ptv;
-			pts_queue[queueid].pop_front();
-			return ptv;
-		}
-		if(interpolation > 0) {
-			long long delta_ts, delta_tv;
-			delta_ts = pts_queue[queueid].front().pts - pts;
-			delta_tv = (long long) (1.0 * delta_ts / interpolation);
-			*ptv = pts_queue[queueid].front().ptv;
-			ptv->tv_sec -= (delta_tv / 1000000LL);
-			delta_tv %= 1000000LL;
-			if(ptv->tv_usec < delta_tv) {
-				ptv->tv_sec--;
-				ptv->tv_usec += 1000000LL;
-			}
-			ptv->tv_usec -= delta_tv;
-			return ptv;
-		}
-		break;
+long long
+encoder_pts_get(unsigned queueid, long long pts, int interpolation) {
+	encoder_pts_t *p;
+	// the queue is allocated by encoder_pts_clear() or encoder_pts_put()
+	if(queueid >= MAX_PTS_QUEUE || pts < 0 || pts_ring[queueid] == NULL)
+		return -1LL;
+	p = &pts_ring[queueid][pts & (PTS_RING_SIZE-1)];
+	if(p->pts == pts)
+		return p->clock;
+	if(interpolation > 0 && pts_last[queueid].pts >= 0) {
+		p = &pts_last[queueid];
+		return p->clock + (pts - p->pts) * GA_NSEC_PER_SEC / interpolation;
 	}
 #if 1
-	ga_error("FIXME: encoder_ptv_get failed: id=%d, pts=%lld\n", queueid, pts);
+	ga_error("FIXME: encoder_pts_get failed: id=%d, pts=%lld\n", queueid, pts);
 #endif
-	return NULL;
+	return -1LL;
 }
 
 // encoder packet queue functions - for async packet delivery
 static int pktqueue_initqsize = -1;
 static int pktqueue_initchannels = -1;
-static encoder_packet_queue_t pktqueue[VIDEO_SOURCE_CHANNEL_MAX+1];
-static list<encoder_packet_t> pktlist[VIDEO_SOURCE_CHANNEL_MAX+1];
-static map<qcallback_t,qcallback_t>queue_cb[VIDEO_SOURCE_CHANNEL_MAX+1];
+// per-channel states, allocated by encoder_pktqueue_init()
+static encoder_packet_queue_t *pktqueue = NULL;
+static deque<encoder_packet_t> *pktlist = NULL;
+static list<encoder_pktqueue_reader_t*> *pktreaders = NULL;
+static encoder_pktqueue_reader_t **pktdefreader = NULL;
+static map<qcallback_t,qcallback_t> *queue_cb = NULL;
+
+/**
+ * Remove all packets from a packet list and release their buffer references.
+ * This is an internal function, the queue mutex must be held.
+ *
+ * @param channelId [in] The channel id.
+ */
+static void
+pktlist_clear(int channelId) {
+	deque<encoder_packet_t>::iterator li;
+	for(li = pktlist[channelId].begin(); li != pktlist[channelId].end(); li++) {
+		if(li->buf != NULL)
+			av_buffer_unref(&li->buf);
+	}
+	pktlist[channelId].clear();
+	return;
+}
+
+/**
+ * Remove the first packet from a packet list and update the queue buffer.
+ * This is an internal function, the queue mutex must be held.
+ *
+ * @param channelId [in] The channel id.
+ */
+static void
+pktlist_pop_front(int channelId) {
+	encoder_packet_queue_t *q = &pktqueue[channelId];
+	encoder_packet_t qp;
+	qp = pktlist[channelId].front();
+	pktlist[channelId].pop_front();
+	// update the packet queue: referenced packets are not in the buffer
+	if(qp.buf != NULL) {
+		av_buffer_unref(&qp.buf);
+	} else {
+		q->head += qp.size;
+	}
+	q->head += qp.padding;
+	q->datasize -= qp.size;
+	q->datasize -= qp.padding;
+	if(q->head == q->bufsize) {
+		q->head = 0;
+	}
+	if(q->head == q->tail) {
+		q->head = q->tail = 0;
+	}
+	return;
+}
+
+/**
+ * Release packets that have been read by all the readers.
+ * This is an internal function, the queue mutex must be held.
+ *
+ * @param channelId [in] The channel id.
+ *
+ * Packets are released immediately if there is no reader attached.
+ */
+static void
+pktqueue_reclaim(int channelId) {
+	list<encoder_pktqueue_reader_t*>::iterator ri;
+	unsigned long long minseq = pktqueue[channelId].nextseq;
+	for(ri = pktreaders[channelId].begin(); ri != pktreaders[channelId].end(); ri++) {
+		if((*ri)->cursor < minseq)
+			minseq = (*ri)->cursor;
+	}
+	while(pktlist[channelId].size() > 0
+	&& pktlist[channelId].front().seq < minseq) {
+		pktlist_pop_front(channelId);
+	}
+	return;
+}
+
+/**
+ * Skip readers that block the head of a full packet queue.
+ * This is an internal function, the queue mutex must be held.
+ *
+ * @param channelId [in] The channel id.
+ * @return The number of readers moved forward.
+ *
+ * A slow reader is moved to the next keyframe in the queue.
+ * If there is no more keyframe, the reader waits for the next one and
+ * packets appended before that are skipped as well.
+ * Channels without keyframe information (e.g., audio) treat every packet
+ * as a keyframe.
+ * Readers holding a packet returned by front() are not moved.
+ */
+static int
+pktqueue_skip_readers(int channelId) {
+	encoder_packet_queue_t *q = &pktqueue[channelId];
+	deque<encoder_packet_t> &pl = pktlist[channelId];
+	list<encoder_pktqueue_reader_t*>::iterator ri;
+	unsigned long long headseq;
+	int moved = 0;
+	if(pl.size() == 0)
+		return 0;
+	headseq = pl.front().seq;
+	for(ri = pktreaders[channelId].begin(); ri != pktreaders[channelId].end(); ri++) {
+		encoder_pktqueue_reader_t *r = *ri;
+		unsigned i, npkt = 0, nbytes = 0;
+		if(r->cursor != headseq || r->holding)
+			continue;
+		for(i = 0; i < pl.size(); i++) {
+			if(i > 0 && (q->keyed == 0 || (pl[i].flags & AV_PKT_FLAG_KEY)))
+				break;
+			npkt++;
+			nbytes += pl[i].size;
+		}
+		nbytes -= r->offset;
+		if(i < pl.size()) {
+			r->cursor = pl[i].seq;
+		} else {
+			r->cursor = q->nextseq;
+			r->waitkey = q->keyed;
+		}
+		r->offset = r->limit = 0;
+		r->skipped += npkt;
+		r->skippedbytes += nbytes;
+		r->skips++;
+		moved++;
+		ga_error("encoder: pktqueue #%d reader %p lagging, %d packets (%d bytes) skipped%s\n",
+			channelId, r, npkt, nbytes, r->waitkey ? ", waiting for a keyframe" : "");
+	}
+	return moved;
+}
+
+/**
+ * Check if a packet only contains non-reference pictures.
+ * This is an internal function.
+ *
+ * @param channelId [in] The channel id.
+ * @param pkt [in] The packet.
+ * @return 1 if the packet can be dropped without breaking later frames,
+ *	or 0 otherwise.
+ *
+ * Only H.264 and H.265 video packets are recognized.
+ */
+static int
+pktqueue_disposable(int channelId, AVPacket *pkt) {
+	unsigned char *ptr, *end = pkt->data + pkt->size;
+	int h265, codelen, type, vcl = 0;
+	if(vencoder == NULL || vencoder->mimetype == NULL
+	|| channelId >= video_source_channels())
+		return 0;
+	if(strcmp(vencoder->mimetype, "video/H264") == 0)
+		h265 = 0;
+	else if(strcmp(vencoder->mimetype, "video/H265") == 0)
+		h265 = 1;
+	else
+		return 0;
+	for(	ptr = ga_find_startcode(pkt->data, end, &codelen);
+		ptr != NULL;
+		ptr = ga_find_startcode(ptr+codelen, end, &codelen)) {
+		//
+		if(h265 == 0) {
+			type = ptr[codelen] & 0x1f;
+			if(type < 1 || type > 5)
+				continue;
+			// nal_ref_idc
+			if(ptr[codelen] & 0x60)
+				return 0;
+		} else {
+			type = (ptr[codelen] >> 1) & 0x3f;
+			if(type > 31)
+				continue;
+			// sub-layer non-reference pictures: even types up to 14
+			if(type > 14 || (type & 1))
+				return 0;
+		}
+		vcl++;
+	}
+	return vcl > 0 ? 1 : 0;
+}
+
+/**
+ * Update the congestion state of a packet queue.
+ * This is an internal function, the queue mutex must be held.
+ *
+ * @param channelId [in] The channel id.
+ * @return The new state (\a GA_BACKPRESSURE_NORMAL or
+ *	\a GA_BACKPRESSURE_CONGESTED), or -1 if the state is not changed.
+ */
+static int
+pktqueue_watermark(int channelId) {
+	encoder_packet_queue_t *q = &pktqueue[channelId];
+	if(q->congested == 0 && q->datasize > q->highmark) {
+		q->congested = 1;
+		return GA_BACKPRESSURE_CONGESTED;
+	}
+	if(q->congested != 0 && q->datasize <= q->lowmark) {
+		q->congested = 0;
+		return GA_BACKPRESSURE_NORMAL;
+	}
+	return -1;
+}
+
+/**
+ * Send a backpressure event to the video encoder.
+ * This is an internal function, the queue mutex must NOT be held.
+ *
+ * @param channelId [in] The channel id.
+ * @param state [in] The event, see \a ga_backpressure_states.
+ *	Nothing is sent if \a state is negative.
+ */
+static void
+pktqueue_backpressure(int channelId, int state) {
+	ga_ioctl_backpressure_t bp;
+	if(state < 0 || vencoder == NULL || channelId >= video_source_channels())
+		return;
+	bp.id = channelId;
+	bp.state = state;
+	bp.level = encoder_pktqueue_level(channelId);
+	ga_error("encoder: pktqueue #%d %s (%d%% full)\n", channelId,
+		state == GA_BACKPRESSURE_CONGESTED ? "congested" :
+		state == GA_BACKPRESSURE_DROPPED ? "dropped a reference frame" :
+			"back to normal",
+		bp.level);
+	ga_module_ioctl(vencoder, GA_IOCTL_BACKPRESSURE, sizeof(bp), &bp);
+	return;
+}
+
+/**
+ * Get the default reader of a channel, used by the single-reader interfaces.
+ *
+ * @param channelId [in] The channel id.
+ * @return The default reader.
+ *
+ * The default reader is attached on its first use.
+ */
+static encoder_pktqueue_reader_t *
+pktqueue_default_reader(int channelId) {
+	encoder_pktqueue_reader_t *r;
+	pthread_mutex_lock(&pktqueue[channelId].mutex);
+	r = pktdefreader[channelId];
+	pthread_mutex_unlock(&pktqueue[channelId].mutex);
+	if(r != NULL)
+		return r;
+	r = encoder_pktqueue_reader_attach(channelId, NULL, NULL);
+	pthread_mutex_lock(&pktqueue[channelId].mutex);
+	if(pktdefreader[channelId] == NULL) {
+		pktdefreader[channelId] = r;
+		r = NULL;
+	}
+	pthread_mutex_unlock(&pktqueue[channelId].mutex);
+	// lost the race
+	if(r != NULL)
+		encoder_pktqueue_reader_detach(r);
+	return pktdefreader[channelId];
+}
 
 /**
  * Initialize an encoder packet queue.
@@ -413,11 +718,38 @@ static map<qcallback_t,qcallback_t>queue_cb[VIDEO_SOURCE_CHANNEL_MAX+1];
  * This function creates a packet queue of size \a qsize for each channel.
  * This functoin should be called only once.
  * If you have multiple channels, specify the number in the \a channels 
- * parameter.
+ * parameter, usually \em encoder_channels().
+ * The per-channel states are allocated for the \a channels channels only.
  */
 int
 encoder_pktqueue_init(int channels, int qsize) {
-	int i;
+	int i, highmark, lowmark;
+	//
+	if(channels <= 0 || channels > MAX_PTS_QUEUE) {
+		ga_error("encoder: invalid number of packet queues (%d)\n", channels);
+		exit(-1);
+	}
+	if(pktqueue != NULL && channels > pktqueue_initchannels) {
+		ga_error("encoder: packet queues cannot be extended from %d to %d channels\n",
+			pktqueue_initchannels, channels);
+		exit(-1);
+	}
+	if(pktqueue == NULL) {
+		pktqueue = (encoder_packet_queue_t*) calloc(channels, sizeof(encoder_packet_queue_t));
+		pktdefreader = (encoder_pktqueue_reader_t**) calloc(channels, sizeof(encoder_pktqueue_reader_t*));
+		if(pktqueue == NULL || pktdefreader == NULL) {
+			ga_error("encoder: allocate %d packet queues failed\n", channels);
+			exit(-1);
+		}
+		pktlist = new deque<encoder_packet_t>[channels];
+		pktreaders = new list<encoder_pktqueue_reader_t*>[channels];
+		queue_cb = new map<qcallback_t,qcallback_t>[channels];
+	}
+	// watermarks, in percent
+	if((highmark = ga_conf_readint("pktqueue-high-watermark")) <= 0 || highmark > 100)
+		highmark = 75;
+	if((lowmark = ga_conf_readint("pktqueue-low-watermark")) <= 0 || lowmark >= highmark)
+		lowmark = highmark / 3;
 	for(i = 0; i < channels; i++) {
 		if(pktqueue[i].buf != NULL)
 			free(pktqueue[i].buf);
@@ -433,11 +765,14 @@ encoder_pktqueue_init(int channels, int qsize) {
 		pktqueue[i].datasize = 0;
 		pktqueue[i].head = 0;
 		pktqueue[i].tail = 0;
-		pktlist[i].clear();
+		pktqueue[i].highmark = (long long) qsize * highmark / 100;
+		pktqueue[i].lowmark = (long long) qsize * lowmark / 100;
+		pktlist_clear(i);
 	}
 	pktqueue_initqsize = qsize;
 	pktqueue_initchannels = channels;
-	ga_error("encoder: packet queue initialized (%dx%d bytes)\n", channels, qsize);
+	ga_error("encoder: packet queue initialized (%dx%d bytes, watermarks %d%%/%d%%)\n",
+		channels, qsize, highmark, lowmark);
 	return 0;
 }
 
@@ -459,14 +794,27 @@ encoder_pktqueue_reset() {
  * Empty packets stored in a single packet queue.
  *
  * @param channelId [in] Chennel id.
+ *
+ * Attached readers are kept, and they start from the next appended packet.
  */
 int
 encoder_pktqueue_reset_channel(int channelId) {
+	list<encoder_pktqueue_reader_t*>::iterator ri;
 	pthread_mutex_lock(&pktqueue[channelId].mutex);
-	pktlist[channelId].clear();
+	pktlist_clear(channelId);
 	pktqueue[channelId].head = pktqueue[channelId].tail = 0;
 	pktqueue[channelId].datasize = 0;
 	pktqueue[channelId].bufsize = pktqueue_initqsize;
+	pktqueue[channelId].keyed = 0;
+	pktqueue[channelId].congested = 0;
+	pktqueue[channelId].dropping = 0;
+	pktqueue[channelId].dropkey = 0;
+	for(ri = pktreaders[channelId].begin(); ri != pktreaders[channelId].end(); ri++) {
+		(*ri)->cursor = pktqueue[channelId].nextseq;
+		(*ri)->offset = (*ri)->limit = 0;
+		(*ri)->holding = 0;
+		(*ri)->waitkey = 0;
+	}
 	pthread_mutex_unlock(&pktqueue[channelId].mutex);
 	return 0;
 }
@@ -476,38 +824,103 @@ encoder_pktqueue_reset_channel(int channelId) {
  *
  * @param channelId [in] The channel id to be read.
  * @return The occupied size in bytes.
+ *
+ * Packets are kept until all the readers have read them,
+ * so the size includes packets that have not been read by the slowest reader.
  */
 int
 encoder_pktqueue_size(int channelId) {
 	return pktqueue[channelId].datasize;
 }
 
+/**
+ * Return the fill level of a packet queue for a given channel.
+ *
+ * @param channelId [in] The channel id to be read.
+ * @return The fill level in percent.
+ */
+int
+encoder_pktqueue_level(int channelId) {
+	encoder_packet_queue_t *q = &pktqueue[channelId];
+	if(q->bufsize <= 0)
+		return 0;
+	return (long long) q->datasize * 100 / q->bufsize;
+}
+
 /**
  * Add a packet into a packet queue.
  *
  * @param channelId [in] The channel id.
  * @param pkt [in] The packet to be stored.
  * @param encoderPts [in] The presentation timestamp in an integer.
- * @param ptv [in] The presentation timestamp in a \timeval structure.
+ * @param ptsns [in] Capture time of the packet on the GA clock
+ *	(in nanoseconds), or 0 to use the current time.
  * @return 0 on success, or -1 on error.
  *
- * The content of \a pkt is copied into the queue buffer, so it can be released
- * after returing from the function.
+ * If \a pkt->buf is set, the queue keeps a reference to the buffer
+ * instead of copying the data, and releases it when the packet has been
+ * read by all the readers.
+ * Otherwise the content of \a pkt is copied into the queue buffer.
+ * In both cases the caller still owns \a pkt,
+ * so it can be released after returing from the function.
+ *
+ * When the queue is full, readers that have not read the oldest packet
+ * are skipped forward to the next keyframe, so a slow reader never stalls
+ * the producer and the other readers.
+ *
+ * Packets are dropped frame by frame: once a packet is dropped, the other
+ * packets of the same frame are dropped as well, and if the frame is a
+ * reference frame, packets are dropped until the next keyframe.
+ * Frames that are not referenced by other frames are dropped first when the
+ * queue fill level exceeds the high watermark.
+ * Congestion and drops are reported to the video encoder with
+ * the \a GA_IOCTL_BACKPRESSURE ioctl() command.
  */
 int
-encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
-	encoder_packet_queue_t *q = &pktqueue[channelId];
+encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns) {
+	encoder_packet_queue_t *q;
 	encoder_packet_t qp;
+	list<encoder_pktqueue_reader_t*>::iterator ri;
 	map<qcallback_t,qcallback_t>::iterator mi;
-	int padding = 0;
+	int padding = 0, disposable = 0, full = 0, state;
+	if(channelId < 0 || channelId >= pktqueue_initchannels) {
+		ga_error("encoder: packet queue #%d does not exist\n", channelId);
+		return -1;
+	}
+	q = &pktqueue[channelId];
 	pthread_mutex_lock(&q->mutex);
+	// the rest of a dropped frame, or frames depending on a dropped frame
+	if(q->dropping && encoderPts == q->droppts)
+		goto drop;
+	q->dropping = 0;
+	if(q->dropkey) {
+		if((pkt->flags & AV_PKT_FLAG_KEY) == 0)
+			goto drop;
+		q->dropkey = 0;
+	}
+	// drop disposable frames first
+	disposable = pktqueue_disposable(channelId, pkt);
+	if(q->congested && disposable)
+		goto drop;
 size_check:
-	// size checking
+	// size checking: referenced packets are counted as well
 	if(q->datasize + pkt->size > q->bufsize) {
-		pthread_mutex_unlock(&q->mutex);
-		ga_error("encoder: packet queue #%d full, packet dropped (%d+%d)\n",
-			channelId, q->datasize, pkt->size);
-		return -1;
+		if(pktqueue_skip_readers(channelId) > 0) {
+			pktqueue_reclaim(channelId);
+			goto size_check;
+		}
+		full = 1;
+		goto drop;
+	}
+	// refcounted: no copy
+	if(pkt->buf != NULL) {
+		if((qp.buf = av_buffer_ref(pkt->buf)) == NULL) {
+			pthread_mutex_unlock(&q->mutex);
+			ga_error("encoder: packet queue #%d cannot reference packet\n", channelId);
+			return -1;
+		}
+		qp.data = (char*) pkt->data;
+		goto enqueue;
 	}
 	// end-of-buffer space is not sufficient
 	if(q->bufsize - q->tail < pkt->size) {
@@ -524,30 +937,72 @@ size_check:
 	bcopy(pkt->data, q->buf + q->tail, pkt->size);
 	//
 	qp.data = q->buf + q->tail;
+	qp.buf = NULL;
+	q->tail += pkt->size;
+	if(q->tail == q->bufsize)
+		q->tail = 0;
+enqueue:
 	qp.size = pkt->size;
-	qp.pts_int64 = pkt->pts;
-	if(ptv != NULL) {
-		qp.pts_tv = *ptv;
-	} else {
-		gettimeofday(&qp.pts_tv, NULL);
-	}
-	//qp.pos = q->tail;
+	qp.pts_int64 = encoderPts;
+	qp.pts_ns = ptsns > 0 ? ptsns : ga_clock_ns();
+	qp.flags = pkt->flags;
 	qp.padding = 0;
+	qp.seq = q->nextseq++;
+	if(qp.flags & AV_PKT_FLAG_KEY)
+		q->keyed = 1;
 	//
-	q->tail += pkt->size;
 	q->datasize += pkt->size;
 	pktlist[channelId].push_back(qp);
-	//
-	if(q->tail == q->bufsize)
-		q->tail = 0;
+	// readers waiting for a keyframe start here, or skip this packet
+	for(ri = pktreaders[channelId].begin(); ri != pktreaders[channelId].end(); ri++) {
+		encoder_pktqueue_reader_t *r = *ri;
+		if(r->waitkey == 0)
+			continue;
+		if(q->keyed == 0 || (qp.flags & AV_PKT_FLAG_KEY)) {
+			r->waitkey = 0;
+			continue;
+		}
+		r->cursor = q->nextseq;
+		r->skipped++;
+		r->skippedbytes += qp.size;
+	}
+	pktqueue_reclaim(channelId);
+	state = pktqueue_watermark(channelId);
+	// notify readers
+	for(ri = pktreaders[channelId].begin(); ri != pktreaders[channelId].end(); ri++) {
+		if((*ri)->callback != NULL && (*ri)->waitkey == 0)
+			(*ri)->callback((*ri)->cbarg);
+	}
 	//
 	pthread_mutex_unlock(&q->mutex);
+	pktqueue_backpressure(channelId, state);
 	// notify client
 	for(mi = queue_cb[channelId].begin(); mi != queue_cb[channelId].end(); mi++) {
 		mi->second(channelId);
 	}
 	//
 	return 0;
+drop:
+	state = -1;
+	q->dropped++;
+	if(q->dropping == 0 && q->dropkey == 0) {
+		// first packet of a dropped frame
+		if(encoderPts != (int64_t) AV_NOPTS_VALUE) {
+			q->dropping = 1;
+			q->droppts = encoderPts;
+		}
+		if(disposable == 0 && q->keyed) {
+			q->dropkey = 1;
+			state = GA_BACKPRESSURE_DROPPED;
+		}
+		if(full) {
+			ga_error("encoder: packet queue #%d full, frame dropped (%d+%d)\n",
+				channelId, q->datasize, pkt->size);
+		}
+	}
+	pthread_mutex_unlock(&q->mutex);
+	pktqueue_backpressure(channelId, state);
+	return -1;
 }
 
 /**
@@ -559,18 +1014,16 @@ size_check:
  *
  * This funcion ONLY reads the first packet.
  * It DOES NOT remove the packet from the queue.
+ * The packet data remains valid until the packet is removed by
+ * \em encoder_pktqueue_pop_front.
+ *
+ * This function and the other single-reader functions use the default
+ * reader of the channel. Use \em encoder_pktqueue_reader_attach
+ * if a channel has multiple readers.
  */
 char *
 encoder_pktqueue_front(int channelId, encoder_packet_t *pkt) {
-	encoder_packet_queue_t *q = &pktqueue[channelId];
-	pthread_mutex_lock(&q->mutex);
-	if(pktlist[channelId].size() == 0) {
-		pthread_mutex_unlock(&q->mutex);
-		return NULL;
-	}
-	*pkt = pktlist[channelId].front();
-	pthread_mutex_unlock(&q->mutex);
-	return pkt->data;
+	return encoder_pktqueue_reader_front(pktqueue_default_reader(channelId), pkt);
 }
 
 /**
@@ -592,30 +1045,7 @@ encoder_pktqueue_front(int channelId, encoder_packet_t *pkt) {
  */
 void
 encoder_pktqueue_split_packet(int channelId, char *offset) {
-	encoder_packet_queue_t *q = &pktqueue[channelId];
-	encoder_packet_t *pkt, newpkt;
-	pthread_mutex_lock(&q->mutex);
-	// has packet?
-	if(pktlist[channelId].size() == 0)
-		goto quit_split_packet;
-	pkt = &pktlist[channelId].front();
-	// offset must be in the middle
-	if(offset <= pkt->data || offset >= pkt->data + pkt->size)
-		goto quit_split_packet;
-	// split the packet: the new one
-	newpkt = *pkt;
-	newpkt.size = offset - pkt->data;
-	newpkt.padding = 0;
-	//
-	pkt->data = offset;
-	pkt->size -= newpkt.size;
-	//
-	pktlist[channelId].push_front(newpkt);
-	//
-	pthread_mutex_unlock(&q->mutex);
-	return;
-quit_split_packet:
-	pthread_mutex_unlock(&q->mutex);
+	encoder_pktqueue_reader_split(pktqueue_default_reader(channelId), offset);
 	return;
 }
 
@@ -623,31 +1053,13 @@ quit_split_packet:
  * Remove the first packet from the queue.
  *
  * @parm channelId [in] The channel id.
+ *
+ * The reference to a zero-copy packet is released here,
+ * so a sink server must not touch the data after calling this function.
  */
 void
 encoder_pktqueue_pop_front(int channelId) {
-	encoder_packet_queue_t *q = &pktqueue[channelId];
-	encoder_packet_t qp;
-	pthread_mutex_lock(&q->mutex);
-	if(pktlist[channelId].size() == 0) {
-		pthread_mutex_unlock(&q->mutex);
-		return;
-	}
-	qp = pktlist[channelId].front();
-	pktlist[channelId].pop_front();
-	// update the packet queue
-	q->head += qp.size;
-	q->head += qp.padding;
-	q->datasize -= qp.size;
-	q->datasize -= qp.padding;
-	if(q->head == q->bufsize) {
-		q->head = 0;
-	}
-	if(q->head == q->tail) {
-		q->head = q->tail = 0;
-	}
-	//
-	pthread_mutex_unlock(&q->mutex);
+	encoder_pktqueue_reader_pop(pktqueue_default_reader(channelId));
 	return;
 }
 
@@ -667,6 +1079,8 @@ encoder_pktqueue_pop_front(int channelId) {
  */
 int
 encoder_pktqueue_register_callback(int channelId, qcallback_t cb) {
+	// packets are kept for the single-reader interfaces from now on
+	pktqueue_default_reader(channelId);
 	queue_cb[channelId][cb] = cb;
 	ga_error("encoder: pktqueue #%d callback registered (%p)\n", channelId, cb);
 	return 0;
@@ -685,3 +1099,236 @@ encoder_pktqueue_unregister_callback(int channelId, qcallback_t cb) {
 	return 0;
 }
 
+/**
+ * Attach a reader to a packet queue.
+ *
+ * @param channelId [in] The channel id.
+ * @param callback [in] Function called when a packet is appended, or NULL.
+ * @param cbarg [in] The argument passed to \a callback.
+ * @return The reader, or NULL on error.
+ *
+ * A new reader starts from the latest keyframe still kept in the queue.
+ * If there is none, it starts from the next keyframe appended.
+ *
+ * The \a callback is called by the encoder thread with the queue locked,
+ * so it must return quickly and must not call packet queue functions.
+ */
+encoder_pktqueue_reader_t *
+encoder_pktqueue_reader_attach(int channelId, void (*callback)(void *), void *cbarg) {
+	encoder_packet_queue_t *q;
+	deque<encoder_packet_t>::reverse_iterator li;
+	encoder_pktqueue_reader_t *r;
+	if(channelId < 0 || channelId >= pktqueue_initchannels) {
+		ga_error("encoder: packet queue #%d does not exist\n", channelId);
+		return NULL;
+	}
+	q = &pktqueue[channelId];
+	if((r = (encoder_pktqueue_reader_t*) malloc(sizeof(encoder_pktqueue_reader_t))) == NULL) {
+		ga_error("encoder: pktqueue #%d attach reader failed.\n", channelId);
+		return NULL;
+	}
+	bzero(r, sizeof(encoder_pktqueue_reader_t));
+	r->channelId = channelId;
+	r->callback = callback;
+	r->cbarg = cbarg;
+	//
+	pthread_mutex_lock(&q->mutex);
+	r->cursor = q->nextseq;
+	r->waitkey = q->keyed;
+	if(q->keyed) {
+		for(li = pktlist[channelId].rbegin(); li != pktlist[channelId].rend(); li++) {
+			if(li->flags & AV_PKT_FLAG_KEY) {
+				r->cursor = li->seq;
+				r->waitkey = 0;
+				break;
+			}
+		}
+	}
+	pktreaders[channelId].push_back(r);
+	pthread_mutex_unlock(&q->mutex);
+	ga_error("encoder: pktqueue #%d reader %p attached, %d readers.\n",
+		channelId, r, pktreaders[channelId].size());
+	return r;
+}
+
+/**
+ * Detach a reader from its packet queue.
+ *
+ * @param reader [in] The reader to be detached.
+ *
+ * Packets that are read only by this reader are released,
+ * and its callback is no longer called when this function returns.
+ */
+void
+encoder_pktqueue_reader_detach(encoder_pktqueue_reader_t *reader) {
+	encoder_packet_queue_t *q;
+	int state;
+	if(reader == NULL)
+		return;
+	q = &pktqueue[reader->channelId];
+	pthread_mutex_lock(&q->mutex);
+	pktreaders[reader->channelId].remove(reader);
+	if(pktdefreader[reader->channelId] == reader)
+		pktdefreader[reader->channelId] = NULL;
+	pktqueue_reclaim(reader->channelId);
+	state = pktqueue_watermark(reader->channelId);
+	pthread_mutex_unlock(&q->mutex);
+	pktqueue_backpressure(reader->channelId, state);
+	ga_error("encoder: pktqueue #%d reader %p detached (%llu packets read, %llu skipped).\n",
+		reader->channelId, reader, reader->delivered, reader->skipped);
+	free(reader);
+	return;
+}
+
+/**
+ * Return the size of packets that have not been read by a reader.
+ *
+ * @param reader [in] The reader.
+ * @return The unread size in bytes.
+ */
+int
+encoder_pktqueue_reader_size(encoder_pktqueue_reader_t *reader) {
+	encoder_packet_queue_t *q = &pktqueue[reader->channelId];
+	deque<encoder_packet_t> &pl = pktlist[reader->channelId];
+	unsigned i;
+	int size = 0;
+	pthread_mutex_lock(&q->mutex);
+	if(reader->waitkey == 0 && reader->cursor < q->nextseq) {
+		for(i = reader->cursor - pl.front().seq; i < pl.size(); i++)
+			size += pl[i].size;
+		size -= reader->offset;
+	}
+	pthread_mutex_unlock(&q->mutex);
+	return size;
+}
+
+/**
+ * Read the next packet for a reader.
+ *
+ * @param reader [in] The reader.
+ * @param pkt [out] The pointer to stored a retrieved packet.
+ * @return Pointer equal to \a pkt->data, or NULL if there is no packet.
+ *
+ * This funcion does not move the reader forward.
+ * The packet data remains valid until \em encoder_pktqueue_reader_pop
+ * is called by the same reader.
+ */
+char *
+encoder_pktqueue_reader_front(encoder_pktqueue_reader_t *reader, encoder_packet_t *pkt) {
+	encoder_packet_queue_t *q = &pktqueue[reader->channelId];
+	deque<encoder_packet_t> &pl = pktlist[reader->channelId];
+	pthread_mutex_lock(&q->mutex);
+	if(reader->waitkey != 0 || reader->cursor >= q->nextseq) {
+		pthread_mutex_unlock(&q->mutex);
+		return NULL;
+	}
+	*pkt = pl[reader->cursor - pl.front().seq];
+	if(reader->limit > 0)
+		pkt->size = reader->limit;
+	pkt->data += reader->offset;
+	pkt->size -= reader->offset;
+	reader->holding = 1;
+	pthread_mutex_unlock(&q->mutex);
+	return pkt->data;
+}
+
+/**
+ * Split the next packet of a reader into two packets.
+ *
+ * @param reader [in] The reader.
+ * @param offset [in] The point to split the packet data.
+ *
+ * This is the multi-reader version of \em encoder_pktqueue_split_packet.
+ * The split only affects the given reader.
+ */
+void
+encoder_pktqueue_reader_split(encoder_pktqueue_reader_t *reader, char *offset) {
+	encoder_packet_queue_t *q = &pktqueue[reader->channelId];
+	deque<encoder_packet_t> &pl = pktlist[reader->channelId];
+	encoder_packet_t *pkt;
+	unsigned end;
+	pthread_mutex_lock(&q->mutex);
+	// has packet?
+	if(reader->waitkey != 0 || reader->cursor >= q->nextseq)
+		goto quit_split_packet;
+	pkt = &pl[reader->cursor - pl.front().seq];
+	end = reader->limit > 0 ? reader->limit : pkt->size;
+	// offset must be in the middle
+	if(offset <= pkt->data + reader->offset || offset >= pkt->data + end)
+		goto quit_split_packet;
+	reader->limit = offset - pkt->data;
+quit_split_packet:
+	pthread_mutex_unlock(&q->mutex);
+	return;
+}
+
+/**
+ * Move a reader to its next packet.
+ *
+ * @param reader [in] The reader.
+ *
+ * The packet is released if all the readers have read it,
+ * so a sink server must not touch the data after calling this function.
+ */
+void
+encoder_pktqueue_reader_pop(encoder_pktqueue_reader_t *reader) {
+	encoder_packet_queue_t *q = &pktqueue[reader->channelId];
+	int state = -1;
+	pthread_mutex_lock(&q->mutex);
+	reader->holding = 0;
+	if(reader->waitkey != 0 || reader->cursor >= q->nextseq) {
+		pthread_mutex_unlock(&q->mutex);
+		return;
+	}
+	if(reader->limit > 0) {
+		// the remaining part of a split packet
+		reader->offset = reader->limit;
+		reader->limit = 0;
+	} else {
+		reader->cursor++;
+		reader->offset = 0;
+		reader->delivered++;
+		pktqueue_reclaim(reader->channelId);
+		state = pktqueue_watermark(reader->channelId);
+	}
+	pthread_mutex_unlock(&q->mutex);
+	pktqueue_backpressure(reader->channelId, state);
+	return;
+}
+
+/**
+ * Get the lag of a reader.
+ *
+ * @param reader [in] The reader.
+ * @param lag [out] The lag and the counters of the reader.
+ * @return 0 on success, or -1 on error.
+ */
+int
+encoder_pktqueue_reader_lag(encoder_pktqueue_reader_t *reader, encoder_pktqueue_lag_t *lag) {
+	encoder_packet_queue_t *q;
+	deque<encoder_packet_t> *pl;
+	long long now;
+	unsigned i;
+	if(reader == NULL || lag == NULL)
+		return -1;
+	q = &pktqueue[reader->channelId];
+	pl = &pktlist[reader->channelId];
+	bzero(lag, sizeof(encoder_pktqueue_lag_t));
+	now = ga_clock_ns();
+	pthread_mutex_lock(&q->mutex);
+	if(reader->waitkey == 0 && reader->cursor < q->nextseq) {
+		i = reader->cursor - pl->front().seq;
+		lag->packets = pl->size() - i;
+		lag->delay = (now - (*pl)[i].pts_ns) / 1000LL;
+		for(; i < pl->size(); i++)
+			lag->bytes += (*pl)[i].size;
+		lag->bytes -= reader->offset;
+	}
+	lag->delivered = reader->delivered;
+	lag->skipped = reader->skipped;
+	lag->skippedbytes = reader->skippedbytes;
+	lag->skips = reader->skips;
+	pthread_mutex_unlock(&q->mutex);
+	return 0;
+}
+
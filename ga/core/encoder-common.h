@@ -39,9 +39,13 @@ typedef struct encoder_packet_s {
 	char *data;		/**< Pointer to the data buffer */
 	unsigned size;		/**< Size of the buffer */
 	int64_t pts_int64;	/**< Packet timestamp in a 64-bit integer */
-	struct timeval pts_tv;	/**< Packet timestamp in \a timeval structure */
+	long long pts_ns;	/**< Capture time on the GA clock, in nanoseconds */
+	int flags;		/**< Packet flags, e.g., AV_PKT_FLAG_KEY */
 	// internal data structure - do not touch
 	int padding;		/**< Padding area: internal used */
+	AVBufferRef *buf;	/**< Reference to the encoder output, or NULL if
+				 * the data is copied into the queue buffer */
+	unsigned long long seq;	/**< Sequence number: internal used */
 }	encoder_packet_t;
 
 typedef struct encoder_packet_queue_s {
@@ -51,11 +55,57 @@ typedef struct encoder_packet_queue_s {
 	int datasize;		/**< Size of occupied data size */
 	int head;		/**< Position of queue head */
 	int tail;		/**< Position of queue tail */
+	unsigned long long nextseq;	/**< Sequence number of the next packet */
+	int keyed;		/**< Keyframes have been seen in this queue */
+	// backpressure
+	int highmark;		/**< High watermark in bytes */
+	int lowmark;		/**< Low watermark in bytes */
+	int congested;		/**< Fill level has exceeded the high watermark */
+	int dropping;		/**< Dropping the rest of a frame */
+	int64_t droppts;	/**< Timestamp of the frame being dropped */
+	int dropkey;		/**< Dropping packets until the next keyframe */
+	unsigned dropped;	/**< Number of dropped packets */
 }	encoder_packet_queue_t;
 
+/*
+ * A reader of an encoder packet queue.
+ *
+ * Each reader has its own cursor, so multiple sink sessions can read
+ * the same channel without removing packets from each other.
+ * This data structure should be read-only outside encoder-common.cpp
+ */
+typedef struct encoder_pktqueue_reader_s {
+	int channelId;		/**< The channel the reader is attached to */
+	unsigned long long cursor;	/**< Sequence number of the next packet to read */
+	unsigned offset;	/**< Bytes of the current packet already read */
+	unsigned limit;		/**< End of a split part of the current packet, or 0 */
+	int holding;		/**< A packet returned by front() is not popped yet */
+	int waitkey;		/**< Waiting for the next keyframe */
+	void (*callback)(void *);	/**< Called on packet appending */
+	void *cbarg;		/**< Argument passed to the callback */
+	// lag accounting
+	unsigned long long delivered;	/**< Number of packets read */
+	unsigned long long skipped;	/**< Number of packets skipped */
+	unsigned long long skippedbytes;	/**< Size of packets skipped */
+	unsigned skips;		/**< Number of forced skips */
+}	encoder_pktqueue_reader_t;
+
+/*
+ * Lag of a packet queue reader, see encoder_pktqueue_reader_lag()
+ */
+typedef struct encoder_pktqueue_lag_s {
+	int packets;		/**< Number of unread packets */
+	int bytes;		/**< Size of unread packets */
+	long long delay;	/**< Age of the oldest unread packet, in microseconds */
+	unsigned long long delivered;	/**< Number of packets read */
+	unsigned long long skipped;	/**< Number of packets skipped */
+	unsigned long long skippedbytes;	/**< Size of packets skipped */
+	unsigned skips;		/**< Number of forced skips */
+}	encoder_pktqueue_lag_t;
+
 typedef struct encoder_pts_s {
-	long long pts;
-	struct timeval ptv;
+	long long pts;		/**< Encoder presentation timestamp */
+	long long clock;	/**< Capture time on the GA clock, in nanoseconds */
 }	encoder_pts_t;
 
 typedef void (*qcallback_t)(int);
@@ -68,26 +118,37 @@ EXPORT int encoder_register_sinkserver(ga_module_t *m);
 EXPORT ga_module_t *encoder_get_vencoder();
 EXPORT ga_module_t *encoder_get_aencoder();
 EXPORT ga_module_t *encoder_get_sinkserver();
+EXPORT int encoder_audio_channel();
+EXPORT int encoder_channels();
 EXPORT int encoder_register_client(void *ctx);
 EXPORT int encoder_unregister_client(void *ctx);
 
-EXPORT int encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);
+EXPORT int encoder_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns);
 
-// encoder pts to ptv mapping function
+// encoder pts to capture time mapping function
 EXPORT int encoder_pts_clear(unsigned queueid);
-EXPORT int encoder_pts_put(unsigned queueid, long long pts, struct timeval *ptv);
-EXPORT struct timeval * encoder_ptv_get(unsigned queueid, long long pts, struct timeval *ptv, int interpolation);
+EXPORT int encoder_pts_put(unsigned queueid, long long pts, long long clock);
+EXPORT long long encoder_pts_get(unsigned queueid, long long pts, int interpolation);
 
 // encoder packet queue - for async packet delivery
 EXPORT int encoder_pktqueue_init(int channels, int qsize);
 EXPORT int encoder_pktqueue_reset();
 EXPORT int encoder_pktqueue_reset_channel(int channelId);
 EXPORT int encoder_pktqueue_size(int channelId);
-EXPORT int encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);
+EXPORT int encoder_pktqueue_level(int channelId);
+EXPORT int encoder_pktqueue_append(int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns);
 EXPORT char * encoder_pktqueue_front(int channelId, encoder_packet_t *pkt);
 EXPORT void encoder_pktqueue_split_packet(int channelId, char *offset);
 EXPORT void encoder_pktqueue_pop_front(int channelId);
 EXPORT int encoder_pktqueue_register_callback(int channelId, qcallback_t cb);
 EXPORT int encoder_pktqueue_unregister_callback(int channelId, qcallback_t cb);
+// packet queue readers - for multiple sink sessions
+EXPORT encoder_pktqueue_reader_t * encoder_pktqueue_reader_attach(int channelId, void (*callback)(void *), void *cbarg);
+EXPORT void encoder_pktqueue_reader_detach(encoder_pktqueue_reader_t *reader);
+EXPORT int encoder_pktqueue_reader_size(encoder_pktqueue_reader_t *reader);
+EXPORT char * encoder_pktqueue_reader_front(encoder_pktqueue_reader_t *reader, encoder_packet_t *pkt);
+EXPORT void encoder_pktqueue_reader_split(encoder_pktqueue_reader_t *reader, char *offset);
+EXPORT void encoder_pktqueue_reader_pop(encoder_pktqueue_reader_t *reader);
+EXPORT int encoder_pktqueue_reader_lag(encoder_pktqueue_reader_t *reader, encoder_pktqueue_lag_t *lag);
 
 #endif
@@ -41,6 +41,7 @@
 #endif /* ANDROID */
 #ifdef __APPLE__
 #include <syslog.h>
+#include <mach/mach_time.h>
 #endif
 
 #if !defined(WIN32) && !defined(__APPLE__) && !defined(ANDROID)
@@ -127,6 +128,107 @@ ga_usleep(long long interval, struct timeval *ptv) {
 	return 0LL;
 }
 
+/**
+ * Read the GA clock.
+ *
+ * @return The current time of the GA clock, in nanoseconds.
+ *
+ * The GA clock is a monotonic clock (CLOCK_MONOTONIC if available).
+ * It is not affected by wall-clock adjustments, e.g., NTP steps, and hence
+ * all capture, encoding, and presentation timestamps in the pipeline should
+ * be taken from this clock. The origin of the clock is unspecified, so only
+ * differences between two readings are meaningful.
+ * Use \em ga_clock_walltime to derive a wall-clock time when required.
+ */
+long long
+ga_clock_ns() {
+#if defined(WIN32)
+	static LARGE_INTEGER freq = { 0 };
+	LARGE_INTEGER now;
+	if(freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (now.QuadPart / freq.QuadPart) * GA_NSEC_PER_SEC
+		+ (now.QuadPart % freq.QuadPart) * GA_NSEC_PER_SEC / freq.QuadPart;
+#elif defined(__APPLE__)
+	static mach_timebase_info_data_t tb = { 0, 0 };
+	if(tb.denom == 0)
+		mach_timebase_info(&tb);
+	return (long long) (mach_absolute_time() * tb.numer / tb.denom);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * GA_NSEC_PER_SEC + ts.tv_nsec;
+#endif
+}
+
+/**
+ * Read the GA clock in micro seconds.
+ *
+ * @return The current time of the GA clock, in micro seconds.
+ */
+long long
+ga_clock_us() {
+	return ga_clock_ns() / 1000LL;
+}
+
+/**
+ * Convert a GA clock time to a wall-clock time.
+ *
+ * @param ns [in] The GA clock time, in nanoseconds.
+ * @param tv [out] The corresponding wall-clock time.
+ * @return The \a tv pointer.
+ *
+ * The offset between the GA clock and the wall-clock is sampled only once,
+ * at the first call, so that the converted timestamps keep the same pace
+ * as the GA clock even if the wall-clock is adjusted later.
+ * This function is meant to be used only at protocol boundaries,
+ * e.g., RTP/RTCP timestamps, which must be expressed in wall-clock time.
+ */
+struct timeval *
+ga_clock_walltime(long long ns, struct timeval *tv) {
+	static long long offset = 0;
+	static pthread_mutex_t offsetmutex = PTHREAD_MUTEX_INITIALIZER;
+	struct timeval now;
+	long long us;
+	//
+	pthread_mutex_lock(&offsetmutex);
+	if(offset == 0) {
+		gettimeofday(&now, NULL);
+		offset = now.tv_sec * 1000000LL + now.tv_usec - ga_clock_us();
+	}
+	pthread_mutex_unlock(&offsetmutex);
+	us = ns / 1000LL + offset;
+	tv->tv_sec = us / 1000000LL;
+	tv->tv_usec = us % 1000000LL;
+	return tv;
+}
+
+/**
+ * Sleep and wake up at \a base + \a interval (micro seconds) on the GA clock.
+ *
+ * @param interval [in] The expected sleeping time (in micro seconds).
+ * @param base [in] The baseline time read from \em ga_clock_ns,
+ *	or 0 to sleep for \a interval micro seconds.
+ * @return 0 on success, or -1 if the wake up time has been passed.
+ *
+ * This is the GA clock version of \em ga_usleep.
+ */
+long long
+ga_clock_usleep(long long interval, long long base) {
+	long long delta;
+	if(base > 0) {
+		delta = (ga_clock_ns() - base) / 1000LL;
+		if(delta >= interval) {
+			usleep(1);
+			return -1;
+		}
+		interval -= delta;
+	}
+	usleep(interval);
+	return 0LL;
+}
+
 /**
  * Write message \a s into the log file.
  * This in an internal function only called by \em ga_log function.
@@ -213,25 +315,22 @@ ga_error(const char *fmt, ...) {
 }
 
 /**
- * malloc() and return the offset to align pointer at 16-byte boundary.
+ * malloc() and return the offset to align pointer at 64-byte boundary.
  *
  * @param size [in] Requested memory space.
  * @param ptr [out] Pointer to the memory pointer.
  * @param alignment [out] Pointer to the alignment value.
  * @return 0 on success, or -1 on failure.
  *
- * Note: The actually allocated memory space is \a size + 16.
- * Data should be stored starting from \a *ptr + \a *alignment.
+ * Note: The actually allocated memory space is \a size + 64.
+ * Data should be stored starting from \a *ptr + \a *alignment,
+ * which is aligned to a cache line.
  */
 int
 ga_malloc(int size, void **ptr, int *alignment) {
-	if((*ptr = malloc(size+16)) == NULL)
+	if((*ptr = malloc(size+64)) == NULL)
 		return -1;
-#ifdef __x86_64__
-	*alignment = 16 - (((unsigned long long) *ptr) & 0x0f);
-#else
-	*alignment = 16 - (((unsigned) *ptr) & 0x0f);
-#endif
+	*alignment = ga_alignment(*ptr, 64);
 	return 0;
 }
 
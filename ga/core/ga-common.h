@@ -60,6 +60,9 @@ extern "C" {
 /** Enable audio subsystem? */
 #define	ENABLE_AUDIO
 
+/** Nanoseconds per second, for GA clock computations */
+#define	GA_NSEC_PER_SEC	1000000000LL
+
 /** Unit size size for RGBA pixels, in bytes */
 #define	RGBA_SIZE	4
 
@@ -79,6 +82,11 @@ struct gaImage {
 
 EXPORT long long tvdiff_us(struct timeval *tv1, struct timeval *tv2);
 EXPORT long long ga_usleep(long long interval, struct timeval *ptv);
+// monotonic GA clock
+EXPORT long long ga_clock_ns();
+EXPORT long long ga_clock_us();
+EXPORT struct timeval * ga_clock_walltime(long long ns, struct timeval *tv);
+EXPORT long long ga_clock_usleep(long long interval, long long base);
 EXPORT int	ga_log(const char *fmt, ...);
 EXPORT int	ga_error(const char *fmt, ...);
 EXPORT int	ga_malloc(int size, void **ptr, int *alignment);
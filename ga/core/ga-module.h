@@ -52,6 +52,7 @@ enum ga_module_types {
 enum ga_ioctl_commands {
 	GA_IOCTL_NULL = 0,		/**< Not used */
 	GA_IOCTL_RECONFIGURE,		/**< Reconfiguration */
+	GA_IOCTL_BACKPRESSURE,		/**< Packet queue backpressure */
 	GA_IOCTL_GETSPS = 0x100,	/**< Get SPS: for H.264 and H.265 */
 	GA_IOCTL_GETPPS,		/**< Get PPS: for H.264 and H.265 */
 	GA_IOCTL_GETVPS,		/**< Get VPS: for H.265 */
@@ -97,6 +98,24 @@ typedef struct ga_ioctl_reconfigure_s {
 	int height;		/**< Height */
 }	ga_ioctl_reconfigure_t;
 
+/**
+ * Packet queue states for ioctl()'s backpressure command.
+ */
+enum ga_backpressure_states {
+	GA_BACKPRESSURE_NORMAL = 0,	/**< Fill level is back under the low watermark */
+	GA_BACKPRESSURE_CONGESTED,	/**< Fill level is over the high watermark */
+	GA_BACKPRESSURE_DROPPED		/**< A reference frame was dropped: a keyframe is needed */
+};
+
+/**
+ * Parameter for ioctl()'s backpressure command.
+ */
+typedef struct ga_ioctl_backpressure_s {
+	int id;
+	int state;		/**< One of the \a ga_backpressure_states */
+	int level;		/**< Fill level of the packet queue, in percent */
+}	ga_ioctl_backpressure_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -117,7 +136,7 @@ typedef struct ga_module_s {
 	int (*ioctl)(int command, int argsize, void *arg);	/**< Pointer to ioctl function */
 	int (*notify)(void *arg);	/**< Pointer to the notify function */
 	void * (*raw)(void *arg, int *size);	/**< Pointer to the raw function */
-	int (*send_packet)(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);	/**< Pointer to the send packet function: sink only */
+	int (*send_packet)(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns);	/**< Pointer to the send packet function: sink only */
 	void * privdata;		/**< Private data of this module */
 }	ga_module_t;
 //////////////////////////////////////////////
@@ -146,7 +165,7 @@ EXPORT int ga_module_deinit(ga_module_t *m, void *arg);
 EXPORT int ga_module_ioctl(ga_module_t *m, int command, int argsize, void *arg);
 EXPORT int ga_module_notify(ga_module_t *m, void *arg);
 EXPORT void * ga_module_raw(ga_module_t *m, void *arg, int *size);
-EXPORT int ga_module_send_packet(ga_module_t *m, const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv);
+EXPORT int ga_module_send_packet(ga_module_t *m, const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns);
 
 #ifdef GA_MODULE
 // a module must have exported the module_load function
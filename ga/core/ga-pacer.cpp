@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * frame pacer: schedule frames at absolute deadlines on the GA clock
+ *
+ * Capturing threads sleep until the deadline of the next frame,
+ * instead of polling a token bucket every millisecond. The last
+ * few micro seconds before a deadline are spent in a busy loop,
+ * because the wake up latency of a sleep is not predictable.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "ga-common.h"
+#include "ga-conf.h"
+#include "ga-pacer.h"
+
+/* Sleep until time t on the GA clock */
+static void
+pacer_sleep_until(long long t) {
+#if defined(WIN32)
+	// Sleep() is coarse, the rest is left to the spin-wait
+	long long ms = (t - ga_clock_ns()) / 1000000LL;
+	if(ms > 1)
+		Sleep((DWORD) (ms - 1));
+#elif defined(__APPLE__)
+	struct timespec ts;
+	long long ns = t - ga_clock_ns();
+	if(ns <= 0)
+		return;
+	ts.tv_sec = ns / GA_NSEC_PER_SEC;
+	ts.tv_nsec = ns % GA_NSEC_PER_SEC;
+	nanosleep(&ts, NULL);
+#else
+	struct timespec ts;
+	// the GA clock is CLOCK_MONOTONIC
+	ts.tv_sec = t / GA_NSEC_PER_SEC;
+	ts.tv_nsec = t % GA_NSEC_PER_SEC;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+#endif
+	return;
+}
+
+/* Record the scheduling error of the current frame and move to the next deadline */
+static long long
+pacer_advance(ga_pacer_t *pacer, long long now) {
+	ga_pacer_stats_t *s = &pacer->stats;
+	long long err = now - pacer->deadline;
+	//
+	s->frames++;
+	s->err_total += err;
+	if(err > s->err_max)
+		s->err_max = err;
+	if(err > 1000000LL)
+		s->late++;
+	// the next deadline
+	pacer->deadline += pacer->interval;
+	pacer->fraction += pacer->remainder;
+	if(pacer->fraction >= pacer->rate_n) {
+		pacer->deadline++;
+		pacer->fraction -= pacer->rate_n;
+	}
+	// more than one frame behind: skip the missed deadlines
+	if(pacer->interval > 0 && now - pacer->deadline >= pacer->interval) {
+		s->skipped += (now - pacer->deadline) / pacer->interval;
+		pacer->deadline = now + pacer->interval;
+		pacer->fraction = 0;
+	}
+	//
+	if(pacer->stats_interval > 0) {
+		if(pacer->stats_start == 0) {
+			pacer->stats_start = now;
+		} else if(now - pacer->stats_start >= pacer->stats_interval * GA_NSEC_PER_SEC) {
+			ga_error("pacer: %s %u frames @ %d/%d fps, error avg %.3f ms, max %.3f ms, late %u, skipped %u\n",
+				pacer->name, s->frames, pacer->rate_n, pacer->rate_d,
+				0.000001 * s->err_total / s->frames,
+				0.000001 * s->err_max, s->late, s->skipped);
+			bzero(s, sizeof(ga_pacer_stats_t));
+			pacer->stats_start = now;
+		}
+	}
+	return err;
+}
+
+/**
+ * Initialize a frame pacer.
+ *
+ * @param pacer [in] The pacer to be initialized.
+ * @param name [in] The name printed in the statistics, must remain valid.
+ * @param rate_n [in] Frame rate numerator.
+ * @param rate_d [in] Frame rate denominator.
+ * @return The \a pacer pointer, or NULL if the frame rate is invalid.
+ *
+ * The spin-wait before each deadline is \em pacer-spin micro seconds
+ * (GA_PACER_DEF_SPIN by default, 0 disables it), and the scheduling
+ * errors are printed every \em pacer-stats-interval seconds if set.
+ */
+ga_pacer_t *
+ga_pacer_init(ga_pacer_t *pacer, const char *name, int rate_n, int rate_d) {
+	char buf[64];
+	//
+	bzero(pacer, sizeof(ga_pacer_t));
+	pacer->name = name;
+	if(ga_pacer_set_rate(pacer, rate_n, rate_d) < 0)
+		return NULL;
+	pacer->spin = GA_PACER_DEF_SPIN * 1000LL;
+	if(ga_conf_readv("pacer-spin", buf, sizeof(buf)) != NULL)
+		pacer->spin = ga_conf_readint("pacer-spin") * 1000LL;
+	if(pacer->spin < 0)
+		pacer->spin = 0;
+	pacer->stats_interval = ga_conf_readint("pacer-stats-interval");
+	return pacer;
+}
+
+/**
+ * Change the frame rate of a pacer.
+ *
+ * @param pacer [in] The pacer.
+ * @param rate_n [in] Frame rate numerator.
+ * @param rate_d [in] Frame rate denominator.
+ * @return 0 on success, or -1 if the frame rate is invalid.
+ *
+ * The next deadline is kept, and the new rate applies to the frames after it.
+ * For example, 30000/1001 schedules NTSC 29.97 fps without drift.
+ */
+int
+ga_pacer_set_rate(ga_pacer_t *pacer, int rate_n, int rate_d) {
+	long long period;
+	if(rate_n <= 0 || rate_d <= 0)
+		return -1;
+	period = rate_d * GA_NSEC_PER_SEC;
+	pacer->rate_n = rate_n;
+	pacer->rate_d = rate_d;
+	pacer->interval = period / rate_n;
+	pacer->remainder = period % rate_n;
+	pacer->fraction = 0;
+	return 0;
+}
+
+/**
+ * Restart a pacer: the next frame is due immediately.
+ *
+ * @param pacer [in] The pacer.
+ *
+ * Call this after the caller paused, e.g., while no encoder is running,
+ * so that the pause is not counted as missed deadlines.
+ */
+void
+ga_pacer_reset(ga_pacer_t *pacer) {
+	pacer->deadline = 0;
+	pacer->fraction = 0;
+	return;
+}
+
+/**
+ * Wait for the deadline of the next frame.
+ *
+ * @param pacer [in] The pacer.
+ * @return The scheduling error, i.e., the time past the deadline
+ *	on return, in nanoseconds.
+ *
+ * The caller sleeps until \em pacer-spin micro seconds before the deadline,
+ * and then spins until the deadline. If the caller is more than one frame
+ * behind, the missed deadlines are skipped.
+ */
+long long
+ga_pacer_wait(ga_pacer_t *pacer) {
+	long long now = ga_clock_ns();
+	if(pacer->deadline == 0)
+		pacer->deadline = now;
+	if(now < pacer->deadline - pacer->spin) {
+		pacer_sleep_until(pacer->deadline - pacer->spin);
+		now = ga_clock_ns();
+	}
+	while(now < pacer->deadline)
+		now = ga_clock_ns();
+	return pacer_advance(pacer, now);
+}
+
+/**
+ * Check, without waiting, whether the next frame is due.
+ *
+ * @param pacer [in] The pacer.
+ * @param now [in] The current time read from \em ga_clock_ns.
+ * @return 1 if the deadline has been passed, or 0 otherwise.
+ *
+ * This is for callers that cannot sleep, e.g., the hooked rendering
+ * functions of a game. The scheduling error is how late the caller checks.
+ */
+int
+ga_pacer_due(ga_pacer_t *pacer, long long now) {
+	if(pacer->deadline == 0)
+		pacer->deadline = now;
+	if(now < pacer->deadline)
+		return 0;
+	pacer_advance(pacer, now);
+	return 1;
+}
+
+/**
+ * Get the scheduling statistics of the current period.
+ *
+ * @param pacer [in] The pacer.
+ * @param stats [out] The statistics since the last printed period.
+ *
+ * This function must be called from the thread that runs the pacer.
+ */
+void
+ga_pacer_stats(ga_pacer_t *pacer, ga_pacer_stats_t *stats) {
+	bcopy(&pacer->stats, stats, sizeof(ga_pacer_stats_t));
+	return;
+}
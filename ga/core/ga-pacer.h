@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * frame pacer: schedule frames at absolute deadlines on the GA clock
+ */
+
+#ifndef __GA_PACER_H__
+#define __GA_PACER_H__
+
+#include "ga-common.h"
+
+/** Default spin-wait before a deadline, in micro seconds */
+#define	GA_PACER_DEF_SPIN	100
+
+/**
+ * Scheduling error statistics of a pacer, see ga_pacer_stats().
+ */
+typedef struct ga_pacer_stats_s {
+	unsigned int frames;	/**< Number of scheduled frames */
+	unsigned int late;	/**< Number of frames delivered more than 1 ms late */
+	unsigned int skipped;	/**< Number of deadlines skipped because the caller was too late */
+	long long err_total;	/**< Sum of the scheduling errors, in nanoseconds */
+	long long err_max;	/**< Maximum scheduling error, in nanoseconds */
+}	ga_pacer_stats_t;
+
+/**
+ * Data structure of a frame pacer.
+ *
+ * The deadline of frame \em i is \a base + \em i * \a rate_d / \a rate_n
+ * seconds, so fractional frame rates do not drift.
+ */
+typedef struct ga_pacer_s {
+	const char *name;	/**< Name printed in the statistics */
+	int rate_n;		/**< Frame rate numerator */
+	int rate_d;		/**< Frame rate denominator */
+	long long interval;	/**< Integral part of the frame interval, in nanoseconds */
+	long long remainder;	/**< Fractional part of the frame interval, in 1/\a rate_n nanoseconds */
+	long long fraction;	/**< Accumulated fractional part of \a deadline */
+	long long deadline;	/**< Deadline of the next frame on the GA clock, or 0 if not started */
+	long long spin;		/**< Spin-wait before a deadline, in nanoseconds */
+	int stats_interval;	/**< Print statistics every N seconds, or 0 */
+	long long stats_start;	/**< Start time of the current statistics period */
+	ga_pacer_stats_t stats;	/**< Statistics of the current period */
+}	ga_pacer_t;
+
+EXPORT ga_pacer_t *	ga_pacer_init(ga_pacer_t *pacer, const char *name, int rate_n, int rate_d);
+EXPORT int		ga_pacer_set_rate(ga_pacer_t *pacer, int rate_n, int rate_d);
+EXPORT void		ga_pacer_reset(ga_pacer_t *pacer);
+EXPORT long long	ga_pacer_wait(ga_pacer_t *pacer);
+EXPORT int		ga_pacer_due(ga_pacer_t *pacer, long long now);
+EXPORT void		ga_pacer_stats(ga_pacer_t *pacer, ga_pacer_stats_t *stats);
+
+#endif /* __GA_PACER_H__ */
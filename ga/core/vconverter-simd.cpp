@@ -0,0 +1,639 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * video frame converter: unscaled RGBA/BGRA to YUV420P/NV12 kernels
+ *
+ * All kernels use the same integer BT.601 (limited range) arithmetic,
+ * so they produce identical results:
+ *	Y = ((66R + 129G + 25B + 128) >> 8) + 16
+ *	U = ((-38R' - 74G' + 112B' + 128) >> 8) + 128
+ *	V = ((112R' - 94G' - 18B' + 128) >> 8) + 128
+ * where R', G', and B' are the rounded averages of each 2x2 block.
+ * The results are within +-1 of libswscale's unscaled conversion.
+ */
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "ga-common.h"
+#include "ga-conf.h"
+
+#include "vconverter.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define	VCONV_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define	VCONV_TARGET(isa)
+#else
+#define	VCONV_TARGET(isa)	__attribute__((target(isa)))
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define	VCONV_NEON
+#include <arm_neon.h>
+#endif
+
+/** Byte offsets of R, G, and B in a packed 32-bit pixel */
+#define	RGB_OFFSETS(rgba, r, g, b)	\
+	do { r = (rgba) ? 0 : 2; g = 1; b = (rgba) ? 2 : 0; } while(0)
+
+/**
+ * Portable kernel. This is an internal function.
+ *
+ * @param src [in] Pointer to the first pixel of the source image.
+ * @param srcstride [in] Source image stride, in bytes.
+ * @param dst [in] Destination planes: Y, U, V for YUV420P, or Y, UV for NV12.
+ * @param dststride [in] Destination strides.
+ * @param x0 [in] First column to convert; must be even.
+ * @param width [in] Image width.
+ * @param height [in] Image height.
+ * @param rgba [in] 1 for RGBA source, or 0 for BGRA source.
+ * @param nv12 [in] 1 for NV12 destination, or 0 for YUV420P destination.
+ *
+ * This function converts columns [\a x0, \a width) of the image.
+ * It is also used by the SIMD kernels to convert the remaining columns.
+ * Odd widths and heights are handled by replicating the last column/row
+ * when computing chroma samples.
+ */
+static void
+rgb2yuv_c(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[],
+		int x0, int width, int height, int rgba, int nv12) {
+	int x, y, r, g, b;
+	RGB_OFFSETS(rgba, r, g, b);
+	for(y = 0; y < height; y += 2) {
+		const unsigned char *s0 = src + y * srcstride;
+		const unsigned char *s1 = (y+1 < height) ? s0 + srcstride : s0;
+		unsigned char *y0 = dst[0] + y * dststride[0];
+		unsigned char *y1 = (y+1 < height) ? y0 + dststride[0] : NULL;
+		unsigned char *u = dst[1] + (y>>1) * dststride[1];
+		unsigned char *v = nv12 ? NULL : dst[2] + (y>>1) * dststride[2];
+		for(x = x0; x < width; x += 2) {
+			const unsigned char *p[4];
+			int i, n, sr = 0, sg = 0, sb = 0;
+			p[0] = s0 + x*4;
+			p[1] = s1 + x*4;
+			n = (x+1 < width) ? 4 : 2;
+			p[2] = p[0] + 4;
+			p[3] = p[1] + 4;
+			for(i = 0; i < 4; i++) {
+				const unsigned char *q = p[i < n ? i : i-2];
+				sr += q[r];
+				sg += q[g];
+				sb += q[b];
+			}
+			y0[x] = ((66*p[0][r] + 129*p[0][g] + 25*p[0][b] + 128) >> 8) + 16;
+			if(n == 4)
+				y0[x+1] = ((66*p[2][r] + 129*p[2][g] + 25*p[2][b] + 128) >> 8) + 16;
+			if(y1 != NULL) {
+				y1[x] = ((66*p[1][r] + 129*p[1][g] + 25*p[1][b] + 128) >> 8) + 16;
+				if(n == 4)
+					y1[x+1] = ((66*p[3][r] + 129*p[3][g] + 25*p[3][b] + 128) >> 8) + 16;
+			}
+			sr = (sr + 2) >> 2;
+			sg = (sg + 2) >> 2;
+			sb = (sb + 2) >> 2;
+			if(nv12) {
+				u[x]   = ((-38*sr - 74*sg + 112*sb + 128) >> 8) + 128;
+				u[x+1] = ((112*sr - 94*sg - 18*sb + 128) >> 8) + 128;
+			} else {
+				u[x>>1] = ((-38*sr - 74*sg + 112*sb + 128) >> 8) + 128;
+				v[x>>1] = ((112*sr - 94*sg - 18*sb + 128) >> 8) + 128;
+			}
+		}
+	}
+	return;
+}
+
+static void
+bgra_yuv420p_c(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_c(src, srcstride, dst, dststride, 0, width, height, 0, 0);
+}
+
+static void
+rgba_yuv420p_c(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_c(src, srcstride, dst, dststride, 0, width, height, 1, 0);
+}
+
+static void
+bgra_nv12_c(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_c(src, srcstride, dst, dststride, 0, width, height, 0, 1);
+}
+
+static void
+rgba_nv12_c(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_c(src, srcstride, dst, dststride, 0, width, height, 1, 1);
+}
+
+#ifdef VCONV_X86
+/*
+ * x86 kernels: pixels are widened to 16-bit [B G R A] (or [R G B A]) lanes,
+ * and _mm_madd_epi16 computes two partial sums per pixel.
+ * The partial sums are added by shuffling even and odd 32-bit lanes.
+ */
+
+/* Add adjacent 32-bit lanes of a and b: [a0+a1, a2+a3, b0+b1, b2+b3] */
+#define	HSUM_SSE(a, b)	_mm_add_epi32(						\
+	_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(2,0,2,0))),\
+	_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b), _MM_SHUFFLE(3,1,3,1))))
+
+/* Y of 4 pixels in 16 bytes, as 32-bit lanes */
+VCONV_TARGET("sse2") static inline __m128i
+luma4_sse2(__m128i px, __m128i cy) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), cy);
+	__m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), cy);
+	__m128i y = HSUM_SSE(lo, hi);
+	y = _mm_srai_epi32(_mm_add_epi32(y, _mm_set1_epi32(128)), 8);
+	return _mm_add_epi32(y, _mm_set1_epi32(16));
+}
+
+/* Rounded averages of two 2x2 blocks in 16 bytes of two rows, as 16-bit lanes */
+VCONV_TARGET("sse2") static inline __m128i
+block2_sse2(__m128i r0, __m128i r1) {
+	__m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(r0, zero), _mm_unpacklo_epi8(r1, zero));
+	__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(r0, zero), _mm_unpackhi_epi8(r1, zero));
+	__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+	return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+}
+
+/* Chroma of four 2x2 blocks (two block2 results), as 32-bit lanes */
+VCONV_TARGET("sse2") static inline __m128i
+chroma4_sse2(__m128i b01, __m128i b23, __m128i c) {
+	__m128i s = HSUM_SSE(_mm_madd_epi16(b01, c), _mm_madd_epi16(b23, c));
+	s = _mm_srai_epi32(_mm_add_epi32(s, _mm_set1_epi32(128)), 8);
+	return _mm_add_epi32(s, _mm_set1_epi32(128));
+}
+
+VCONV_TARGET("sse2") static void
+rgb2yuv_sse2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[],
+		int width, int height, int rgba, int nv12) {
+	int x, y, simdw = width & ~15;
+	__m128i cy, cu, cv;
+	if(rgba) {
+		cy = _mm_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0);
+		cu = _mm_setr_epi16(-38, -74, 112, 0, -38, -74, 112, 0);
+		cv = _mm_setr_epi16(112, -94, -18, 0, 112, -94, -18, 0);
+	} else {
+		cy = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+		cu = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+		cv = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+	}
+	for(y = 0; y+1 < height; y += 2) {
+		const unsigned char *s0 = src + y * srcstride;
+		const unsigned char *s1 = s0 + srcstride;
+		unsigned char *y0 = dst[0] + y * dststride[0];
+		unsigned char *y1 = y0 + dststride[0];
+		unsigned char *u = dst[1] + (y>>1) * dststride[1];
+		unsigned char *v = nv12 ? NULL : dst[2] + (y>>1) * dststride[2];
+		for(x = 0; x < simdw; x += 16) {
+			__m128i a[4], b[4], blk[4], uu, vv;
+			int i;
+			for(i = 0; i < 4; i++) {
+				a[i] = _mm_loadu_si128((const __m128i*) (s0 + (x+i*4)*4));
+				b[i] = _mm_loadu_si128((const __m128i*) (s1 + (x+i*4)*4));
+				blk[i] = block2_sse2(a[i], b[i]);
+			}
+			_mm_storeu_si128((__m128i*) (y0 + x), _mm_packus_epi16(
+				_mm_packs_epi32(luma4_sse2(a[0], cy), luma4_sse2(a[1], cy)),
+				_mm_packs_epi32(luma4_sse2(a[2], cy), luma4_sse2(a[3], cy))));
+			_mm_storeu_si128((__m128i*) (y1 + x), _mm_packus_epi16(
+				_mm_packs_epi32(luma4_sse2(b[0], cy), luma4_sse2(b[1], cy)),
+				_mm_packs_epi32(luma4_sse2(b[2], cy), luma4_sse2(b[3], cy))));
+			uu = _mm_packs_epi32(chroma4_sse2(blk[0], blk[1], cu), chroma4_sse2(blk[2], blk[3], cu));
+			vv = _mm_packs_epi32(chroma4_sse2(blk[0], blk[1], cv), chroma4_sse2(blk[2], blk[3], cv));
+			uu = _mm_packus_epi16(uu, uu);
+			vv = _mm_packus_epi16(vv, vv);
+			if(nv12) {
+				_mm_storeu_si128((__m128i*) (u + x), _mm_unpacklo_epi8(uu, vv));
+			} else {
+				_mm_storel_epi64((__m128i*) (u + (x>>1)), uu);
+				_mm_storel_epi64((__m128i*) (v + (x>>1)), vv);
+			}
+		}
+	}
+	// remaining columns and the last odd row
+	if(simdw < width)
+		rgb2yuv_c(src, srcstride, dst, dststride, simdw, width, height & ~1, rgba, nv12);
+	if(height & 1) {
+		unsigned char *last[3];
+		last[0] = dst[0] + (height-1) * dststride[0];
+		last[1] = dst[1] + ((height-1)>>1) * dststride[1];
+		last[2] = nv12 ? NULL : dst[2] + ((height-1)>>1) * dststride[2];
+		rgb2yuv_c(src + (height-1) * srcstride, srcstride, last, dststride, 0, width, 1, rgba, nv12);
+	}
+	return;
+}
+
+/* AVX2 versions of the helpers: the same operations within each 128-bit lane */
+#define	HSUM_AVX2(a, b)	_mm256_add_epi32(						\
+	_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(2,0,2,0))),\
+	_mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), _MM_SHUFFLE(3,1,3,1))))
+
+/* Y of 8 pixels in 32 bytes, in order */
+VCONV_TARGET("avx2") static inline __m256i
+luma8_avx2(__m256i px, __m256i cy) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi8(px, zero), cy);
+	__m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi8(px, zero), cy);
+	__m256i y = HSUM_AVX2(lo, hi);
+	y = _mm256_srai_epi32(_mm256_add_epi32(y, _mm256_set1_epi32(128)), 8);
+	return _mm256_add_epi32(y, _mm256_set1_epi32(16));
+}
+
+/* Rounded averages of four 2x2 blocks: [b0 b1 | b2 b3] */
+VCONV_TARGET("avx2") static inline __m256i
+block4_avx2(__m256i r0, __m256i r1) {
+	__m256i zero = _mm256_setzero_si256();
+	__m256i lo = _mm256_add_epi16(_mm256_unpacklo_epi8(r0, zero), _mm256_unpacklo_epi8(r1, zero));
+	__m256i hi = _mm256_add_epi16(_mm256_unpackhi_epi8(r0, zero), _mm256_unpackhi_epi8(r1, zero));
+	__m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+	return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+}
+
+/* Chroma of eight 2x2 blocks (two block4 results), in order */
+VCONV_TARGET("avx2") static inline __m256i
+chroma8_avx2(__m256i b0123, __m256i b4567, __m256i c) {
+	__m256i s = HSUM_AVX2(_mm256_madd_epi16(b0123, c), _mm256_madd_epi16(b4567, c));
+	s = _mm256_srai_epi32(_mm256_add_epi32(s, _mm256_set1_epi32(128)), 8);
+	s = _mm256_add_epi32(s, _mm256_set1_epi32(128));
+	// [c0 c1 c4 c5 | c2 c3 c6 c7] -> [c0 .. c7]
+	return _mm256_permute4x64_epi64(s, _MM_SHUFFLE(3,1,2,0));
+}
+
+/* Pack 4 x 8 32-bit lanes into 32 bytes, in order */
+VCONV_TARGET("avx2") static inline __m256i
+pack32_avx2(__m256i a, __m256i b, __m256i c, __m256i d) {
+	__m256i ab = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3,1,2,0));
+	__m256i cd = _mm256_permute4x64_epi64(_mm256_packs_epi32(c, d), _MM_SHUFFLE(3,1,2,0));
+	return _mm256_permute4x64_epi64(_mm256_packus_epi16(ab, cd), _MM_SHUFFLE(3,1,2,0));
+}
+
+/* Pack 2 x 8 32-bit lanes into 16 bytes, in order */
+VCONV_TARGET("avx2") static inline __m128i
+pack16_avx2(__m256i a, __m256i b) {
+	__m256i ab = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3,1,2,0));
+	return _mm_packus_epi16(_mm256_castsi256_si128(ab), _mm256_extracti128_si256(ab, 1));
+}
+
+VCONV_TARGET("avx2") static void
+rgb2yuv_avx2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[],
+		int width, int height, int rgba, int nv12) {
+	int x, y, simdw = width & ~31;
+	__m256i cy, cu, cv;
+	if(rgba) {
+		cy = _mm256_setr_epi16(66, 129, 25, 0, 66, 129, 25, 0, 66, 129, 25, 0, 66, 129, 25, 0);
+		cu = _mm256_setr_epi16(-38, -74, 112, 0, -38, -74, 112, 0, -38, -74, 112, 0, -38, -74, 112, 0);
+		cv = _mm256_setr_epi16(112, -94, -18, 0, 112, -94, -18, 0, 112, -94, -18, 0, 112, -94, -18, 0);
+	} else {
+		cy = _mm256_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0, 25, 129, 66, 0, 25, 129, 66, 0);
+		cu = _mm256_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0, 112, -74, -38, 0, 112, -74, -38, 0);
+		cv = _mm256_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0, -18, -94, 112, 0, -18, -94, 112, 0);
+	}
+	for(y = 0; y+1 < height; y += 2) {
+		const unsigned char *s0 = src + y * srcstride;
+		const unsigned char *s1 = s0 + srcstride;
+		unsigned char *y0 = dst[0] + y * dststride[0];
+		unsigned char *y1 = y0 + dststride[0];
+		unsigned char *u = dst[1] + (y>>1) * dststride[1];
+		unsigned char *v = nv12 ? NULL : dst[2] + (y>>1) * dststride[2];
+		for(x = 0; x < simdw; x += 32) {
+			__m256i a[4], b[4], blk[4];
+			__m128i uu, vv;
+			int i;
+			for(i = 0; i < 4; i++) {
+				a[i] = _mm256_loadu_si256((const __m256i*) (s0 + (x+i*8)*4));
+				b[i] = _mm256_loadu_si256((const __m256i*) (s1 + (x+i*8)*4));
+				blk[i] = block4_avx2(a[i], b[i]);
+			}
+			_mm256_storeu_si256((__m256i*) (y0 + x), pack32_avx2(
+				luma8_avx2(a[0], cy), luma8_avx2(a[1], cy),
+				luma8_avx2(a[2], cy), luma8_avx2(a[3], cy)));
+			_mm256_storeu_si256((__m256i*) (y1 + x), pack32_avx2(
+				luma8_avx2(b[0], cy), luma8_avx2(b[1], cy),
+				luma8_avx2(b[2], cy), luma8_avx2(b[3], cy)));
+			uu = pack16_avx2(chroma8_avx2(blk[0], blk[1], cu), chroma8_avx2(blk[2], blk[3], cu));
+			vv = pack16_avx2(chroma8_avx2(blk[0], blk[1], cv), chroma8_avx2(blk[2], blk[3], cv));
+			if(nv12) {
+				_mm_storeu_si128((__m128i*) (u + x), _mm_unpacklo_epi8(uu, vv));
+				_mm_storeu_si128((__m128i*) (u + x + 16), _mm_unpackhi_epi8(uu, vv));
+			} else {
+				_mm_storeu_si128((__m128i*) (u + (x>>1)), uu);
+				_mm_storeu_si128((__m128i*) (v + (x>>1)), vv);
+			}
+		}
+	}
+	if(simdw < width)
+		rgb2yuv_c(src, srcstride, dst, dststride, simdw, width, height & ~1, rgba, nv12);
+	if(height & 1) {
+		unsigned char *last[3];
+		last[0] = dst[0] + (height-1) * dststride[0];
+		last[1] = dst[1] + ((height-1)>>1) * dststride[1];
+		last[2] = nv12 ? NULL : dst[2] + ((height-1)>>1) * dststride[2];
+		rgb2yuv_c(src + (height-1) * srcstride, srcstride, last, dststride, 0, width, 1, rgba, nv12);
+	}
+	return;
+}
+
+static void
+bgra_yuv420p_sse2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_sse2(src, srcstride, dst, dststride, width, height, 0, 0);
+}
+
+static void
+rgba_yuv420p_sse2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_sse2(src, srcstride, dst, dststride, width, height, 1, 0);
+}
+
+static void
+bgra_nv12_sse2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_sse2(src, srcstride, dst, dststride, width, height, 0, 1);
+}
+
+static void
+rgba_nv12_sse2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_sse2(src, srcstride, dst, dststride, width, height, 1, 1);
+}
+
+static void
+bgra_yuv420p_avx2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_avx2(src, srcstride, dst, dststride, width, height, 0, 0);
+}
+
+static void
+rgba_yuv420p_avx2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_avx2(src, srcstride, dst, dststride, width, height, 1, 0);
+}
+
+static void
+bgra_nv12_avx2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_avx2(src, srcstride, dst, dststride, width, height, 0, 1);
+}
+
+static void
+rgba_nv12_avx2(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_avx2(src, srcstride, dst, dststride, width, height, 1, 1);
+}
+
+/* Check if the CPU and the OS support AVX2 */
+static int
+cpu_has_avx2() {
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] < 7)
+		return 0;
+	__cpuid(info, 1);
+	// OSXSAVE and AVX, and the OS saves the YMM registers
+	if((info[2] & (1<<27)) == 0 || (info[2] & (1<<28)) == 0)
+		return 0;
+	if((_xgetbv(0) & 6) != 6)
+		return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1<<5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif	/* VCONV_X86 */
+
+#ifdef VCONV_NEON
+static void
+rgb2yuv_neon(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[],
+		int width, int height, int rgba, int nv12) {
+	int x, y, simdw = width & ~15;
+	int ri = rgba ? 0 : 2, bi = rgba ? 2 : 0;
+	for(y = 0; y+1 < height; y += 2) {
+		const unsigned char *s0 = src + y * srcstride;
+		const unsigned char *s1 = s0 + srcstride;
+		unsigned char *y0 = dst[0] + y * dststride[0];
+		unsigned char *y1 = y0 + dststride[0];
+		unsigned char *u = dst[1] + (y>>1) * dststride[1];
+		unsigned char *v = nv12 ? NULL : dst[2] + (y>>1) * dststride[2];
+		for(x = 0; x < simdw; x += 16) {
+			uint8x16x4_t a = vld4q_u8(s0 + x*4);
+			uint8x16x4_t b = vld4q_u8(s1 + x*4);
+			uint16x8_t ylo, yhi;
+			int16x8_t sr, sg, sb, t;
+			uint8x8x2_t uv;
+			// luma
+#define	LUMA(px, half)	vmlal_u8(vmlal_u8(vmull_u8(half(px.val[ri]), vdup_n_u8(66)),	\
+				half(px.val[1]), vdup_n_u8(129)), half(px.val[bi]), vdup_n_u8(25))
+			ylo = LUMA(a, vget_low_u8);
+			yhi = LUMA(a, vget_high_u8);
+			vst1q_u8(y0 + x, vaddq_u8(vcombine_u8(
+				vshrn_n_u16(vaddq_u16(ylo, vdupq_n_u16(128)), 8),
+				vshrn_n_u16(vaddq_u16(yhi, vdupq_n_u16(128)), 8)), vdupq_n_u8(16)));
+			ylo = LUMA(b, vget_low_u8);
+			yhi = LUMA(b, vget_high_u8);
+			vst1q_u8(y1 + x, vaddq_u8(vcombine_u8(
+				vshrn_n_u16(vaddq_u16(ylo, vdupq_n_u16(128)), 8),
+				vshrn_n_u16(vaddq_u16(yhi, vdupq_n_u16(128)), 8)), vdupq_n_u8(16)));
+#undef	LUMA
+			// chroma: rounded averages of 2x2 blocks
+			sr = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(a.val[ri]), b.val[ri]), 2));
+			sg = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(a.val[1]), b.val[1]), 2));
+			sb = vreinterpretq_s16_u16(vrshrq_n_u16(vpadalq_u8(vpaddlq_u8(a.val[bi]), b.val[bi]), 2));
+			t = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(sr, -38), sg, -74), sb, 112);
+			uv.val[0] = vqmovun_s16(vaddq_s16(vshrq_n_s16(vaddq_s16(t, vdupq_n_s16(128)), 8), vdupq_n_s16(128)));
+			t = vmlaq_n_s16(vmlaq_n_s16(vmulq_n_s16(sr, 112), sg, -94), sb, -18);
+			uv.val[1] = vqmovun_s16(vaddq_s16(vshrq_n_s16(vaddq_s16(t, vdupq_n_s16(128)), 8), vdupq_n_s16(128)));
+			if(nv12) {
+				vst2_u8(u + x, uv);
+			} else {
+				vst1_u8(u + (x>>1), uv.val[0]);
+				vst1_u8(v + (x>>1), uv.val[1]);
+			}
+		}
+	}
+	if(simdw < width)
+		rgb2yuv_c(src, srcstride, dst, dststride, simdw, width, height & ~1, rgba, nv12);
+	if(height & 1) {
+		unsigned char *last[3];
+		last[0] = dst[0] + (height-1) * dststride[0];
+		last[1] = dst[1] + ((height-1)>>1) * dststride[1];
+		last[2] = nv12 ? NULL : dst[2] + ((height-1)>>1) * dststride[2];
+		rgb2yuv_c(src + (height-1) * srcstride, srcstride, last, dststride, 0, width, 1, rgba, nv12);
+	}
+	return;
+}
+
+static void
+bgra_yuv420p_neon(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_neon(src, srcstride, dst, dststride, width, height, 0, 0);
+}
+
+static void
+rgba_yuv420p_neon(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_neon(src, srcstride, dst, dststride, width, height, 1, 0);
+}
+
+static void
+bgra_nv12_neon(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_neon(src, srcstride, dst, dststride, width, height, 0, 1);
+}
+
+static void
+rgba_nv12_neon(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[], int width, int height) {
+	rgb2yuv_neon(src, srcstride, dst, dststride, width, height, 1, 1);
+}
+#endif	/* VCONV_NEON */
+
+/** Kernels of an instruction set, indexed by [rgba][nv12] */
+struct vconv_kernel_set {
+	const char *name;
+	vconv_kernel_t kernel[2][2];
+};
+
+static struct vconv_kernel_set kernel_c = { "C",
+	{ { bgra_yuv420p_c, bgra_nv12_c }, { rgba_yuv420p_c, rgba_nv12_c } } };
+#ifdef VCONV_X86
+static struct vconv_kernel_set kernel_sse2 = { "SSE2",
+	{ { bgra_yuv420p_sse2, bgra_nv12_sse2 }, { rgba_yuv420p_sse2, rgba_nv12_sse2 } } };
+static struct vconv_kernel_set kernel_avx2 = { "AVX2",
+	{ { bgra_yuv420p_avx2, bgra_nv12_avx2 }, { rgba_yuv420p_avx2, rgba_nv12_avx2 } } };
+#endif
+#ifdef VCONV_NEON
+static struct vconv_kernel_set kernel_neon = { "NEON",
+	{ { bgra_yuv420p_neon, bgra_nv12_neon }, { rgba_yuv420p_neon, rgba_nv12_neon } } };
+#endif
+
+/* Get the kernel of \a set for a conversion, or NULL if not supported */
+static vconv_kernel_t
+kernel_of(struct vconv_kernel_set *set, PixelFormat srcfmt, PixelFormat dstfmt) {
+	int rgba, nv12;
+	if(set == NULL)
+		return NULL;
+	if(srcfmt == PIX_FMT_RGBA)		rgba = 1;
+	else if(srcfmt == PIX_FMT_BGRA)		rgba = 0;
+	else					return NULL;
+	if(dstfmt == PIX_FMT_YUV420P)		nv12 = 0;
+	else if(dstfmt == PIX_FMT_NV12)		nv12 = 1;
+	else					return NULL;
+	return set->kernel[rgba][nv12];
+}
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static struct vconv_kernel_set *kernels = NULL;
+
+/* Select the kernels for the running CPU */
+static void
+select_frame_kernels() {
+	char isa[16];
+	kernels = &kernel_c;
+#ifdef VCONV_X86
+	// SSE2 is part of x86-64, and required by all supported x86 CPUs
+	kernels = cpu_has_avx2() ? &kernel_avx2 : &kernel_sse2;
+#endif
+#ifdef VCONV_NEON
+	kernels = &kernel_neon;
+#endif
+	// allow to force a slower kernel set, e.g., for comparisons
+	if(ga_conf_readv("converter-simd", isa, sizeof(isa)) != NULL) {
+		if(strcasecmp(isa, "c") == 0)
+			kernels = &kernel_c;
+#ifdef VCONV_X86
+		if(strcasecmp(isa, "sse2") == 0)
+			kernels = &kernel_sse2;
+#endif
+		if(strcasecmp(isa, "none") == 0)
+			kernels = NULL;
+	}
+	ga_error("frame converter: unscaled RGB to YUV kernels = %s\n",
+		kernels ? kernels->name : "disabled (swscale)");
+	return;
+}
+
+/**
+ * Look up an unscaled conversion kernel.
+ *
+ * @param srcfmt [in] Video source frame pixel format.
+ * @param dstfmt [in] Video destination frame pixel format.
+ * @return The fastest kernel for the running CPU,
+ *	or NULL if the conversion is not supported by the kernels.
+ *
+ * Kernels are available for RGBA or BGRA to YUV420P or NV12 conversions
+ * without scaling. Other conversions should use a converter from
+ * \em create_frame_converter or \em checkout_frame_converter.
+ * The kernels are selected at the first call according to the CPU features,
+ * and can be limited with the \em converter-simd parameter
+ * (c, sse2, or none).
+ */
+vconv_kernel_t
+lookup_frame_kernel(PixelFormat srcfmt, PixelFormat dstfmt) {
+	pthread_once(&kernel_once, select_frame_kernels);
+	return kernel_of(kernels, srcfmt, dstfmt);
+}
+
+/**
+ * Look up an unscaled conversion kernel of an instruction set.
+ *
+ * @param isa [in] Name of the instruction set: c, sse2, avx2, or neon.
+ * @param srcfmt [in] Video source frame pixel format.
+ * @param dstfmt [in] Video destination frame pixel format.
+ * @return The kernel, or NULL if the instruction set is not available
+ *	on the running CPU or the conversion is not supported.
+ *
+ * Unlike \em lookup_frame_kernel, the \em converter-simd parameter is
+ * ignored. It is used to compare the kernels, e.g., by tests and benchmarks.
+ */
+vconv_kernel_t
+lookup_frame_kernel_isa(const char *isa, PixelFormat srcfmt, PixelFormat dstfmt) {
+	struct vconv_kernel_set *set = NULL;
+	if(strcasecmp(isa, "c") == 0)
+		set = &kernel_c;
+#ifdef VCONV_X86
+	if(strcasecmp(isa, "sse2") == 0)
+		set = &kernel_sse2;
+	if(strcasecmp(isa, "avx2") == 0 && cpu_has_avx2())
+		set = &kernel_avx2;
+#endif
+#ifdef VCONV_NEON
+	if(strcasecmp(isa, "neon") == 0)
+		set = &kernel_neon;
+#endif
+	return kernel_of(set, srcfmt, dstfmt);
+}
+
@@ -22,7 +22,9 @@
  */
 
 #include <stdio.h>
+#include <pthread.h>
 #include <map>
+#include <list>
 
 #include "ga-common.h"
 #include "ga-conf.h"
@@ -31,7 +33,13 @@
 
 using namespace std;
 
+/* shared converters: see create_frame_converter() */
+static pthread_rwlock_t ga_converters_lock = PTHREAD_RWLOCK_INITIALIZER;
 static map<struct vconvcfg, struct SwsContext *> ga_converters;
+/* idle and checked-out converters: see checkout_frame_converter() */
+static pthread_mutex_t ga_converter_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static map<struct vconvcfg, list<struct SwsContext *> > ga_converter_pool;
+static map<struct SwsContext *, struct vconvcfg> ga_converter_checkedout;
 
 /**
  * Implement operator< for \a vconvcfg data structure.
@@ -58,12 +66,59 @@ bool operator<(struct vconvcfg a, struct vconvcfg b) {
 	return false;
 }
 
+/**
+ * Fill a \a vconvcfg data structure. This is an internal function.
+ *
+ * @param ccfg [out] Pointer to the \a vconvcfg data structure.
+ * @param srcw [in] Video source frame width.
+ * @param srch [in] Video source frame height.
+ * @param srcfmt [in] Video source frame pixel format.
+ * @param dstw [in] Video destination frame width.
+ * @param dsth [in] Video destination frame height.
+ * @param dstfmt [in] Video destination frame pixel format.
+ */
+static void
+fill_vconvcfg(struct vconvcfg *ccfg,
+		int srcw, int srch, PixelFormat srcfmt,
+		int dstw, int dsth, PixelFormat dstfmt) {
+	ccfg->src_width = srcw;
+	ccfg->src_height = srch;
+	ccfg->src_fmt = srcfmt;
+	ccfg->dst_width = dstw;
+	ccfg->dst_height = dsth;
+	ccfg->dst_fmt = dstfmt;
+	return;
+}
+
+/**
+ * Allocate a new converter. This is an internal function.
+ *
+ * @param ccfg [in] Pointer to a prepared \a vconvcfg data structure.
+ * @return Pointer to the \a SwsContext structure of the converter,
+ *	or NULL if it fails on creating a converter.
+ */
+static struct SwsContext *
+new_frame_converter(struct vconvcfg *ccfg) {
+	struct SwsContext *ctx;
+	if((ctx = sws_getContext(ccfg->src_width, ccfg->src_height, ccfg->src_fmt,
+				 ccfg->dst_width, ccfg->dst_height, ccfg->dst_fmt,
+				 SWS_BICUBIC, NULL, NULL, NULL)) == NULL) {
+		return NULL;
+	}
+	ga_error("Frame converter created: from (%d,%d)[%d] -> (%d,%d)[%d]\n",
+		(int) ccfg->src_width, (int) ccfg->src_height, (int) ccfg->src_fmt,
+		(int) ccfg->dst_width, (int) ccfg->dst_height, (int) ccfg->dst_fmt);
+	return ctx;
+}
+
 /**
  * Look up an existing converter. This is an internal function.
  *
  * @param ccfg [in] Pointer to a prepared \a vconvcfg data structure.
  * @return Pointer to the \a SwsContext structure of the converter,
  *	or NULL if not found.
+ *
+ * The caller must hold \a ga_converters_lock.
  */
 static struct SwsContext *
 lookup_frame_converter_internal(struct vconvcfg *ccfg) {
@@ -91,15 +146,14 @@ lookup_frame_converter_internal(struct vconvcfg *ccfg) {
 struct SwsContext *
 lookup_frame_converter(int srcw, int srch, PixelFormat srcfmt, int dstw, int dsth, PixelFormat dstfmt) {
 	struct vconvcfg ccfg;
+	struct SwsContext *ctx;
 	//
-	ccfg.src_width = srcw;
-	ccfg.src_height = srch;
-	ccfg.src_fmt = srcfmt;
-	ccfg.dst_width = dstw;
-	ccfg.dst_height = dsth;
-	ccfg.dst_fmt = dstfmt;
+	fill_vconvcfg(&ccfg, srcw, srch, srcfmt, dstw, dsth, dstfmt);
 	//
-	return lookup_frame_converter_internal(&ccfg);
+	pthread_rwlock_rdlock(&ga_converters_lock);
+	ctx = lookup_frame_converter_internal(&ccfg);
+	pthread_rwlock_unlock(&ga_converters_lock);
+	return ctx;
 }
 
 /**
@@ -116,34 +170,147 @@ lookup_frame_converter(int srcw, int srch, PixelFormat srcfmt, int dstw, int dst
  *
  * This function does not create duplicated converters.
  * An existing converter is returned if it has already been created.
+ * A converter returned by this function is shared, and a \a SwsContext
+ * must not be used by two threads at the same time.
+ * Threads that may convert frames concurrently should use
+ * \em checkout_frame_converter or \em cached_frame_converter instead.
  */
 struct SwsContext *
 create_frame_converter(int srcw, int srch, PixelFormat srcfmt,
 		 int dstw, int dsth, PixelFormat dstfmt) {
-	map<struct vconvcfg, struct SwsContext *>::iterator mi;
 	struct vconvcfg ccfg;
 	struct SwsContext *ctx;
 	//
-	ccfg.src_width = srcw;
-	ccfg.src_height = srch;
-	ccfg.src_fmt = srcfmt;
-	ccfg.dst_width = dstw;
-	ccfg.dst_height = dsth;
-	ccfg.dst_fmt = dstfmt;
+	fill_vconvcfg(&ccfg, srcw, srch, srcfmt, dstw, dsth, dstfmt);
 	//
-	if((ctx = lookup_frame_converter_internal(&ccfg)) != NULL)
-		return ctx;
+	pthread_rwlock_wrlock(&ga_converters_lock);
+	if((ctx = lookup_frame_converter_internal(&ccfg)) == NULL) {
+		if((ctx = new_frame_converter(&ccfg)) != NULL)
+			ga_converters[ccfg] = ctx;
+	}
+	pthread_rwlock_unlock(&ga_converters_lock);
 	//
-	if((ctx = sws_getContext(srcw, srch, srcfmt,
-				 dstw, dsth, dstfmt,
-				 SWS_BICUBIC, NULL, NULL, NULL)) == NULL) {
-		return NULL;
+	return ctx;
+}
+
+/**
+ * Check out a video frame converter for exclusive use.
+ *
+ * @param srcw [in] Video source frame width.
+ * @param srch [in] Video source frame height.
+ * @param srcfmt [in] Video source frame pixel format.
+ * @param dstw [in] Video destination frame width.
+ * @param dsth [in] Video destination frame height.
+ * @param dstfmt [in] Video destination frame pixel format.
+ * @return Pointer to the \a SwsContext structure of the converter,
+ *	or NULL if it fails on creating a converter.
+ *
+ * An idle converter of the same configuration is reused if there is one,
+ * otherwise a new converter is created.
+ * The converter is owned by the caller until it is returned by
+ * \em checkin_frame_converter.
+ */
+struct SwsContext *
+checkout_frame_converter(int srcw, int srch, PixelFormat srcfmt,
+		int dstw, int dsth, PixelFormat dstfmt) {
+	map<struct vconvcfg, list<struct SwsContext *> >::iterator mi;
+	struct vconvcfg ccfg;
+	struct SwsContext *ctx = NULL;
+	//
+	fill_vconvcfg(&ccfg, srcw, srch, srcfmt, dstw, dsth, dstfmt);
+	//
+	pthread_mutex_lock(&ga_converter_pool_mutex);
+	if((mi = ga_converter_pool.find(ccfg)) != ga_converter_pool.end()
+	&& mi->second.size() > 0) {
+		ctx = mi->second.front();
+		mi->second.pop_front();
 	}
-	ga_converters[ccfg] = ctx;
-	ga_error("Frame converter created: from (%d,%d)[%d] -> (%d,%d)[%d]\n",
-		(int) srcw, (int) srch, (int) srcfmt,
-		(int) dstw, (int) dsth, (int) dstfmt);
+	pthread_mutex_unlock(&ga_converter_pool_mutex);
+	// sws_getContext() is slow: do not hold the lock
+	if(ctx == NULL && (ctx = new_frame_converter(&ccfg)) == NULL)
+		return NULL;
 	//
+	pthread_mutex_lock(&ga_converter_pool_mutex);
+	ga_converter_checkedout[ctx] = ccfg;
+	pthread_mutex_unlock(&ga_converter_pool_mutex);
 	return ctx;
 }
 
+/**
+ * Return a converter obtained from \em checkout_frame_converter.
+ *
+ * @param ctx [in] Pointer to the \a SwsContext structure of the converter.
+ * @return 0 on success, or -1 if \a ctx has not been checked out.
+ *
+ * The converter is kept for later \em checkout_frame_converter calls.
+ */
+int
+checkin_frame_converter(struct SwsContext *ctx) {
+	map<struct SwsContext *, struct vconvcfg>::iterator mi;
+	//
+	if(ctx == NULL)
+		return -1;
+	pthread_mutex_lock(&ga_converter_pool_mutex);
+	if((mi = ga_converter_checkedout.find(ctx)) == ga_converter_checkedout.end()) {
+		pthread_mutex_unlock(&ga_converter_pool_mutex);
+		ga_error("frame converter: check in unknown converter %p\n", ctx);
+		return -1;
+	}
+	ga_converter_pool[mi->second].push_back(ctx);
+	ga_converter_checkedout.erase(mi);
+	pthread_mutex_unlock(&ga_converter_pool_mutex);
+	return 0;
+}
+
+/**
+ * Get a video frame converter through a per-thread converter cache.
+ *
+ * @param cache [in,out] The converter cache owned by the calling thread.
+ *	It must be zero-initialized before the first use.
+ * @param srcw [in] Video source frame width.
+ * @param srch [in] Video source frame height.
+ * @param srcfmt [in] Video source frame pixel format.
+ * @param dstw [in] Video destination frame width.
+ * @param dsth [in] Video destination frame height.
+ * @param dstfmt [in] Video destination frame pixel format.
+ * @return Pointer to the \a SwsContext structure of the converter,
+ *	or NULL if it fails on creating a converter.
+ *
+ * If the configuration matches the cached one, the cached converter is
+ * returned without any locking, so this function can be called for
+ * each frame. Otherwise the cached converter is checked in and a converter
+ * for the new configuration is checked out.
+ */
+struct SwsContext *
+cached_frame_converter(struct vconvcache *cache,
+		int srcw, int srch, PixelFormat srcfmt,
+		int dstw, int dsth, PixelFormat dstfmt) {
+	if(cache->ctx != NULL
+	&& cache->cfg.src_width == srcw
+	&& cache->cfg.src_height == srch
+	&& cache->cfg.src_fmt == srcfmt
+	&& cache->cfg.dst_width == dstw
+	&& cache->cfg.dst_height == dsth
+	&& cache->cfg.dst_fmt == dstfmt) {
+		return cache->ctx;
+	}
+	release_frame_converter_cache(cache);
+	if((cache->ctx = checkout_frame_converter(srcw, srch, srcfmt, dstw, dsth, dstfmt)) == NULL)
+		return NULL;
+	fill_vconvcfg(&cache->cfg, srcw, srch, srcfmt, dstw, dsth, dstfmt);
+	return cache->ctx;
+}
+
+/**
+ * Release the converter held by a per-thread converter cache.
+ *
+ * @param cache [in,out] The converter cache.
+ */
+void
+release_frame_converter_cache(struct vconvcache *cache) {
+	if(cache->ctx != NULL)
+		checkin_frame_converter(cache->ctx);
+	cache->ctx = NULL;
+	return;
+}
+
@@ -48,9 +48,38 @@ struct vconvcfg {
 	PixelFormat dst_fmt;	/**< destination vodeo frame pixel format */
 };
 
+/**
+ * Per-thread converter cache, see cached_frame_converter()
+ */
+struct vconvcache {
+	struct vconvcfg cfg;	/**< configuration of the cached converter */
+	struct SwsContext *ctx;	/**< the cached converter, owned by the thread */
+};
+
+/**
+ * Unscaled RGBA/BGRA to YUV conversion kernel, see lookup_frame_kernel().
+ * It converts \a height rows of \a width pixels. \a dst and \a dststride
+ * describe the Y, U, and V planes of YUV420P, or the Y and UV planes of NV12.
+ */
+typedef void (*vconv_kernel_t)(const unsigned char *src, int srcstride,
+		unsigned char * const dst[], const int dststride[],
+		int width, int height);
+
 EXPORT struct SwsContext * lookup_frame_converter(int srcw, int srch, PixelFormat srcfmt, int dstw, int dsth, PixelFormat dstfmt);
 EXPORT struct SwsContext * create_frame_converter(
 		int srcw, int srch, PixelFormat srcfmt,
 		int dstw, int dsth, PixelFormat dstfmt);
+// converters for exclusive use: safe for concurrent conversions
+EXPORT struct SwsContext * checkout_frame_converter(
+		int srcw, int srch, PixelFormat srcfmt,
+		int dstw, int dsth, PixelFormat dstfmt);
+EXPORT int checkin_frame_converter(struct SwsContext *ctx);
+EXPORT struct SwsContext * cached_frame_converter(struct vconvcache *cache,
+		int srcw, int srch, PixelFormat srcfmt,
+		int dstw, int dsth, PixelFormat dstfmt);
+EXPORT void release_frame_converter_cache(struct vconvcache *cache);
+// unscaled RGB to YUV kernels: vconverter-simd.cpp
+EXPORT vconv_kernel_t lookup_frame_kernel(PixelFormat srcfmt, PixelFormat dstfmt);
+EXPORT vconv_kernel_t lookup_frame_kernel_isa(const char *isa, PixelFormat srcfmt, PixelFormat dstfmt);
 
 #endif
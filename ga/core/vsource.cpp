@@ -37,11 +37,6 @@
 #include "ga-avcodec.h"
 #include "ga-crc.h"
 
-/**< Video buffer allocation alignment: should be 2^n */
-#define	VSOURCE_ALIGNMENT	16
-/**< Video buffer allocation alignment mask: should be \em VSOURCE_ALIGNMENT-1 */
-#define	VSOURCE_ALIGNMENT_MASK	0x0f
-
 // embed colorcode feature
 #define	COLORCODE_MAX_DIGIT	10	/**< Maximum number of embedded color code digits */
 #define	COLORCODE_MAX_WIDTH	128	/**< Maximum Width of each embedded color code digit */
@@ -55,8 +50,31 @@
 
 // golbal image structure
 static int gChannels;		/**< Total number of video channels */
-static vsource_t gVsource[VIDEO_SOURCE_CHANNEL_MAX];	/**< Video source */
-static dpipe_t *gPipe[VIDEO_SOURCE_CHANNEL_MAX];	/**< Video pipeline */
+static int gChannelSlots;	/**< Number of allocated channels */
+static vsource_t *gVsource[VIDEO_SOURCE_CHANNEL_MAX];	/**< Video source of each channel */
+static dpipe_t *gPipe[VIDEO_SOURCE_CHANNEL_MAX];	/**< Video pipeline of each channel */
+static pthread_mutex_t gOutMutex = PTHREAD_MUTEX_INITIALIZER;	/**< Guard output resolution changes */
+
+/* Initialize a video frame with \a imgbufsize bytes of frame data */
+static vsource_frame_t *
+vsource_frame_init_internal(vsource_t *vs, vsource_frame_t *frame, int imgbufsize) {
+	int i;
+	//
+	bzero(frame, sizeof(vsource_frame_t));
+	//
+	for(i = 0; i < VIDEO_SOURCE_MAX_STRIDE; i++) {
+		frame->linesize[i] = vs->max_stride;
+	}
+	frame->maxstride = vs->max_stride;
+	frame->imgbufsize = imgbufsize;
+	frame->imgbuf_internal = ((unsigned char *) frame) + sizeof(vsource_frame_t);
+	frame->alignment = ga_alignment(frame->imgbuf_internal, VIDEO_SOURCE_ALIGNMENT);
+	frame->imgbuf = frame->imgbuf_internal + frame->alignment;
+	//ga_error("XXX: frame=%p, imgbuf=%p, sizeof(vframe)=%d, bzero(%d)\n",
+	//	frame, frame->imgbuf, sizeof(vsource_frame_t), frame->imgbufsize);
+	bzero(frame->imgbuf, frame->imgbufsize);
+	return frame;
+}
 
 /**
  * Initialize a video frame
@@ -67,38 +85,151 @@ static dpipe_t *gPipe[VIDEO_SOURCE_CHANNEL_MAX];	/**< Video pipeline */
  *
  * Note that video frame data is stored right after a video frame structure.
  * So the size of allocated video frame structure must be at least:
- * \em sizeof(vsource_frame_t)
- * + \em video-source-max-stride * \em video-source-max-height
- * + \em VSOURCE_ALIGNMENT.
+ * \em sizeof(vsource_frame_t) + \em video_source_mem_size().
  *
- * \a imgbufsize will be set to \em video-source-max-stride * \em video-source-max-height,
- * and \a imgbuf is pointed to an aligned memory address.
+ * \a imgbufsize will be set to \em video-source-max-stride * the padded
+ * \em video-source-max-height, and \a imgbuf is pointed to a
+ * \em VIDEO_SOURCE_ALIGNMENT-byte aligned memory address.
  */
 vsource_frame_t *
 vsource_frame_init(int channel, vsource_frame_t *frame) {
-	int i;
 	vsource_t *vs;
 	//
-	if(channel < 0 || channel >= VIDEO_SOURCE_CHANNEL_MAX)
+	if((vs = video_source(channel)) == NULL)
 		return NULL;
-	vs = &gVsource[channel];
 	// has not been initialized?
 	if(vs->max_width == 0)
 		return NULL;
+	return vsource_frame_init_internal(vs, frame,
+		VIDEO_SOURCE_PAD_HEIGHT(vs->max_height) * vs->max_stride);
+}
+
+/**
+ * Initialize a video frame buffer allocated by a lazy pipe.
+ *
+ * @param dpipe [in] The pipe, its \a channel_id is the channel of the frame.
+ * @param buffer [in] The allocated frame buffer.
+ * @param arg [in] Not used.
+ * @return 0 on success, or -1 on error.
+ *
+ * This is the \a init callback of \em dpipe_create_lazy for pipes of video
+ * frames. The frame buffer of \a buffer->size bytes has the room for
+ * a frame of \em vsource_frame_size bytes, which is usually smaller than
+ * the maximum resolution.
+ */
+int
+vsource_frame_init_buffer(dpipe_t *dpipe, dpipe_buffer_t *buffer, void *arg) {
+	vsource_t *vs;
+	int imgbufsize = buffer->size - (int) sizeof(vsource_frame_t) - VIDEO_SOURCE_ALIGNMENT;
 	//
-	bzero(frame, sizeof(vsource_frame_t));
+	if((vs = video_source(dpipe->channel_id)) == NULL)
+		return -1;
+	if(vs->max_width == 0 || imgbufsize <= 0)
+		return -1;
+	return vsource_frame_init_internal(vs, (vsource_frame_t*) buffer->pointer, imgbufsize) == NULL ? -1 : 0;
+}
+
+/**
+ * Get the frame buffer size needed for a video frame.
+ *
+ * @param format [in] Pixel format: RGBA, BGRA, or YUV420P.
+ * @param width [in] Frame width.
+ * @param height [in] Frame height.
+ * @return The size in bytes, including the \em vsource_frame_t header
+ *	and the alignment, or -1 if the format is not supported.
+ *
+ * This is the smallest pipe frame size for which \em vsource_frame_layout
+ * succeeds with the given format and resolution.
+ */
+int
+vsource_frame_size(PixelFormat format, int width, int height) {
+	int rows = VIDEO_SOURCE_PAD_HEIGHT(height);
+	int size;
+	if(format == PIX_FMT_RGBA || format == PIX_FMT_BGRA) {
+		size = VIDEO_SOURCE_ALIGN(width * 4) * rows;
+	} else if(format == PIX_FMT_YUV420P) {
+		size = VIDEO_SOURCE_ALIGN(width) * rows
+			+ 2 * VIDEO_SOURCE_ALIGN((width + 1) >> 1) * (rows >> 1);
+	} else {
+		return -1;
+	}
+	return sizeof(vsource_frame_t) + size + VIDEO_SOURCE_ALIGNMENT;
+}
+
+/**
+ * Setup the plane layout of a video frame.
+ *
+ * @param frame [in] Pointer to an initialized video frame.
+ * @param format [in] Pixel format: RGBA, BGRA, or YUV420P.
+ * @param width [in] Frame width.
+ * @param height [in] Frame height.
+ * @return 0 on success, or -1 if the format is not supported
+ *	or the frame does not fit in \a imgbuf.
+ *
+ * Each plane starts at a \em VIDEO_SOURCE_ALIGNMENT-byte boundary,
+ * the linesizes are padded to a multiple of \em VIDEO_SOURCE_ALIGNMENT,
+ * and the planes are padded to a multiple of \em VIDEO_SOURCE_PAD_ROWS rows.
+ * Producers that write the frame themselves call this function
+ * before filling the planes; consumers must use \a linesize and
+ * vsource_frame_plane(), instead of computing the offsets from the width.
+ */
+int
+vsource_frame_layout(vsource_frame_t *frame, PixelFormat format, int width, int height) {
+	int rows = VIDEO_SOURCE_PAD_HEIGHT(height);
 	//
-	for(i = 0; i < VIDEO_SOURCE_MAX_STRIDE; i++) {
-		frame->linesize[i] = vs->max_stride;
+	if(width <= 0 || height <= 0)
+		return -1;
+	bzero(frame->linesize, sizeof(frame->linesize));
+	bzero(frame->planeoffset, sizeof(frame->planeoffset));
+	if(format == PIX_FMT_RGBA || format == PIX_FMT_BGRA) {
+		frame->linesize[0] = VIDEO_SOURCE_ALIGN(width * 4);
+		frame->realsize = frame->linesize[0] * rows;
+	} else if(format == PIX_FMT_YUV420P) {
+		frame->linesize[0] = VIDEO_SOURCE_ALIGN(width);
+		frame->linesize[1] = frame->linesize[2] = VIDEO_SOURCE_ALIGN((width + 1) >> 1);
+		frame->planeoffset[1] = frame->linesize[0] * rows;
+		frame->planeoffset[2] = frame->planeoffset[1] + frame->linesize[1] * (rows >> 1);
+		frame->realsize = frame->planeoffset[2] + frame->linesize[2] * (rows >> 1);
+	} else {
+		return -1;
 	}
-	frame->maxstride = vs->max_stride;
-	frame->imgbufsize = vs->max_height * vs->max_stride;
-	frame->imgbuf = ((unsigned char *) frame) + sizeof(vsource_frame_t);
-	frame->imgbuf += ga_alignment(frame->imgbuf, VSOURCE_ALIGNMENT);
-	//ga_error("XXX: frame=%p, imgbuf=%p, sizeof(vframe)=%d, bzero(%d)\n",
-	//	frame, frame->imgbuf, sizeof(vsource_frame_t), frame->imgbufsize);
-	bzero(frame->imgbuf, frame->imgbufsize);
-	return frame;
+	if(frame->realsize > frame->imgbufsize)
+		return -1;
+	frame->pixelformat = format;
+	frame->realwidth = width;
+	frame->realheight = height;
+	frame->realstride = frame->linesize[0];
+	return 0;
+}
+
+/**
+ * Get the address of the video frame data.
+ *
+ * @param frame [in] Pointer to the video frame.
+ * @return The address of the frame data in this process.
+ *
+ * Unlike \a imgbuf, it is also valid for a frame loaded from a pipe
+ * attached with \em video_source_attach_shm, where the frame is mapped
+ * at another address than in the capturing process.
+ */
+unsigned char *
+vsource_frame_imgbuf(const vsource_frame_t *frame) {
+	// the data is stored right after the frame, unless replaced by the source
+	if(frame->imgbuf == frame->imgbuf_internal + frame->alignment)
+		return ((unsigned char*) frame) + sizeof(vsource_frame_t) + frame->alignment;
+	return frame->imgbuf;
+}
+
+/**
+ * Get the address of a video plane.
+ *
+ * @param frame [in] Pointer to the video frame.
+ * @param plane [in] The plane index, e.g., 0 for Y and 1 for U.
+ * @return The address of the first row of the plane.
+ */
+unsigned char *
+vsource_frame_plane(const vsource_frame_t *frame, int plane) {
+	return vsource_frame_imgbuf(frame) + frame->planeoffset[plane];
 }
 
 /**
@@ -124,12 +255,233 @@ vsource_dup_frame(vsource_frame_t *src, vsource_frame_t *dst) {
 	dst->pixelformat = src->pixelformat;
 	for(j = 0; j < VIDEO_SOURCE_MAX_STRIDE; j++) {
 		dst->linesize[j] = src->linesize[j];
+		dst->planeoffset[j] = src->planeoffset[j];
 	}
 	dst->realwidth = src->realwidth;
 	dst->realheight = src->realheight;
 	dst->realstride = src->realstride;
 	dst->realsize = src->realsize;
-	bcopy(src->imgbuf, dst->imgbuf, src->realstride * src->realheight/*dst->imgbufsize*/);
+	vsource_copy_tilemap(dst, src);
+	// realsize covers all the planes, including the padding
+	bcopy(src->imgbuf, dst->imgbuf, src->realsize/*dst->imgbufsize*/);
+	return;
+}
+
+/* Tile hash: four independent 64-bit lanes (xxHash64 rounds),
+ * so that consecutive 32-byte stripes are hashed in parallel. */
+#define	TILE_PRIME1	0x9E3779B185EBCA87ULL
+#define	TILE_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define	TILE_ROTL(x, r)	(((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline unsigned long long
+tile_round(unsigned long long acc, unsigned long long input) {
+	acc += input * TILE_PRIME2;
+	acc = TILE_ROTL(acc, 31);
+	return acc * TILE_PRIME1;
+}
+
+static inline unsigned long long
+tile_load(const unsigned char *p) {
+	unsigned long long v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Hash \a rows rows of \a bytes bytes, starting from \a h */
+static unsigned long long
+tile_hash(const unsigned char *p, int stride, int bytes, int rows, unsigned long long h) {
+	unsigned long long v1 = h + TILE_PRIME1 + TILE_PRIME2;
+	unsigned long long v2 = h + TILE_PRIME2;
+	unsigned long long v3 = h;
+	unsigned long long v4 = h - TILE_PRIME1;
+	int x, y;
+	for(y = 0; y < rows; y++, p += stride) {
+		for(x = 0; x + 32 <= bytes; x += 32) {
+			v1 = tile_round(v1, tile_load(p + x));
+			v2 = tile_round(v2, tile_load(p + x + 8));
+			v3 = tile_round(v3, tile_load(p + x + 16));
+			v4 = tile_round(v4, tile_load(p + x + 24));
+		}
+		for(; x + 8 <= bytes; x += 8)
+			v1 = tile_round(v1, tile_load(p + x));
+		for(; x < bytes; x++)
+			v2 = tile_round(v2, p[x]);
+	}
+	h = TILE_ROTL(v1, 1) + TILE_ROTL(v2, 7) + TILE_ROTL(v3, 12) + TILE_ROTL(v4, 18);
+	h ^= h >> 33;
+	h *= TILE_PRIME2;
+	h ^= h >> 29;
+	return h;
+}
+
+/**
+ * Detect the changed tiles of a frame.
+ *
+ * @param tracker [in,out] The tracker, holding the tile hashes of the last frame.
+ * @param frame [in] The new frame, in RGBA, BGRA, or YUV420P format.
+ * @return The number of changed tiles, or -1 if the frame cannot be tracked.
+ *
+ * The frame is divided into tiles of \em VIDEO_SOURCE_TILE_SIZE pixels,
+ * and the hash of each tile is compared with the one of the last frame.
+ * The bitmap of changed tiles is stored in \a tracker->tilemap.
+ * All tiles are changed if the frame size or format is changed.
+ * Frames larger than \em VIDEO_SOURCE_MAX_TILES tiles are not tracked.
+ * Use vsource_set_tilemap() to attach the result to a frame.
+ */
+int
+vsource_detect_changes(vsource_tracker_t *tracker, const vsource_frame_t *frame) {
+	int cols, rows, tx, ty, i, bpp, reset = 0;
+	const unsigned char *plane[3];
+	int stride[3];
+	//
+	cols = (frame->realwidth + VIDEO_SOURCE_TILE_SIZE - 1) / VIDEO_SOURCE_TILE_SIZE;
+	rows = (frame->realheight + VIDEO_SOURCE_TILE_SIZE - 1) / VIDEO_SOURCE_TILE_SIZE;
+	if(cols * rows > VIDEO_SOURCE_MAX_TILES) {
+		tracker->tilecols = tracker->tilerows = 0;
+		return -1;
+	}
+	if(frame->pixelformat == PIX_FMT_RGBA || frame->pixelformat == PIX_FMT_BGRA) {
+		bpp = 4;
+		plane[0] = vsource_frame_imgbuf(frame);
+		stride[0] = frame->realstride;
+		// bottom-up image: tiles are in the top-down order
+		if(frame->linesize[0] < 0) {
+			plane[0] += (frame->realheight - 1) * frame->realstride;
+			stride[0] = -frame->realstride;
+		}
+	} else if(frame->pixelformat == PIX_FMT_YUV420P) {
+		bpp = 1;
+		for(i = 0; i < 3; i++) {
+			plane[i] = vsource_frame_plane(frame, i);
+			stride[i] = frame->linesize[i];
+		}
+	} else {
+		tracker->tilecols = tracker->tilerows = 0;
+		return -1;
+	}
+	//
+	if(tracker->width != frame->realwidth || tracker->height != frame->realheight
+	|| tracker->pixelformat != frame->pixelformat || tracker->tilecols == 0) {
+		tracker->width = frame->realwidth;
+		tracker->height = frame->realheight;
+		tracker->pixelformat = frame->pixelformat;
+		reset = 1;
+	}
+	tracker->tilecols = cols;
+	tracker->tilerows = rows;
+	tracker->changed = 0;
+	bzero(tracker->tilemap, (cols * rows + 7) / 8);
+	for(ty = 0, i = 0; ty < rows; ty++) {
+		int y = ty * VIDEO_SOURCE_TILE_SIZE;
+		int th = frame->realheight - y;
+		if(th > VIDEO_SOURCE_TILE_SIZE)
+			th = VIDEO_SOURCE_TILE_SIZE;
+		for(tx = 0; tx < cols; tx++, i++) {
+			int x = tx * VIDEO_SOURCE_TILE_SIZE;
+			int tw = frame->realwidth - x;
+			unsigned long long h;
+			if(tw > VIDEO_SOURCE_TILE_SIZE)
+				tw = VIDEO_SOURCE_TILE_SIZE;
+			if(bpp == 4) {
+				h = tile_hash(plane[0] + y * stride[0] + x * 4,
+					stride[0], tw * 4, th, 0);
+			} else {
+				h = tile_hash(plane[0] + y * stride[0] + x,
+					stride[0], tw, th, 0);
+				h = tile_hash(plane[1] + (y>>1) * stride[1] + (x>>1),
+					stride[1], (tw+1)>>1, (th+1)>>1, h);
+				h = tile_hash(plane[2] + (y>>1) * stride[2] + (x>>1),
+					stride[2], (tw+1)>>1, (th+1)>>1, h);
+			}
+			if(reset || h != tracker->hash[i]) {
+				tracker->tilemap[i>>3] |= (1 << (i & 7));
+				tracker->changed++;
+			}
+			tracker->hash[i] = h;
+		}
+	}
+	return tracker->changed;
+}
+
+/**
+ * Mark the tiles covered by changed rectangles of a frame.
+ *
+ * @param frame [in] The frame to be annotated, \a realwidth and \a realheight must be set.
+ * @param rects [in] Changed rectangles, in frame coordinates.
+ * @param nrects [in] Number of rectangles, or -1 if the changed region is unknown.
+ *
+ * This is used by video sources that know the changed region,
+ * e.g., from the window system, instead of vsource_detect_changes().
+ */
+void
+vsource_set_tilemap_rects(vsource_frame_t *frame, const struct gaRect *rects, int nrects) {
+	int i, tx, ty, cols, rows;
+	cols = (frame->realwidth + VIDEO_SOURCE_TILE_SIZE - 1) / VIDEO_SOURCE_TILE_SIZE;
+	rows = (frame->realheight + VIDEO_SOURCE_TILE_SIZE - 1) / VIDEO_SOURCE_TILE_SIZE;
+	if(nrects < 0 || cols * rows > VIDEO_SOURCE_MAX_TILES) {
+		frame->tilecols = frame->tilerows = 0;
+		frame->changed = 0;
+		return;
+	}
+	frame->tilecols = cols;
+	frame->tilerows = rows;
+	frame->changed = 0;
+	bzero(frame->tilemap, (cols * rows + 7) / 8);
+	for(i = 0; i < nrects; i++) {
+		int l = rects[i].left, t = rects[i].top;
+		int r = rects[i].right, b = rects[i].bottom;
+		if(l < 0)	l = 0;
+		if(t < 0)	t = 0;
+		if(r >= frame->realwidth)	r = frame->realwidth - 1;
+		if(b >= frame->realheight)	b = frame->realheight - 1;
+		if(l > r || t > b)
+			continue;
+		for(ty = t / VIDEO_SOURCE_TILE_SIZE; ty <= b / VIDEO_SOURCE_TILE_SIZE; ty++) {
+			for(tx = l / VIDEO_SOURCE_TILE_SIZE; tx <= r / VIDEO_SOURCE_TILE_SIZE; tx++) {
+				int j = ty * cols + tx;
+				if(frame->tilemap[j>>3] & (1 << (j & 7)))
+					continue;
+				frame->tilemap[j>>3] |= (1 << (j & 7));
+				frame->changed++;
+			}
+		}
+	}
+	return;
+}
+
+/**
+ * Copy the changed tiles of a frame to another frame.
+ *
+ * @param dst [in] The frame to be annotated.
+ * @param src [in] The frame annotated by its producer.
+ */
+void
+vsource_copy_tilemap(vsource_frame_t *dst, const vsource_frame_t *src) {
+	dst->tilecols = src->tilecols;
+	dst->tilerows = src->tilerows;
+	dst->changed = src->changed;
+	if(src->tilecols > 0)
+		bcopy(src->tilemap, dst->tilemap, (src->tilecols * src->tilerows + 7) / 8);
+	return;
+}
+
+/**
+ * Attach the changed tiles detected by a tracker to a frame.
+ *
+ * @param frame [in] The frame to be annotated.
+ * @param tracker [in] The tracker, or NULL to mark the changed tiles as unknown.
+ */
+void
+vsource_set_tilemap(vsource_frame_t *frame, const vsource_tracker_t *tracker) {
+	if(tracker == NULL || tracker->tilecols == 0) {
+		frame->tilecols = frame->tilerows = 0;
+		frame->changed = 0;
+		return;
+	}
+	frame->tilecols = tracker->tilecols;
+	frame->tilerows = tracker->tilerows;
+	frame->changed = tracker->changed;
+	bcopy(tracker->tilemap, frame->tilemap, (tracker->tilecols * tracker->tilerows + 7) / 8);
 	return;
 }
 
@@ -308,7 +660,8 @@ vsource_embed_yuv_code(vsource_frame_t *frame, unsigned int value) {
 	// save code-timestamp mapping
 	struct timeval ccodets;
 	if(savefp_ccodets != NULL) {
-		gettimeofday(&ccodets, NULL);
+		// wall-clock: compared against timestamps taken on the client
+		ga_clock_walltime(frame->timestamp, &ccodets);
 		ga_save_printf(savefp_ccodets, "COLORCODE-TIMESTAMP: %08u -> %u.%06u\n",
 			value, ccodets.tv_sec, ccodets.tv_usec);
 	}
@@ -356,9 +709,9 @@ vsource_embed_yuv_code(vsource_frame_t *frame, unsigned int value) {
 	//// fill color code line
 	height = frame->realheight < vsource_colorcode_height ?
 			frame->realheight : vsource_colorcode_height;
-	dstY = frame->imgbuf;
-	dstU = dstY + frame->linesize[0] * (frame->realheight);
-	dstV = dstU + frame->linesize[1] * (frame->realheight >> 1);
+	dstY = vsource_frame_plane(frame, 0);
+	dstU = vsource_frame_plane(frame, 1);
+	dstV = vsource_frame_plane(frame, 2);
 	//
 	for(i = 0; i < height; i++) {
 		bcopy(srcY, dstY, vsource_colorcode_total_width);
@@ -394,7 +747,8 @@ vsource_embed_rgba_code(vsource_frame_t *frame, unsigned int value, unsigned cha
 	// save code-timestamp mapping
 	struct timeval ccodets;
 	if(savefp_ccodets != NULL) {
-		gettimeofday(&ccodets, NULL);
+		// wall-clock: compared against timestamps taken on the client
+		ga_clock_walltime(frame->timestamp, &ccodets);
 		ga_save_printf(savefp_ccodets, "COLORCODE-TIMESTAMP: %u -> %u.%06u\n",
 			value, ccodets.tv_sec, ccodets.tv_usec);
 	}
@@ -496,18 +850,83 @@ video_source_channels() {
 	return gChannels;
 }
 
+/**
+ * Get the number of video channels a video source module should setup.
+ *
+ * @return The value of \em video-channels, or \em VIDEO_SOURCE_DEF_CHANNELS
+ *	if it is not set. The value is limited to \em VIDEO_SOURCE_CHANNEL_MAX.
+ *
+ * Channels other than channel 0 broadcast the captured frames of channel 0,
+ * so each of them can be encoded at its own output resolution and bitrate.
+ */
+int
+video_source_config_channels() {
+	int n = ga_conf_readint("video-channels");
+	if(n <= 0)
+		return VIDEO_SOURCE_DEF_CHANNELS;
+	if(n > VIDEO_SOURCE_CHANNEL_MAX) {
+		ga_error("video source: video-channels = %d exceeds the limit, %d channels used.\n",
+			n, VIDEO_SOURCE_CHANNEL_MAX);
+		return VIDEO_SOURCE_CHANNEL_MAX;
+	}
+	return n;
+}
+
 /**
  * Get the video source setup of a given channel.
  *
  * @param channel [in] The channel Id.
- * @return Pointer to the obtained video source info data structure.
+ * @return Pointer to the obtained video source info data structure,
+ *	or NULL if the channel has not been allocated.
  */
 vsource_t *
 video_source(int channel) {
-	if(channel < 0 || channel > gChannels) {
+#ifdef __GNUC__
+	if(channel < 0 || channel >= __atomic_load_n(&gChannelSlots, __ATOMIC_ACQUIRE)) {
+#else
+	if(channel < 0 || channel >= gChannelSlots) {
+#endif
 		return NULL;
 	}
-	return &gVsource[channel];
+	return gVsource[channel];
+}
+
+/**
+ * Allocate the states of channels up to \a channels.
+ * This is an internal function.
+ *
+ * @param channels [in] Number of channels.
+ * @return 0 on success, or -1 on error.
+ *
+ * The channel tables have \em VIDEO_SOURCE_CHANNEL_MAX entries and are
+ * never moved, so other threads may call \em video_source meanwhile.
+ * A channel is counted only after its state is allocated, and allocated
+ * channels are kept, so the pointers returned by \em video_source remain
+ * valid.
+ */
+static int
+video_source_alloc_channels(int channels) {
+	static pthread_mutex_t alloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+	int ret = 0;
+	//
+	if(channels > VIDEO_SOURCE_CHANNEL_MAX)
+		return -1;
+	pthread_mutex_lock(&alloc_mutex);
+	while(gChannelSlots < channels) {
+		if((gVsource[gChannelSlots] = (vsource_t *) calloc(1, sizeof(vsource_t))) == NULL) {
+			ret = -1;
+			break;
+		}
+		gPipe[gChannelSlots] = NULL;
+		// publish the channel after its state is set
+#ifdef __GNUC__
+		__atomic_store_n(&gChannelSlots, gChannelSlots + 1, __ATOMIC_RELEASE);
+#else
+		gChannelSlots++;
+#endif
+	}
+	pthread_mutex_unlock(&alloc_mutex);
+	return ret;
 }
 
 /**
@@ -669,6 +1088,69 @@ video_source_out_stride(int channel) {
 	return vs == NULL ? -1 : vs->out_stride;
 }
 
+/**
+ * Get the output resolution of a video source.
+ *
+ * @param channel [in] The channel id of the video source.
+ * @param width [out] The output width of the video source.
+ * @param height [out] The output height of the video source.
+ * @return 0 on success, or -1 on error.
+ *
+ * Width and height are read together, so the caller never sees
+ * half of a resolution change made by \em video_source_set_out_resolution.
+ */
+int
+video_source_out_resolution(int channel, int *width, int *height) {
+	vsource_t *vs = video_source(channel);
+	if(vs == NULL)
+		return -1;
+	pthread_mutex_lock(&gOutMutex);
+	*width = vs->out_width;
+	*height = vs->out_height;
+	pthread_mutex_unlock(&gOutMutex);
+	return 0;
+}
+
+/**
+ * Change the output resolution of a video source at runtime.
+ *
+ * @param channel [in] The channel id of the video source.
+ * @param width [in] The new output width.
+ * @param height [in] The new output height.
+ * @return 0 on success, or -1 if the resolution is not supported.
+ *
+ * Frame buffers are allocated for the maximum resolution, so the new
+ * resolution must be even and must not exceed \em max-resolution.
+ * The filter picks up the change at the next frame, and the encoder
+ * follows the size of the frames it receives.
+ */
+int
+video_source_set_out_resolution(int channel, int width, int height) {
+	vsource_t *vs = video_source(channel);
+	if(vs == NULL)
+		return -1;
+	if(width <= 0 || height <= 0 || (width & 1) != 0 || (height & 1) != 0
+	|| width > vs->max_width || height > vs->max_height) {
+		ga_error("video source: unsupported output resolution %dx%d (max %dx%d).\n",
+			width, height, vs->max_width, vs->max_height);
+		return -1;
+	}
+	pthread_mutex_lock(&gOutMutex);
+	vs->out_width = width;
+	vs->out_height = height;
+	vs->out_stride = width * 4;
+	pthread_mutex_unlock(&gOutMutex);
+	ga_error("video source: channel %d output resolution set to %dx%d.\n",
+		channel, width, height);
+	return 0;
+}
+
+/* Frame buffer size of a video source: padded planes plus the alignment */
+static int
+vsource_mem_size(vsource_t *vs) {
+	return VIDEO_SOURCE_PAD_HEIGHT(vs->max_height) * vs->max_stride + VIDEO_SOURCE_ALIGNMENT;
+}
+
 /**
   * Return the maximum memory size to store a frame (including size for alignment)
   *
@@ -678,12 +1160,25 @@ video_source_out_stride(int channel) {
 int
 video_source_mem_size(int channel) {
 	vsource_t *vs = video_source(channel);
-	return vs == NULL ? 0 : (vs->max_height * vs->max_stride + VSOURCE_ALIGNMENT);
+	return vs == NULL ? 0 : vsource_mem_size(vs);
 }
 
 /** Return the larger value of \a x and \a y */
 #define	max(x, y)	((x) > (y) ? (x) : (y))
 
+/* Frame buffer size of a captured frame at the current resolution */
+static int
+vsource_curr_frame_size(vsource_t *vs) {
+	int size = vsource_frame_size(PIX_FMT_RGBA, vs->curr_width, vs->curr_height);
+	// captured rows may be longer than the width
+	size = max(size, (int) sizeof(vsource_frame_t)
+		+ VIDEO_SOURCE_ALIGN(vs->curr_stride) * VIDEO_SOURCE_PAD_HEIGHT(vs->curr_height)
+		+ VIDEO_SOURCE_ALIGNMENT);
+	if(size > (int) sizeof(vsource_frame_t) + vsource_mem_size(vs))
+		size = sizeof(vsource_frame_t) + vsource_mem_size(vs);
+	return size;
+}
+
 /**
  * The generic function to setup video sources.
  *
@@ -698,19 +1193,28 @@ video_source_mem_size(int channel) {
  *   the configuratoin file.
  * - The pipeline name is automatically generated based on the index of
  *   each video configuration.
- * - The corresponding video pipeline is created as well.
+ * - The corresponding video pipeline is created as well. Its frames are
+ *   allocated on demand, sized for the current resolution.
+ * - If \em video-source-shm is enabled, the pipelines are created in
+ *   shared memory, to be attached by another process with
+ *   \em video_source_attach_shm.
  */
 int
 video_source_setup_ex(vsource_config_t *config, int nConfig) {
 	int idx;
 	int maxres[2] = { 0, 0 };
 	int outres[2] = { 0, 0 };
+	int shm = ga_conf_readbool("video-source-shm", 0);
 	//
 	if(config==NULL || nConfig <=0 || nConfig > VIDEO_SOURCE_CHANNEL_MAX) {
 		ga_error("video source: invalid video source configuration request=%d; MAX=%d; config=%p\n",
 			nConfig, VIDEO_SOURCE_CHANNEL_MAX, config);
 		return -1;
 	}
+	if(video_source_alloc_channels(nConfig) < 0) {
+		ga_error("video source: allocate %d channels failed.\n", nConfig);
+		return -1;
+	}
 	//
 	if(ga_conf_readints("max-resolution", maxres, 2) != 2) {
 		maxres[0] = maxres[1] = 0;
@@ -720,7 +1224,7 @@ video_source_setup_ex(vsource_config_t *config, int nConfig) {
 	}
 	//
 	for(idx = 0; idx < nConfig; idx++) {
-		vsource_t *vs = &gVsource[idx];
+		vsource_t *vs = gVsource[idx];
 		dpipe_buffer_t *data = NULL;
 		char pipename[64];
 		//
@@ -733,7 +1237,7 @@ video_source_setup_ex(vsource_config_t *config, int nConfig) {
 		}
 		vs->max_width   = max(VIDEO_SOURCE_DEF_MAXWIDTH, maxres[0]);
 		vs->max_height  = max(VIDEO_SOURCE_DEF_MAXHEIGHT, maxres[1]);
-		vs->max_stride  = max(VIDEO_SOURCE_DEF_MAXWIDTH, maxres[0]) * 4;
+		vs->max_stride  = VIDEO_SOURCE_ALIGN(max(VIDEO_SOURCE_DEF_MAXWIDTH, maxres[0]) * 4);
 		vs->curr_width  = config[idx].curr_width;
 		vs->curr_height = config[idx].curr_height;
 		vs->curr_stride = config[idx].curr_stride;
@@ -747,13 +1251,31 @@ video_source_setup_ex(vsource_config_t *config, int nConfig) {
 			vs->out_stride  = vs->curr_stride;
 		}
 		// create pipe
-		gPipe[idx] = dpipe_create(idx, pipename, VIDEO_SOURCE_POOLSIZE,
-				sizeof(vsource_frame_t) + vs->max_height * vs->max_stride + VSOURCE_ALIGNMENT);
+		if(shm) {
+			if(idx > 0 && config[idx].broadcast) {
+				ga_error("video source: broadcast channels cannot be shared with other processes.\n");
+				return -1;
+			}
+			gPipe[idx] = dpipe_create_shm(idx, pipename, VIDEO_SOURCE_POOLSIZE,
+				sizeof(vsource_frame_t) + vsource_mem_size(vs),
+				vs, sizeof(vsource_t));
+		} else if(idx > 0 && config[idx].broadcast) {
+			gPipe[idx] = dpipe_create_subscriber(idx, pipename, gPipe[0]);
+		} else {
+			// frames are allocated on demand, sized for the current resolution
+			gPipe[idx] = dpipe_create_lazy(idx, pipename, VIDEO_SOURCE_POOLSIZE,
+				sizeof(vsource_frame_t) + vsource_mem_size(vs), 0,
+				vsource_frame_init_buffer, NULL);
+			if(gPipe[idx] != NULL)
+				dpipe_set_framesize(gPipe[idx], vsource_curr_frame_size(vs));
+		}
 		if(gPipe[idx] == NULL) {
 			ga_error("video source: init pipeline failed.\n");
 			return -1;
 		}
-		for(data = gPipe[idx]->in; data != NULL; data = data->next) {
+		// subscribers share the frames of channel 0,
+		// and lazy frames are initialized by vsource_frame_init_buffer()
+		for(data = gPipe[idx]->in; gPipe[idx]->source == NULL && data != NULL; data = data->next) {
 			if(vsource_frame_init(idx, (vsource_frame_t*) data->pointer) == NULL) {
 				ga_error("video source: init faile failed.\n");
 				return -1;
@@ -770,6 +1292,58 @@ video_source_setup_ex(vsource_config_t *config, int nConfig) {
 	return 0;
 }
 
+/**
+ * Attach the video sources exported by another process.
+ *
+ * @return 0 on success, or -1 if no video source is available yet.
+ *
+ * This is the counterpart of \em video_source_setup_ex when
+ * \em video-source-shm is enabled in the capturing process.
+ * Each video channel pipe is attached from shared memory, and the
+ * video source setup is copied from the data published with the pipe.
+ * The frames can then be loaded from the video source pipes as usual,
+ * but only one process can load from a channel. The region is mapped at
+ * another address than in the capturing process, so the frame data must
+ * be accessed with \em vsource_frame_imgbuf or \em vsource_frame_plane.
+ */
+int
+video_source_attach_shm() {
+	int idx;
+	//
+	for(idx = gChannels; idx < VIDEO_SOURCE_CHANNEL_MAX; idx++) {
+		vsource_t *vs;
+		dpipe_t *pipe;
+		char pipename[64];
+		//
+		snprintf(pipename, sizeof(pipename), VIDEO_SOURCE_PIPEFORMAT, idx);
+		if((pipe = dpipe_attach_shm(idx, pipename)) == NULL)
+			break;
+		if(video_source_alloc_channels(idx+1) < 0) {
+			ga_error("video source: allocate channel %d failed.\n", idx);
+			dpipe_destroy(pipe);
+			break;
+		}
+		vs = gVsource[idx];
+		gPipe[idx] = pipe;
+		bcopy(dpipe_shm_userdata(gPipe[idx]), vs, sizeof(vsource_t));
+		// the pipename list is not valid in this process
+		vs->pipename = NULL;
+		if(video_source_add_pipename_internal(vs, pipename) == NULL) {
+			ga_error("video source: setup pipename failed (%s).\n", pipename);
+			dpipe_destroy(gPipe[idx]);
+			gPipe[idx] = NULL;
+			break;
+		}
+		ga_error("video-source: %s attached max-curr-out = (%dx%d)-(%dx%d)-(%dx%d)\n",
+			pipename, vs->max_width, vs->max_height,
+			vs->curr_width, vs->curr_height, vs->out_width, vs->out_height);
+	}
+	//
+	gChannels = idx;
+	//
+	return idx > 0 ? 0 : -1;
+}
+
 /**
  * Setup up a one-channel only video source
  *
@@ -40,12 +40,29 @@
 #define	VIDEO_SOURCE_DEF_MAXHEIGHT	1600
 /** Define the maximum number of video planes */
 #define	VIDEO_SOURCE_MAX_STRIDE		4
-/** Define the maximum number of video sources. This value must be at least 1 */
-#define	VIDEO_SOURCE_CHANNEL_MAX	2
+/** Define the upper limit of video channels. The states of a channel
+ * are allocated only when the channel is set up, see \em video-channels */
+#define	VIDEO_SOURCE_CHANNEL_MAX	16
+/** Define the default number of video channels */
+#define	VIDEO_SOURCE_DEF_CHANNELS	1
 /** Define the default video source pipe name format */
 #define	VIDEO_SOURCE_PIPEFORMAT		"video-%d"
 /** Define the default video source pipe pool size (frames in the pipe) */
 #define	VIDEO_SOURCE_POOLSIZE		8
+/** Define the width and height of a tile for change detection */
+#define	VIDEO_SOURCE_TILE_SIZE		64
+/** Define the maximum number of tiles of a frame: 4096x4096 with 64x64 tiles */
+#define	VIDEO_SOURCE_MAX_TILES		4096
+/** Define the alignment of frame buffers, planes, and linesizes (in bytes).
+ * 64 bytes is a cache line, and the width of an AVX-512 register. */
+#define	VIDEO_SOURCE_ALIGNMENT		64
+/** Define the number of rows that planes are padded to: a macroblock row,
+ * so encoders and SIMD kernels can read whole blocks past the last row */
+#define	VIDEO_SOURCE_PAD_ROWS		16
+/** Round \a x up to a multiple of \em VIDEO_SOURCE_ALIGNMENT */
+#define	VIDEO_SOURCE_ALIGN(x)		(((x) + VIDEO_SOURCE_ALIGNMENT - 1) & ~(VIDEO_SOURCE_ALIGNMENT - 1))
+/** Round the height \a h up to a multiple of \em VIDEO_SOURCE_PAD_ROWS */
+#define	VIDEO_SOURCE_PAD_HEIGHT(h)	(((h) + VIDEO_SOURCE_PAD_ROWS - 1) & ~(VIDEO_SOURCE_PAD_ROWS - 1))
 
 /**
  * Data structure to store a video frame in RGBA or YUV420 format.
@@ -60,26 +77,55 @@ typedef struct vsource_frame_s {
 				 * RGBA, BGRA, or YUV420P
 				 * Note: current use values defined in ffmpeg */
 	int linesize[VIDEO_SOURCE_MAX_STRIDE];	/**< strides
-				 * for each video plane (YUV420P only). */
+				 * for each video plane (YUV420P only).
+				 * For RGBA and BGRA frames, a negative
+				 * \a linesize[0] indicates that the rows
+				 * are stored bottom-up in \a imgbuf. */
+	int planeoffset[VIDEO_SOURCE_MAX_STRIDE];	/**< Offset of
+				 * each video plane from \a imgbuf,
+				 * see vsource_frame_plane() */
 	int realwidth;		/**< Actual width of the video frame */
 	int realheight;		/**< Actual height of the video frame */
 	int realstride;		/**< stride for RGBA and BGRA video frame */
 	int realsize;		/**< Total size of the video frame data */
-	struct timeval timestamp;	/**< Captured timestamp */
+	long long timestamp;	/**< Captured time on the GA clock, in nanoseconds */
+	// change detection, see vsource_detect_changes()
+	int tilecols;		/**< Number of tile columns in \a tilemap,
+				 * or 0 if the changed tiles are unknown */
+	int tilerows;		/**< Number of tile rows in \a tilemap */
+	int changed;		/**< Number of changed tiles */
+	unsigned char tilemap[VIDEO_SOURCE_MAX_TILES/8];	/**< Bitmap of
+				 * changed tiles of the captured frame,
+				 * in row-major order */
 	// internal data - should not change after initialized
 	int maxstride;		/**< */
 	int imgbufsize;		/**< Allocated video frame buffer size */
-	unsigned char *imgbuf;	/**< Pointer to the video frame buffer */
+	unsigned char *imgbuf;	/**< Pointer to the video frame buffer.
+				 * Consumers use vsource_frame_imgbuf(), which
+				 * is also valid in another process. */
 	unsigned char *imgbuf_internal;	/**< Internal pointer
 				 * for buffer allocation.
 				 * This is used to ensure that \a imgbuf
-				 * is started at an aligned address
-				 * XXX: NOT USED NOW. */
+				 * is started at an aligned address */
 	int alignment;		/**< \a imgbuf alignment value.
-				 * \a imgbuf = \a imgbuf_internal + \a alignment.
-				 * XXX: NOT USED NOW. */
+				 * \a imgbuf = \a imgbuf_internal + \a alignment. */
 }	vsource_frame_t;
 
+/**
+ * Data structure to detect changed tiles between consecutive frames.
+ * Initialize it with zeros, then call vsource_detect_changes() for each frame.
+ */
+typedef struct vsource_tracker_s {
+	int width;		/**< Width of the last frame */
+	int height;		/**< Height of the last frame */
+	PixelFormat pixelformat;/**< Pixel format of the last frame */
+	int tilecols;		/**< Number of tile columns, or 0 if the frame is not tracked */
+	int tilerows;		/**< Number of tile rows */
+	int changed;		/**< Number of changed tiles of the last frame */
+	unsigned long long hash[VIDEO_SOURCE_MAX_TILES];	/**< Tile hashes of the last frame */
+	unsigned char tilemap[VIDEO_SOURCE_MAX_TILES/8];	/**< Bitmap of changed tiles */
+}	vsource_tracker_t;
+
 /**
  * Data structure to setup a video configuration.
  */
@@ -90,6 +136,9 @@ typedef struct vsource_config_s {
 				 * should be the value of height * 4,
 				 * because the captured video should be
 				 * in RGBA or BGRA format */
+	int broadcast;		/**< Non-zero if the channel shares the
+				 * captured frames of channel 0 by reference,
+				 * instead of being fed by its own producer */
 }	vsource_config_t;
 
 /**
@@ -123,14 +172,24 @@ typedef struct vsource_s {
 }	vsource_t;
 
 EXPORT vsource_frame_t * vsource_frame_init(int channel, vsource_frame_t *frame);
+EXPORT int vsource_frame_init_buffer(dpipe_t *dpipe, dpipe_buffer_t *buffer, void *arg);
+EXPORT int vsource_frame_size(PixelFormat format, int width, int height);
 EXPORT void vsource_frame_release(vsource_frame_t *frame);
+EXPORT int vsource_frame_layout(vsource_frame_t *frame, PixelFormat format, int width, int height);
+EXPORT unsigned char * vsource_frame_imgbuf(const vsource_frame_t *frame);
+EXPORT unsigned char * vsource_frame_plane(const vsource_frame_t *frame, int plane);
 EXPORT void vsource_dup_frame(vsource_frame_t *src, vsource_frame_t *dst);
+EXPORT int vsource_detect_changes(vsource_tracker_t *tracker, const vsource_frame_t *frame);
+EXPORT void vsource_set_tilemap(vsource_frame_t *frame, const vsource_tracker_t *tracker);
+EXPORT void vsource_set_tilemap_rects(vsource_frame_t *frame, const struct gaRect *rects, int nrects);
+EXPORT void vsource_copy_tilemap(vsource_frame_t *dst, const vsource_frame_t *src);
 EXPORT int vsource_embed_colorcode_init(int RGBmode);
 EXPORT void vsource_embed_colorcode_reset();
 EXPORT void vsource_embed_colorcode_inc(vsource_frame_t *frame);
 EXPORT void vsource_embed_colorcode(vsource_frame_t *frame, unsigned int value);
 
 EXPORT int video_source_channels();
+EXPORT int video_source_config_channels();
 EXPORT vsource_t * video_source(int channel);
 EXPORT const char *video_source_add_pipename(int channel, const char *pipename);
 EXPORT const char *video_source_get_pipename(int channel);
@@ -144,9 +203,12 @@ EXPORT int video_source_curr_stride(int channel);
 EXPORT int video_source_out_width(int channel);
 EXPORT int video_source_out_height(int channel);
 EXPORT int video_source_out_stride(int channel);
+EXPORT int video_source_out_resolution(int channel, int *width, int *height);
+EXPORT int video_source_set_out_resolution(int channel, int width, int height);
 EXPORT int video_source_mem_size(int channel);
 
 EXPORT int video_source_setup_ex(vsource_config_t *config, int nConfig);
 EXPORT int video_source_setup(int curr_width, int curr_height, int curr_stride);
+EXPORT int video_source_attach_shm();
 
 #endif
@@ -75,13 +75,16 @@ aencoder_deinit(void *arg) {
 static int
 aencoder_init(void *arg) {
 	struct RTSPConf *rtspconf = rtspconf_global();
-	rtp_id = video_source_channels();
 	if(aencoder_initialized != 0)
 		return 0;
 	if(rtspconf == NULL) {
 		ga_error("audio encoder: no valid global configuration available.\n");
 		return -1;
 	}
+	if((rtp_id = encoder_audio_channel()) < 0) {
+		ga_error("audio encoder: audio is disabled.\n");
+		return -1;
+	}
 	// no duplicated initialization
 	if(encoder != NULL) {
 		ga_error("audio encoder: has been initialized.\n");
@@ -208,12 +211,8 @@ aencoder_threadproc(void *arg) {
 	unsigned char *samples = NULL;
 	int nsamples, samplebytes, maxsamples, samplesize;
 	int offset;
-	// for a/v sync
-#ifdef WIN32
-	LARGE_INTEGER baseT, currT, freq;
-#else
-	struct timeval baseT, currT;
-#endif
+	// for a/v sync: GA clock, in nanoseconds
+	long long baseT, currT, captured;
 	long long pts = -1LL, newpts = 0LL, ptsOffset = 0LL, ptsSync = 0LL;
 	//
 	audio_buffer_t *ab = NULL;
@@ -255,10 +254,7 @@ aencoder_threadproc(void *arg) {
 		audio_source_chunksize(),	//audio->chunk_size
 		audio_source_chunkbytes(),	//audio->chunk_bytes
 		encoder->delay);
-	//
-#ifdef WIN32
-	QueryPerformanceFrequency(&freq);
-#endif
+	encoder_pts_clear(rtp_id);
 	//
 	while(aencoder_started != 0 && encoder_running() > 0) {
 		//
@@ -272,25 +268,20 @@ aencoder_threadproc(void *arg) {
 			usleep(1000);
 			continue;
 		}
-#ifdef WIN32
-		QueryPerformanceCounter(&currT);
-#else
-		gettimeofday(&currT, NULL);
-#endif
+		currT = ga_clock_ns();
 		if(pts == -1LL) {
 			baseT = currT;
 			ptsSync = encoder_pts_sync(rtspconf->audio_samplerate);
 			pts = newpts = ptsSync;
 			ptsOffset = r;
 		} else {
-#ifdef WIN32
-			newpts = ptsSync + pcdiff_us(currT, baseT, freq) * rtspconf->audio_samplerate / 1000000LL;
-#else
-			newpts = ptsSync + tvdiff_us(&currT, &baseT) * rtspconf->audio_samplerate / 1000000LL;
-#endif
+			newpts = ptsSync + (currT - baseT) / 1000LL * rtspconf->audio_samplerate / 1000000LL;
 			newpts -= r;
 			newpts -= ptsOffset;
 		}
+		// capture time of the first sample just read
+		encoder_pts_put(rtp_id, newpts,
+			currT - r * GA_NSEC_PER_SEC / rtspconf->audio_samplerate);
 		//
 		if(newpts > pts) {
 			pts = newpts;
@@ -353,11 +344,14 @@ aencoder_threadproc(void *arg) {
 			if(snd_in->extended_data && snd_in->extended_data != snd_in->data)
 				av_freep(snd_in->extended_data);
 			pkt->stream_index = 0;
+			// capture time of the frame, interpolated from sample positions
+			if((captured = encoder_pts_get(rtp_id, pkt->pts, rtspconf->audio_samplerate)) < 0)
+				captured = 0;
 			// send the packet
 			if(encoder_send_packet("audio-encoder",
-				rtp_id/*rtspconf->audio_id*/, pkt,
+				rtp_id, pkt,
 				/*encoder->coded_frame->*/pkt->pts == AV_NOPTS_VALUE ? pts : /*encoder->coded_frame->*/pkt->pts,
-				NULL) < 0) {
+				captured) < 0) {
 				goto audio_quit;
 			}
 			//
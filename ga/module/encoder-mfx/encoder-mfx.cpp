@@ -142,7 +142,7 @@ mfx_threadproc(void *arg) {
 	unsigned char startcode[] = { 0, 0, 0, 1 };
 	unsigned long long timeunit;
 	unsigned long long lastTimeStamp = (unsigned long long) -1LL;
-	struct timeval pkttv;
+	long long pkttime = 0;
 	//
 	int video_written = 0;
 	//
@@ -238,7 +238,7 @@ mfx_threadproc(void *arg) {
 		if(RGBmode == 0) {
 			// YUV420P
 			mfxU8 *dst;
-			unsigned char *src = frame->imgbuf;
+			unsigned char *src = vsource_frame_imgbuf(frame);
 			int i, w2 = outputW>>1, h2 = outputH>>1, p2 = svppin->Data.Pitch/2;
 			// copy the frame
 			if(svppin->Data.Pitch < frame->linesize[0]
@@ -257,12 +257,14 @@ mfx_threadproc(void *arg) {
 				src += frame->linesize[0]; 
 			}
 			// Copy U
+			src = vsource_frame_plane(frame, 1);
 			for(dst = svppin->Data.U, i = 0; i < h2; i++) {
 				memcpy(dst, src, w2);
 				dst += p2;
 				src += frame->linesize[1];
 			}
 			// Copy V
+			src = vsource_frame_plane(frame, 2);
 			for(dst = svppin->Data.V, i = 0; i < h2; i++) {
 				memcpy(dst, src, w2);
 				dst += p2;
@@ -271,7 +273,7 @@ mfx_threadproc(void *arg) {
 		} else {
 			// RGB
 			mfxU8 *dst;
-			unsigned char *src = frame->imgbuf;
+			unsigned char *src = vsource_frame_imgbuf(frame);
 			int i;
 			// copy the frame
 			if(svppin->Data.Pitch < frame->linesize[0]) {
@@ -327,7 +329,7 @@ mfx_threadproc(void *arg) {
 		MFXVideoCORE_SyncOperation(_session[cid], encsync, MFX_INFINITE);
 		if(_mfxbs[cid].TimeStamp != lastTimeStamp) {
 			lastTimeStamp = _mfxbs[cid].TimeStamp;
-			gettimeofday(&pkttv, NULL);
+			pkttime = ga_clock_ns();
 		}
 #ifdef SAVEENC
 		if(fsaveenc != NULL)
@@ -356,7 +358,7 @@ mfx_threadproc(void *arg) {
 				pkt.size = nextptr != NULL ?
 						(nextptr - ptr) :
 						(_mfxbs[cid].Data+_mfxbs[cid].DataOffset+_mfxbs[cid].DataLength-ptr);
-				if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, &pkttv) < 0) {
+				if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, pkttime) < 0) {
 					goto video_quit;
 				}
 				ptr = nextptr;
@@ -367,7 +369,7 @@ mfx_threadproc(void *arg) {
 			av_init_packet(&pkt);
 			pkt.data = ptr;
 			pkt.size = _mfxbs[cid].Data+_mfxbs[cid].DataOffset+_mfxbs[cid].DataLength-ptr;
-			if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, &pkttv) < 0) {
+			if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, pkttime) < 0) {
 				goto video_quit;
 			}
 			video_written = 1;
@@ -377,7 +379,7 @@ mfx_threadproc(void *arg) {
 		if(_mfxbs[cid].Data) {
 			pkt.data = _mfxbs[cid].Data + _mfxbs[cid].DataOffset;
 			pkt.size = _mfxbs[cid].DataLength;
-			if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, &pkttv) < 0) {
+			if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, pkttime) < 0) {
 				goto video_quit;
 			}
 		}
@@ -29,6 +29,8 @@
 
 #include "dpipe.h"
 
+#include <libavutil/opt.h>
+
 //// Prevent use of GLOBAL_HEADER to pass parameters, disabled by default
 //#define STANDALONE_SDP	1
 
@@ -36,48 +38,63 @@ static struct RTSPConf *rtspconf = NULL;
 
 static int vencoder_initialized = 0;
 static int vencoder_started = 0;
-static pthread_t vencoder_tid[VIDEO_SOURCE_CHANNEL_MAX];
-//// encoders for encoding
-static AVCodecContext *vencoder[VIDEO_SOURCE_CHANNEL_MAX];
+// packet queue backpressure
+static pthread_mutex_t vencoder_bp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int vencoder_bp_ratio = 50;	/**< Bitrate in percent when congested */
+
+/* Per-channel state, allocated for the video channels in use */
+typedef struct vencoder_channel_s {
+	pthread_t tid;
+	dpipe_t *pipe;
+	int bp_events;		/**< Pending events: bitmask of 1<<state, guarded by vencoder_bp_mutex */
+	int64_t bp_bitrate;	/**< Bitrate before congestion, or 0 */
+	int64_t bp_maxrate;	/**< rc_max_rate before congestion */
+	//// encoder for encoding
+	AVCodecContext *encoder;
 #ifdef STANDALONE_SDP
-//// encoders for generating SDP
-/* separate encoder and encoder_sdp because some ffmpeg codecs
- * only generate ctx->extradata when CODEC_FLAG_GLOBAL_HEADER flag
- * is set */
-static AVCodecContext *vencoder_sdp[VIDEO_SOURCE_CHANNEL_MAX];
+	//// encoder for generating SDP
+	/* separate encoder and encoder_sdp because some ffmpeg codecs
+	 * only generate ctx->extradata when CODEC_FLAG_GLOBAL_HEADER flag
+	 * is set */
+	AVCodecContext *encoder_sdp;
 #endif
+	// specific data for h.264/h.265
+	char *sps;
+	int spslen;
+	char *pps;
+	int ppslen;
+	char *vps;
+	int vpslen;
+	char pipename[64];	/**< Pipe name passed to the thread */
+}	vencoder_channel_t;
+
+static vencoder_channel_t *vchannel = NULL;
 
-// specific data for h.264/h.265
-static char *_sps[VIDEO_SOURCE_CHANNEL_MAX];
-static int _spslen[VIDEO_SOURCE_CHANNEL_MAX];
-static char *_pps[VIDEO_SOURCE_CHANNEL_MAX];
-static int _ppslen[VIDEO_SOURCE_CHANNEL_MAX];
-static char *_vps[VIDEO_SOURCE_CHANNEL_MAX];
-static int _vpslen[VIDEO_SOURCE_CHANNEL_MAX];
+/* Check if a channel id refers to an allocated channel */
+static int
+vencoder_valid_id(int iid) {
+	return vchannel != NULL && iid >= 0 && iid < video_source_channels();
+}
 
 static int
 vencoder_deinit(void *arg) {
 	int iid;
-	for(iid = 0; iid < video_source_channels(); iid++) {
-		if(_sps[iid] != NULL)
-			free(_sps[iid]);
-		if(_pps[iid] != NULL)
-			free(_pps[iid]);
+	for(iid = 0; vchannel != NULL && iid < video_source_channels(); iid++) {
+		if(vchannel[iid].sps != NULL)
+			free(vchannel[iid].sps);
+		if(vchannel[iid].pps != NULL)
+			free(vchannel[iid].pps);
+		if(vchannel[iid].vps != NULL)
+			free(vchannel[iid].vps);
 #ifdef STANDALONE_SDP
-		if(vencoder_sdp[iid] != NULL)
-			ga_avcodec_close(vencoder_sdp[iid]);
+		if(vchannel[iid].encoder_sdp != NULL)
+			ga_avcodec_close(vchannel[iid].encoder_sdp);
 #endif
-		if(vencoder[iid] != NULL)
-			ga_avcodec_close(vencoder[iid]);
-#ifdef STANDALONE_SDP
-		vencoder_sdp[iid] = NULL;
-#endif
-		vencoder[iid] = NULL;
+		if(vchannel[iid].encoder != NULL)
+			ga_avcodec_close(vchannel[iid].encoder);
 	}
-	bzero(_sps, sizeof(_sps));
-	bzero(_pps, sizeof(_pps));
-	bzero(_spslen, sizeof(_spslen));
-	bzero(_ppslen, sizeof(_ppslen));
+	free(vchannel);
+	vchannel = NULL;
 	vencoder_initialized = 0;
 	ga_error("video encoder: deinitialized.\n");
 	return 0;
@@ -96,13 +113,20 @@ vencoder_init(void *arg) {
 	if(vencoder_initialized != 0)
 		return 0;
 	//
+	if((vchannel = (vencoder_channel_t*) calloc(video_source_channels(), sizeof(vencoder_channel_t))) == NULL) {
+		ga_error("video encoder: allocate %d channels failed.\n", video_source_channels());
+		return -1;
+	}
+	if((vencoder_bp_ratio = ga_conf_readint("encoder-backpressure-bitrate")) <= 0
+	|| vencoder_bp_ratio > 100)
+		vencoder_bp_ratio = 50;
 	for(iid = 0; iid < video_source_channels(); iid++) {
 		char pipename[64];
 		int outputW, outputH;
 		dpipe_t *pipe;
 		//
-		_sps[iid] = _pps[iid] = NULL;
-		_spslen[iid] = _ppslen[iid] = 0;
+		vchannel[iid].sps = vchannel[iid].pps = NULL;
+		vchannel[iid].spslen = vchannel[iid].ppslen = 0;
 		snprintf(pipename, sizeof(pipename), pipefmt, iid);
 		outputW = video_source_out_width(iid);
 		outputH = video_source_out_height(iid);
@@ -110,14 +134,18 @@ vencoder_init(void *arg) {
 			ga_error("video encoder: pipe %s is not found\n", pipename);
 			goto init_failed;
 		}
+		vchannel[iid].pipe = pipe;
 		ga_error("video encoder: video source #%d from '%s' (%dx%d).\n",
 			iid, pipe->name, outputW, outputH, iid);
-		vencoder[iid] = ga_avcodec_vencoder_init(NULL,
+		vchannel[iid].encoder = ga_avcodec_vencoder_init(NULL,
 				rtspconf->video_encoder_codec,
 				outputW, outputH,
 				rtspconf->video_fps, rtspconf->vso);
-		if(vencoder[iid] == NULL)
+		if(vchannel[iid].encoder == NULL)
 			goto init_failed;
+		// an I frame requested after a drop must be an IDR frame,
+		// ignored by codecs without the option
+		av_opt_set_int(vchannel[iid].encoder, "forced-idr", 1, AV_OPT_SEARCH_CHILDREN);
 #ifdef STANDALONE_SDP
 		// encoders for SDP generation
 		switch(rtspconf->video_encoder_codec->id) {
@@ -142,7 +170,7 @@ vencoder_init(void *arg) {
 			// do nothing
 			break;
 		}
-		vencoder_sdp[iid] = avc;
+		vchannel[iid].encoder_sdp = avc;
 #endif
 	}
 	vencoder_initialized = 1;
@@ -153,26 +181,59 @@ init_failed:
 	return -1;
 }
 
+/**
+ * Adjust the bitrate for packet queue backpressure events.
+ *
+ * @param iid [in] The channel id.
+ * @param events [in] The pending events, bitmask of 1<<state.
+ *
+ * The bitrate is lowered while the packet queue is congested,
+ * and restored when the queue is drained. libavcodec applies the new
+ * rate at the next frame for encoders supporting it, e.g., libx264.
+ */
+static void
+vencoder_backpressure_bitrate(int iid, int events) {
+	AVCodecContext *encoder = vchannel[iid].encoder;
+	//
+	if((events & (1<<GA_BACKPRESSURE_CONGESTED))
+	&& vchannel[iid].bp_bitrate == 0 && encoder->bit_rate > 0) {
+		vchannel[iid].bp_bitrate = encoder->bit_rate;
+		vchannel[iid].bp_maxrate = encoder->rc_max_rate;
+		encoder->bit_rate = encoder->bit_rate * vencoder_bp_ratio / 100;
+		encoder->rc_max_rate = encoder->rc_max_rate * vencoder_bp_ratio / 100;
+		ga_error("video encoder: backpressure - bitrate %d/%dKbps.\n",
+			(int) (encoder->bit_rate / 1000), (int) (encoder->rc_max_rate / 1000));
+	}
+	if((events & (1<<GA_BACKPRESSURE_NORMAL)) && vchannel[iid].bp_bitrate > 0) {
+		encoder->bit_rate = vchannel[iid].bp_bitrate;
+		encoder->rc_max_rate = vchannel[iid].bp_maxrate;
+		vchannel[iid].bp_bitrate = 0;
+		ga_error("video encoder: backpressure - bitrate restored to %d/%dKbps.\n",
+			(int) (encoder->bit_rate / 1000), (int) (encoder->rc_max_rate / 1000));
+	}
+	return;
+}
+
 static void *
 vencoder_threadproc(void *arg) {
 	// arg is pointer to source pipename
-	int iid, outputW, outputH;
+	int i, j, iid, outputW, outputH;
 	vsource_frame_t *frame = NULL;
 	char *pipename = (char*) arg;
 	dpipe_t *pipe = dpipe_lookup(pipename);
 	dpipe_buffer_t *data = NULL;
 	AVCodecContext *encoder = NULL;
+	char policy[16];
 	//
 	AVFrame *pic_in = NULL;
 	unsigned char *pic_in_buf = NULL;
 	int pic_in_size;
-	unsigned char *nalbuf = NULL, *nalbuf_a = NULL;
-	int nalbuf_size = 0, nalign = 0;
 	long long basePts = -1LL, newpts = 0LL, pts = -1LL, ptsSync = 0LL;
 	pthread_mutex_t condMutex = PTHREAD_MUTEX_INITIALIZER;
 	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 	//
 	int video_written = 0;
+	int events;
 	//
 	if(pipe == NULL) {
 		ga_error("video encoder: invalid pipeline specified (%s).\n", pipename);
@@ -182,20 +243,18 @@ vencoder_threadproc(void *arg) {
 	rtspconf = rtspconf_global();
 	// init variables
 	iid = pipe->channel_id;
-	encoder = vencoder[iid];
+	encoder = vchannel[iid].encoder;
+	// frame drop policy: do not queue stale frames if encoding falls behind
+	if(ga_conf_readv("encoder-pipe-policy", policy, sizeof(policy)) != NULL
+	&& dpipe_set_policy(pipe, (dpipe_policy_t) dpipe_policy_byname(policy)) < 0) {
+		ga_error("video encoder: unknown pipe policy '%s', ignored.\n", policy);
+	}
 	//
 	outputW = video_source_out_width(iid);
 	outputH = video_source_out_height(iid);
 	//
 	encoder_pts_clear(iid);
 	//
-	nalbuf_size = 100000+12 * outputW * outputH;
-	if(ga_malloc(nalbuf_size, (void**) &nalbuf, &nalign) < 0) {
-		ga_error("video encoder: buffer allocation failed, terminated.\n");
-		goto video_quit;
-	}
-	nalbuf_a = nalbuf + nalign;
-	//
 	if((pic_in = av_frame_alloc()) == NULL) {
 		ga_error("video encoder: picture allocation failed, terminated.\n");
 		goto video_quit;
@@ -209,23 +268,32 @@ vencoder_threadproc(void *arg) {
 			PIX_FMT_YUV420P, outputW, outputH);
 	//ga_error("video encoder: linesize = %d|%d|%d\n", pic_in->linesize[0], pic_in->linesize[1], pic_in->linesize[2]);
 	// start encoding
-	ga_error("video encoding started: tid=%ld %dx%d@%dfps, nalbuf_size=%d, pic_in_size=%d.\n",
+	ga_error("video encoding started: tid=%ld %dx%d@%dfps, pic_in_size=%d.\n",
 		ga_gettid(),
 		outputW, outputH, rtspconf->video_fps,
-		nalbuf_size, pic_in_size);
+		pic_in_size);
 	//
 	while(vencoder_started != 0 && encoder_running() > 0) {
 		AVPacket pkt;
 		int got_packet = 0;
-		// wait for notification
-		struct timeval tv;
-		struct timespec to;
-		gettimeofday(&tv, NULL);
-		to.tv_sec = tv.tv_sec+1;
-		to.tv_nsec = tv.tv_usec * 1000;
-		data = dpipe_load(pipe, &to);
-		if(data == NULL) {
-			ga_error("viedo encoder: image source timed out.\n");
+		long long captured;
+		// packet queue backpressure
+		pthread_mutex_lock(&vencoder_bp_mutex);
+		events = vchannel[iid].bp_events;
+		vchannel[iid].bp_events = 0;
+		pthread_mutex_unlock(&vencoder_bp_mutex);
+		if(events != 0)
+			vencoder_backpressure_bitrate(iid, events);
+		// the packet queue dropped a reference frame: send an IDR frame,
+		// see the forced-idr option set in vencoder_init()
+		if(events & (1<<GA_BACKPRESSURE_DROPPED))
+			pic_in->pict_type = AV_PICTURE_TYPE_I;
+		// wait for notification, or a wakeup from stop
+		if((data = dpipe_load(pipe, NULL)) == NULL)
+			continue;
+		// congested: give the sinks a frame interval to drain the queue
+		if(events & (1<<GA_BACKPRESSURE_CONGESTED)) {
+			dpipe_put(pipe, data);
 			continue;
 		}
 		frame = (vsource_frame_t*) data->pointer;
@@ -238,18 +306,19 @@ vencoder_threadproc(void *arg) {
 			newpts = ptsSync + frame->imgpts - basePts;
 		}
 		// XXX: assume always YUV420P
-		if(pic_in->linesize[0] == frame->linesize[0]
-		&& pic_in->linesize[1] == frame->linesize[1]
-		&& pic_in->linesize[2] == frame->linesize[2]) {
-			bcopy(frame->imgbuf, pic_in_buf, pic_in_size);
-		} else {
-			ga_error("video encoder: YUV mode failed - mismatched linesize(s) (src:%d,%d,%d; dst:%d,%d,%d)\n",
-				frame->linesize[0], frame->linesize[1], frame->linesize[2],
-				pic_in->linesize[0], pic_in->linesize[1], pic_in->linesize[2]);
-			dpipe_put(pipe, data);
-			goto video_quit;
+		// the frame rows are padded, so copy row by row
+		for(i = 0; i < 3; i++) {
+			unsigned char *src = vsource_frame_plane(frame, i);
+			unsigned char *dst = pic_in->data[i];
+			int w = i == 0 ? outputW : (outputW>>1);
+			int h = i == 0 ? outputH : (outputH>>1);
+			for(j = 0; j < h; j++) {
+				bcopy(src, dst, w);
+				src += frame->linesize[i];
+				dst += pic_in->linesize[i];
+			}
 		}
-		tv = frame->timestamp;
+		captured = frame->timestamp;
 		dpipe_put(pipe, data);
 		// pts must be monotonically increasing
 		if(newpts > pts) {
@@ -258,15 +327,18 @@ vencoder_threadproc(void *arg) {
 			pts++;
 		}
 		// encode
-		encoder_pts_put(iid, pts, &tv);
+		encoder_pts_put(iid, pts, captured);
 		pic_in->pts = pts;
+		// let the encoder allocate a refcounted packet,
+		// which is queued by reference in encoder_pktqueue_append()
 		av_init_packet(&pkt);
-		pkt.data = nalbuf_a;
-		pkt.size = nalbuf_size;
+		pkt.data = NULL;
+		pkt.size = 0;
 		if(avcodec_encode_video2(encoder, &pkt, pic_in, &got_packet) < 0) {
 			ga_error("video encoder: encode failed, terminated.\n");
 			goto video_quit;
 		}
+		pic_in->pict_type = AV_PICTURE_TYPE_NONE;
 		if(got_packet) {
 			if(pkt.pts == (int64_t) AV_NOPTS_VALUE) {
 				pkt.pts = pts;
@@ -287,27 +359,22 @@ vencoder_threadproc(void *arg) {
 			} while(0);
 #endif
 			//
+			// capture time of the frame, or 0 for the current time
 			if(pkt.pts != AV_NOPTS_VALUE) {
-				if(encoder_ptv_get(iid, pkt.pts, &tv, 0) == NULL) {
-					gettimeofday(&tv, NULL);
-				}
+				if((captured = encoder_pts_get(iid, pkt.pts, 0)) < 0)
+					captured = 0;
 			} else {
-				gettimeofday(&tv, NULL);
+				captured = 0;
 			}
 			// send the packet
 			if(encoder_send_packet("video-encoder",
 				iid/*rtspconf->video_id*/, &pkt,
-				pkt.pts, &tv) < 0) {
+				pkt.pts, captured) < 0) {
+				av_free_packet(&pkt);
 				goto video_quit;
 			}
-			// free unused side-data
-			if(pkt.side_data_elems > 0) {
-				int i;
-				for (i = 0; i < pkt.side_data_elems; i++)
-					av_free(pkt.side_data[i].data);
-				av_freep(&pkt.side_data);
-				pkt.side_data_elems = 0;
-			}
+			// release the data and side-data: the sink keeps its own reference
+			av_free_packet(&pkt);
 			//
 			if(video_written == 0) {
 				video_written = 1;
@@ -323,7 +390,6 @@ video_quit:
 	//
 	if(pic_in_buf)	av_free(pic_in_buf);
 	if(pic_in)	av_free(pic_in);
-	if(nalbuf)	free(nalbuf);
 	//
 	ga_error("video encoder: thread terminated (tid=%ld).\n", ga_gettid());
 	//
@@ -334,14 +400,17 @@ static int
 vencoder_start(void *arg) {
 	int iid;
 	char *pipefmt = (char*) arg;
-#define	MAXPARAMLEN	64
-	static char pipename[VIDEO_SOURCE_CHANNEL_MAX][MAXPARAMLEN];
 	if(vencoder_started != 0)
 		return 0;
+	if(vencoder_initialized == 0)
+		return -1;
 	vencoder_started = 1;
+	// one thread for each channel
 	for(iid = 0; iid < video_source_channels(); iid++) {
-		snprintf(pipename[iid], MAXPARAMLEN, pipefmt, iid);
-		if(pthread_create(&vencoder_tid[iid], NULL, vencoder_threadproc, pipename[iid]) != 0) {
+		snprintf(vchannel[iid].pipename, sizeof(vchannel[iid].pipename), pipefmt, iid);
+		// known before the thread runs, so that vencoder_stop() can wake it up
+		vchannel[iid].pipe = dpipe_lookup(vchannel[iid].pipename);
+		if(pthread_create(&vchannel[iid].tid, NULL, vencoder_threadproc, vchannel[iid].pipename) != 0) {
 			vencoder_started = 0;
 			ga_error("video encoder: create thread failed.\n");
 			return -1;
@@ -359,7 +428,8 @@ vencoder_stop(void *arg) {
 		return 0;
 	vencoder_started = 0;
 	for(iid = 0; iid < video_source_channels(); iid++) {
-		pthread_join(vencoder_tid[iid], &ignored);
+		dpipe_wakeup(vchannel[iid].pipe);
+		pthread_join(vchannel[iid].tid, &ignored);
 	}
 	ga_error("video encdoer: all stopped (%d)\n", iid);
 	return 0;
@@ -375,11 +445,11 @@ vencoder_raw(void *arg, int *size) {
 #else
 	int iid = (int) arg;
 #endif
-	if(vencoder_initialized == 0)
+	if(vencoder_initialized == 0 || vencoder_valid_id(iid) == 0)
 		return NULL;
 	if(size)
-		*size = sizeof(vencoder[iid]);
-	return vencoder[iid];
+		*size = sizeof(vchannel[iid].encoder);
+	return vchannel[iid].encoder;
 }
 
 /* find startcode: XXX: only 00 00 00 01 - a simplified version */
@@ -402,7 +472,7 @@ h264or5_get_vparam(int type, int channelId, unsigned char *data, int datalen) {
 	unsigned char *r;
 	unsigned char *sps = NULL, *pps = NULL, *vps = NULL;
 	int spslen = 0, ppslen = 0, vpslen = 0;
-	if(_sps[channelId] != NULL)
+	if(vchannel[channelId].sps != NULL)
 		return 0;
 	r = find_startcode(data, data + datalen);
 	while(r < data + datalen) {
@@ -442,67 +512,85 @@ h264or5_get_vparam(int type, int channelId, unsigned char *data, int datalen) {
 	}
 	if(sps != NULL && pps != NULL) {
 		// alloc and copy SPS
-		if((_sps[channelId] = (char*) malloc(spslen)) == NULL)
+		if((vchannel[channelId].sps = (char*) malloc(spslen)) == NULL)
 			goto error_get_h264or5_vparam;
-		_spslen[channelId] = spslen;
-		bcopy(sps, _sps[channelId], spslen);
+		vchannel[channelId].spslen = spslen;
+		bcopy(sps, vchannel[channelId].sps, spslen);
 		// alloc and copy PPS
-		if((_pps[channelId] = (char*) malloc(ppslen)) == NULL) {
+		if((vchannel[channelId].pps = (char*) malloc(ppslen)) == NULL) {
 			goto error_get_h264or5_vparam;
 		}
-		_ppslen[channelId] = ppslen;
-		bcopy(pps, _pps[channelId], ppslen);
+		vchannel[channelId].ppslen = ppslen;
+		bcopy(pps, vchannel[channelId].pps, ppslen);
 		// alloc and copy VPS
 		if(vps != NULL) {
-			if((_vps[channelId] = (char*) malloc(vpslen)) == NULL) {
+			if((vchannel[channelId].vps = (char*) malloc(vpslen)) == NULL) {
 				goto error_get_h264or5_vparam;
 			}
-			_vpslen[channelId] = vpslen;
-			bcopy(vps, _vps[channelId], vpslen);
+			vchannel[channelId].vpslen = vpslen;
+			bcopy(vps, vchannel[channelId].vps, vpslen);
 		}
 		//
 		if(type == 265) {
 			if(vps == NULL)
 				goto error_get_h264or5_vparam;
 			ga_error("video encoder: h.265/found sps@%d(%d); pps@%d(%d); vps@%d(%d)\n",
-				sps-data, _spslen[channelId],
-				pps-data, _ppslen[channelId],
-				vps-data, _vpslen[channelId]);
+				sps-data, vchannel[channelId].spslen,
+				pps-data, vchannel[channelId].ppslen,
+				vps-data, vchannel[channelId].vpslen);
 		} else {
 			ga_error("video encoder: h.264/found sps@%d(%d); pps@%d(%d)\n",
-				sps-data, _spslen[channelId],
-				pps-data, _ppslen[channelId]);
+				sps-data, vchannel[channelId].spslen,
+				pps-data, vchannel[channelId].ppslen);
 		}
 		//
 		ret = 0;
 	}
 	return ret;
 error_get_h264or5_vparam:
-	if(_sps[channelId])	free(_sps[channelId]);
-	if(_pps[channelId])	free(_pps[channelId]);
-	if(_vps[channelId])	free(_vps[channelId]);
-	_sps[channelId]    = _pps[channelId]    = _vps[channelId]    = NULL;
-	_spslen[channelId] = _ppslen[channelId] = _vpslen[channelId] = 0;
+	if(vchannel[channelId].sps)	free(vchannel[channelId].sps);
+	if(vchannel[channelId].pps)	free(vchannel[channelId].pps);
+	if(vchannel[channelId].vps)	free(vchannel[channelId].vps);
+	vchannel[channelId].sps    = vchannel[channelId].pps    = vchannel[channelId].vps    = NULL;
+	vchannel[channelId].spslen = vchannel[channelId].ppslen = vchannel[channelId].vpslen = 0;
 	return -1;
 }
 
 static AVCodecContext *
 vencoder_opt_get_encoder(int cid) {
 	AVCodecContext *ve = NULL;
-	if(vencoder_initialized == 0)
+	if(vencoder_initialized == 0 || vencoder_valid_id(cid) == 0)
 		return NULL;
 #ifdef STANDALONE_SDP
-	ve = vencoder_sdp[cid] ? vencoder_sdp[cid] : vencoder[cid];
+	ve = vchannel[cid].encoder_sdp ? vchannel[cid].encoder_sdp : vchannel[cid].encoder;
 #else
-	ve = vencoder[cid];
+	ve = vchannel[cid].encoder;
 #endif
 	return ve;
 }
 
+static int
+vencoder_backpressure(ga_ioctl_backpressure_t *bp) {
+	if(vencoder_valid_id(bp->id) == 0)
+		return GA_IOCTL_ERR_BADID;
+	if(bp->state < GA_BACKPRESSURE_NORMAL || bp->state > GA_BACKPRESSURE_DROPPED)
+		return GA_IOCTL_ERR_INVALID_ARGUMENT;
+	pthread_mutex_lock(&vencoder_bp_mutex);
+	// congested and normal cancel each other
+	if(bp->state == GA_BACKPRESSURE_CONGESTED)
+		vchannel[bp->id].bp_events &= ~(1<<GA_BACKPRESSURE_NORMAL);
+	if(bp->state == GA_BACKPRESSURE_NORMAL)
+		vchannel[bp->id].bp_events &= ~(1<<GA_BACKPRESSURE_CONGESTED);
+	vchannel[bp->id].bp_events |= (1<<bp->state);
+	pthread_mutex_unlock(&vencoder_bp_mutex);
+	return 0;
+}
+
 static int
 vencoder_ioctl(int command, int argsize, void *arg) {
 	int ret = 0;
 	ga_ioctl_buffer_t *buf = (ga_ioctl_buffer_t*) arg;
+	ga_ioctl_reconfigure_t *reconf = NULL;
 	AVCodecContext *ve = NULL;
 	//
 	switch(command) {
@@ -524,22 +612,42 @@ vencoder_ioctl(int command, int argsize, void *arg) {
 			return GA_IOCTL_ERR_NOTFOUND;
 		}
 		if(command == GA_IOCTL_GETSPS) {
-			if(buf->size < _spslen[buf->id])
+			if(buf->size < vchannel[buf->id].spslen)
 				return GA_IOCTL_ERR_BUFFERSIZE;
-			buf->size = _spslen[buf->id];
-			bcopy(_sps[buf->id], buf->ptr, buf->size);
+			buf->size = vchannel[buf->id].spslen;
+			bcopy(vchannel[buf->id].sps, buf->ptr, buf->size);
 		} else if(command == GA_IOCTL_GETPPS) {
-			if(buf->size < _ppslen[buf->id])
+			if(buf->size < vchannel[buf->id].ppslen)
 				return GA_IOCTL_ERR_BUFFERSIZE;
-			buf->size = _ppslen[buf->id];
-			bcopy(_pps[buf->id], buf->ptr, buf->size);
+			buf->size = vchannel[buf->id].ppslen;
+			bcopy(vchannel[buf->id].pps, buf->ptr, buf->size);
 		} else if(command == GA_IOCTL_GETVPS) {
-			if(buf->size < _vpslen[buf->id])
+			if(buf->size < vchannel[buf->id].vpslen)
 				return GA_IOCTL_ERR_BUFFERSIZE;
-			buf->size = _vpslen[buf->id];
-			bcopy(_vps[buf->id], buf->ptr, buf->size);
+			buf->size = vchannel[buf->id].vpslen;
+			bcopy(vchannel[buf->id].vps, buf->ptr, buf->size);
 		}
 		break;
+	case GA_IOCTL_BACKPRESSURE:
+		if(argsize != sizeof(ga_ioctl_backpressure_t))
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		ret = vencoder_backpressure((ga_ioctl_backpressure_t*) arg);
+		break;
+	case GA_IOCTL_RECONFIGURE:
+		reconf = (ga_ioctl_reconfigure_t*) arg;
+		if(argsize != sizeof(ga_ioctl_reconfigure_t))
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		if(vencoder_valid_id(reconf->id) == 0)
+			return GA_IOCTL_ERR_BADID;
+		// the avcodec encoder is opened once: a new resolution needs a restart
+		if((reconf->width > 0 && reconf->width != video_source_out_width(reconf->id))
+		|| (reconf->height > 0 && reconf->height != video_source_out_height(reconf->id))) {
+			ga_error("video encoder: reconfigure to %dx%d not supported.\n",
+				reconf->width, reconf->height);
+			return GA_IOCTL_ERR_NOTSUPPORTED;
+		}
+		ret = GA_IOCTL_ERR_NOTSUPPORTED;
+		break;
 	default:
 		ret = GA_IOCTL_ERR_NOTSUPPORTED;
 		break;
@@ -17,6 +17,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "vsource.h"
 #include "encoder-common.h"
@@ -111,6 +112,25 @@ init_failed:
 	return -1;
 }
 
+/* The VPU reads compact YUV420P frames: remove the padding of the rows */
+static unsigned char *
+vpu_compact_frame(vsource_frame_t *frame, unsigned char *buf, int width, int height) {
+	int i, j;
+	unsigned char *src, *dst = buf;
+	//
+	for(i = 0; i < 3; i++) {
+		int w = i == 0 ? width : (width>>1);
+		int h = i == 0 ? height : (height>>1);
+		src = vsource_frame_plane(frame, i);
+		for(j = 0; j < h; j++) {
+			bcopy(src, dst, w);
+			src += frame->linesize[i];
+			dst += w;
+		}
+	}
+	return buf;
+}
+
 /// TODO
 static void *
 vencoder_threadproc(void *arg) {
@@ -127,11 +147,9 @@ vencoder_threadproc(void *arg) {
 	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 	//
 	int outputW, outputH;
+	unsigned char *framebuf = NULL;
 	//
-	struct timeval pkttv;
-#ifdef PRINT_LATENCY
-	struct timeval ptv;
-#endif
+	long long pkttime;
 	//
 	int video_written = 0;
 	//
@@ -144,6 +162,10 @@ vencoder_threadproc(void *arg) {
 	cid = pipe->channel_id;
 	outputW = video_source_out_width(cid);
 	outputH = video_source_out_height(cid);
+	if((framebuf = (unsigned char*) malloc(vpu[cid].vpu_framesize)) == NULL) {
+		ga_error("video encoder: alloc frame buffer failed.\n");
+		goto video_quit;
+	}
 	//
 	// start encoding
 	ga_error("video encoding started: tid=%ld.\n", ga_gettid());
@@ -174,8 +196,10 @@ vencoder_threadproc(void *arg) {
 			newpts = ptsSync + frame->imgpts - basePts;
 		}
 		// encode!
-		gettimeofday(&pkttv, NULL);
-		enc = vpu_encoder_encode(&vpu[cid], frame->imgbuf, vpu[cid].vpu_framesize, &encsize);
+		pkttime = frame->timestamp;
+		enc = vpu_encoder_encode(&vpu[cid],
+			vpu_compact_frame(frame, framebuf, outputW, outputH),
+			vpu[cid].vpu_framesize, &encsize);
 		//
 		dpipe_put(pipe, data);
 		//
@@ -196,7 +220,7 @@ vencoder_threadproc(void *arg) {
 #endif
 		pkt.data = enc;
 		pkt.size = encsize;
-		if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, &pkttv) < 0) {
+		if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, pkttime) < 0) {
 			goto video_quit;
 		}
 		if(video_written == 0) {
@@ -204,8 +228,7 @@ vencoder_threadproc(void *arg) {
 			ga_error("first video frame written (pts=%lld)\n", pts);
 		}
 #ifdef PRINT_LATENCY		/* print out latency */
-		gettimeofday(&ptv, NULL);
-		ga_aggregated_print(0x0001, 601, tvdiff_us(&ptv, &frame->timestamp));
+		ga_aggregated_print(0x0001, 601, (ga_clock_ns() - pkttime) / 1000LL);
 #endif
 	}
 	//
@@ -213,6 +236,10 @@ video_quit:
 	if(pipe) {
 		pipe = NULL;
 	}
+	if(framebuf) {
+		free(framebuf);
+		framebuf = NULL;
+	}
 	//
 	ga_error("video encoder: thread terminated (tid=%ld).\n", ga_gettid());
 	//
@@ -41,17 +41,35 @@ static struct RTSPConf *rtspconf = NULL;
 
 static int vencoder_initialized = 0;
 static int vencoder_started = 0;
-static pthread_t vencoder_tid[VIDEO_SOURCE_CHANNEL_MAX];
-static pthread_mutex_t vencoder_reconf_mutex[VIDEO_SOURCE_CHANNEL_MAX];
-static ga_ioctl_reconfigure_t vencoder_reconf[VIDEO_SOURCE_CHANNEL_MAX];
-//// encoders for encoding
-static x264_t* vencoder[VIDEO_SOURCE_CHANNEL_MAX];
+static int vencoder_bp_ratio = 50;	/**< Bitrate in percent when congested */
 
-// specific data for h.264
-static char *_sps[VIDEO_SOURCE_CHANNEL_MAX];
-static int _spslen[VIDEO_SOURCE_CHANNEL_MAX];
-static char *_pps[VIDEO_SOURCE_CHANNEL_MAX];
-static int _ppslen[VIDEO_SOURCE_CHANNEL_MAX];
+/* Per-channel state, allocated for the video channels in use */
+typedef struct vencoder_channel_s {
+	pthread_t tid;
+	dpipe_t *pipe;
+	pthread_mutex_t reconf_mutex;
+	ga_ioctl_reconfigure_t reconf;
+	// packet queue backpressure, also guarded by reconf_mutex
+	int bp_events;		/**< Pending events: bitmask of 1<<state */
+	int bp_bitrate;		/**< Bitrate before congestion, or 0 */
+	int bp_maxrate;		/**< vbv-maxrate before congestion */
+	//// encoder for encoding
+	x264_t *encoder;
+	// specific data for h.264
+	char *sps;
+	int spslen;
+	char *pps;
+	int ppslen;
+	char pipename[64];	/**< Pipe name passed to the thread */
+}	vencoder_channel_t;
+
+static vencoder_channel_t *vchannel = NULL;
+
+/* Check if a channel id refers to an allocated channel */
+static int
+vencoder_valid_id(int iid) {
+	return vchannel != NULL && iid >= 0 && iid < video_source_channels();
+}
 
 //#define	SAVEENC	"save.264"
 #ifdef SAVEENC
@@ -67,20 +85,17 @@ vencoder_deinit(void *arg) {
 		fsaveenc = NULL;
 	}
 #endif
-	for(iid = 0; iid < video_source_channels(); iid++) {
-		if(_sps[iid] != NULL)
-			free(_sps[iid]);
-		if(_pps[iid] != NULL)
-			free(_pps[iid]);
-		if(vencoder[iid] != NULL)
-			x264_encoder_close(vencoder[iid]);
-		pthread_mutex_destroy(&vencoder_reconf_mutex[iid]);
-		vencoder[iid] = NULL;
+	for(iid = 0; vchannel != NULL && iid < video_source_channels(); iid++) {
+		if(vchannel[iid].sps != NULL)
+			free(vchannel[iid].sps);
+		if(vchannel[iid].pps != NULL)
+			free(vchannel[iid].pps);
+		if(vchannel[iid].encoder != NULL)
+			x264_encoder_close(vchannel[iid].encoder);
+		pthread_mutex_destroy(&vchannel[iid].reconf_mutex);
 	}
-	bzero(_sps, sizeof(_sps));
-	bzero(_pps, sizeof(_pps));
-	bzero(_spslen, sizeof(_spslen));
-	bzero(_ppslen, sizeof(_ppslen));
+	free(vchannel);
+	vchannel = NULL;
 	vencoder_initialized = 0;
 	ga_error("video encoder: deinitialized.\n");
 	return 0;
@@ -110,16 +125,26 @@ vencoder_init(void *arg) {
 	if(vencoder_initialized != 0)
 		return 0;
 	//
+	if((vencoder_bp_ratio = ga_conf_readint("encoder-backpressure-bitrate")) <= 0
+	|| vencoder_bp_ratio > 100)
+		vencoder_bp_ratio = 50;
+	//
+	if((vchannel = (vencoder_channel_t*) calloc(video_source_channels(), sizeof(vencoder_channel_t))) == NULL) {
+		ga_error("video encoder: allocate %d channels failed.\n", video_source_channels());
+		return -1;
+	}
 	for(iid = 0; iid < video_source_channels(); iid++) {
 		char pipename[64];
 		int outputW, outputH;
 		dpipe_t *pipe;
 		x264_param_t params;
 		//
-		_sps[iid] = _pps[iid] = NULL;
-		_spslen[iid] = _ppslen[iid] = 0;
-		pthread_mutex_init(&vencoder_reconf_mutex[iid], NULL);
-		vencoder_reconf[iid].id = -1;
+		vchannel[iid].sps = vchannel[iid].pps = NULL;
+		vchannel[iid].spslen = vchannel[iid].ppslen = 0;
+		pthread_mutex_init(&vchannel[iid].reconf_mutex, NULL);
+		vchannel[iid].reconf.id = -1;
+		vchannel[iid].bp_events = 0;
+		vchannel[iid].bp_bitrate = 0;
 		//
 		snprintf(pipename, sizeof(pipename), pipefmt, iid);
 		outputW = video_source_out_width(iid);
@@ -132,6 +157,7 @@ vencoder_init(void *arg) {
 			ga_error("video encoder: pipe %s is not found\n", pipename);
 			goto init_failed;
 		}
+		vchannel[iid].pipe = pipe;
 		ga_error("video encoder: video source #%d from '%s' (%dx%d).\n",
 			iid, pipe->name, outputW, outputH, iid);
 		//
@@ -209,8 +235,8 @@ vencoder_init(void *arg) {
 			}
 		}
 		//
-		vencoder[iid] = x264_encoder_open(&params);
-		if(vencoder[iid] == NULL)
+		vchannel[iid].encoder = x264_encoder_open(&params);
+		if(vchannel[iid].encoder == NULL)
 			goto init_failed;
 		ga_error("video encoder: opened! bitrate=%dKbps; me_method=%d; me_range=%d; refs=%d; g=%d; intra-refresh=%d; width=%d; height=%d; crop=%d,%d,%d,%d; threads=%d; slices=%d; repeat-hdr=%d; annexb=%d\n",
 			params.rc.i_bitrate,
@@ -239,11 +265,11 @@ static int
 vencoder_reconfigure(int iid) {
 	int ret = 0;
 	x264_param_t params;
-	x264_t *encoder = vencoder[iid];
-	ga_ioctl_reconfigure_t *reconf = &vencoder_reconf[iid];
+	x264_t *encoder = vchannel[iid].encoder;
+	ga_ioctl_reconfigure_t *reconf = &vchannel[iid].reconf;
 	//
-	pthread_mutex_lock(&vencoder_reconf_mutex[iid]);
-	if(vencoder_reconf[iid].id >= 0) {
+	pthread_mutex_lock(&vchannel[iid].reconf_mutex);
+	if(vchannel[iid].reconf.id >= 0) {
 		int doit = 0;
 		x264_encoder_parameters(encoder, &params);
 		//
@@ -286,10 +312,110 @@ vencoder_reconfigure(int iid) {
 		}
 		reconf->id = -1;
 	}
-	pthread_mutex_unlock(&vencoder_reconf_mutex[iid]);
+	pthread_mutex_unlock(&vchannel[iid].reconf_mutex);
 	return ret;
 }
 
+/**
+ * Reopen the encoder of a channel for a new output resolution.
+ *
+ * @param iid [in] The channel id.
+ * @param width [in] The new width.
+ * @param height [in] The new height.
+ * @return The new encoder, or NULL on error. The old encoder is kept on error.
+ *
+ * x264 cannot change the resolution with x264_encoder_reconfig, so a new
+ * encoder is opened with the current parameters. Its first frame is an IDR
+ * frame with in-band SPS/PPS, so the RTSP sessions are not interrupted.
+ * The cached SPS/PPS are dropped and refetched for new sessions.
+ * Frames still delayed in the old encoder are discarded: there are none
+ * with bframes=0 and tune=zerolatency.
+ */
+static x264_t *
+vencoder_resize(int iid, int width, int height) {
+	x264_param_t params;
+	x264_t *encoder, *oldencoder = vchannel[iid].encoder;
+	long long t0 = ga_clock_ns();
+	//
+	x264_encoder_parameters(oldencoder, &params);
+	params.i_width = width;
+	params.i_height = height;
+	if((encoder = x264_encoder_open(&params)) == NULL) {
+		ga_error("video encoder: reopen for %dx%d failed.\n", width, height);
+		return NULL;
+	}
+	// sps/pps are fetched by the sinks under the same lock
+	pthread_mutex_lock(&vchannel[iid].reconf_mutex);
+	vchannel[iid].encoder = encoder;
+	if(vchannel[iid].sps != NULL)
+		free(vchannel[iid].sps);
+	if(vchannel[iid].pps != NULL)
+		free(vchannel[iid].pps);
+	vchannel[iid].sps = vchannel[iid].pps = NULL;
+	vchannel[iid].spslen = vchannel[iid].ppslen = 0;
+	pthread_mutex_unlock(&vchannel[iid].reconf_mutex);
+	x264_encoder_close(oldencoder);
+	ga_error("video encoder: resolution changed to %dx%d in %.3f ms.\n",
+		width, height, 0.000001 * (ga_clock_ns() - t0));
+	return encoder;
+}
+
+/**
+ * Handle packet queue backpressure events.
+ *
+ * @param iid [in] The channel id.
+ * @param forceidr [out] Set to 1 if the next frame must be an IDR frame.
+ * @return Number of input frames to be skipped.
+ *
+ * The bitrate is lowered while the packet queue is congested,
+ * and restored when the queue is drained.
+ */
+static int
+vencoder_backpressure(int iid, int *forceidr) {
+	x264_param_t params;
+	x264_t *encoder = vchannel[iid].encoder;
+	int events, skip = 0;
+	//
+	pthread_mutex_lock(&vchannel[iid].reconf_mutex);
+	events = vchannel[iid].bp_events;
+	vchannel[iid].bp_events = 0;
+	pthread_mutex_unlock(&vchannel[iid].reconf_mutex);
+	if(events == 0)
+		return 0;
+	//
+	x264_encoder_parameters(encoder, &params);
+	if((events & (1<<GA_BACKPRESSURE_CONGESTED))
+	&& vchannel[iid].bp_bitrate == 0 && params.rc.i_bitrate > 0) {
+		vchannel[iid].bp_bitrate = params.rc.i_bitrate;
+		vchannel[iid].bp_maxrate = params.rc.i_vbv_max_bitrate;
+		params.rc.i_bitrate = params.rc.i_bitrate * vencoder_bp_ratio / 100;
+		params.rc.i_vbv_max_bitrate = params.rc.i_vbv_max_bitrate * vencoder_bp_ratio / 100;
+		if(x264_encoder_reconfig(encoder, &params) < 0) {
+			ga_error("video encoder: backpressure - lower bitrate failed.\n");
+		} else {
+			ga_error("video encoder: backpressure - bitrate %d/%dKbps.\n",
+				params.rc.i_bitrate, params.rc.i_vbv_max_bitrate);
+		}
+	}
+	if((events & (1<<GA_BACKPRESSURE_NORMAL)) && vchannel[iid].bp_bitrate > 0) {
+		params.rc.i_bitrate = vchannel[iid].bp_bitrate;
+		params.rc.i_vbv_max_bitrate = vchannel[iid].bp_maxrate;
+		vchannel[iid].bp_bitrate = 0;
+		if(x264_encoder_reconfig(encoder, &params) < 0) {
+			ga_error("video encoder: backpressure - restore bitrate failed.\n");
+		} else {
+			ga_error("video encoder: backpressure - bitrate restored to %d/%dKbps.\n",
+				params.rc.i_bitrate, params.rc.i_vbv_max_bitrate);
+		}
+	}
+	// give the sinks a frame interval to drain the queue
+	if(events & (1<<GA_BACKPRESSURE_CONGESTED))
+		skip = 1;
+	if(events & (1<<GA_BACKPRESSURE_DROPPED))
+		*forceidr = 1;
+	return skip;
+}
+
 static void *
 vencoder_threadproc(void *arg) {
 	// arg is pointer to source pipename
@@ -299,15 +425,21 @@ vencoder_threadproc(void *arg) {
 	dpipe_t *pipe = dpipe_lookup(pipename);
 	dpipe_buffer_t *data = NULL;
 	x264_t *encoder = NULL;
+	char policy[16];
 	//
 	long long basePts = -1LL, newpts = 0LL, pts = -1LL, ptsSync = 0LL;
 	pthread_mutex_t condMutex = PTHREAD_MUTEX_INITIALIZER;
 	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 	//
+	// encoded frames are queued by reference, see encoder_pktqueue_append()
+	AVBufferPool *pktpool = NULL;
+	AVBufferRef *pktref = NULL;
 	unsigned char *pktbuf = NULL;
 	int pktbufsize = 0, pktbufmax = 0;
 	int video_written = 0;
 	int64_t x264_pts = 0;
+	long long captured;
+	int skipframes = 0, forceidr = 0;
 	//
 	if(pipe == NULL) {
 		ga_error("video encoder: invalid pipeline specified (%s).\n", pipename);
@@ -317,15 +449,21 @@ vencoder_threadproc(void *arg) {
 	rtspconf = rtspconf_global();
 	// init variables
 	iid = pipe->channel_id;
-	encoder = vencoder[iid];
+	encoder = vchannel[iid].encoder;
+	// frame drop policy: do not queue stale frames if encoding falls behind
+	if(ga_conf_readv("encoder-pipe-policy", policy, sizeof(policy)) != NULL
+	&& dpipe_set_policy(pipe, (dpipe_policy_t) dpipe_policy_byname(policy)) < 0) {
+		ga_error("video encoder: unknown pipe policy '%s', ignored.\n", policy);
+	}
 	//
 	outputW = video_source_out_width(iid);
 	outputH = video_source_out_height(iid);
 	pktbufmax = outputW * outputH * 2;
-	if((pktbuf = (unsigned char*) malloc(pktbufmax)) == NULL) {
+	if((pktpool = av_buffer_pool_init(pktbufmax, NULL)) == NULL) {
 		ga_error("video encoder: allocate memory failed.\n");
 		goto video_quit;
 	}
+	encoder_pts_clear(iid);
 	// start encoding
 	ga_error("video encoding started: tid=%ld %dx%d@%dfps.\n",
 		ga_gettid(),
@@ -335,20 +473,40 @@ vencoder_threadproc(void *arg) {
 		x264_picture_t pic_in, pic_out = {0};
 		x264_nal_t *nal;
 		int i, size, nnal;
-		struct timeval tv;
-		struct timespec to;
-		gettimeofday(&tv, NULL);
 		// need reconfigure?
 		vencoder_reconfigure(iid);
-		// wait for notification
-		to.tv_sec = tv.tv_sec+1;
-		to.tv_nsec = tv.tv_usec * 1000;
-		data = dpipe_load(pipe, &to);
-		if(data == NULL) {
-			ga_error("viedo encoder: image source timed out.\n");
+		skipframes += vencoder_backpressure(iid, &forceidr);
+		// wait for notification, or a wakeup from stop/reconfigure
+		if((data = dpipe_load(pipe, NULL)) == NULL)
+			continue;
+		if(skipframes > 0) {
+			skipframes--;
+			dpipe_put(pipe, data);
 			continue;
 		}
 		frame = (vsource_frame_t*) data->pointer;
+		// the filter has switched to a new output resolution
+		if(frame->realwidth != outputW || frame->realheight != outputH) {
+			if(vencoder_resize(iid, frame->realwidth, frame->realheight) == NULL) {
+				// roll back, the filter returns to the old resolution
+				video_source_set_out_resolution(iid, outputW, outputH);
+				dpipe_put(pipe, data);
+				continue;
+			}
+			encoder = vchannel[iid].encoder;
+			outputW = frame->realwidth;
+			outputH = frame->realheight;
+			// released buffers of the old pool are freed by their holders
+			if(outputW * outputH * 2 > pktbufmax) {
+				pktbufmax = outputW * outputH * 2;
+				av_buffer_pool_uninit(&pktpool);
+				if((pktpool = av_buffer_pool_init(pktbufmax, NULL)) == NULL) {
+					ga_error("video encoder: allocate memory failed.\n");
+					dpipe_put(pipe, data);
+					goto video_quit;
+				}
+			}
+		}
 		// handle pts
 		if(basePts == -1LL) {
 			basePts = frame->imgpts;
@@ -359,15 +517,20 @@ vencoder_threadproc(void *arg) {
 		}
 		//
 		x264_picture_init(&pic_in);
+		// the packet queue dropped a reference frame
+		if(forceidr) {
+			pic_in.i_type = X264_TYPE_IDR;
+			forceidr = 0;
+		}
 		//
 		pic_in.img.i_csp = X264_CSP_I420;
 		pic_in.img.i_plane = 3;
 		pic_in.img.i_stride[0] = frame->linesize[0];
 		pic_in.img.i_stride[1] = frame->linesize[1];
 		pic_in.img.i_stride[2] = frame->linesize[2];
-		pic_in.img.plane[0] = frame->imgbuf;
-		pic_in.img.plane[1] = pic_in.img.plane[0] + outputW*outputH;
-		pic_in.img.plane[2] = pic_in.img.plane[1] + ((outputW * outputH) >> 2);
+		pic_in.img.plane[0] = vsource_frame_plane(frame, 0);
+		pic_in.img.plane[1] = vsource_frame_plane(frame, 1);
+		pic_in.img.plane[2] = vsource_frame_plane(frame, 2);
 		// pts must be monotonically increasing
 		if(newpts > pts) {
 			pts = newpts;
@@ -376,6 +539,7 @@ vencoder_threadproc(void *arg) {
 		}
 		//pic_in.i_pts = pts;
 		pic_in.i_pts = x264_pts++;
+		encoder_pts_put(iid, pic_in.i_pts, frame->timestamp);
 		// encode
 		if((size = x264_encoder_encode(encoder, &nal, &nnal, &pic_in, &pic_out)) < 0) {
 			ga_error("video encoder: encode failed, err = %d\n", size);
@@ -386,11 +550,19 @@ vencoder_threadproc(void *arg) {
 		// encode
 		if(size > 0) {
 			AVPacket pkt;
+			// capture time of the encoded frame, or 0 for the current time
+			if((captured = encoder_pts_get(iid, pic_out.i_pts, 0)) < 0)
+				captured = 0;
 #if 1
 			av_init_packet(&pkt);
 			pkt.pts = pic_in.i_pts;
 			pkt.stream_index = 0;
 			// concatenate nals
+			if((pktref = av_buffer_pool_get(pktpool)) == NULL) {
+				ga_error("video encoder: allocate packet buffer failed.\n");
+				goto video_quit;
+			}
+			pktbuf = pktref->data;
 			pktbufsize = 0;
 			for(i = 0; i < nnal; i++) {
 				if(pktbufsize + nal[i].i_payload > pktbufmax) {
@@ -402,6 +574,10 @@ vencoder_threadproc(void *arg) {
 			}
 			pkt.size = pktbufsize;
 			pkt.data = pktbuf;
+			pkt.buf = pktref;
+			// slow readers of the packet queue resume at keyframes
+			if(pic_out.b_keyframe)
+				pkt.flags |= AV_PKT_FLAG_KEY;
 #if 0			// XXX: dump naltype
 			do {
 				int codelen;
@@ -419,13 +595,15 @@ vencoder_threadproc(void *arg) {
 			// send the packet
 			if(encoder_send_packet("video-encoder",
 					iid/*rtspconf->video_id*/, &pkt,
-					pkt.pts, NULL) < 0) {
+					pkt.pts, captured) < 0) {
 				goto video_quit;
 			}
 #ifdef SAVEENC
 			if(fsaveenc != NULL)
 				fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
 #endif
+			// the sink keeps its own reference
+			av_buffer_unref(&pktref);
 #else
 			// handling special nals (type > 5)
 			for(i = 0; i < nnal; i++) {
@@ -443,8 +621,10 @@ vencoder_threadproc(void *arg) {
 				pkt.stream_index = 0;
 				pkt.size = nal[i].i_payload;
 				pkt.data = ptr;
+				if(pic_out.b_keyframe)
+					pkt.flags |= AV_PKT_FLAG_KEY;
 				if(encoder_send_packet("video-encoder",
-					iid/*rtspconf->video_id*/, &pkt, pkt.pts, NULL) < 0) {
+					iid/*rtspconf->video_id*/, &pkt, pkt.pts, captured) < 0) {
 					goto video_quit;
 				}
 #ifdef SAVEENC
@@ -453,6 +633,11 @@ vencoder_threadproc(void *arg) {
 #endif
 			}
 			// handling video frame data
+			if((pktref = av_buffer_pool_get(pktpool)) == NULL) {
+				ga_error("video encoder: allocate packet buffer failed.\n");
+				goto video_quit;
+			}
+			pktbuf = pktref->data;
 			pktbufsize = 0;
 			for(; i < nnal; i++) {
 				if(pktbufsize + nal[i].i_payload > pktbufmax) {
@@ -468,8 +653,11 @@ vencoder_threadproc(void *arg) {
 				pkt.stream_index = 0;
 				pkt.size = pktbufsize;
 				pkt.data = pktbuf;
+				pkt.buf = pktref;
+				if(pic_out.b_keyframe)
+					pkt.flags |= AV_PKT_FLAG_KEY;
 				if(encoder_send_packet("video-encoder",
-					iid/*rtspconf->video_id*/, &pkt, pkt.pts, NULL) < 0) {
+					iid/*rtspconf->video_id*/, &pkt, pkt.pts, captured) < 0) {
 					goto video_quit;
 				}
 #ifdef SAVEENC
@@ -477,6 +665,7 @@ vencoder_threadproc(void *arg) {
 					fwrite(pkt.data, sizeof(char), pkt.size, fsaveenc);
 #endif
 			}
+			av_buffer_unref(&pktref);
 #endif
 			// free unused side-data
 			if(pkt.side_data_elems > 0) {
@@ -498,9 +687,9 @@ video_quit:
 	if(pipe) {
 		pipe = NULL;
 	}
-	if(pktbuf != NULL) {
-		free(pktbuf);
-	}
+	// buffers still queued are freed when released
+	av_buffer_unref(&pktref);
+	av_buffer_pool_uninit(&pktpool);
 	pktbuf = NULL;
 	//
 	ga_error("video encoder: thread terminated (tid=%ld).\n", ga_gettid());
@@ -512,14 +701,17 @@ static int
 vencoder_start(void *arg) {
 	int iid;
 	char *pipefmt = (char*) arg;
-#define	MAXPARAMLEN	64
-	static char pipename[VIDEO_SOURCE_CHANNEL_MAX][MAXPARAMLEN];
 	if(vencoder_started != 0)
 		return 0;
+	if(vencoder_initialized == 0)
+		return -1;
 	vencoder_started = 1;
+	// one thread for each channel
 	for(iid = 0; iid < video_source_channels(); iid++) {
-		snprintf(pipename[iid], MAXPARAMLEN, pipefmt, iid);
-		if(pthread_create(&vencoder_tid[iid], NULL, vencoder_threadproc, pipename[iid]) != 0) {
+		snprintf(vchannel[iid].pipename, sizeof(vchannel[iid].pipename), pipefmt, iid);
+		// known before the thread runs, so that vencoder_stop() can wake it up
+		vchannel[iid].pipe = dpipe_lookup(vchannel[iid].pipename);
+		if(pthread_create(&vchannel[iid].tid, NULL, vencoder_threadproc, vchannel[iid].pipename) != 0) {
 			vencoder_started = 0;
 			ga_error("video encoder: create thread failed.\n");
 			return -1;
@@ -537,7 +729,8 @@ vencoder_stop(void *arg) {
 		return 0;
 	vencoder_started = 0;
 	for(iid = 0; iid < video_source_channels(); iid++) {
-		pthread_join(vencoder_tid[iid], &ignored);
+		dpipe_wakeup(vchannel[iid].pipe);
+		pthread_join(vchannel[iid].tid, &ignored);
 	}
 	ga_error("video encdoer: all stopped (%d)\n", iid);
 	return 0;
@@ -553,22 +746,56 @@ vencoder_raw(void *arg, int *size) {
 #else
 	int iid = (int) arg;
 #endif
-	if(vencoder_initialized == 0)
+	if(vencoder_initialized == 0 || vencoder_valid_id(iid) == 0)
 		return NULL;
 	if(size)
-		*size = sizeof(vencoder[iid]);
-	return vencoder[iid];
+		*size = sizeof(vchannel[iid].encoder);
+	return vchannel[iid].encoder;
 }
 
 static int
 x264_reconfigure(ga_ioctl_reconfigure_t *reconf) {
+	int outputW, outputH;
+	if(vencoder_valid_id(reconf->id) == 0)
+		return GA_IOCTL_ERR_BADID;
 	if(vencoder_started == 0 || encoder_running() == 0) {
 		ga_error("video encoder: reconfigure - not running.\n");
 		return 0;
 	}
-	pthread_mutex_lock(&vencoder_reconf_mutex[reconf->id]);
-	bcopy(reconf, &vencoder_reconf[reconf->id], sizeof(ga_ioctl_reconfigure_t));
-	pthread_mutex_unlock(&vencoder_reconf_mutex[reconf->id]);
+	// the filter switches at its next frame, and the encoder follows the frames
+	if(reconf->width > 0 && reconf->height > 0
+	&& video_source_out_resolution(reconf->id, &outputW, &outputH) == 0
+	&& (reconf->width != outputW || reconf->height != outputH)) {
+		if(reconf->width % 4 != 0 || reconf->height % 4 != 0) {
+			ga_error("video encoder: unsupported resolutin %dx%d\n",
+				reconf->width, reconf->height);
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		}
+		if(video_source_set_out_resolution(reconf->id, reconf->width, reconf->height) < 0)
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+	}
+	pthread_mutex_lock(&vchannel[reconf->id].reconf_mutex);
+	bcopy(reconf, &vchannel[reconf->id].reconf, sizeof(ga_ioctl_reconfigure_t));
+	pthread_mutex_unlock(&vchannel[reconf->id].reconf_mutex);
+	// apply now even if no frame is coming
+	dpipe_wakeup(vchannel[reconf->id].pipe);
+	return 0;
+}
+
+static int
+x264_backpressure(ga_ioctl_backpressure_t *bp) {
+	if(vencoder_valid_id(bp->id) == 0)
+		return GA_IOCTL_ERR_BADID;
+	if(bp->state < GA_BACKPRESSURE_NORMAL || bp->state > GA_BACKPRESSURE_DROPPED)
+		return GA_IOCTL_ERR_INVALID_ARGUMENT;
+	pthread_mutex_lock(&vchannel[bp->id].reconf_mutex);
+	// congested and normal cancel each other
+	if(bp->state == GA_BACKPRESSURE_CONGESTED)
+		vchannel[bp->id].bp_events &= ~(1<<GA_BACKPRESSURE_NORMAL);
+	if(bp->state == GA_BACKPRESSURE_NORMAL)
+		vchannel[bp->id].bp_events &= ~(1<<GA_BACKPRESSURE_CONGESTED);
+	vchannel[bp->id].bp_events |= (1<<bp->state);
+	pthread_mutex_unlock(&vchannel[bp->id].reconf_mutex);
 	return 0;
 }
 
@@ -578,39 +805,39 @@ x264_get_sps_pps(int iid) {
 	int ret = 0;
 	int i, i_nal;
 	// alread obtained?
-	if(_sps[iid] != NULL)
+	if(vchannel[iid].sps != NULL)
 		return 0;
 	//
 	if(vencoder_initialized == 0)
 		return GA_IOCTL_ERR_NOTINITIALIZED;
-	if(x264_encoder_headers(vencoder[iid], &p_nal, &i_nal) < 0)
+	if(x264_encoder_headers(vchannel[iid].encoder, &p_nal, &i_nal) < 0)
 		return GA_IOCTL_ERR_NOTFOUND;
 	for(i = 0; i < i_nal; i++) {
 		if(p_nal[i].i_type == NAL_SPS) {
-			if((_sps[iid] = (char*) malloc(p_nal[i].i_payload)) == NULL) {
+			if((vchannel[iid].sps = (char*) malloc(p_nal[i].i_payload)) == NULL) {
 				ret = GA_IOCTL_ERR_NOMEM;
 				break;
 			}
-			bcopy(p_nal[i].p_payload, _sps[iid], p_nal[i].i_payload);
-			_spslen[iid] = p_nal[i].i_payload;
+			bcopy(p_nal[i].p_payload, vchannel[iid].sps, p_nal[i].i_payload);
+			vchannel[iid].spslen = p_nal[i].i_payload;
 		} else if(p_nal[i].i_type == NAL_PPS) {
-			if((_pps[iid] = (char*) malloc(p_nal[i].i_payload)) == NULL) {
+			if((vchannel[iid].pps = (char*) malloc(p_nal[i].i_payload)) == NULL) {
 				ret = GA_IOCTL_ERR_NOMEM;
 				break;
 			}
-			bcopy(p_nal[i].p_payload, _pps[iid], p_nal[i].i_payload);
-			_ppslen[iid] = p_nal[i].i_payload;
+			bcopy(p_nal[i].p_payload, vchannel[iid].pps, p_nal[i].i_payload);
+			vchannel[iid].ppslen = p_nal[i].i_payload;
 		}
 	}
 	//
-	if(_sps[iid] == NULL || _pps[iid] == NULL) {
-		if(_sps[iid])	free(_sps[iid]);
-		if(_pps[iid])	free(_pps[iid]);
-		_sps[iid] = _pps[iid] = NULL;
-		_spslen[iid] = _ppslen[iid] = 0;
+	if(vchannel[iid].sps == NULL || vchannel[iid].pps == NULL) {
+		if(vchannel[iid].sps)	free(vchannel[iid].sps);
+		if(vchannel[iid].pps)	free(vchannel[iid].pps);
+		vchannel[iid].sps = vchannel[iid].pps = NULL;
+		vchannel[iid].spslen = vchannel[iid].ppslen = 0;
 	} else {
 		ga_error("video encoder: found sps (%d bytes); pps (%d bytes)\n",
-			_spslen[iid], _ppslen[iid]);
+			vchannel[iid].spslen, vchannel[iid].ppslen);
 	}
 	return ret;
 }
@@ -627,27 +854,46 @@ vencoder_ioctl(int command, int argsize, void *arg) {
 	case GA_IOCTL_RECONFIGURE:
 		if(argsize != sizeof(ga_ioctl_reconfigure_t))
 			return GA_IOCTL_ERR_INVALID_ARGUMENT;
-		x264_reconfigure((ga_ioctl_reconfigure_t*) arg);
+		ret = x264_reconfigure((ga_ioctl_reconfigure_t*) arg);
+		break;
+	case GA_IOCTL_BACKPRESSURE:
+		if(argsize != sizeof(ga_ioctl_backpressure_t))
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		ret = x264_backpressure((ga_ioctl_backpressure_t*) arg);
 		break;
 	case GA_IOCTL_GETSPS:
 		if(argsize != sizeof(ga_ioctl_buffer_t))
 			return GA_IOCTL_ERR_INVALID_ARGUMENT;
-		if(x264_get_sps_pps(buf->id) < 0)
-			return GA_IOCTL_ERR_NOTFOUND;
-		if(buf->size < _spslen[buf->id])
-			return GA_IOCTL_ERR_BUFFERSIZE;
-		buf->size = _spslen[buf->id];
-		bcopy(_sps[buf->id], buf->ptr, buf->size);
+		if(vencoder_valid_id(buf->id) == 0)
+			return GA_IOCTL_ERR_BADID;
+		// the encoder may be reopened for a new resolution
+		pthread_mutex_lock(&vchannel[buf->id].reconf_mutex);
+		if(x264_get_sps_pps(buf->id) < 0) {
+			ret = GA_IOCTL_ERR_NOTFOUND;
+		} else if(buf->size < vchannel[buf->id].spslen) {
+			ret = GA_IOCTL_ERR_BUFFERSIZE;
+		} else {
+			buf->size = vchannel[buf->id].spslen;
+			bcopy(vchannel[buf->id].sps, buf->ptr, buf->size);
+		}
+		pthread_mutex_unlock(&vchannel[buf->id].reconf_mutex);
 		break;
 	case GA_IOCTL_GETPPS:
 		if(argsize != sizeof(ga_ioctl_buffer_t))
 			return GA_IOCTL_ERR_INVALID_ARGUMENT;
-		if(x264_get_sps_pps(buf->id) < 0)
-			return GA_IOCTL_ERR_NOTFOUND;
-		if(buf->size < _ppslen[buf->id])
-			return GA_IOCTL_ERR_BUFFERSIZE;
-		buf->size = _ppslen[buf->id];
-		bcopy(_pps[buf->id], buf->ptr, buf->size);
+		if(vencoder_valid_id(buf->id) == 0)
+			return GA_IOCTL_ERR_BADID;
+		// the encoder may be reopened for a new resolution
+		pthread_mutex_lock(&vchannel[buf->id].reconf_mutex);
+		if(x264_get_sps_pps(buf->id) < 0) {
+			ret = GA_IOCTL_ERR_NOTFOUND;
+		} else if(buf->size < vchannel[buf->id].ppslen) {
+			ret = GA_IOCTL_ERR_BUFFERSIZE;
+		} else {
+			buf->size = vchannel[buf->id].ppslen;
+			bcopy(vchannel[buf->id].pps, buf->ptr, buf->size);
+		}
+		pthread_mutex_unlock(&vchannel[buf->id].reconf_mutex);
 		break;
 	default:
 		ret = GA_IOCTL_ERR_NOTSUPPORTED;
@@ -35,14 +35,56 @@
 
 #define	POOLSIZE		8
 #define	ENABLE_EMBED_COLORCODE	1
+#define	MAX_FILTER_THREADS	16	/* bands converted in parallel */
+#define	MIN_BAND_HEIGHT		16	/* rows */
 
 using namespace std;
 
 static int filter_initialized = 0;
 static int filter_started = 0;
-static pthread_t filter_tid[VIDEO_SOURCE_CHANNEL_MAX];
 static FILE *savefp = NULL;
 
+#define	MAXPARAMLEN	64
+
+/* Per-channel state, allocated for the video channels in use */
+typedef struct filter_channel_s {
+	pthread_t tid;
+	dpipe_t *dstpipe;
+	char *param[2];		/* source and destination pipe names */
+	char params[2][MAXPARAMLEN];
+}	filter_channel_t;
+
+static filter_channel_t *filter_channel = NULL;
+
+struct filter_pool_s;
+
+/* A horizontal band of the output frame */
+typedef struct filter_band_s {
+	int id;			/* band 0 is converted by the filter thread */
+	struct filter_pool_s *pool;
+	pthread_t thread;
+	struct vconvcache convcache;	/* converters owned by this band */
+}	filter_band_t;
+
+/* Worker pool of a filter thread: each band has its own converter */
+typedef struct filter_pool_s {
+	int nbands;		/* bands per frame, including band 0 */
+	int nworkers;		/* workers started: bands 1 .. nworkers */
+	pthread_mutex_t mutex;
+	pthread_cond_t start;	/* a new frame is posted */
+	pthread_cond_t done;	/* all worker bands are converted */
+	unsigned long long generation;
+	int pending;
+	// the frame being converted
+	vsource_frame_t *srcframe;
+	vsource_frame_t *dstframe;
+	unsigned char **src;
+	int *srcstride;
+	unsigned char **dst;
+	vconv_kernel_t kernel;	/* unscaled kernel, or NULL to use swscale */
+	filter_band_t band[MAX_FILTER_THREADS];
+}	filter_pool_t;
+
 /* filter_RGB2YUV_init: arg is two pointers to pipeline format string */
 /*	1st ptr: source pipeline */
 /*	2nd ptr: destination pipeline */
@@ -53,12 +95,14 @@ filter_RGB2YUV_init(void *arg) {
 	// arg is image source id
 	int iid;
 	const char **filterpipe = (const char **) arg;
-	dpipe_t *srcpipe[VIDEO_SOURCE_CHANNEL_MAX];
-	dpipe_t *dstpipe[VIDEO_SOURCE_CHANNEL_MAX];
 	char savefile[128];
 	//
 	if(filter_initialized != 0)
 		return 0;
+	if((filter_channel = (filter_channel_t*) calloc(video_source_channels(), sizeof(filter_channel_t))) == NULL) {
+		ga_error("RGB2YUV filter: allocate %d channels failed.\n", video_source_channels());
+		return -1;
+	}
 	//
 	if(ga_conf_readv("save-yuv-image", savefile, sizeof(savefile)) != NULL) {
 		savefp = ga_save_init(savefile);
@@ -66,20 +110,17 @@ filter_RGB2YUV_init(void *arg) {
 #ifdef ENABLE_EMBED_COLORCODE
 	vsource_embed_colorcode_init(0/*RGBmode*/);
 #endif
-	//
-	bzero(dstpipe, sizeof(dstpipe));
 	//
 	for(iid = 0; iid < video_source_channels(); iid++) {
 		char pixelfmt[64];
 		char srcpipename[64], dstpipename[64];
 		int inputW, inputH, outputW, outputH;
 		struct SwsContext *swsctx = NULL;
-		dpipe_buffer_t *data = NULL;
+		dpipe_t **dstpipe = &filter_channel[iid].dstpipe;
 		//
 		snprintf(srcpipename, sizeof(srcpipename), filterpipe[0], iid);
 		snprintf(dstpipename, sizeof(dstpipename), filterpipe[1], iid);
-		srcpipe[iid] = dpipe_lookup(srcpipename);
-		if(srcpipe[iid] == NULL) {
+		if(dpipe_lookup(srcpipename) == NULL) {
 			ga_error("RGB2YUV filter: cannot find pipe %s\n", srcpipename);
 			goto init_failed;
 		}
@@ -87,20 +128,20 @@ filter_RGB2YUV_init(void *arg) {
 		inputH = video_source_curr_height(iid);
 		outputW = video_source_out_width(iid);
 		outputH = video_source_out_height(iid);
-		// create default converters
+		// create default converters: checked out by the filter threads later
 		if(ga_conf_readv("filter-source-pixelformat", pixelfmt, sizeof(pixelfmt)) != NULL) {
 			if(strcasecmp("rgba", pixelfmt) == 0) {
-				swsctx = create_frame_converter(
+				swsctx = checkout_frame_converter(
 						inputW, inputH, PIX_FMT_RGBA,
 						outputW, outputH, PIX_FMT_YUV420P);
 				ga_error("RGB2YUV filter: RGBA source specified.\n");
 			} else if(strcasecmp("bgra", pixelfmt) == 0) {
-				swsctx = create_frame_converter(
+				swsctx = checkout_frame_converter(
 						inputW, inputH, PIX_FMT_BGRA,
 						outputW, outputH, PIX_FMT_YUV420P);
 				ga_error("RGB2YUV filter: BGRA source specified.\n");
 			} else if(strcasecmp("yuv420p", pixelfmt) == 0) {
-				swsctx = create_frame_converter(
+				swsctx = checkout_frame_converter(
 						inputW, inputH, PIX_FMT_YUV420P,
 						outputW, outputH, PIX_FMT_YUV420P);
 				ga_error("RGB2YUV filter: YUV source specified.\n");
@@ -108,11 +149,11 @@ filter_RGB2YUV_init(void *arg) {
 		}
 		if(swsctx == NULL) {
 #ifdef __APPLE__
-			swsctx = create_frame_converter(
+			swsctx = checkout_frame_converter(
 					inputW, inputH, PIX_FMT_RGBA,
 					outputW, outputH, PIX_FMT_YUV420P);
 #else
-			swsctx = create_frame_converter(
+			swsctx = checkout_frame_converter(
 					inputW, inputH, PIX_FMT_BGRA,
 					outputW, outputH, PIX_FMT_YUV420P);
 #endif
@@ -121,18 +162,23 @@ filter_RGB2YUV_init(void *arg) {
 			ga_error("RGB2YUV filter: cannot initialize converters.\n");
 			goto init_failed;
 		}
+		checkin_frame_converter(swsctx);
 		//
-		dstpipe[iid] = dpipe_create(iid, dstpipename, POOLSIZE,
-				sizeof(vsource_frame_t) + video_source_mem_size(iid));
-		if(dstpipe[iid] == NULL) {
+		// the filter is the only producer and the encoder is the only consumer,
+		// frames are allocated on demand, sized for the output resolution
+		*dstpipe = dpipe_create_lazy(iid, dstpipename, POOLSIZE,
+				sizeof(vsource_frame_t) + video_source_mem_size(iid),
+				ga_conf_readbool("filter-spsc-pipe", 1),
+				vsource_frame_init_buffer, NULL);
+		if(*dstpipe == NULL) {
 			ga_error("RGB2YUV filter: create dst-pipeline failed (%s).\n", dstpipename);
 			goto init_failed;
 		}
-		for(data = dstpipe[iid]->in; data != NULL; data = data->next) {
-			if(vsource_frame_init(iid, (vsource_frame_t*) data->pointer) == NULL) {
-				ga_error("RGB2YUV filter: init frame failed for %s.\n", dstpipename);
-				goto init_failed;
-			}
+		if(dpipe_set_framesize(*dstpipe,
+				vsource_frame_size(PIX_FMT_YUV420P, outputW, outputH)) < 0) {
+			ga_error("RGB2YUV filter: output resolution %dx%d exceeds the maximum resolution.\n",
+				outputW, outputH);
+			goto init_failed;
 		}
 		video_source_add_pipename(iid, dstpipename);
 	}
@@ -142,10 +188,11 @@ filter_RGB2YUV_init(void *arg) {
 	return 0;
 init_failed:
 	for(iid = 0; iid < video_source_channels(); iid++) {
-		if(dstpipe[iid] != NULL)
-			dpipe_destroy(dstpipe[iid]);
-		dstpipe[iid] = NULL;
+		if(filter_channel[iid].dstpipe != NULL)
+			dpipe_destroy(filter_channel[iid].dstpipe);
 	}
+	free(filter_channel);
+	filter_channel = NULL;
 #if 0
 	if(pipe) {
 		delete pipe;
@@ -163,6 +210,172 @@ filter_RGB2YUV_deinit(void *arg) {
 	return 0;
 }
 
+/* Convert rows [y0, y1) of the output frame posted to the pool.
+ * Band boundaries are even, so each band owns whole chroma rows.
+ * Frames are not scaled vertically, so the same rows are read from the
+ * source frame, see filter_RGB2YUV_threadproc(). */
+static int
+filter_convert_band(filter_pool_t *pool, filter_band_t *band) {
+	vsource_frame_t *srcframe = pool->srcframe;
+	vsource_frame_t *dstframe = pool->dstframe;
+	int dstH = dstframe->realheight;
+	int y0, y1;
+	unsigned char *src[4] = { NULL, NULL, NULL, NULL };
+	unsigned char *dst[4] = { NULL, NULL, NULL, NULL };
+	struct SwsContext *swsctx;
+	//
+	y0 = (int) ((long long) dstH * band->id / pool->nbands) & ~1;
+	y1 = band->id == pool->nbands - 1 ? dstH :
+		(int) ((long long) dstH * (band->id+1) / pool->nbands) & ~1;
+	if(y1 <= y0)
+		return 0;
+	//
+	if(srcframe->pixelformat == PIX_FMT_YUV420P) {
+		src[0] = pool->src[0] + y0 * pool->srcstride[0];
+		src[1] = pool->src[1] + (y0>>1) * pool->srcstride[1];
+		src[2] = pool->src[2] + (y0>>1) * pool->srcstride[2];
+	} else {
+		src[0] = pool->src[0] + y0 * pool->srcstride[0];
+	}
+	dst[0] = pool->dst[0] + y0 * dstframe->linesize[0];
+	dst[1] = pool->dst[1] + (y0>>1) * dstframe->linesize[1];
+	dst[2] = pool->dst[2] + (y0>>1) * dstframe->linesize[2];
+	//
+	if(pool->kernel != NULL) {
+		pool->kernel(src[0], pool->srcstride[0], dst, dstframe->linesize,
+			dstframe->realwidth, y1 - y0);
+		return 0;
+	}
+	swsctx = cached_frame_converter(&band->convcache,
+			srcframe->realwidth, y1 - y0, srcframe->pixelformat,
+			dstframe->realwidth, y1 - y0, dstframe->pixelformat);
+	if(swsctx == NULL) {
+		ga_error("RGB2YUV filter: cannot create frame converter for band %d (%d-%d)\n",
+			band->id, y0, y1);
+		return -1;
+	}
+	sws_scale(swsctx, src, pool->srcstride, 0, y1 - y0, dst, dstframe->linesize);
+	return 0;
+}
+
+static void
+filter_pool_unlock(void *arg) {
+	pthread_mutex_unlock((pthread_mutex_t*) arg);
+}
+
+static void *
+filter_pool_threadproc(void *arg) {
+	filter_band_t *band = (filter_band_t*) arg;
+	filter_pool_t *pool = band->pool;
+	unsigned long long generation = 0;
+	//
+	while(true) {
+		pthread_mutex_lock(&pool->mutex);
+		pthread_cleanup_push(filter_pool_unlock, &pool->mutex);
+		while(pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		generation = pool->generation;
+		pthread_cleanup_pop(1);
+		//
+		filter_convert_band(pool, band);
+		//
+		pthread_mutex_lock(&pool->mutex);
+		if(--pool->pending == 0)
+			pthread_cond_signal(&pool->done);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+	return NULL;
+}
+
+/* Stop the workers and release the pool */
+static void
+filter_pool_destroy(void *arg) {
+	filter_pool_t *pool = (filter_pool_t*) arg;
+	int i;
+	if(pool == NULL)
+		return;
+	for(i = 1; i <= pool->nworkers; i++) {
+		pthread_cancel(pool->band[i].thread);
+		pthread_join(pool->band[i].thread, NULL);
+	}
+	for(i = 0; i < pool->nbands; i++)
+		release_frame_converter_cache(&pool->band[i].convcache);
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->start);
+	pthread_cond_destroy(&pool->done);
+	free(pool);
+}
+
+/* Create a pool of nbands bands: nbands-1 workers plus the filter thread */
+static filter_pool_t *
+filter_pool_create(int nbands) {
+	filter_pool_t *pool;
+	int i;
+	if((pool = (filter_pool_t*) calloc(1, sizeof(filter_pool_t))) == NULL)
+		return NULL;
+	pool->nbands = nbands;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for(i = 0; i < nbands; i++) {
+		pool->band[i].id = i;
+		pool->band[i].pool = pool;
+	}
+	for(i = 1; i < nbands; i++) {
+		if(pthread_create(&pool->band[i].thread, NULL,
+				filter_pool_threadproc, &pool->band[i]) != 0) {
+			ga_error("RGB2YUV filter: create worker thread failed.\n");
+			filter_pool_destroy(pool);
+			return NULL;
+		}
+		pool->nworkers = i;
+	}
+	return pool;
+}
+
+/* Convert a frame with all the bands of the pool,
+ * using the kernel if it is not NULL, or swscale otherwise */
+static int
+filter_pool_convert(filter_pool_t *pool,
+		vsource_frame_t *srcframe, vsource_frame_t *dstframe,
+		unsigned char **src, int *srcstride, unsigned char **dst,
+		vconv_kernel_t kernel) {
+	int err;
+	pthread_mutex_lock(&pool->mutex);
+	pool->srcframe = srcframe;
+	pool->dstframe = dstframe;
+	pool->src = src;
+	pool->srcstride = srcstride;
+	pool->dst = dst;
+	pool->kernel = kernel;
+	pool->pending = pool->nworkers;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+	// the filter thread converts the first band
+	err = filter_convert_band(pool, &pool->band[0]);
+	//
+	pthread_mutex_lock(&pool->mutex);
+	pthread_cleanup_push(filter_pool_unlock, &pool->mutex);
+	while(pool->pending > 0)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	pthread_cleanup_pop(1);
+	return err;
+}
+
+/* Report the conversion time saved by dropping unchanged frames:
+ * dropped frames times the average conversion time, minus hashing time */
+static void
+filter_report_savings(int iid, unsigned long long frames, unsigned long long unchanged,
+		unsigned long long dropped, long long convert, long long detect) {
+	unsigned long long converted = frames - dropped;
+	double saved = converted > 0 ? 1.0 * convert / converted * dropped : 0.0;
+	ga_error("RGB2YUV filter: pipe#%d %llu frames, %llu unchanged, %llu dropped, conversion saved %.1f ms, change detection %.1f ms, net %.1f ms\n",
+		iid, frames, unchanged, dropped,
+		0.000001 * saved, 0.000001 * detect, 0.000001 * (saved - detect));
+	return;
+}
+
 /* filter_RGB2YUV_threadproc: arg is two pointers to pipeline name */
 /*	1st ptr: source pipeline */
 /*	2nd ptr: destination pipeline */
@@ -184,11 +397,24 @@ filter_RGB2YUV_threadproc(void *arg) {
 	unsigned char *src[] = { NULL, NULL, NULL, NULL };
 	unsigned char *dst[] = { NULL, NULL, NULL, NULL };
 	int srcstride[] = { 0, 0, 0, 0 };
-	int dststride[] = { 0, 0, 0, 0 };
 	int iid;
-	int outputW, outputH;
+	int outputW, outputH, newW, newH, resized;
 	//
 	struct SwsContext *swsctx = NULL;
+	vconv_kernel_t kernel = NULL;
+	int use_kernel;
+	struct vconvcache convcache = { { 0 }, NULL };	// owned by this thread
+	filter_pool_t *pool = NULL;
+	int nbands, banded = 0;
+	// conversion time statistics
+	int stats_interval, stats_frames = 0;
+	long long stats_start, stats_total = 0, stats_max = 0, t0, t1;
+	// change detection
+	vsource_tracker_t *tracker = NULL;
+	int drop_unchanged = 0, changed;
+	long long refresh_interval = 0, last_delivered = 0;
+	unsigned long long session_frames = 0, session_unchanged = 0, session_dropped = 0;
+	long long session_convert = 0, session_detect = 0;
 	//
 	pthread_mutex_t condMutex = PTHREAD_MUTEX_INITIALIZER;
 	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
@@ -205,66 +431,146 @@ filter_RGB2YUV_threadproc(void *arg) {
 	outputW = video_source_out_width(iid);
 	outputH = video_source_out_height(iid);
 	//
-	ga_error("RGB2YUV filter[%ld]: pipe#%d from '%s' to '%s' (output-resolution=%dx%d)\n",
+	// split frames into bands converted in parallel
+	if((nbands = ga_conf_readint("filter-threads")) <= 0)
+		nbands = 1;
+	if(nbands > MAX_FILTER_THREADS)
+		nbands = MAX_FILTER_THREADS;
+	if(nbands > outputH / MIN_BAND_HEIGHT)
+		nbands = outputH / MIN_BAND_HEIGHT;
+	if(nbands > 1 && (pool = filter_pool_create(nbands)) == NULL) {
+		ga_error("RGB2YUV filter: worker pool disabled.\n");
+		nbands = 1;
+	}
+	use_kernel = ga_conf_readbool("filter-simd", 1);
+	// skip unchanged frames
+	if(ga_conf_readbool("filter-change-detection", 0) != 0) {
+		char mode[64];
+		if((tracker = (vsource_tracker_t*) malloc(sizeof(vsource_tracker_t))) == NULL) {
+			ga_error("RGB2YUV filter: change detection disabled - alloc failed.\n");
+		} else {
+			bzero(tracker, sizeof(vsource_tracker_t));
+			drop_unchanged = 1;
+			if(ga_conf_readv("filter-unchanged-frames", mode, sizeof(mode)) != NULL
+			&& strcasecmp(mode, "convert") == 0)
+				drop_unchanged = 0;
+			if((refresh_interval = ga_conf_readint("filter-unchanged-refresh")) <= 0)
+				refresh_interval = 1000;
+			refresh_interval *= 1000000LL;
+			ga_error("RGB2YUV filter: change detection enabled, unchanged frames are %s.\n",
+				drop_unchanged ? "dropped" : "converted");
+		}
+	}
+	stats_interval = ga_conf_readint("filter-stats-interval");
+	stats_start = ga_clock_ns();
+	//
+	ga_error("RGB2YUV filter[%ld]: pipe#%d from '%s' to '%s' (output-resolution=%dx%d, threads=%d)\n",
 		ga_gettid(), iid,
 		srcpipe->name, dstpipe->name,
-		outputW/*iwidth*/, outputH/*iheight*/);
+		outputW/*iwidth*/, outputH/*iheight*/, nbands);
 	// start filtering
+	pthread_cleanup_push(filter_pool_destroy, pool);
 	while(filter_started != 0) {
 		// wait for notification
 		srcdata = dpipe_load(srcpipe, NULL);
 		if(srcdata == NULL) {
-			ga_error("RGB2YUV filter: unexpected NULL frame received (from '%s', data=%d, buf=%d).\n",
-				srcpipe->name, srcpipe->out_count, srcpipe->in_count);
-			exit(-1);
-			// should never be here
-			goto filter_quit;
+			// interrupted by dpipe_wakeup(): check filter_started again
+			continue;
 		}
 		srcframe = (vsource_frame_t*) srcdata->pointer;
+		session_frames++;
+		// output resolution may be changed at runtime, see video_source_set_out_resolution()
+		resized = 0;
+		video_source_out_resolution(iid, &newW, &newH);
+		if(newW != outputW || newH != outputH) {
+			ga_error("RGB2YUV filter: pipe#%d output resolution changed from %dx%d to %dx%d.\n",
+				iid, outputW, outputH, newW, newH);
+			outputW = newW;
+			outputH = newH;
+			resized = 1;
+			// free frames of the old size are reallocated by dpipe_get()
+			dpipe_set_framesize(dstpipe, vsource_frame_size(PIX_FMT_YUV420P, outputW, outputH));
+		}
+		// compare with the previous frame, unless the source knows the changes
+		if(tracker != NULL) {
+			t0 = ga_clock_ns();
+			if(srcframe->tilecols > 0) {
+				changed = srcframe->changed;
+				tracker->tilecols = 0;	// hashes are outdated
+			} else {
+				changed = vsource_detect_changes(tracker, srcframe);
+			}
+			t1 = ga_clock_ns();
+			session_detect += t1 - t0;
+			if(changed == 0) {
+				session_unchanged++;
+				// still deliver a frame every refresh interval,
+				// and the first frame of a new output resolution
+				if(drop_unchanged && resized == 0
+				&& t1 - last_delivered < refresh_interval) {
+					session_dropped++;
+					dpipe_put(srcpipe, srcdata);
+					continue;
+				}
+			}
+		}
 		//
 		dstdata = dpipe_get(dstpipe);
 		dstframe = (vsource_frame_t*) dstdata->pointer;
 		// basic info
 		dstframe->imgpts = srcframe->imgpts;
 		dstframe->timestamp = srcframe->timestamp;
-		dstframe->pixelformat = PIX_FMT_YUV420P;	//yuv420p;
-		dstframe->realwidth = outputW;
-		dstframe->realheight = outputH;
-		dstframe->realstride = outputW;
-		dstframe->realsize = outputW * outputH * 3 / 2;
+		// aligned planes and padded linesizes
+		if(vsource_frame_layout(dstframe, PIX_FMT_YUV420P, outputW, outputH) < 0) {
+			ga_error("RGB2YUV filter: fatal - output frame %dx%d does not fit in the frame buffer.\n",
+				outputW, outputH);
+			exit(-1);
+		}
+		if(tracker != NULL && srcframe->tilecols == 0)
+			vsource_set_tilemap(dstframe, tracker);
+		else
+			vsource_copy_tilemap(dstframe, srcframe);
 		// scale image: RGBA, BGRA, or YUV
-		swsctx = lookup_frame_converter(
-				srcframe->realwidth,
-				srcframe->realheight,
-				srcframe->pixelformat,
-				dstframe->realwidth,
-				dstframe->realheight,
-				dstframe->pixelformat);
-		if(swsctx == NULL) {
-			swsctx = create_frame_converter(
+		// unscaled RGBA/BGRA frames are converted by the SIMD kernels
+		kernel = NULL;
+		if(use_kernel
+		&& srcframe->realwidth == outputW && srcframe->realheight == outputH) {
+			kernel = lookup_frame_kernel(srcframe->pixelformat, dstframe->pixelformat);
+		}
+		// bands are converted separately, which is only seamless
+		// without vertical scaling: scaled frames are converted as a whole
+		banded = (pool != NULL && srcframe->realheight == outputH);
+		// no locking unless the source frame format changes
+		if(banded == 0 && kernel == NULL) {
+			swsctx = cached_frame_converter(&convcache,
 				srcframe->realwidth,
 				srcframe->realheight,
 				srcframe->pixelformat,
 				dstframe->realwidth,
 				dstframe->realheight,
 				dstframe->pixelformat);
-		}
-		if(swsctx == NULL) {
-			ga_error("RGB2YUV filter: fatal - cannot create frame converter (%d,%d,%d)->(%x,%d,%d)\n",
-				srcframe->realwidth, srcframe->realheight, srcframe->pixelformat,
-				dstframe->realwidth, dstframe->realheight, dstframe->pixelformat);
+			if(swsctx == NULL) {
+				ga_error("RGB2YUV filter: fatal - cannot create frame converter (%d,%d,%d)->(%x,%d,%d)\n",
+					srcframe->realwidth, srcframe->realheight, srcframe->pixelformat,
+					dstframe->realwidth, dstframe->realheight, dstframe->pixelformat);
+			}
 		}
 		//
 		if(srcframe->pixelformat == PIX_FMT_RGBA
 		|| srcframe->pixelformat == PIX_FMT_BGRA/*rgba*/) {
-			src[0] = srcframe->imgbuf;
+			src[0] = vsource_frame_imgbuf(srcframe);
 			src[1] = NULL;
 			srcstride[0] = srcframe->realstride; //srcframe->stride;
 			srcstride[1] = 0;
+			// bottom-up image: convert from the last row upward
+			if(srcframe->linesize[0] < 0) {
+				src[0] += (srcframe->realheight - 1) * srcframe->realstride;
+				srcstride[0] = -srcframe->realstride;
+			}
 		} else if(srcframe->pixelformat == PIX_FMT_YUV420P) {
-			src[0] = srcframe->imgbuf;
-			src[1] = src[0] + ((srcframe->realwidth * srcframe->realheight));
-			src[2] = src[1] + ((srcframe->realwidth * srcframe->realheight)>>2);
+			src[0] = vsource_frame_plane(srcframe, 0);
+			src[1] = vsource_frame_plane(srcframe, 1);
+			src[2] = vsource_frame_plane(srcframe, 2);
 			src[3] = NULL;
 			srcstride[0] = srcframe->linesize[0];
 			srcstride[1] = srcframe->linesize[1];
@@ -275,18 +581,41 @@ filter_RGB2YUV_threadproc(void *arg) {
 			exit(-1);
 		}
 		//
-		dst[0] = dstframe->imgbuf;
-		dst[1] = dstframe->imgbuf + outputH*outputW;
-		dst[2] = dstframe->imgbuf + outputH*outputW + (outputH*outputW>>2);
+		dst[0] = vsource_frame_plane(dstframe, 0);
+		dst[1] = vsource_frame_plane(dstframe, 1);
+		dst[2] = vsource_frame_plane(dstframe, 2);
 		dst[3] = NULL;
-		dstframe->linesize[0] = dststride[0] = outputW;
-		dstframe->linesize[1] = dststride[1] = outputW>>1;
-		dstframe->linesize[2] = dststride[2] = outputW>>1;
-		dstframe->linesize[3] = dststride[3] = 0;
 		//
-		sws_scale(swsctx,
-			src, srcstride, 0, srcframe->realheight,
-			dst, dstframe->linesize);
+		t0 = ga_clock_ns();
+		if(banded) {
+			filter_pool_convert(pool, srcframe, dstframe, src, srcstride, dst, kernel);
+		} else if(kernel != NULL) {
+			kernel(src[0], srcstride[0], dst, dstframe->linesize, outputW, outputH);
+		} else {
+			sws_scale(swsctx,
+				src, srcstride, 0, srcframe->realheight,
+				dst, dstframe->linesize);
+		}
+		t1 = ga_clock_ns();
+		last_delivered = t1;
+		session_convert += t1 - t0;
+		// report conversion time
+		stats_frames++;
+		stats_total += t1 - t0;
+		if(t1 - t0 > stats_max)
+			stats_max = t1 - t0;
+		if(stats_interval > 0 && t1 - stats_start >= stats_interval * GA_NSEC_PER_SEC) {
+			ga_error("RGB2YUV filter: pipe#%d %d frames, conversion avg %.3f ms, max %.3f ms (threads=%d)\n",
+				iid, stats_frames,
+				0.000001 * stats_total / stats_frames,
+				0.000001 * stats_max, nbands);
+			if(tracker != NULL)
+				filter_report_savings(iid, session_frames, session_unchanged,
+					session_dropped, session_convert, session_detect);
+			stats_frames = 0;
+			stats_total = stats_max = 0;
+			stats_start = t1;
+		}
 		// embed first, and then save
 #ifdef ENABLE_EMBED_COLORCODE
 		vsource_embed_colorcode_inc(dstframe);
@@ -300,6 +629,7 @@ filter_RGB2YUV_threadproc(void *arg) {
 		dpipe_store(dstpipe, dstdata);
 		//
 	}
+	pthread_cleanup_pop(1);
 	//
 filter_quit:
 	if(srcpipe) {
@@ -310,7 +640,12 @@ filter_quit:
 		dstpipe = NULL;
 	}
 	//
-	if(swsctx)	sws_freeContext(swsctx);
+	release_frame_converter_cache(&convcache);
+	if(tracker != NULL) {
+		filter_report_savings(iid, session_frames, session_unchanged,
+			session_dropped, session_convert, session_detect);
+		free(tracker);
+	}
 	//
 	ga_error("RGB2YUV filter: thread terminated.\n");
 	//
@@ -326,25 +661,28 @@ static int
 filter_RGB2YUV_start(void *arg) {
 	int iid;
 	const char **filterpipe = (const char **) arg;
-	static char *filter_param[VIDEO_SOURCE_CHANNEL_MAX][2];
-#define	MAXPARAMLEN	64
-	static char params[VIDEO_SOURCE_CHANNEL_MAX][2][MAXPARAMLEN];
 	//
 	if(filter_started != 0)
 		return 0;
+	if(filter_channel == NULL) {
+		ga_error("filter RGB2YUV: not initialized.\n");
+		return -1;
+	}
 	filter_started = 1;
+	// one thread for each channel
 	for(iid = 0; iid < video_source_channels(); iid++) {
-		snprintf(params[iid][0], MAXPARAMLEN, filterpipe[0], iid);
-		snprintf(params[iid][1], MAXPARAMLEN, filterpipe[1], iid);
-		filter_param[iid][0] = params[iid][0];
-		filter_param[iid][1] = params[iid][1];
+		filter_channel_t *ch = &filter_channel[iid];
+		snprintf(ch->params[0], MAXPARAMLEN, filterpipe[0], iid);
+		snprintf(ch->params[1], MAXPARAMLEN, filterpipe[1], iid);
+		ch->param[0] = ch->params[0];
+		ch->param[1] = ch->params[1];
 		pthread_cancel_init();
-		if(pthread_create(&filter_tid[iid], NULL, filter_RGB2YUV_threadproc, filter_param[iid]) != 0) {
+		if(pthread_create(&ch->tid, NULL, filter_RGB2YUV_threadproc, ch->param) != 0) {
 			filter_started = 0;
 			ga_error("filter RGB2YUV: create thread failed.\n");
 			return -1;
 		}
-		pthread_detach(filter_tid[iid]);
+		pthread_detach(ch->tid);
 	}
 	return 0;
 }
@@ -358,7 +696,7 @@ filter_RGB2YUV_stop(void *arg) {
 		return 0;
 	filter_started = 0;
 	for(iid = 0; iid < video_source_channels(); iid++) {
-		pthread_cancel(filter_tid[iid]);
+		pthread_cancel(filter_channel[iid].tid);
 	}
 	return 0;
 }
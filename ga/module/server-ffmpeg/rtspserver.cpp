@@ -159,7 +159,7 @@ rtp_open_internal(unsigned short *port) {
 
 int
 rtp_open_ports(RTSPContext *ctx, int streamid) {
-	if(streamid < 0)
+	if(streamid < 0 || streamid >= ctx->channels)
 		return -1;
 	if(streamid+1 > ctx->streamCount) {
 		ctx->streamCount = streamid+1;
@@ -358,6 +358,32 @@ per_client_init(RTSPContext *ctx) {
 		return -1;
 	}
 	ctx->sdp_fmtctx->oformat = fmt;
+	// per-channel states: video channels, and the audio channel if enabled
+	ctx->channels = encoder_channels();
+	if((ctx->sdp_vstream = (AVStream**) calloc(ctx->channels, sizeof(AVStream*))) == NULL
+	|| (ctx->sdp_vencoder = (AVCodecContext**) calloc(ctx->channels, sizeof(AVCodecContext*))) == NULL
+	|| (ctx->lower_transport = (enum RTSPLowerTransport*) calloc(ctx->channels, sizeof(enum RTSPLowerTransport))) == NULL
+	|| (ctx->fmtctx = (AVFormatContext**) calloc(ctx->channels, sizeof(AVFormatContext*))) == NULL
+	|| (ctx->stream = (AVStream**) calloc(ctx->channels, sizeof(AVStream*))) == NULL
+	|| (ctx->encoder = (AVCodecContext**) calloc(ctx->channels, sizeof(AVCodecContext*))) == NULL
+	|| (ctx->rtp = (URLContext**) calloc(ctx->channels, sizeof(URLContext*))) == NULL) {
+		ga_error("cannot allocate per-channel states (%d channels)\n", ctx->channels);
+		return -1;
+	}
+#ifdef HOLE_PUNCHING
+#ifdef WIN32
+	ctx->rtpSocket = (SOCKET*) calloc(2 * ctx->channels, sizeof(SOCKET));
+#else
+	ctx->rtpSocket = (int*) calloc(2 * ctx->channels, sizeof(int));
+#endif
+	if(ctx->rtpSocket == NULL
+	|| (ctx->rtpLocalPort = (unsigned short*) calloc(2 * ctx->channels, sizeof(unsigned short))) == NULL
+	|| (ctx->rtpPeerPort = (unsigned short*) calloc(2 * ctx->channels, sizeof(unsigned short))) == NULL
+	|| (ctx->rtpPortChecked = (char*) calloc(2 * ctx->channels, sizeof(char))) == NULL) {
+		ga_error("cannot allocate rtp ports (%d channels)\n", ctx->channels);
+		return -1;
+	}
+#endif
 	// video stream
 	for(i = 0; i < video_source_channels(); i++) {
 		if((ctx->sdp_vstream[i] = ga_avformat_new_stream(
@@ -381,9 +407,11 @@ per_client_init(RTSPContext *ctx) {
 	}
 	// audio stream
 #ifdef ENABLE_AUDIO
+	if(encoder_audio_channel() < 0)
+		goto audio_disabled;
 	if((ctx->sdp_astream = ga_avformat_new_stream(
 			ctx->sdp_fmtctx,
-			video_source_channels(),
+			encoder_audio_channel(),
 			rtspconf->audio_encoder_codec)) == NULL) {
 		ga_error("cannot create new audio stream (%d)\n",
 			rtspconf->audio_encoder_codec->id);
@@ -400,6 +428,7 @@ per_client_init(RTSPContext *ctx) {
 		ga_error("cannot init audio encoder\n");
 		return -1;
 	}
+audio_disabled:
 #endif
 	if((ctx->mtu = ga_conf_readint("packet-size")) <= 0)
 		ctx->mtu = RTSP_TCP_MAX_PACKET_SIZE;
@@ -451,7 +480,7 @@ close_av(AVFormatContext *fctx, AVStream *st, AVCodecContext *cctx, enum RTSPLow
 static void
 per_client_deinit(RTSPContext *ctx) {
 	int i;
-	for(i = 0; i < video_source_channels()+1; i++) {
+	for(i = 0; ctx->fmtctx != NULL && i < ctx->channels; i++) {
 		close_av(ctx->fmtctx[i], ctx->stream[i], ctx->encoder[i], ctx->lower_transport[i]);
 #ifdef HOLE_PUNCHING
 		if(ctx->lower_transport[i] == RTSP_LOWER_TRANSPORT_UDP)
@@ -470,6 +499,20 @@ per_client_deinit(RTSPContext *ctx) {
 	if(ctx->rbuffer) {
 		free(ctx->rbuffer);
 	}
+	if(ctx->sdp_vstream)	free(ctx->sdp_vstream);
+	if(ctx->sdp_vencoder)	free(ctx->sdp_vencoder);
+	if(ctx->lower_transport)	free(ctx->lower_transport);
+	if(ctx->fmtctx)		free(ctx->fmtctx);
+	if(ctx->stream)		free(ctx->stream);
+	if(ctx->encoder)	free(ctx->encoder);
+	if(ctx->rtp)		free(ctx->rtp);
+#ifdef HOLE_PUNCHING
+	if(ctx->rtpSocket)	free(ctx->rtpSocket);
+	if(ctx->rtpLocalPort)	free(ctx->rtpLocalPort);
+	if(ctx->rtpPeerPort)	free(ctx->rtpPeerPort);
+	if(ctx->rtpPortChecked)	free(ctx->rtpPortChecked);
+#endif
+	ctx->channels = 0;
 	ctx->rbufsize = 0;
 	ctx->rbufhead = ctx->rbuftail = 0;
 	//
@@ -614,9 +657,9 @@ rtp_new_av_stream(RTSPContext *ctx, struct sockaddr_in *sin, int streamid, enum
 	AVCodecContext *encoder = NULL;
 	uint8_t *dummybuf = NULL;
 	//
-	if(streamid > VIDEO_SOURCE_CHANNEL_MAX) {
-		ga_error("invalid stream index (%d > %d)\n",
-			streamid, VIDEO_SOURCE_CHANNEL_MAX);
+	if(streamid < 0 || streamid >= ctx->channels) {
+		ga_error("invalid stream index (%d >= %d)\n",
+			streamid, ctx->channels);
 		return -1;
 	}
 	if(codecid != rtspconf->video_encoder_codec->id
@@ -745,29 +788,27 @@ rtsp_cmd_setup(RTSPContext *ctx, const char *url, RTSPMessageHeader *h) {
 	socklen_t destaddrlen, myaddrlen;
 #endif
 	char path[4096];
-	char channelname[VIDEO_SOURCE_CHANNEL_MAX+1][RTSP_STREAM_FORMAT_MAXLEN];
+	char channelname[RTSP_STREAM_FORMAT_MAXLEN];
 	int baselen = strlen(rtspconf->object);
 	int streamid;
 	int rtp_port, rtcp_port;
 	enum RTSPStatusCode errcode;
 	//
 	av_url_split(NULL, 0, NULL, 0, NULL, 0, NULL, path, sizeof(path), url);
-	for(i = 0; i < VIDEO_SOURCE_CHANNEL_MAX+1; i++) {
-		snprintf(channelname[i], RTSP_STREAM_FORMAT_MAXLEN, RTSP_STREAM_FORMAT, i);
-	}
 	//
 	if(strncmp(path, rtspconf->object, baselen) != 0) {
 		ga_error("invalid object (path=%s)\n", path);
 		rtsp_reply_error(ctx, RTSP_STATUS_AGGREGATE);
 		return;
 	}
-	for(i = 0; i < VIDEO_SOURCE_CHANNEL_MAX+1; i++) {
-		if(strcmp(path+baselen+1, channelname[i]) == 0) {
+	for(i = 0; i < ctx->channels; i++) {
+		snprintf(channelname, sizeof(channelname), RTSP_STREAM_FORMAT, i);
+		if(strcmp(path+baselen+1, channelname) == 0) {
 			streamid = i;
 			break;
 		}
 	}
-	if(i == VIDEO_SOURCE_CHANNEL_MAX+1) {
+	if(i == ctx->channels) {
 		// not found
 		ga_error("invalid service (path=%s)\n", path);
 		rtsp_reply_error(ctx, RTSP_STATUS_SERVICE);
@@ -824,7 +865,7 @@ rtsp_cmd_setup(RTSPContext *ctx, const char *url, RTSPMessageHeader *h) {
 	//
 	ctx->lower_transport[streamid] = th->lower_transport;
 	if(rtp_new_av_stream(ctx, &destaddr, streamid,
-			streamid == video_source_channels()/*rtspconf->audio_id*/ ?
+			streamid == encoder_audio_channel() ?
 				rtspconf->audio_encoder_codec->id : rtspconf->video_encoder_codec->id) < 0) {
 		ga_error("Create AV stream %d failed.\n", streamid);
 		errcode = RTSP_STATUS_TRANSPORT;
@@ -39,9 +39,6 @@ int ffio_open_dyn_packet_buf(AVIOContext **, int);
 
 #define	HOLE_PUNCHING		// enable self-implemented hole-punching
 
-#define	RTSP_CHANNEL_MAX	8	// must be at least VIDEO_SOURCE_CHANNEL_MAX+1
-#define	RTSP_CHANNEL_MAXx2	16	// must be RTSP_CHANNEL_MAX * 2
-
 enum RTSPServerState {
 	SERVER_STATE_IDLE = 0,
 	SERVER_STATE_READY,
@@ -75,31 +72,33 @@ struct RTSPContext {
 	int rbufsize;
 	// for creating SDP
 	AVFormatContext *sdp_fmtctx;
-	AVStream *sdp_vstream[VIDEO_SOURCE_CHANNEL_MAX];
+	AVStream **sdp_vstream;
 	AVStream *sdp_astream;
-	AVCodecContext *sdp_vencoder[VIDEO_SOURCE_CHANNEL_MAX];
+	AVCodecContext **sdp_vencoder;
 	AVCodecContext *sdp_aencoder;
 	// for real audio/video encoding
 	int seq;
 	char *session_id;
-	enum RTSPLowerTransport lower_transport[RTSP_CHANNEL_MAX];
-	AVFormatContext *fmtctx[RTSP_CHANNEL_MAX];
-	AVStream *stream[RTSP_CHANNEL_MAX];
-	AVCodecContext *encoder[RTSP_CHANNEL_MAX];
+	// per-channel states, allocated for encoder_channels() channels
+	int channels;
+	enum RTSPLowerTransport *lower_transport;
+	AVFormatContext **fmtctx;
+	AVStream **stream;
+	AVCodecContext **encoder;
 	// streaming
 	int mtu;
-	URLContext *rtp[RTSP_CHANNEL_MAX];	// RTP over UDP
+	URLContext **rtp;	// RTP over UDP
 	pthread_mutex_t rtsp_writer_mutex;	// RTP over RTSP/TCP
 #ifdef HOLE_PUNCHING
 	int streamCount;
 #ifdef WIN32
-	SOCKET rtpSocket[RTSP_CHANNEL_MAXx2];
+	SOCKET *rtpSocket;	// two for each channel
 #else
-	int rtpSocket[RTSP_CHANNEL_MAXx2];
+	int *rtpSocket;		// two for each channel
 #endif
-	unsigned short rtpLocalPort[RTSP_CHANNEL_MAXx2];
-	unsigned short rtpPeerPort[RTSP_CHANNEL_MAXx2];
-	char rtpPortChecked[RTSP_CHANNEL_MAXx2];
+	unsigned short *rtpLocalPort;
+	unsigned short *rtpPeerPort;
+	char *rtpPortChecked;
 #endif
 };
 
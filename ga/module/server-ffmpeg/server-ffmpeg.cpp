@@ -48,27 +48,163 @@ static int server_socket = -1;			/**< The server socket */
 static pthread_t server_tid;
 static int server_started = 0;
 static pthread_rwlock_t cclock = PTHREAD_RWLOCK_INITIALIZER;
-static map<void *, void *> client_context;
+
+/**
+ * Per-client packet sender.
+ * Each client reads the encoder packet queues with its own readers,
+ * so a slow client does not block the encoders and the other clients.
+ */
+typedef struct ff_client_s {
+	RTSPContext *rtsp;
+	int channels;
+	encoder_pktqueue_reader_t **reader;	/**< One reader for each track */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	int pending;		/**< Packets appended since the last wait */
+	int running;
+}	ff_client_t;
+
+static map<void *, ff_client_t *> client_context;
+
+static int ff_server_send_packet_1(const char *prefix, void *ctx, int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns);
+
+static void
+ff_client_notify(void *arg) {
+	ff_client_t *c = (ff_client_t*) arg;
+	pthread_mutex_lock(&c->mutex);
+	c->pending = 1;
+	pthread_cond_signal(&c->cond);
+	pthread_mutex_unlock(&c->mutex);
+	return;
+}
+
+static void *
+ff_client_sender(void *arg) {
+	ff_client_t *c = (ff_client_t*) arg;
+	encoder_packet_t qp;
+	AVPacket pkt;
+	int i, sent;
+	//
+	ga_error("ffmpeg-server: sender started: tid=%ld.\n", ga_gettid());
+	while(c->running) {
+		sent = 0;
+		for(i = 0; i < c->channels; i++) {
+			if(c->reader[i] == NULL)
+				continue;
+			while(encoder_pktqueue_reader_front(c->reader[i], &qp) != NULL) {
+				av_init_packet(&pkt);
+				pkt.data = (uint8_t*) qp.data;
+				pkt.size = qp.size;
+				pkt.pts = qp.pts_int64;
+				pkt.flags = qp.flags;
+				pkt.stream_index = 0;
+				ff_server_send_packet_1("ffmpeg-server", c->rtsp, i, &pkt, qp.pts_int64, qp.pts_ns);
+				encoder_pktqueue_reader_pop(c->reader[i]);
+				sent++;
+			}
+		}
+		if(sent > 0)
+			continue;
+		// wait for new packets
+		pthread_mutex_lock(&c->mutex);
+		if(c->pending == 0 && c->running)
+			pthread_cond_wait(&c->cond, &c->mutex);
+		c->pending = 0;
+		pthread_mutex_unlock(&c->mutex);
+	}
+	ga_error("ffmpeg-server: sender terminated: tid=%ld.\n", ga_gettid());
+	return NULL;
+}
+
+static void
+ff_client_destroy(ff_client_t *c) {
+	int i;
+	if(c == NULL)
+		return;
+	if(c->running) {
+		pthread_mutex_lock(&c->mutex);
+		c->running = 0;
+		pthread_cond_signal(&c->cond);
+		pthread_mutex_unlock(&c->mutex);
+		pthread_join(c->thread, NULL);
+	}
+	if(c->reader != NULL) {
+		for(i = 0; i < c->channels; i++) {
+			encoder_pktqueue_reader_detach(c->reader[i]);
+		}
+		free(c->reader);
+	}
+	pthread_cond_destroy(&c->cond);
+	pthread_mutex_destroy(&c->mutex);
+	free(c);
+	return;
+}
+
+static ff_client_t *
+ff_client_create(void *ccontext) {
+	ff_client_t *c;
+	int i;
+	if((c = (ff_client_t*) malloc(sizeof(ff_client_t))) == NULL)
+		return NULL;
+	bzero(c, sizeof(ff_client_t));
+	c->rtsp = (RTSPContext*) ccontext;
+	pthread_mutex_init(&c->mutex, NULL);
+	pthread_cond_init(&c->cond, NULL);
+	// video channels, and the audio channel if enabled
+	c->channels = encoder_channels();
+	if((c->reader = (encoder_pktqueue_reader_t**) calloc(c->channels, sizeof(encoder_pktqueue_reader_t*))) == NULL)
+		goto error;
+	for(i = 0; i < c->channels; i++) {
+		if((c->reader[i] = encoder_pktqueue_reader_attach(i, ff_client_notify, c)) == NULL)
+			goto error;
+	}
+	c->running = 1;
+	if(pthread_create(&c->thread, NULL, ff_client_sender, c) != 0) {
+		c->running = 0;
+		ga_error("ffmpeg-server: cannot create sender thread.\n");
+		goto error;
+	}
+	return c;
+error:
+	ff_client_destroy(c);
+	return NULL;
+}
 
 int
 ff_server_register_client(void *ccontext) {
-	if(encoder_register_client(ccontext) < 0)
-		return -1;
-	//
+	ff_client_t *c;
+	// readers must be attached before the encoders start
 	pthread_rwlock_wrlock(&cclock);
-	client_context[ccontext] = ccontext;
+	if(client_context.find(ccontext) == client_context.end()) {
+		if((c = ff_client_create(ccontext)) == NULL) {
+			pthread_rwlock_unlock(&cclock);
+			return -1;
+		}
+		client_context[ccontext] = c;
+	}
 	pthread_rwlock_unlock(&cclock);
+	//
+	if(encoder_register_client(ccontext) < 0)
+		return -1;
 	return 0;
 }
 
 int
 ff_server_unregister_client(void *ccontext) {
-	if(encoder_unregister_client(ccontext) < 0)
-		return -1;
+	map<void *, ff_client_t *>::iterator mi;
+	ff_client_t *c = NULL;
 	//
 	pthread_rwlock_wrlock(&cclock);
-	client_context.erase(ccontext);
+	if((mi = client_context.find(ccontext)) != client_context.end()) {
+		c = mi->second;
+		client_context.erase(mi);
+	}
 	pthread_rwlock_unlock(&cclock);
+	ff_client_destroy(c);
+	//
+	if(encoder_unregister_client(ccontext) < 0)
+		return -1;
 	return 0;
 }
 
@@ -148,6 +284,8 @@ ff_server_init(void *arg) {
 		perror("listen");
 		return -1;
 	}
+	//
+	encoder_pktqueue_init(encoder_channels(), 3 * 1024* 1024/*3MB*/);
 	return 0;
 }
 
@@ -183,7 +321,7 @@ ff_server_deinit(void *arg) {
 }
 
 static int
-ff_server_send_packet_1(const char *prefix, void *ctx, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
+ff_server_send_packet_1(const char *prefix, void *ctx, int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns) {
 	int iolen;
 	uint8_t *iobuf;
 	RTSPContext *rtsp = (RTSPContext*) ctx;
@@ -249,13 +387,9 @@ ff_server_send_packet_1(const char *prefix, void *ctx, int channelId, AVPacket *
 }
 
 static int
-ff_server_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, struct timeval *ptv) {
-	map<void*, void*>::iterator mi;
-	pthread_rwlock_rdlock(&cclock);
-	for(mi = client_context.begin(); mi != client_context.end(); mi++) {
-		ff_server_send_packet_1(prefix, mi->second, channelId, pkt, encoderPts, ptv);
-	}
-	pthread_rwlock_unlock(&cclock);
+ff_server_send_packet(const char *prefix, int channelId, AVPacket *pkt, int64_t encoderPts, long long ptsns) {
+	// delivered by the sender of each client
+	encoder_pktqueue_append(channelId, pkt, encoderPts, ptsns);
 	return 0;
 }
 
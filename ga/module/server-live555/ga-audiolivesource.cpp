@@ -21,10 +21,6 @@
 #include "ga-audiolivesource.h"
 #include "ga-liveserver.h"
 
-static GAAudioLiveSource *aLiveSource = NULL;
-static void signalNewAudioFrameData(int channelId);
-
-EventTriggerId GAAudioLiveSource::eventTriggerId = 0;
 unsigned GAAudioLiveSource::referenceCount = 0;
 
 GAAudioLiveSource * GAAudioLiveSource
@@ -44,24 +40,20 @@ GAAudioLiveSource
 	++referenceCount;
 	// Any instance-specific initialization of the device would be done here:
 	this->channelId = cid;
-	aLiveSource = this;
-	if (eventTriggerId == 0) {
-		eventTriggerId = envir().taskScheduler().createEventTrigger(deliverFrame0);
-		encoder_pktqueue_register_callback(cid, signalNewAudioFrameData);
-	}
+	this->eventTriggerId = envir().taskScheduler().createEventTrigger(deliverFrame0);
+	this->reader = encoder_pktqueue_reader_attach(cid, signalNewFrameData, this);
 }
 
 GAAudioLiveSource
 ::~GAAudioLiveSource() {
 	// Any instance-specific 'destruction' (i.e., resetting) of the device would be done here:
-	aLiveSource = NULL;
+	// no more signals once the reader is detached
+	encoder_pktqueue_reader_detach(this->reader);
+	// Reclaim our 'event trigger'
+	envir().taskScheduler().deleteEventTrigger(this->eventTriggerId);
 	--referenceCount;
 	if (referenceCount == 0) {
 		// Any global 'destruction' (i.e., resetting) of the device would be done here:
-		encoder_pktqueue_unregister_callback(this->channelId, signalNewAudioFrameData);
-		// Reclaim our 'event trigger'
-		envir().taskScheduler().deleteEventTrigger(eventTriggerId);
-		eventTriggerId = 0;
 	}
 }
 
@@ -79,7 +71,7 @@ void GAAudioLiveSource
 		return;
 	}
 	// If a new frame of data is immediately available to be delivered, then do this now:
-	if (encoder_pktqueue_size(this->channelId) > 0) {
+	if (this->reader != NULL && encoder_pktqueue_reader_size(this->reader) > 0) {
 		deliverFrame();
 	}
 	// No new data is immediately available to be delivered.  We don't do anything more here.
@@ -111,12 +103,13 @@ void GAAudioLiveSource
 	// Note the code below.
 
 	if (!isCurrentlyAwaitingData()) return; // we're not ready for the data yet
+	if (this->reader == NULL) return;
 
 	encoder_packet_t pkt;
 	u_int8_t* newFrameDataStart = NULL; //%%% TO BE WRITTEN %%%
 	unsigned newFrameSize = 0; //%%% TO BE WRITTEN %%%
 
-	newFrameDataStart = (u_int8_t*) encoder_pktqueue_front(this->channelId, &pkt);
+	newFrameDataStart = (u_int8_t*) encoder_pktqueue_reader_front(this->reader, &pkt);
 	if(newFrameDataStart == NULL)
 		return;
 	newFrameSize = pkt.size;
@@ -129,23 +122,24 @@ void GAAudioLiveSource
 		fFrameSize = newFrameSize;
 	}
 	//gettimeofday(&fPresentationTime, NULL); // If you have a more accurate time - e.g., from an encoder - then use that instead.
-	fPresentationTime = pkt.pts_tv;
+	// RTP/RTCP timestamps are derived from the wall-clock presentation time
+	ga_clock_walltime(pkt.pts_ns, &fPresentationTime);
 	// If the device is *not* a 'live source' (e.g., it comes instead from a file or buffer), then set "fDurationInMicroseconds" here.
 	memmove(fTo, newFrameDataStart, fFrameSize);
 
-	encoder_pktqueue_pop_front(channelId);
+	encoder_pktqueue_reader_pop(this->reader);
 
 	// After delivering the data, inform the reader that it is now available:
 	FramedSource::afterGetting(this);
 }
 
-static void
-signalNewAudioFrameData(int channelId) {
+void GAAudioLiveSource
+::signalNewFrameData(void* clientData) {
 	TaskScheduler* ourScheduler = (TaskScheduler*) liveserver_taskscheduler(); //%%% TO BE WRITTEN %%%
-	GAAudioLiveSource* ourDevice = aLiveSource; //%%% TO BE WRITTEN %%%
+	GAAudioLiveSource* ourDevice = (GAAudioLiveSource*) clientData;
 
 	if (ourScheduler != NULL) { // sanity check
-		ourScheduler->triggerEvent(GAAudioLiveSource::eventTriggerId, ourDevice);
+		ourScheduler->triggerEvent(ourDevice->eventTriggerId, ourDevice);
 	}
 }
 
@@ -20,24 +20,25 @@
 #define __GA_AUDIOLIVESOURCE_H__
 
 #include <FramedSource.hh>
+#include "encoder-common.h"
 
 class GAAudioLiveSource : public FramedSource {
 public:
 	static GAAudioLiveSource * createNew(UsageEnvironment& env, int cid/* TODO: more params */);
-	static EventTriggerId eventTriggerId;
 protected:
 	GAAudioLiveSource(UsageEnvironment& env, int cid);
 	~GAAudioLiveSource();
 private:
 	static unsigned referenceCount;
 	int channelId;
+	encoder_pktqueue_reader_t *reader;
+	EventTriggerId eventTriggerId;
 	//
+	static void signalNewFrameData(void *clientData);
 	static void deliverFrame0(void* clientData);
 	void doGetNextFrame();
 	//virtual void doStopGettingFrames(); // optional
 	void deliverFrame();
 };
 
-void signalNewAudioFrameData();
-
 #endif /* __GA_AUDIOLIVESOURCE_H__ */
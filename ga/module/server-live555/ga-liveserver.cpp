@@ -41,7 +41,8 @@ liveserver_main(void *arg) {
 		exit(1);
 	}
 	//
-	encoder_pktqueue_init(VIDEO_SOURCE_CHANNEL_MAX+1, 3 * 1024* 1024/*3MB*/);
+	// one packet queue for each track
+	encoder_pktqueue_init(encoder_channels(), 3 * 1024* 1024/*3MB*/);
 	//
 	ServerMediaSession * sms
 		= ServerMediaSession::createNew(*env,
@@ -63,7 +64,7 @@ liveserver_main(void *arg) {
 		sms->addSubsession(GAMediaSubsession::createNew(*env, cid, m->mimetype)); 
 	}
 	// add audio session, if necessary
-	if((m = encoder_get_aencoder()) != NULL) {
+	if((m = encoder_get_aencoder()) != NULL && (cid = encoder_audio_channel()) >= 0) {
 		if(m->mimetype == NULL) {
 			ga_error("live-server: FATAL - audio encoder does not configure mimetype.\n");
 			exit(-1);
@@ -34,7 +34,7 @@
 
 GAMediaSubsession
 ::GAMediaSubsession(UsageEnvironment &env, int cid, const char *mimetype, portNumBits initialPortNum, Boolean multiplexRTCPWithRTP)
-		: OnDemandServerMediaSubsession(env, True/*reuseFirstSource*/, initialPortNum, multiplexRTCPWithRTP) {
+		: OnDemandServerMediaSubsession(env, False/*reuseFirstSource: a packet queue reader per session*/, initialPortNum, multiplexRTCPWithRTP) {
 	this->mimetype = strdup(mimetype);
 	this->channelId = cid;
 }
@@ -24,11 +24,6 @@
 #include "ga-videolivesource.h"
 #include "ga-liveserver.h"
 
-static GAVideoLiveSource *vLiveSource[VIDEO_SOURCE_CHANNEL_MAX];
-static EventTriggerId eventTriggerId[VIDEO_SOURCE_CHANNEL_MAX];
-static void signalNewVideoFrameData(int channelId);
-
-//EventTriggerId GAVideoLiveSource::eventTriggerId = 0;
 unsigned GAVideoLiveSource::referenceCount = 0;
 int GAVideoLiveSource::remove_startcode = 0;
 ga_module_t * GAVideoLiveSource::m = NULL;
@@ -41,6 +36,12 @@ GAVideoLiveSource * GAVideoLiveSource
 GAVideoLiveSource
 ::GAVideoLiveSource(UsageEnvironment& env, int cid)
 		: FramedSource(env) {
+	// Any instance-specific initialization of the device would be done here:
+	// each session reads the channel with its own reader,
+	// attached before the encoder starts so the first keyframe is kept
+	this->channelId = cid;
+	this->eventTriggerId = envir().taskScheduler().createEventTrigger(deliverFrame0);
+	this->reader = encoder_pktqueue_reader_attach(cid, signalNewFrameData, this);
 	//
 	if (referenceCount == 0) {
 		// Any global initialization of the device would be done here:
@@ -51,29 +52,21 @@ GAVideoLiveSource
 		live_server_register_client(this);
 	}
 	++referenceCount;
-	// Any instance-specific initialization of the device would be done here:
-	this->channelId = cid;
-	vLiveSource[cid] = this;
-	if (eventTriggerId[cid] == 0) {
-		eventTriggerId[cid] = envir().taskScheduler().createEventTrigger(deliverFrame0);
-		encoder_pktqueue_register_callback(this->channelId, signalNewVideoFrameData);
-	}
 }
 
 GAVideoLiveSource
 ::~GAVideoLiveSource() {
 	// Any instance-specific 'destruction' (i.e., resetting) of the device would be done here:
-	vLiveSource[this->channelId] = NULL;
+	// no more signals once the reader is detached
+	encoder_pktqueue_reader_detach(this->reader);
+	// Reclaim our 'event trigger'
+	envir().taskScheduler().deleteEventTrigger(this->eventTriggerId);
 	--referenceCount;
 	if (referenceCount == 0) {
 		// Any global 'destruction' (i.e., resetting) of the device would be done here:
 		live_server_unregister_client(this);
 		remove_startcode = 0;
 		m = NULL;
-		encoder_pktqueue_unregister_callback(this->channelId, signalNewVideoFrameData);
-		// Reclaim our 'event trigger'
-		envir().taskScheduler().deleteEventTrigger(eventTriggerId[this->channelId]);
-		eventTriggerId[this->channelId] = 0;
 	}
 }
 
@@ -91,7 +84,7 @@ void GAVideoLiveSource
 		return;
 	}
 	// If a new frame of data is immediately available to be delivered, then do this now:
-	if (encoder_pktqueue_size(this->channelId) > 0) {
+	if (this->reader != NULL && encoder_pktqueue_reader_size(this->reader) > 0) {
 		deliverFrame();
 	}
 	// No new data is immediately available to be delivered.  We don't do anything more here.
@@ -123,12 +116,13 @@ void GAVideoLiveSource
 	// Note the code below.
 
 	if (!isCurrentlyAwaitingData()) return; // we're not ready for the data yet
+	if (this->reader == NULL) return;
 
 	encoder_packet_t pkt;
 	u_int8_t* newFrameDataStart = NULL; //%%% TO BE WRITTEN %%%
 	unsigned newFrameSize = 0; //%%% TO BE WRITTEN %%%
 
-	newFrameDataStart = (u_int8_t*) encoder_pktqueue_front(this->channelId, &pkt);
+	newFrameDataStart = (u_int8_t*) encoder_pktqueue_reader_front(this->reader, &pkt);
 	if(newFrameDataStart == NULL)
 		return;
 	newFrameSize = pkt.size;
@@ -154,29 +148,30 @@ void GAVideoLiveSource
 		fNumTruncatedBytes = newFrameSize - fMaxSize;
 		ga_error("video encoder: packet truncated (%d > %d).\n", newFrameSize, fMaxSize);
 #else		// for regular H264Framer
-		encoder_pktqueue_split_packet(this->channelId, (char*) newFrameDataStart + fMaxSize);
+		encoder_pktqueue_reader_split(this->reader, (char*) newFrameDataStart + fMaxSize);
 #endif
 	} else {
 		fFrameSize = newFrameSize;
 	}
 	//gettimeofday(&fPresentationTime, NULL); // If you have a more accurate time - e.g., from an encoder - then use that instead.
-	fPresentationTime = pkt.pts_tv;
+	// RTP/RTCP timestamps are derived from the wall-clock presentation time
+	ga_clock_walltime(pkt.pts_ns, &fPresentationTime);
 	// If the device is *not* a 'live source' (e.g., it comes instead from a file or buffer), then set "fDurationInMicroseconds" here.
 	memmove(fTo, newFrameDataStart, fFrameSize);
 
-	encoder_pktqueue_pop_front(channelId);
+	encoder_pktqueue_reader_pop(this->reader);
 
 	// After delivering the data, inform the reader that it is now available:
 	FramedSource::afterGetting(this);
 }
 
-static void
-signalNewVideoFrameData(int channelId) {
+void GAVideoLiveSource
+::signalNewFrameData(void* clientData) {
 	TaskScheduler* ourScheduler = (TaskScheduler*) liveserver_taskscheduler(); //%%% TO BE WRITTEN %%%
-	GAVideoLiveSource* ourDevice = vLiveSource[channelId]; //%%% TO BE WRITTEN %%%
+	GAVideoLiveSource* ourDevice = (GAVideoLiveSource*) clientData;
 
 	if (ourScheduler != NULL) { // sanity check
-		ourScheduler->triggerEvent(eventTriggerId[channelId], ourDevice);
+		ourScheduler->triggerEvent(ourDevice->eventTriggerId, ourDevice);
 	}
 }
 
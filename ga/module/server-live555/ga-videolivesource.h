@@ -21,6 +21,7 @@
 
 #include <FramedSource.hh>
 #include "ga-module.h"
+#include "encoder-common.h"
 
 class GAVideoLiveSource : public FramedSource {
 public:
@@ -34,7 +35,10 @@ private:
 	static int remove_startcode;
 	static ga_module_t *m;
 	int channelId;
+	encoder_pktqueue_reader_t *reader;
+	EventTriggerId eventTriggerId;
 	//
+	static void signalNewFrameData(void *clientData);
 	static void deliverFrame0(void* clientData);
 	void doGetNextFrame();
 	//virtual void doStopGettingFrames(); // optional
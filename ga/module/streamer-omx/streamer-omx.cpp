@@ -290,8 +290,6 @@ vencoder_threadproc(void *arg) {
 	pthread_mutex_t condMutex = PTHREAD_MUTEX_INITIALIZER;
 	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
 	//
-	struct timeval pkttv;
-	//
 	int video_written = 0;
 	//
 	rtspconf = rtspconf_global();
@@ -356,7 +354,7 @@ vencoder_threadproc(void *arg) {
 #endif
 		pkt.data = enc;
 		pkt.size = encsize;
-		if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, NULL/*&pkttv*/) < 0) {
+		if(encoder_send_packet("video-encoder", cid, &pkt, pkt.pts, 0) < 0) {
 			goto video_quit;
 		}
 		if(video_written == 0) {
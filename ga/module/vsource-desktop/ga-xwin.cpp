@@ -21,10 +21,23 @@
 #include <string.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#ifdef HAVE_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#endif
+#ifdef HAVE_XFIXES
+#include <X11/extensions/Xfixes.h>
+#endif
+
+#include <map>
+#include <vector>
 
 #include "ga-common.h"
+#include "ga-conf.h"
+#include "ctrl-msg.h"
 #include "ga-xwin.h"
 
+using namespace std;
+
 static int screenNumber;
 static int width, height, depth;
 
@@ -37,6 +50,45 @@ static XImage *image = NULL;
 static XShmSegmentInfo __xshminfo;
 static bool __xshmattached = false;
 
+/* XDamage: the shared image is updated only in damaged regions.
+ * Each pipe buffer remembers the image generation it holds, and
+ * receives the regions damaged since then from the history.
+ * Without HAVE_XDAMAGE, every frame is captured as a whole. */
+#define	DAMAGE_HISTORY		16	/* generations kept in history */
+#define	DAMAGE_MAX_RECTS	256	/* more rectangles are fetched as a whole */
+static bool damage_enabled = false;
+#ifdef HAVE_XDAMAGE
+static int damage_event_base = 0;
+static Damage damage = 0;
+static XserverRegion damage_region = 0;
+#endif
+static unsigned int damage_gen = 0;	/* generation of the shared image */
+static vector<XRectangle> damage_history[DAMAGE_HISTORY];
+static bool damage_full[DAMAGE_HISTORY];	/* the whole image is updated */
+static map<char*, unsigned int> damage_bufgen;	/* generation held by each buffer */
+static vector<XRectangle> damage_pending;	/* damaged since the last capture */
+static bool damage_pending_full = true;
+static bool damage_image_stale = true;	/* the shared image misses some damage */
+static vector<XRectangle> damage_last;		/* changed by the last capture */
+static bool damage_last_full = true;
+
+/* Frame buffers allocated as XShm segments, see ga_xwin_alloc_buffer().
+ * XShmGetImage() writes into them directly, and with XDamage the damaged
+ * regions are fetched into each buffer instead of the shared image. */
+typedef struct xwin_buffer_s {
+	XImage *image;
+	XShmSegmentInfo shminfo;
+	bool attached;
+}	xwin_buffer_t;
+static map<char*, xwin_buffer_t*> xwin_buffers;
+
+/* XFixes: the cursor is not in the captured image, see ga_xwin_cursor_init() */
+static bool cursor_enabled = false;
+#ifdef HAVE_XFIXES
+static int cursor_event_base = 0;
+static unsigned char cursor_pixels[CTRL_CURSOR_MAXSIZE * CTRL_CURSOR_MAXSIZE * 4];
+#endif
+
 int
 ga_xwin_init(const char *displayname, gaImage *gaimg) {
 	int ignore = 0;
@@ -97,6 +149,8 @@ ga_xwin_init(const char *displayname, gaImage *gaimg) {
 	//
 	__xshmattached = true;
 	rootWindow = XRootWindow(display, screenNumber);
+	if(ga_conf_readbool("desktop-damage", 1) != 0)
+		ga_xwin_damage_init();
 	gaimg->width = image->width;
 	gaimg->height = image->height;
 	gaimg->bytes_per_line = image->bytes_per_line;
@@ -112,6 +166,17 @@ void
 //ga_xwin_deinit(Display *display, XImage *image) {
 ga_xwin_deinit() {
 	//
+#ifdef HAVE_XDAMAGE
+	if(damage_enabled) {
+		XDamageDestroy(display, damage);
+		XFixesDestroyRegion(display, damage_region);
+		damage_enabled = false;
+	}
+#endif
+	damage_bufgen.clear();
+	ga_xwin_free_buffers();
+	cursor_enabled = false;
+	//
 	if(__xshmattached) {
 		XShmDetach(display, &__xshminfo);
 		__xshmattached = false;
@@ -144,14 +209,460 @@ ga_xwin_imageinfo(XImage *image) {
 	return;
 }
 
+/* Track damage of the root window with XDamage, see ga_xwin_update() */
+int
+ga_xwin_damage_init() {
+#ifdef HAVE_XDAMAGE
+	int error_base, major = 0, minor = 0;
+	if(XDamageQueryExtension(display, &damage_event_base, &error_base) == False
+	|| XDamageQueryVersion(display, &major, &minor) == 0) {
+		ga_error("XDamage extension not supported, capture full frames.\n");
+		return -1;
+	}
+	if(XFixesQueryExtension(display, &error_base, &error_base) == False) {
+		ga_error("XFixes extension not supported, capture full frames.\n");
+		return -1;
+	}
+	damage = XDamageCreate(display, rootWindow, XDamageReportNonEmpty);
+	damage_region = XFixesCreateRegion(display, NULL, 0);
+	damage_gen = 0;
+	damage_pending.clear();
+	damage_pending_full = true;
+	damage_image_stale = true;
+	damage_enabled = true;
+	ga_error("XDamage extension version %d.%d, capture damaged regions.\n", major, minor);
+	return 0;
+#else
+	ga_error("XDamage support is not built, capture full frames.\n");
+	return -1;
+#endif
+}
+
+/**
+ * Check if the frames are captured in damaged regions.
+ *
+ * @return Non-zero if XDamage is used.
+ *
+ * ga_xwin_capture() then updates each buffer with the regions damaged
+ * since its previous capture, so the buffers must be kept: a buffer
+ * released and allocated again at the same address would be blank.
+ */
+int
+ga_xwin_damage_enabled() {
+	return damage_enabled ? 1 : 0;
+}
+
+/**
+ * Track the cursor with XFixes.
+ *
+ * @return 0 on success, or -1 if XFixes is not supported.
+ *
+ * The cursor image is read by ga_xwin_cursor_image() when
+ * ga_xwin_cursor_changed() reports a new image, and the position
+ * by ga_xwin_cursor_position().
+ */
+int
+ga_xwin_cursor_init() {
+#ifdef HAVE_XFIXES
+	int error_base, major = 0, minor = 0;
+	if(XFixesQueryExtension(display, &cursor_event_base, &error_base) == False
+	|| XFixesQueryVersion(display, &major, &minor) == 0 || major < 2) {
+		ga_error("XFixes cursor tracking not supported.\n");
+		return -1;
+	}
+	XFixesSelectCursorInput(display, rootWindow, XFixesDisplayCursorNotifyMask);
+	cursor_enabled = true;
+	ga_error("XFixes extension version %d.%d, track the cursor.\n", major, minor);
+	return 0;
+#else
+	ga_error("XFixes support is not built, cursor tracking disabled.\n");
+	return -1;
+#endif
+}
+
+/**
+ * Check whether the cursor image is changed.
+ *
+ * @return 1 if the image is changed since the last call, 0 if it is not,
+ *	or -1 if the cursor is not tracked.
+ */
+int
+ga_xwin_cursor_changed() {
+#ifdef HAVE_XFIXES
+	XEvent event;
+	int changed = 0;
+	if(!cursor_enabled)
+		return -1;
+	while(XCheckTypedEvent(display, cursor_event_base + XFixesCursorNotify, &event))
+		changed = 1;
+	return changed;
+#else
+	return -1;
+#endif
+}
+
+/**
+ * Read the current cursor image.
+ *
+ * @param width [out] Image width, at most CTRL_CURSOR_MAXSIZE.
+ * @param height [out] Image height, at most CTRL_CURSOR_MAXSIZE.
+ * @param xhot [out] Horizontal hotspot position.
+ * @param yhot [out] Vertical hotspot position.
+ * @return The pixels in B, G, R, A byte order with straight alpha,
+ *	valid until the next call, or NULL on error.
+ *
+ * Larger images are clipped around the hotspot.
+ */
+unsigned char *
+ga_xwin_cursor_image(int *width, int *height, int *xhot, int *yhot) {
+#ifdef HAVE_XFIXES
+	XFixesCursorImage *ci;
+	unsigned char *dst = cursor_pixels;
+	int x, y, x0, y0, w, h;
+	if(!cursor_enabled || (ci = XFixesGetCursorImage(display)) == NULL)
+		return NULL;
+	w = ci->width < CTRL_CURSOR_MAXSIZE ? ci->width : CTRL_CURSOR_MAXSIZE;
+	h = ci->height < CTRL_CURSOR_MAXSIZE ? ci->height : CTRL_CURSOR_MAXSIZE;
+	// keep the hotspot in the clipped image
+	x0 = ci->xhot >= w ? ci->xhot - w + 1 : 0;
+	y0 = ci->yhot >= h ? ci->yhot - h + 1 : 0;
+	for(y = 0; y < h; y++) {
+		// the pixels are premultiplied ARGB, stored in longs
+		unsigned long *src = ci->pixels + (y0 + y) * ci->width + x0;
+		for(x = 0; x < w; x++, dst += 4) {
+			unsigned int p = (unsigned int) src[x];
+			unsigned int a = p >> 24;
+			if(a == 0) {
+				dst[0] = dst[1] = dst[2] = dst[3] = 0;
+				continue;
+			}
+			dst[0] = (unsigned char) ((p & 0xff) * 255 / a);
+			dst[1] = (unsigned char) (((p >> 8) & 0xff) * 255 / a);
+			dst[2] = (unsigned char) (((p >> 16) & 0xff) * 255 / a);
+			dst[3] = (unsigned char) a;
+		}
+	}
+	*width = w;
+	*height = h;
+	*xhot = ci->xhot - x0;
+	*yhot = ci->yhot - y0;
+	XFree(ci);
+	return cursor_pixels;
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * Read the cursor position.
+ *
+ * @param x [out] Horizontal position on the screen.
+ * @param y [out] Vertical position on the screen.
+ * @return 1 if the cursor is on the captured screen, or 0 if it is not.
+ */
+int
+ga_xwin_cursor_position(int *x, int *y) {
+	Window root, child;
+	int wx, wy;
+	unsigned int mask;
+	if(XQueryPointer(display, rootWindow, &root, &child, x, y, &wx, &wy, &mask) == False)
+		return 0;
+	return 1;
+}
+
+/* Fetch a region of the root window (screen coordinates) into an image
+ * of the screen, or of the crop rectangle if \a crop is not NULL */
+static void
+xwin_fetch(XImage *dst, const XRectangle *r, struct gaRect *crop) {
+	int x = r->x, y = r->y, w = r->width, h = r->height;
+	if(crop != NULL) {
+		// clip to the crop rectangle
+		if(x < crop->left)	{ w -= crop->left - x; x = crop->left; }
+		if(y < crop->top)	{ h -= crop->top - y; y = crop->top; }
+		if(x + w > crop->right + 1)	w = crop->right + 1 - x;
+		if(y + h > crop->bottom + 1)	h = crop->bottom + 1 - y;
+		if(w <= 0 || h <= 0)
+			return;
+	}
+	if(XGetSubImage(display, rootWindow, x, y, w, h,
+			XAllPlanes(), ZPixmap, dst,
+			x - (crop ? crop->left : 0), y - (crop ? crop->top : 0)) == NULL) {
+		ga_error("FATAL: XGetSubImage failed.\n");
+		exit(-1);
+	}
+	return;
+}
+
+/**
+ * Update the shared image with the damaged regions.
+ *
+ * @return The number of damaged rectangles, 0 if nothing is changed,
+ *	or -1 if damage is not tracked and every frame must be captured.
+ *
+ * Small regions are fetched with XGetSubImage(), and large ones with
+ * a single XShmGetImage() of the whole screen. If the frame buffers are
+ * allocated by ga_xwin_alloc_buffer(), only the damage is recorded here,
+ * and ga_xwin_capture() fetches the regions into the buffers.
+ */
+int
+ga_xwin_update() {
+#ifdef HAVE_XDAMAGE
+	XRectangle *rects;
+	XEvent event;
+	int i, n = 0, full;
+	long long area = 0;
+	if(!damage_enabled)
+		return -1;
+	// drain the notifications: damage is polled
+	while(XCheckTypedEvent(display, damage_event_base + XDamageNotify, &event))
+		;
+	XDamageSubtract(display, damage, None, damage_region);
+	if((rects = XFixesFetchRegion(display, damage_region, &n)) == NULL)
+		n = 0;
+	full = (damage_gen == 0) || n > DAMAGE_MAX_RECTS
+		|| (damage_image_stale && xwin_buffers.empty());
+	for(i = 0; i < n && !full; i++)
+		area += rects[i].width * rects[i].height;
+	if(area * 4 > (long long) width * height)
+		full = 1;
+	if(n == 0 && !full) {
+		if(rects != NULL)
+			XFree(rects);
+		return 0;
+	}
+	// update the shared image
+	damage_gen++;
+	damage_history[damage_gen % DAMAGE_HISTORY].clear();
+	damage_full[damage_gen % DAMAGE_HISTORY] = (full != 0);
+	if(full) {
+		if(xwin_buffers.empty()) {
+			if(XShmGetImage(display, rootWindow, image, 0, 0, XAllPlanes()) == 0) {
+				ga_error("FATAL: XShmGetImage failed.\n");
+				exit(-1);
+			}
+			damage_image_stale = false;
+		}
+		damage_pending_full = true;
+	} else {
+		for(i = 0; i < n; i++) {
+			XRectangle r = rects[i];
+			// clip to the screen
+			if(r.x < 0)	{ r.width += r.x; r.x = 0; }
+			if(r.y < 0)	{ r.height += r.y; r.y = 0; }
+			if(r.x + r.width > width)	r.width = width - r.x;
+			if(r.y + r.height > height)	r.height = height - r.y;
+			if((short) r.width <= 0 || (short) r.height <= 0)
+				continue;
+			if(xwin_buffers.empty())
+				xwin_fetch(image, &r, NULL);
+			damage_history[damage_gen % DAMAGE_HISTORY].push_back(r);
+			damage_pending.push_back(r);
+		}
+	}
+	if(rects != NULL)
+		XFree(rects);
+	return full ? 1 : n;
+#else
+	return -1;
+#endif
+}
+
+/* Copy a region of the shared image (screen coordinates) into a frame */
+static void
+xwin_copy(char *buf, struct gaRect *rect, int x, int y, int w, int h) {
+	int i, linesize;
+	char *src, *dst;
+	if(rect != NULL) {
+		// clip to the crop rectangle
+		if(x < rect->left)	{ w -= rect->left - x; x = rect->left; }
+		if(y < rect->top)	{ h -= rect->top - y; y = rect->top; }
+		if(x + w > rect->right + 1)	w = rect->right + 1 - x;
+		if(y + h > rect->bottom + 1)	h = rect->bottom + 1 - y;
+		if(w <= 0 || h <= 0)
+			return;
+	}
+	linesize = rect ? rect->linesize : image->bytes_per_line;
+	src = image->data + image->bytes_per_line * y + RGBA_SIZE * x;
+	dst = buf + linesize * (y - (rect ? rect->top : 0))
+		+ RGBA_SIZE * (x - (rect ? rect->left : 0));
+	for(i = 0; i < h; i++) {
+		bcopy(src, dst, w * RGBA_SIZE);
+		src += image->bytes_per_line;
+		dst += linesize;
+	}
+	return;
+}
+
+/**
+ * Get the regions changed by the last ga_xwin_capture().
+ *
+ * @param rects [out] Changed rectangles, in frame coordinates.
+ * @param maxrects [in] Size of \a rects.
+ * @param crop [in] The crop rectangle passed to ga_xwin_capture(), or NULL.
+ * @return The number of rectangles, or -1 if the whole frame may be changed.
+ */
+int
+ga_xwin_damage_rects(struct gaRect *rects, int maxrects, struct gaRect *crop) {
+	unsigned int i;
+	int n = 0;
+	if(!damage_enabled || damage_last_full || (int) damage_last.size() > maxrects)
+		return -1;
+	for(i = 0; i < damage_last.size(); i++) {
+		const XRectangle *r = &damage_last[i];
+		int dx = crop ? crop->left : 0, dy = crop ? crop->top : 0;
+		rects[n].left = r->x - dx;
+		rects[n].top = r->y - dy;
+		rects[n].right = r->x + r->width - 1 - dx;
+		rects[n].bottom = r->y + r->height - 1 - dy;
+		n++;
+	}
+	return n;
+}
+
+static void
+xwin_buffer_free(xwin_buffer_t *xb) {
+	if(xb->attached)
+		XShmDetach(display, &xb->shminfo);
+	if(xb->shminfo.shmaddr != NULL)
+		shmdt(xb->shminfo.shmaddr);
+	if(xb->image != NULL) {
+		xb->image->data = NULL;	// not allocated by Xlib
+		XDestroyImage(xb->image);
+	}
+	free(xb);
+	return;
+}
+
+/**
+ * Allocate a frame buffer as an XShm segment.
+ *
+ * @param rect [in] The crop rectangle passed to ga_xwin_capture(), or NULL.
+ * @param stride [out] Bytes per line of the buffer.
+ * @return Pointer to the buffer, or NULL on error.
+ *
+ * ga_xwin_capture() asks the X server to write the screen, or the crop
+ * rectangle, directly into the buffer instead of copying it from the
+ * shared image. The buffers are released by ga_xwin_free_buffers().
+ */
+char *
+ga_xwin_alloc_buffer(struct gaRect *rect, int *stride) {
+	xwin_buffer_t *xb;
+	if((xb = (xwin_buffer_t*) malloc(sizeof(xwin_buffer_t))) == NULL)
+		return NULL;
+	bzero(xb, sizeof(xwin_buffer_t));
+	if((xb->image = XShmCreateImage(display,
+			XDefaultVisual(display, screenNumber),
+			depth, ZPixmap, NULL, &xb->shminfo,
+			rect ? rect->width : width,
+			rect ? rect->height : height)) == NULL) {
+		ga_error("XShmCreateImage failed.\n");
+		goto alloc_error;
+	}
+	if((xb->shminfo.shmid = shmget(IPC_PRIVATE,
+				xb->image->bytes_per_line * xb->image->height,
+				IPC_CREAT | 0600)) < 0) {
+		perror("shmget");
+		goto alloc_error;
+	}
+	xb->shminfo.shmaddr = (char*) shmat(xb->shminfo.shmid, 0, 0);
+	if(xb->shminfo.shmaddr == (char*) -1) {
+		perror("shmat");
+		xb->shminfo.shmaddr = NULL;
+		shmctl(xb->shminfo.shmid, IPC_RMID, NULL);
+		goto alloc_error;
+	}
+	xb->image->data = xb->shminfo.shmaddr;
+	xb->shminfo.readOnly = False;
+	if(XShmAttach(display, &xb->shminfo) == 0) {
+		ga_error("XShmAttach failed.\n");
+		shmctl(xb->shminfo.shmid, IPC_RMID, NULL);
+		goto alloc_error;
+	}
+	xb->attached = true;
+	// the segment is removed once both sides detach
+	XSync(display, False);
+	shmctl(xb->shminfo.shmid, IPC_RMID, NULL);
+	xwin_buffers[xb->image->data] = xb;
+	*stride = xb->image->bytes_per_line;
+	return xb->image->data;
+alloc_error:
+	xwin_buffer_free(xb);
+	return NULL;
+}
+
+/* Release all the buffers allocated by ga_xwin_alloc_buffer() */
+void
+ga_xwin_free_buffers() {
+	map<char*, xwin_buffer_t*>::iterator bi;
+	for(bi = xwin_buffers.begin(); bi != xwin_buffers.end(); bi++) {
+		damage_bufgen.erase(bi->first);
+		xwin_buffer_free(bi->second);
+	}
+	// the shared image is not updated while the buffers are in use
+	if(!xwin_buffers.empty())
+		damage_image_stale = true;
+	xwin_buffers.clear();
+	return;
+}
+
 void
 ga_xwin_capture(char *buf, int buflen, struct gaRect *rect) {
 	int frameSize = image->height * image->bytes_per_line;
-	if(buflen < frameSize) {
+	map<char*, unsigned int>::iterator mi;
+	map<char*, xwin_buffer_t*>::iterator bi;
+	xwin_buffer_t *xb = NULL;
+	unsigned int g, held = 0;
+	if((bi = xwin_buffers.find(buf)) != xwin_buffers.end())
+		xb = bi->second;
+	if(xb == NULL && buflen < frameSize) {
 		ga_error("FATAL: insufficient buffer size\n");
 		exit(-1);
 	}
-	if(XShmGetImage(display, rootWindow, image, 0, 0, XAllPlanes()) == 0) {
+	if(damage_enabled) {
+		// the damage is recorded by ga_xwin_update()
+		if(damage_gen == 0)
+			ga_xwin_update();
+		damage_last.swap(damage_pending);
+		damage_last_full = damage_pending_full;
+		damage_pending.clear();
+		damage_pending_full = false;
+		if((mi = damage_bufgen.find(buf)) != damage_bufgen.end())
+			held = mi->second;
+		damage_bufgen[buf] = damage_gen;
+		// the shared image is not updated if the buffers are XShm segments
+		if(xb == NULL && !xwin_buffers.empty())
+			held = 0;
+		// the buffer is up to date, or only misses a few generations
+		if(held > 0 && damage_gen - held < DAMAGE_HISTORY) {
+			for(g = held + 1; g <= damage_gen; g++) {
+				if(damage_full[g % DAMAGE_HISTORY])
+					break;
+			}
+			if(g > damage_gen) {
+				for(g = held + 1; g <= damage_gen; g++) {
+					vector<XRectangle> &h = damage_history[g % DAMAGE_HISTORY];
+					for(unsigned int i = 0; i < h.size(); i++) {
+						if(xb != NULL)
+							xwin_fetch(xb->image, &h[i], rect);
+						else
+							xwin_copy(buf, rect, h[i].x, h[i].y, h[i].width, h[i].height);
+					}
+				}
+				return;
+			}
+		}
+	}
+	// capture directly into the buffer
+	if(xb != NULL) {
+		if(XShmGetImage(display, rootWindow, xb->image,
+				rect ? rect->left : 0, rect ? rect->top : 0, XAllPlanes()) == 0) {
+			ga_error("FATAL: XShmGetImage failed.\n");
+			exit(-1);
+		}
+		return;
+	}
+	if((!damage_enabled || !xwin_buffers.empty())
+	&& XShmGetImage(display, rootWindow, image, 0, 0, XAllPlanes()) == 0) {
 		ga_error("FATAL: XShmGetImage failed.\n");
 		exit(-1);
 	}
@@ -173,4 +684,3 @@ ga_xwin_capture(char *buf, int buflen, struct gaRect *rect) {
 	}
 	return;
 }
-
@@ -34,6 +34,16 @@ int	ga_xwin_init(const char *displayname, gaImage *gaimg);
 void	ga_xwin_deinit();
 void	ga_xwin_imageinfo(XImage *image);
 void	ga_xwin_capture(char *buf, int buflen, struct gaRect *rect);
+int	ga_xwin_damage_init();
+int	ga_xwin_damage_enabled();
+int	ga_xwin_update();
+int	ga_xwin_damage_rects(struct gaRect *rects, int maxrects, struct gaRect *crop);
+char *	ga_xwin_alloc_buffer(struct gaRect *rect, int *stride);
+void	ga_xwin_free_buffers();
+int	ga_xwin_cursor_init();
+int	ga_xwin_cursor_changed();
+unsigned char *	ga_xwin_cursor_image(int *width, int *height, int *xhot, int *yhot);
+int	ga_xwin_cursor_position(int *x, int *y);
 #ifdef __cplusplus
 }
 #endif
@@ -27,10 +27,13 @@
 
 #include "vsource.h"
 #include "dpipe.h"
+#include "controller.h"
 #include "encoder-common.h"
 #include "rtspconf.h"
 
 #include "ga-common.h"
+#include "ga-conf.h"
+#include "ga-pacer.h"
 
 #ifdef WIN32
 #include "ga-win32-common.h"
@@ -52,6 +55,7 @@
 #include "vsource-desktop.h"
 
 #define	SOURCES			1
+#define	MAX_DAMAGE_RECTS	64	/* more changed rectangles: the whole frame */
 //#define	ENABLE_EMBED_COLORCODE	1	/* XXX: enabled at the filter, not here */
 
 using namespace std;
@@ -59,6 +63,7 @@ using namespace std;
 static struct gaRect croprect;
 static struct gaRect *prect = NULL;
 static int screenwidth, screenheight;
+static int framestride;
 
 static struct gaImage realimage, *image = &realimage;
 
@@ -71,9 +76,156 @@ static int vsource_framerate_n = -1;
 static int vsource_framerate_d = -1;
 static int vsource_reconfigured = 0;
 
+#if !defined(WIN32) && !defined(__APPLE__)
+/* X11: frame buffers replaced by XShm segments */
+static vsource_frame_t *xshmframe[VIDEO_SOURCE_POOLSIZE];
+static unsigned char *xshmsaved[VIDEO_SOURCE_POOLSIZE];
+static int xshmsavedsize[VIDEO_SOURCE_POOLSIZE];
+static int xshmframes = 0;
+/* X11: the cursor is sent to the client as control messages */
+static int cursormeta = 0;
+#endif
+
 /* video source has to send images to video-# pipes */
 /* the format is defined in VIDEO_SOURCE_PIPEFORMAT */
 
+#if !defined(WIN32) && !defined(__APPLE__)
+/* Restore the frame buffers allocated by the pipe */
+static void
+vsource_detach_xshm() {
+	int i;
+	for(i = 0; i < xshmframes; i++) {
+		xshmframe[i]->imgbuf = xshmsaved[i];
+		xshmframe[i]->imgbufsize = xshmsavedsize[i];
+	}
+	xshmframes = 0;
+	ga_xwin_free_buffers();
+	return;
+}
+
+/*
+ * Let the X server write the captured frames into the pipe buffers:
+ * the image buffer of each frame is replaced by an XShm segment.
+ */
+static int
+vsource_attach_xshm() {
+	char pipename[64];
+	dpipe_t *pipe;
+	dpipe_buffer_t *data;
+	vsource_frame_t *frame;
+	unsigned char *buf;
+	int stride;
+	//
+	snprintf(pipename, sizeof(pipename), VIDEO_SOURCE_PIPEFORMAT, 0);
+	if((pipe = dpipe_lookup(pipename)) == NULL)
+		return -1;
+	// the segments are not mapped in other processes
+	if(pipe->shm != NULL)
+		return -1;
+	// the frames must be allocated, and kept, before they are replaced
+	if(dpipe_preallocate(pipe) < 0)
+		goto attach_error;
+	for(data = pipe->in; data != NULL; data = data->next) {
+		if(xshmframes >= VIDEO_SOURCE_POOLSIZE)
+			goto attach_error;
+		frame = (vsource_frame_t*) data->pointer;
+		if((buf = (unsigned char*) ga_xwin_alloc_buffer(prect, &stride)) == NULL)
+			goto attach_error;
+		xshmframe[xshmframes] = frame;
+		xshmsaved[xshmframes] = frame->imgbuf;
+		xshmsavedsize[xshmframes] = frame->imgbufsize;
+		xshmframes++;
+		frame->imgbuf = buf;
+		frame->imgbufsize = stride * (prect ? prect->height : screenheight);
+		// the downstream modules are configured with the pipe stride
+		if(stride != framestride) {
+			ga_error("video source: XShm stride %d mismatched (%d).\n", stride, framestride);
+			goto attach_error;
+		}
+	}
+	ga_error("video source: capture into %d XShm frame buffers.\n", xshmframes);
+	return 0;
+attach_error:
+	ga_error("video source: XShm frame buffers disabled.\n");
+	vsource_detach_xshm();
+	return -1;
+}
+
+/*
+ * Allocate all the frames of video-0 and never release them. Without
+ * XShm buffers, ga_xwin_capture() only copies the regions damaged since
+ * a frame was last captured, which requires the frame to be kept.
+ */
+static int
+vsource_keep_frames() {
+	char pipename[64];
+	dpipe_t *pipe;
+	//
+	snprintf(pipename, sizeof(pipename), VIDEO_SOURCE_PIPEFORMAT, 0);
+	if((pipe = dpipe_lookup(pipename)) == NULL)
+		return -1;
+	if(dpipe_preallocate(pipe) < 0) {
+		ga_error("video source: cannot allocate the frames of %s.\n", pipename);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Send the cursor image and position to the client, if they are changed.
+ * The position is in the coordinates of the output video.
+ */
+static void
+vsource_update_cursor() {
+	static ctrlmsg_system_cursorshape_t shape;
+	static int lastclient = 0, lastx = -1, lasty = -1, lastvisible = -1;
+	static int shapepending = 1;
+	static unsigned int serial = 0;
+	ctrlmsg_t msg;
+	unsigned char *pixels;
+	int client, size, x, y, visible, w, h, xhot, yhot;
+	//
+	if((client = ctrl_server_client()) == 0)
+		return;
+	// a new client needs the current image
+	if(client != lastclient) {
+		lastclient = client;
+		shapepending = 1;
+	}
+	if(ga_xwin_cursor_changed() > 0)
+		shapepending = 1;
+	if(shapepending
+	&& (pixels = ga_xwin_cursor_image(&w, &h, &xhot, &yhot)) != NULL
+	&& (size = ctrlsys_cursorshape(&shape, serial + 1, w, h, xhot, yhot, pixels)) > 0) {
+		// retried at the next frame if not sent
+		if(ctrl_server_sendmsg(&shape, size) == size) {
+			serial++;
+			shapepending = 0;
+			lastvisible = -1;
+		}
+	}
+	//
+	visible = ga_xwin_cursor_position(&x, &y);
+	if(prect != NULL) {
+		x -= prect->left;
+		y -= prect->top;
+	}
+	if(x < 0 || y < 0 || x >= video_source_curr_width(0) || y >= video_source_curr_height(0))
+		visible = 0;
+	x = x * video_source_out_width(0) / video_source_curr_width(0);
+	y = y * video_source_out_height(0) / video_source_curr_height(0);
+	if(x == lastx && y == lasty && visible == lastvisible)
+		return;
+	ctrlsys_cursor(&msg, serial, x, y, visible);
+	if(ctrl_server_sendmsg(&msg, sizeof(ctrlmsg_system_cursor_t)) > 0) {
+		lastx = x;
+		lasty = y;
+		lastvisible = visible;
+	}
+	return;
+}
+#endif
+
 /*
  * vsource_init(void *arg)
  * arg is a pointer to a gaRect (if cropping is enabled)
@@ -135,19 +287,22 @@ vsource_init(void *arg) {
 
 	screenwidth = image->width;
 	screenheight = image->height;
+	framestride = prect ? prect->linesize : image->bytes_per_line;
 
 #ifdef SOURCES
 	do {
 		int i;
-		vsource_config_t config[SOURCES];
+		int sources = video_source_config_channels();
+		vsource_config_t config[VIDEO_SOURCE_CHANNEL_MAX];
 		bzero(config, sizeof(config));
-		for(i = 0; i < SOURCES; i++) {
+		for(i = 0; i < sources; i++) {
 			//config[i].rtp_id = i;
 			config[i].curr_width = prect ? prect->width : image->width;
 			config[i].curr_height = prect ? prect->height : image->height;
 			config[i].curr_stride = prect ? prect->linesize : image->bytes_per_line;
+			config[i].broadcast = (i > 0);
 		}
-		if(video_source_setup_ex(config, SOURCES) < 0) {
+		if(video_source_setup_ex(config, sources) < 0) {
 			return -1;
 		}
 	} while(0);
@@ -158,6 +313,17 @@ vsource_init(void *arg) {
 			prect ? prect->linesize : image->bytes_per_line) < 0) {
 		return -1;
 	}
+#endif
+#if !defined(WIN32) && !defined(__APPLE__)
+	if(ga_conf_readbool("desktop-xshm-buffers", 1) != 0)
+		vsource_attach_xshm();
+	// damaged regions are copied into frames that must not be released
+	if(xshmframes == 0 && ga_xwin_damage_enabled())
+		vsource_keep_frames();
+	cursormeta = 0;
+	if(ga_conf_readbool("desktop-cursor-metadata", 1) != 0
+	&& ga_xwin_cursor_init() == 0)
+		cursormeta = 1;
 #endif
 	//
 	vsource_initialized = 1;
@@ -170,14 +336,24 @@ vsource_init(void *arg) {
 static void *
 vsource_threadproc(void *arg) {
 	int i;
-	int token;
 	int frame_interval;
 	struct timeval tv;
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
-	dpipe_t *pipe[SOURCES];
-	struct timeval initialTv, lastTv, captureTv;
+	dpipe_t *pipe[VIDEO_SOURCE_CHANNEL_MAX];
+	ga_pacer_t pacer;
+	long long initialTime, captureTime;
 	struct RTSPConf *rtspconf = rtspconf_global();
+#if !defined(WIN32) && !defined(__APPLE__)
+	struct gaRect damage[MAX_DAMAGE_RECTS];
+	long long lastDelivered = 0, refresh;
+	int outW = 0, outH = 0, newW, newH;
+	// deliver a frame at least every refresh interval, even if nothing is changed
+	if((refresh = ga_conf_readint("desktop-damage-refresh")) <= 0)
+		refresh = 1000;
+	refresh *= 1000000LL;
+	video_source_out_resolution(0, &outW, &outH);
+#endif
 	// reset framerate setup
 	vsource_framerate_n = rtspconf->video_fps;
 	vsource_framerate_d = 1;
@@ -185,10 +361,14 @@ vsource_threadproc(void *arg) {
 	//
 	frame_interval = 1000000/rtspconf->video_fps;	// in the unif of us
 	frame_interval++;
+	if(ga_pacer_init(&pacer, "video-source", vsource_framerate_n, vsource_framerate_d) == NULL) {
+		ga_error("video source: invalid frame rate %d.\n", vsource_framerate_n);
+		exit(-1);
+	}
 #ifdef ENABLE_EMBED_COLORCODE
 	vsource_embed_colorcode_reset();
 #endif
-	for(i = 0; i < SOURCES; i++) {
+	for(i = 0; i < video_source_channels(); i++) {
 		char pipename[64];
 		snprintf(pipename, sizeof(pipename), VIDEO_SOURCE_PIPEFORMAT, i);
 		if((pipe[i] = dpipe_lookup(pipename)) == NULL) {
@@ -198,9 +378,7 @@ vsource_threadproc(void *arg) {
 	}
 	//
 	ga_error("video source thread started: tid=%ld\n", ga_gettid());
-	gettimeofday(&initialTv, NULL);
-	lastTv = initialTv;
-	token = frame_interval;
+	initialTime = ga_clock_ns();
 	while(vsource_started != 0) {
 		// encoder has not launched?
 		if(encoder_running() == 0) {
@@ -209,27 +387,26 @@ vsource_threadproc(void *arg) {
 #else
 			usleep(1000);
 #endif
-			gettimeofday(&lastTv, NULL);
-			token = frame_interval;
+			ga_pacer_reset(&pacer);
 			continue;
 		}
-		// token bucket based capturing
-		gettimeofday(&captureTv, NULL);
-		token += tvdiff_us(&captureTv, &lastTv);
-		if(token > (frame_interval<<1)) {
-			token = (frame_interval<<1);
-		}
-		lastTv = captureTv;
-		//
-		if(token < frame_interval) {
-#ifdef WIN32
-			Sleep(1);
-#else
-			usleep(1000);
-#endif
+		// wait for the next frame
+		ga_pacer_wait(&pacer);
+		captureTime = ga_clock_ns();
+#if !defined(WIN32) && !defined(__APPLE__)
+		// the cursor is not in the frames
+		if(cursormeta)
+			vsource_update_cursor();
+		// skip the capture if the screen is not damaged,
+		// but a new output resolution needs a frame to take effect
+		video_source_out_resolution(0, &newW, &newH);
+		if(ga_xwin_update() == 0 && captureTime - lastDelivered < refresh
+		&& newW == outW && newH == outH)
 			continue;
-		}
-		token -= frame_interval;
+		lastDelivered = captureTime;
+		outW = newW;
+		outH = newH;
+#endif
 		// copy image 
 		data = dpipe_get(pipe[0]);
 		frame = (vsource_frame_t*) data->pointer;
@@ -242,14 +419,14 @@ vsource_threadproc(void *arg) {
 		////////////////////////////////////////
 		frame->realwidth = screenwidth;
 		frame->realheight = screenheight;
-		frame->realstride = screenwidth<<2;
+		frame->realstride = framestride;
 		frame->realsize = screenheight * frame->realstride;
 		////////////////////////////////////////
 		} else {
 		////////////////////////////////////////
 		frame->realwidth = prect->width;
 		frame->realheight = prect->height;
-		frame->realstride = prect->width<<2;
+		frame->realstride = framestride;
 		frame->realsize = prect->height * frame->realstride;
 		////////////////////////////////////////
 		}
@@ -266,34 +443,27 @@ vsource_threadproc(void *arg) {
 		ga_osx_capture((char*) frame->imgbuf, frame->imgbufsize, prect);
 #else // X11
 		ga_xwin_capture((char*) frame->imgbuf, frame->imgbufsize, prect);
+		vsource_set_tilemap_rects(frame, damage,
+			ga_xwin_damage_rects(damage, MAX_DAMAGE_RECTS, prect));
 #endif
 		// draw cursor
 #ifdef WIN32
 		ga_win32_draw_system_cursor(frame);
 #endif
 		//gImgPts++;
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
 		// embed color code?
 #ifdef ENABLE_EMBED_COLORCODE
 		vsource_embed_colorcode_inc(frame);
 #endif
-		// duplicate from channel 0 to other channels
-		for(i = 1; i < SOURCES; i++) {
-			dpipe_buffer_t *dupdata;
-			vsource_frame_t *dupframe;
-			dupdata = dpipe_get(pipe[i]);
-			dupframe = (vsource_frame_t*) dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
-			dpipe_store(pipe[i], dupdata);
-		}
+		// other channels subscribe to channel 0
 		dpipe_store(pipe[0], data);
 		// reconfigured?
 		if(vsource_reconfigured != 0) {
 			frame_interval = (int) (1000000.0 * vsource_framerate_d / vsource_framerate_n);
 			frame_interval++;
+			ga_pacer_set_rate(&pacer, vsource_framerate_n, vsource_framerate_d);
 			vsource_reconfigured = 0;
 			ga_error("video source: reconfigured - framerate=%d/%d (interval=%d)\n",
 				vsource_framerate_n, vsource_framerate_d, frame_interval);
@@ -322,6 +492,7 @@ vsource_deinit(void *arg) {
 	ga_osx_deinit();
 #else
 	//ga_xwin_deinit(display, image);
+	vsource_detach_xshm();
 	ga_xwin_deinit();
 #endif
 	vsource_initialized = 0;
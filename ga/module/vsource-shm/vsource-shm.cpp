@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2013-2014 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * A video source that receives frames captured by another process,
+ * e.g., a hooked game running with video-source-shm enabled.
+ * The frames are loaded from shared-memory pipes without copying,
+ * so the filter and the encoders run as usual in this process.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "vsource.h"
+#include "ga-common.h"
+#include "ga-conf.h"
+#include "ga-module.h"
+
+#define	VSOURCE_SHM_DEF_WAIT	30	/* seconds to wait for the producer */
+
+static int vsource_initialized = 0;
+
+/*
+ * vsource_init(void *arg)
+ * arg is not used: cropping is done by the capturing process
+ */
+static int
+vsource_init(void *arg) {
+	int i, wait;
+	//
+	if(vsource_initialized != 0)
+		return 0;
+	if((wait = ga_conf_readint("video-source-shm-wait")) <= 0)
+		wait = VSOURCE_SHM_DEF_WAIT;
+	// the capturing process may not have created the pipes yet
+	for(i = 0; i < wait * 10; i++) {
+		if(video_source_attach_shm() == 0)
+			break;
+		if(i == 0)
+			ga_error("video source: waiting for the capturing process ...\n");
+		usleep(100000);
+	}
+	if(i >= wait * 10) {
+		ga_error("video source: no shared video source found in %d seconds.\n", wait);
+		return -1;
+	}
+	ga_error("video source: %d shared channel(s) attached.\n", video_source_channels());
+	//
+	vsource_initialized = 1;
+	return 0;
+}
+
+static int
+vsource_start(void *arg) {
+	// frames are produced by the capturing process
+	return 0;
+}
+
+static int
+vsource_ioctl(int command, int argsize, void *arg) {
+	if(vsource_initialized == 0)
+		return GA_IOCTL_ERR_NOTINITIALIZED;
+	// the capture rate is controlled by the capturing process
+	return GA_IOCTL_ERR_NOTSUPPORTED;
+}
+
+ga_module_t *
+module_load() {
+	static ga_module_t m;
+	bzero(&m, sizeof(m));
+	m.type = GA_MODULE_TYPE_VSOURCE;
+	m.name = strdup("vsource-shm");
+	m.init = vsource_init;
+	m.start = vsource_start;
+	m.ioctl = vsource_ioctl;
+	return &m;
+}
+
@@ -0,0 +1,643 @@
+/*
+ * Copyright (c) 2013-2014 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Synthetic video source: frames are generated, or replayed from a file,
+ * instead of being captured, so the pipeline can be run without a display.
+ * The content of frame #n depends only on n and the configuration,
+ * so two runs with the same configuration produce the same frames.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "vsource.h"
+#include "dpipe.h"
+#include "encoder-common.h"
+#include "rtspconf.h"
+
+#include "ga-common.h"
+#include "ga-conf.h"
+#include "ga-module.h"
+#include "ga-pacer.h"
+
+#include "ga-avcodec.h"
+
+#define	SYNTHETIC_DEF_WIDTH	1280
+#define	SYNTHETIC_DEF_HEIGHT	720
+#define	SYNTHETIC_DEF_SEED	1
+#define	SYNTHETIC_SCROLL_SPEED	2	/* scrolled pixels per frame */
+#define	SYNTHETIC_LINE_HEIGHT	10	/* 8x8 glyphs + 2 blank rows */
+
+enum {
+	PATTERN_GRADIENT = 0,	/* moving color gradients */
+	PATTERN_SCROLL,		/* a scrolling text console */
+	PATTERN_NOISE,		/* random pixels, the worst case for encoders */
+	PATTERN_STATIC,		/* the same frame over and over */
+	PATTERN_FILE		/* raw or Y4M frames read from a file */
+};
+
+static int pattern = PATTERN_GRADIENT;
+static int width, height;
+static enum PixelFormat pixelformat = PIX_FMT_BGRA;
+static unsigned int seed = SYNTHETIC_DEF_SEED;
+static int colorcode = 0;
+
+/* file replay */
+static FILE *replayfp = NULL;
+static long replaystart = 0;	/* offset of the first frame */
+static int replayy4m = 0;
+static int replayloop = 1;
+
+static int vsource_initialized = 0;
+static int vsource_started = 0;
+static pthread_t vsource_tid;
+
+/* support reconfiguration of frame rate */
+static int vsource_framerate_n = -1;
+static int vsource_framerate_d = -1;
+static int vsource_reconfigured = 0;
+
+/* 8x8 glyphs of hex digits, the most significant bit is the left-most pixel */
+static const unsigned char hexfont[16][8] = {
+	{ 0x3c, 0x66, 0x6e, 0x76, 0x66, 0x66, 0x3c, 0x00 },	/* 0 */
+	{ 0x18, 0x38, 0x18, 0x18, 0x18, 0x18, 0x7e, 0x00 },	/* 1 */
+	{ 0x3c, 0x66, 0x06, 0x0c, 0x30, 0x60, 0x7e, 0x00 },	/* 2 */
+	{ 0x3c, 0x66, 0x06, 0x1c, 0x06, 0x66, 0x3c, 0x00 },	/* 3 */
+	{ 0x0c, 0x1c, 0x3c, 0x6c, 0x7e, 0x0c, 0x0c, 0x00 },	/* 4 */
+	{ 0x7e, 0x60, 0x7c, 0x06, 0x06, 0x66, 0x3c, 0x00 },	/* 5 */
+	{ 0x3c, 0x66, 0x60, 0x7c, 0x66, 0x66, 0x3c, 0x00 },	/* 6 */
+	{ 0x7e, 0x66, 0x0c, 0x18, 0x18, 0x18, 0x18, 0x00 },	/* 7 */
+	{ 0x3c, 0x66, 0x66, 0x3c, 0x66, 0x66, 0x3c, 0x00 },	/* 8 */
+	{ 0x3c, 0x66, 0x66, 0x3e, 0x06, 0x66, 0x3c, 0x00 },	/* 9 */
+	{ 0x18, 0x3c, 0x66, 0x7e, 0x66, 0x66, 0x66, 0x00 },	/* A */
+	{ 0x7c, 0x66, 0x66, 0x7c, 0x66, 0x66, 0x7c, 0x00 },	/* B */
+	{ 0x3c, 0x66, 0x60, 0x60, 0x60, 0x66, 0x3c, 0x00 },	/* C */
+	{ 0x78, 0x6c, 0x66, 0x66, 0x66, 0x6c, 0x78, 0x00 },	/* D */
+	{ 0x7e, 0x60, 0x60, 0x78, 0x60, 0x60, 0x7e, 0x00 },	/* E */
+	{ 0x7e, 0x60, 0x60, 0x78, 0x60, 0x60, 0x60, 0x00 }	/* F */
+};
+
+/* xorshift32: a tiny PRNG that is the same on all platforms */
+static unsigned int
+synthetic_rand(unsigned int *state) {
+	unsigned int x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return (*state = x);
+}
+
+/* Pointers to the planes of a frame */
+static void
+synthetic_planes(vsource_frame_t *frame, unsigned char *plane[3]) {
+	plane[0] = vsource_frame_plane(frame, 0);
+	plane[1] = vsource_frame_plane(frame, 1);
+	plane[2] = vsource_frame_plane(frame, 2);
+	return;
+}
+
+/* Number of planes, and the size of each plane without padding */
+static int
+synthetic_plane_size(int plane, int *rowbytes, int *rows) {
+	if(pixelformat == PIX_FMT_BGRA) {
+		*rowbytes = width * 4;
+		*rows = height;
+		return 1;
+	}
+	*rowbytes = plane == 0 ? width : width / 2;
+	*rows = plane == 0 ? height : height / 2;
+	return 3;
+}
+
+static void
+synthetic_gradient(vsource_frame_t *frame, unsigned int n) {
+	unsigned char *plane[3], *dst;
+	int x, y;
+	//
+	synthetic_planes(frame, plane);
+	if(pixelformat == PIX_FMT_BGRA) {
+		for(y = 0; y < height; y++) {
+			dst = plane[0] + y * frame->linesize[0];
+			for(x = 0; x < width; x++) {
+				*dst++ = (unsigned char) (x + 2 * n);
+				*dst++ = (unsigned char) (y + n);
+				*dst++ = (unsigned char) (((x + y) >> 1) + 3 * n);
+				*dst++ = 0xff;
+			}
+		}
+		return;
+	}
+	for(y = 0; y < height; y++) {
+		dst = plane[0] + y * frame->linesize[0];
+		for(x = 0; x < width; x++)
+			*dst++ = (unsigned char) (((x + y) >> 1) + 2 * n);
+	}
+	for(y = 0; y < height / 2; y++) {
+		unsigned char *u = plane[1] + y * frame->linesize[1];
+		unsigned char *v = plane[2] + y * frame->linesize[2];
+		for(x = 0; x < width / 2; x++) {
+			*u++ = (unsigned char) (2 * x + n);
+			*v++ = (unsigned char) (2 * y + 3 * n);
+		}
+	}
+	return;
+}
+
+/*
+ * A console filled with lines of hex dumps, scrolled upward.
+ * Line L is "LLLLLLLL hhhhhhhh hhhhhhhh ...", where h are random digits
+ * seeded by L, so a line looks the same whenever it is on the screen.
+ */
+static void
+synthetic_scroll(vsource_frame_t *frame, unsigned int n) {
+	static signed char *text = NULL;
+	static int textsize = 0;
+	unsigned char *plane[3], *dst;
+	unsigned int line, lastline = (unsigned int) -1, state;
+	int x, y, gy, cols = width / 8;
+	//
+	if(text == NULL || textsize < cols) {
+		free(text);
+		if((text = (signed char*) malloc(cols)) == NULL) {
+			textsize = 0;
+			return;
+		}
+		textsize = cols;
+	}
+	synthetic_planes(frame, plane);
+	for(y = 0; y < height; y++) {
+		unsigned int ay = y + n * SYNTHETIC_SCROLL_SPEED;
+		line = ay / SYNTHETIC_LINE_HEIGHT;
+		gy = ay % SYNTHETIC_LINE_HEIGHT;
+		// the text of the line: -1 is a blank
+		if(line != lastline) {
+			state = (line ^ seed) * 2654435761U;
+			if(state == 0)
+				state = 1;
+			for(x = 0; x < cols; x++) {
+				if(x < 8)
+					text[x] = (line >> ((7 - x) * 4)) & 0x0f;
+				else if(x % 9 == 8)
+					text[x] = -1;
+				else
+					text[x] = synthetic_rand(&state) & 0x0f;
+			}
+			lastline = line;
+		}
+		dst = plane[0] + y * frame->linesize[0];
+		for(x = 0; x < width; x++) {
+			int c = x / 8;
+			unsigned char on = 0;
+			if(c < cols && gy < 8 && text[c] >= 0)
+				on = (hexfont[(int) text[c]][gy] >> (7 - (x % 8))) & 1;
+			if(pixelformat == PIX_FMT_BGRA) {
+				*dst++ = on ? 0x40 : 0x20;	// green on dark grey
+				*dst++ = on ? 0xe0 : 0x20;
+				*dst++ = on ? 0x40 : 0x20;
+				*dst++ = 0xff;
+			} else {
+				*dst++ = on ? 0xa0 : 0x20;
+			}
+		}
+	}
+	if(pixelformat == PIX_FMT_YUV420P) {
+		for(y = 0; y < height / 2; y++) {
+			memset(plane[1] + y * frame->linesize[1], 0x80, width / 2);
+			memset(plane[2] + y * frame->linesize[2], 0x80, width / 2);
+		}
+	}
+	return;
+}
+
+static void
+synthetic_noise(vsource_frame_t *frame, unsigned int n) {
+	unsigned int state = (n + 1) * 2654435761U ^ seed;
+	unsigned char *plane[3];
+	int i, x, y, nplanes, rowbytes, rows;
+	//
+	if(state == 0)
+		state = 1;
+	synthetic_planes(frame, plane);
+	nplanes = synthetic_plane_size(0, &rowbytes, &rows);
+	for(i = 0; i < nplanes; i++) {
+		synthetic_plane_size(i, &rowbytes, &rows);
+		for(y = 0; y < rows; y++) {
+			// rows start at aligned addresses
+			unsigned int *dst = (unsigned int*) (plane[i] + y * frame->linesize[i]);
+			for(x = 0; x < rowbytes / 4; x++)
+				dst[x] = synthetic_rand(&state);
+			if(pixelformat == PIX_FMT_BGRA) {
+				for(x = 0; x < rowbytes / 4; x++)
+					dst[x] |= 0xff000000;	// opaque, little endian
+			} else if(rowbytes % 4 != 0) {
+				unsigned int r = synthetic_rand(&state);
+				bcopy(&r, dst + x, rowbytes % 4);
+			}
+		}
+	}
+	return;
+}
+
+/* Read the planes of a frame stored without padding */
+static int
+synthetic_read_planes(vsource_frame_t *frame) {
+	unsigned char *plane[3];
+	int i, y, nplanes, rowbytes, rows;
+	//
+	synthetic_planes(frame, plane);
+	nplanes = synthetic_plane_size(0, &rowbytes, &rows);
+	for(i = 0; i < nplanes; i++) {
+		synthetic_plane_size(i, &rowbytes, &rows);
+		for(y = 0; y < rows; y++) {
+			if(fread(plane[i] + y * frame->linesize[i], rowbytes, 1, replayfp) != 1)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/* Read the next frame from the replayed file */
+static int
+synthetic_file(vsource_frame_t *frame) {
+	char line[256];
+	int retry;
+	//
+	for(retry = 0; retry < 2; retry++) {
+		if(replayy4m) {
+			if(fgets(line, sizeof(line), replayfp) != NULL
+			&& strncmp(line, "FRAME", 5) == 0
+			&& synthetic_read_planes(frame) == 0)
+				return 0;
+		} else {
+			if(synthetic_read_planes(frame) == 0)
+				return 0;
+		}
+		// end of file
+		if(replayloop == 0)
+			return -1;
+		fseek(replayfp, replaystart, SEEK_SET);
+	}
+	ga_error("video source: read synthetic-file failed.\n");
+	return -1;
+}
+
+/*
+ * Parse the header of a YUV4MPEG2 file,
+ * e.g., "YUV4MPEG2 W1280 H720 F30000:1001 Ip A1:1 C420jpeg".
+ */
+static int
+synthetic_y4m_header(char *header) {
+	char *token;
+	int fn = 0, fd = 0;
+	//
+	width = height = 0;
+	for(token = strtok(header, " \r\n"); token != NULL; token = strtok(NULL, " \r\n")) {
+		switch(token[0]) {
+		case 'W':
+			width = strtol(token + 1, NULL, 10);
+			break;
+		case 'H':
+			height = strtol(token + 1, NULL, 10);
+			break;
+		case 'F':
+			sscanf(token + 1, "%d:%d", &fn, &fd);
+			break;
+		case 'C':
+			if(strncmp(token + 1, "420", 3) != 0) {
+				ga_error("video source: unsupported Y4M colorspace '%s'.\n", token + 1);
+				return -1;
+			}
+			break;
+		case 'I':
+			if(token[1] != 'p' && token[1] != '?')
+				ga_error("video source: interlaced Y4M file, played as progressive.\n");
+			break;
+		}
+	}
+	if(fn > 0 && fd > 0) {
+		ga_error("video source: Y4M file recorded at %d/%d fps, replayed at video-fps.\n", fn, fd);
+	}
+	pixelformat = PIX_FMT_YUV420P;
+	return 0;
+}
+
+static int
+synthetic_open_file() {
+	char filename[1024], header[1024];
+	//
+	if(ga_conf_readv("synthetic-file", filename, sizeof(filename)) == NULL) {
+		ga_error("video source: synthetic-file is not specified.\n");
+		return -1;
+	}
+	if((replayfp = fopen(filename, "rb")) == NULL) {
+		ga_error("video source: open %s failed.\n", filename);
+		return -1;
+	}
+	replayloop = ga_conf_readbool("synthetic-file-loop", 1);
+	replayy4m = 0;
+	if(fgets(header, sizeof(header), replayfp) != NULL
+	&& strncmp(header, "YUV4MPEG2 ", 10) == 0) {
+		replayy4m = 1;
+		if(synthetic_y4m_header(header + 10) < 0)
+			goto open_failed;
+	} else {
+		// raw frames of synthetic-resolution and synthetic-format
+		rewind(replayfp);
+	}
+	replaystart = ftell(replayfp);
+	ga_error("video source: replay %s file %s.\n", replayy4m ? "Y4M" : "raw", filename);
+	return 0;
+open_failed:
+	fclose(replayfp);
+	replayfp = NULL;
+	return -1;
+}
+
+/*
+ * vsource_init(void *arg)
+ * arg is not used: there is nothing to crop
+ */
+static int
+vsource_init(void *arg) {
+	char buf[64];
+	int res[2];
+	//
+	if(vsource_initialized != 0)
+		return 0;
+	//
+	pattern = PATTERN_GRADIENT;
+	if(ga_conf_readv("synthetic-pattern", buf, sizeof(buf)) != NULL) {
+		if(strcasecmp(buf, "gradient") == 0)		pattern = PATTERN_GRADIENT;
+		else if(strcasecmp(buf, "scroll") == 0)		pattern = PATTERN_SCROLL;
+		else if(strcasecmp(buf, "noise") == 0)		pattern = PATTERN_NOISE;
+		else if(strcasecmp(buf, "static") == 0)		pattern = PATTERN_STATIC;
+		else if(strcasecmp(buf, "file") == 0)		pattern = PATTERN_FILE;
+		else {
+			ga_error("video source: unknown synthetic-pattern '%s'.\n", buf);
+			return -1;
+		}
+	}
+	pixelformat = PIX_FMT_BGRA;
+	if(ga_conf_readv("synthetic-format", buf, sizeof(buf)) != NULL) {
+		if(strcasecmp(buf, "yuv420p") == 0)
+			pixelformat = PIX_FMT_YUV420P;
+		else if(strcasecmp(buf, "bgra") != 0) {
+			ga_error("video source: unknown synthetic-format '%s'.\n", buf);
+			return -1;
+		}
+	}
+	if(ga_conf_readints("synthetic-resolution", res, 2) == 2) {
+		width = res[0];
+		height = res[1];
+	} else {
+		width = SYNTHETIC_DEF_WIDTH;
+		height = SYNTHETIC_DEF_HEIGHT;
+	}
+	seed = SYNTHETIC_DEF_SEED;
+	if(ga_conf_readv("synthetic-seed", buf, sizeof(buf)) != NULL)
+		seed = strtoul(buf, NULL, 0);
+	// Y4M files override the resolution and the format
+	if(pattern == PATTERN_FILE && synthetic_open_file() < 0)
+		return -1;
+	if(width <= 0 || height <= 0
+	|| (pixelformat == PIX_FMT_YUV420P && ((width | height) & 1) != 0)) {
+		ga_error("video source: invalid synthetic resolution %dx%d.\n", width, height);
+		goto init_failed;
+	}
+	//
+	do {
+		int i;
+		int sources = video_source_config_channels();
+		vsource_config_t config[VIDEO_SOURCE_CHANNEL_MAX];
+		bzero(config, sizeof(config));
+		for(i = 0; i < sources; i++) {
+			config[i].curr_width = width;
+			config[i].curr_height = height;
+			config[i].curr_stride = VIDEO_SOURCE_ALIGN(pixelformat == PIX_FMT_BGRA ? width * 4 : width);
+			config[i].broadcast = (i > 0);
+		}
+		if(video_source_setup_ex(config, sources) < 0) {
+			goto init_failed;
+		}
+	} while(0);
+	if(width > video_source_max_width(0) || height > video_source_max_height(0)) {
+		ga_error("video source: synthetic resolution %dx%d exceeds max-resolution %dx%d.\n",
+			width, height, video_source_max_width(0), video_source_max_height(0));
+		goto init_failed;
+	}
+	colorcode = (vsource_embed_colorcode_init(pixelformat == PIX_FMT_BGRA) == 0);
+	//
+	ga_error("video source: synthetic %dx%d %s, pattern=%d, seed=%u\n",
+		width, height, pixelformat == PIX_FMT_BGRA ? "bgra" : "yuv420p",
+		pattern, seed);
+	vsource_initialized = 1;
+	return 0;
+init_failed:
+	if(replayfp != NULL) {
+		fclose(replayfp);
+		replayfp = NULL;
+	}
+	return -1;
+}
+
+/*
+ * vsource_threadproc accepts no arguments
+ */
+static void *
+vsource_threadproc(void *arg) {
+	int frame_interval;
+	unsigned int n = 0;
+	dpipe_buffer_t *data;
+	vsource_frame_t *frame;
+	dpipe_t *pipe;
+	ga_pacer_t pacer;
+	char pipename[64];
+	long long initialTime, captureTime;
+	struct RTSPConf *rtspconf = rtspconf_global();
+	// reset framerate setup
+	vsource_framerate_n = rtspconf->video_fps;
+	vsource_framerate_d = 1;
+	vsource_reconfigured = 0;
+	//
+	frame_interval = 1000000/rtspconf->video_fps;	// in the unif of us
+	frame_interval++;
+	if(ga_pacer_init(&pacer, "video-source", vsource_framerate_n, vsource_framerate_d) == NULL) {
+		ga_error("video source: invalid frame rate %d.\n", vsource_framerate_n);
+		exit(-1);
+	}
+	if(colorcode)
+		vsource_embed_colorcode_reset();
+	snprintf(pipename, sizeof(pipename), VIDEO_SOURCE_PIPEFORMAT, 0);
+	if((pipe = dpipe_lookup(pipename)) == NULL) {
+		ga_error("video source: cannot find pipeline '%s'\n", pipename);
+		exit(-1);
+	}
+	//
+	ga_error("video source thread started: tid=%ld\n", ga_gettid());
+	initialTime = ga_clock_ns();
+	while(vsource_started != 0) {
+		// encoder has not launched?
+		if(encoder_running() == 0) {
+#ifdef WIN32
+			Sleep(1);
+#else
+			usleep(1000);
+#endif
+			ga_pacer_reset(&pacer);
+			continue;
+		}
+		// wait for the next frame
+		ga_pacer_wait(&pacer);
+		captureTime = ga_clock_ns();
+		//
+		data = dpipe_get(pipe);
+		frame = (vsource_frame_t*) data->pointer;
+		// checked against the frame buffer size in vsource_init()
+		vsource_frame_layout(frame, pixelformat, width, height);
+		switch(pattern) {
+		case PATTERN_GRADIENT:
+			synthetic_gradient(frame, n);
+			break;
+		case PATTERN_SCROLL:
+			synthetic_scroll(frame, n);
+			break;
+		case PATTERN_NOISE:
+			synthetic_noise(frame, n);
+			break;
+		case PATTERN_STATIC:
+			synthetic_gradient(frame, 0);
+			break;
+		case PATTERN_FILE:
+			// end of a file that is not looped: stop delivering frames
+			if(synthetic_file(frame) < 0) {
+				dpipe_put(pipe, data);
+				continue;
+			}
+			break;
+		}
+		n++;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
+		// embed color code?
+		if(colorcode)
+			vsource_embed_colorcode_inc(frame);
+		dpipe_store(pipe, data);
+		// reconfigured?
+		if(vsource_reconfigured != 0) {
+			frame_interval = (int) (1000000.0 * vsource_framerate_d / vsource_framerate_n);
+			frame_interval++;
+			ga_pacer_set_rate(&pacer, vsource_framerate_n, vsource_framerate_d);
+			vsource_reconfigured = 0;
+			ga_error("video source: reconfigured - framerate=%d/%d (interval=%d)\n",
+				vsource_framerate_n, vsource_framerate_d, frame_interval);
+		}
+	}
+	//
+	ga_error("video source: thread terminated.\n");
+	//
+	return NULL;
+}
+
+static int
+vsource_deinit(void *arg) {
+	if(vsource_initialized == 0)
+		return 0;
+	if(replayfp != NULL) {
+		fclose(replayfp);
+		replayfp = NULL;
+	}
+	vsource_initialized = 0;
+	return 0;
+}
+
+static int
+vsource_start(void *arg) {
+	if(vsource_started != 0)
+		return 0;
+	vsource_started = 1;
+	if(pthread_create(&vsource_tid, NULL, vsource_threadproc, arg) != 0) {
+		vsource_started = 0;
+		ga_error("video source: create thread failed.\n");
+		return -1;
+	}
+	pthread_detach(vsource_tid);
+	return 0;
+}
+
+static int
+vsource_stop(void *arg) {
+	if(vsource_started == 0)
+		return 0;
+	vsource_started = 0;
+	pthread_cancel(vsource_tid);
+	return 0;
+}
+
+static int
+vsource_ioctl(int command, int argsize, void *arg) {
+	int ret = 0;
+	ga_ioctl_reconfigure_t *reconf = (ga_ioctl_reconfigure_t*) arg;
+	//
+	if(vsource_initialized == 0)
+		return GA_IOCTL_ERR_NOTINITIALIZED;
+	//
+	switch(command) {
+	case GA_IOCTL_RECONFIGURE:
+		if(argsize != sizeof(ga_ioctl_reconfigure_t))
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		if(reconf->framerate_n > 0 && reconf->framerate_d > 0) {
+			double framerate;
+			if(vsource_framerate_n == reconf->framerate_n
+			&& vsource_framerate_d == reconf->framerate_d)
+				break;
+			framerate = 1.0 * reconf->framerate_n / reconf->framerate_d;
+			if(framerate < 2 || framerate > 120) {
+				return GA_IOCTL_ERR_INVALID_ARGUMENT;
+			}
+			vsource_framerate_n = reconf->framerate_n;
+			vsource_framerate_d = reconf->framerate_d;
+			vsource_reconfigured = 1;
+		}
+		break;
+	default:
+		ret = GA_IOCTL_ERR_NOTSUPPORTED;
+		break;
+	}
+	return ret;
+}
+
+ga_module_t *
+module_load() {
+	static ga_module_t m;
+	bzero(&m, sizeof(m));
+	m.type = GA_MODULE_TYPE_VSOURCE;
+	m.name = strdup("vsource-synthetic");
+	m.init = vsource_init;
+	m.start = vsource_start;
+	m.stop = vsource_stop;
+	m.deinit = vsource_deinit;
+	m.ioctl = vsource_ioctl;
+	return &m;
+}
+
@@ -193,21 +193,10 @@ D3D9_screen_capture(IDirect3DDevice9 * pDevice) {
 			dst += frame->realstride;//frame->stride;
 		}
 		frame->imgpts = pcdiff_us(captureTv, initialTv, freq)/frame_interval;
-		gettimeofday(&frame->timestamp, NULL);
+		frame->timestamp = ga_clock_ns();
 	} while(0);
 
-	// duplicate from channel 0 to other channels
-	for(i = 1; i < SOURCES; i++) {
-		int j;
-		dpipe_buffer_t *dupdata;
-		vsource_frame_t *dupframe;
-		dupdata = dpipe_get(g_pipe[i]);
-		dupframe = (vsource_frame_t*) dupdata->pointer;
-		//
-		vsource_dup_frame(frame, dupframe);
-		//
-		dpipe_store(g_pipe[i], dupdata);
-	}
+	// other channels subscribe to channel 0
 	dpipe_store(g_pipe[0], data);
 	
 	offscreenSurface->UnlockRect();
@@ -732,21 +721,10 @@ hook_DXGISwapChainPresent(
 				dst += frame->realstride;//frame->stride;
 			}
 			frame->imgpts = pcdiff_us(captureTv, initialTv, freq)/frame_interval;
-			gettimeofday(&frame->timestamp, NULL);
+			frame->timestamp = ga_clock_ns();
 		} while(0);
 	
-		// duplicate from channel 0 to other channels
-		for(i = 1; i < SOURCES; i++) {
-			int j;
-			dpipe_buffer_t *dupdata;
-			vsource_frame_t *dupframe;
-			dupdata = dpipe_get(g_pipe[i]);
-			dupframe = (vsource_frame_t*) dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
-			dpipe_store(g_pipe[i], dupdata);
-		}
+		// other channels subscribe to channel 0
 		dpipe_store(g_pipe[0], data);
 		
 		pDstBuffer->Unmap(0);
@@ -814,21 +792,10 @@ hook_DXGISwapChainPresent(
 				dst += frame->realstride;//frame->stride;
 			}
 			frame->imgpts = pcdiff_us(captureTv, initialTv, freq)/frame_interval;
-			gettimeofday(&frame->timestamp, NULL);
+			frame->timestamp = ga_clock_ns();
 		} while(0);
 	
-		// duplicate from channel 0 to other channels
-		for(i = 1; i < SOURCES; i++) {
-			int j;
-			dpipe_buffer_t *dupdata;
-			vsource_frame_t *dupframe;
-			dupdata = dpipe_get(g_pipe[i]);
-			dupframe = (vsource_frame_t*) dupdata->pointer;
-			//
-			vsource_dup_frame(frame, dupframe);
-			//
-			dpipe_store(g_pipe[i], dupdata);
-		}
+		// other channels subscribe to channel 0
 		dpipe_store(g_pipe[0], data);
 
 		pDeviceContext->Unmap(pDstBuffer, 0);
@@ -26,6 +26,7 @@
 
 #include "ga-common.h"
 #include "ga-conf.h"
+#include "ga-pacer.h"
 #include "ga-module.h"
 #include "rtspconf.h"
 #include "controller.h"
@@ -52,12 +53,9 @@ int hook_boost = 0;
 int no_default_controller = 0;
 
 int enable_server_rate_control = 1;
-int server_token_fill_interval = 41667;
-int server_num_token_to_fill = 1;
-int server_max_tokens = 2;
 int video_fps = 24;
 
-dpipe_t *g_pipe[SOURCES];
+dpipe_t *g_pipe[VIDEO_SOURCE_CHANNEL_MAX];
 
 static char *ga_root = NULL;
 
@@ -94,15 +92,18 @@ vsource_init(int width, int height) {
 	image->bytes_per_line = (BITSPERPIXEL>>3) * image->width;
 #ifdef SOURCES
 	do {
-		vsource_config_t config[SOURCES];
+		// the hooks capture channel 0, other channels broadcast its frames
+		int sources = video_source_config_channels();
+		vsource_config_t config[VIDEO_SOURCE_CHANNEL_MAX];
 		bzero(config, sizeof(config));
-		for(i = 0; i < SOURCES; i++) {
+		for(i = 0; i < sources; i++) {
 			//config[i].rtp_id = i;
 			config[i].curr_width = image->width;
 			config[i].curr_height = image->height;
 			config[i].curr_stride = image->bytes_per_line;
+			config[i].broadcast = (i > 0);
 		}
-		if(video_source_setup_ex(config, SOURCES) < 0) {
+		if(video_source_setup_ex(config, sources) < 0) {
 			return -1;
 		}
 	} while(0);
@@ -112,7 +113,7 @@ vsource_init(int width, int height) {
 	}
 #endif
 	// setup pipelines
-	for(i = 0; i < SOURCES; i++) {
+	for(i = 0; i < video_source_channels(); i++) {
 		char pipename[64];
 		snprintf(pipename, sizeof(pipename), imagepipefmt, i);
 		if ((g_pipe[i] = dpipe_lookup(pipename)) == NULL) {
@@ -151,22 +152,6 @@ ga_hook_capture_prepared(int width, int height, int check_resolution) {
 	return 0;
 }
 
-void
-ga_hook_capture_dupframe(vsource_frame_t *frame) {
-	int i;
-	for(i = 1; i < SOURCES; i++) {
-		dpipe_buffer_t *dupdata;
-		vsource_frame_t *dupframe;
-		dupdata = dpipe_get(g_pipe[i]);
-		dupframe = (vsource_frame_t*) dupdata->pointer;
-		//
-		vsource_dup_frame(frame, dupframe);
-		//
-		dpipe_store(g_pipe[i], dupdata);
-	}
-	return;
-}
-
 #ifdef	WIN32
 #define	BACKSLASHDIR(fwd, back)	back
 #else
@@ -319,6 +304,11 @@ ga_server(void *arg) {
 			prect->left, prect->top,
 			prect->right, prect->bottom);
 	}
+	// frames are encoded and streamed by another process
+	if(ga_conf_readbool("video-source-shm", 0) != 0) {
+		ga_error("[ga_server] video source exported in shared memory, capture only\n");
+		return NULL;
+	}
 	// load server modules
 	if(load_modules() < 0)	 { return NULL; }
 	if(init_modules() < 0)	 { return NULL; }
@@ -375,58 +365,72 @@ ga_hook_get_resolution(int width, int height) {
 	return -1;
 }
 
-// token bucket rate controller
+// deadline based rate controller: capture a frame only if it is due
+static ga_pacer_t hook_pacer;
+static int hook_framerate_n = -1;
+static int hook_framerate_d = -1;
+static int hook_reconfigured = 0;
+
 int
 ga_hook_video_rate_control() {
 	static int initialized = 0;
-	static int max_tokens;
-	static long long tokens = 0LL;
-#ifdef WIN32
-	static LARGE_INTEGER lastCounter, freq;
-	LARGE_INTEGER currCounter;
-#else
-	static struct timeval lastCounter;
-	struct timeval currCounter;
-#endif
-	long long delta;
 	// init
 	if(initialized == 0) {
-		tokens = 0LL;
-		max_tokens = server_max_tokens * server_token_fill_interval;
-#ifdef WIN32
-		QueryPerformanceFrequency(&freq);
-		QueryPerformanceCounter(&lastCounter);
-#else
-		gettimeofday(&lastCounter, NULL);
-#endif
-		ga_error("[token_bucket] interval=%d, fill=%d, max=%d (%d)\n",
-			(int) server_token_fill_interval,
-			(int) server_num_token_to_fill,
-			(int) server_max_tokens,
-			(int) max_tokens);
+		hook_framerate_n = video_fps > 0 ? video_fps : 24;
+		hook_framerate_d = 1;
+		ga_pacer_init(&hook_pacer, "hook-video", hook_framerate_n, hook_framerate_d);
+		ga_error("[rate_control] framerate=%d/%d\n",
+			hook_framerate_n, hook_framerate_d);
+		hook_reconfigured = 0;
 		initialized = 1;
-		return -1;
-	}
-	//
-#ifdef WIN32
-	QueryPerformanceCounter(&currCounter);
-	delta = pcdiff_us(currCounter, lastCounter, freq);
-#else
-	gettimeofday(&currCounter, NULL);
-	delta = tvdiff_us(&currCounter, &lastCounter);
-#endif
-	if(delta >= server_token_fill_interval) {
-		tokens += delta;
-		lastCounter = currCounter;
 	}
-	if(tokens > max_tokens) {
-		tokens = max_tokens;
+	// reconfigured? applied by the capturing thread, which owns the pacer
+	if(hook_reconfigured != 0) {
+		ga_pacer_set_rate(&hook_pacer, hook_framerate_n, hook_framerate_d);
+		hook_reconfigured = 0;
+		ga_error("[rate_control] reconfigured - framerate=%d/%d\n",
+			hook_framerate_n, hook_framerate_d);
 	}
-	if(tokens >= server_token_fill_interval) {
-		tokens -= server_token_fill_interval;
-		return 1;
+	//
+	return ga_pacer_due(&hook_pacer, ga_clock_ns()) ? 1 : -1;
+}
+
+/**
+ * ioctl() of the hooked video source.
+ *
+ * @param command [in] The ioctl() command.
+ * @param argsize [in] The size of the argument.
+ * @param arg [in] The argument.
+ * @return GA_IOCTL_ERR_NONE on success, or a GA_IOCTL_ERR_* error code.
+ *
+ * GA_IOCTL_RECONFIGURE changes the rate of ga_hook_video_rate_control(),
+ * and is then passed to the video encoder.
+ */
+int
+ga_hook_ioctl(int command, int argsize, void *arg) {
+	ga_ioctl_reconfigure_t *reconf = (ga_ioctl_reconfigure_t*) arg;
+	//
+	switch(command) {
+	case GA_IOCTL_RECONFIGURE:
+		if(argsize != sizeof(ga_ioctl_reconfigure_t))
+			return GA_IOCTL_ERR_INVALID_ARGUMENT;
+		if(reconf->framerate_n > 0 && reconf->framerate_d > 0
+		&& (hook_framerate_n != reconf->framerate_n
+		 || hook_framerate_d != reconf->framerate_d)) {
+			double framerate = 1.0 * reconf->framerate_n / reconf->framerate_d;
+			if(framerate < 2 || framerate > 120)
+				return GA_IOCTL_ERR_INVALID_ARGUMENT;
+			hook_framerate_n = reconf->framerate_n;
+			hook_framerate_d = reconf->framerate_d;
+			hook_reconfigured = 1;
+		}
+		break;
+	default:
+		break;
 	}
-	return -1;
+	if(m_vencoder == NULL)
+		return GA_IOCTL_ERR_NOTINITIALIZED;
+	return ga_module_ioctl(m_vencoder, command, argsize, arg);
 }
 
 int
@@ -486,9 +490,6 @@ ga_hook_init() {
 	}
 	//
 	enable_server_rate_control = ga_conf_readbool("enable-server-rate-control", 0);
-	server_token_fill_interval = ga_conf_readint("server-token-fill-interval");
-	server_num_token_to_fill = ga_conf_readint("server-num-token-to-fill");
-	server_max_tokens = ga_conf_readint("server-max-tokens");
 	video_fps = ga_conf_readint("video-fps");
 	//
 	// XXX: check for valid configurations
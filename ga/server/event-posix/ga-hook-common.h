@@ -44,21 +44,18 @@ extern int hook_boost;
 extern int no_default_controller;
 
 extern int enable_server_rate_control;
-extern int server_token_fill_interval;
-extern int server_num_token_to_fill;
-extern int server_max_tokens;
 extern int video_fps;
 
-extern dpipe_t *g_pipe[SOURCES];
+extern dpipe_t *g_pipe[VIDEO_SOURCE_CHANNEL_MAX];	/* frames are stored to g_pipe[0] */
 
 int vsource_init(int width, int height);
 
 int ga_hook_capture_prepared(int width, int height, int check_resolution);
-void ga_hook_capture_dupframe(vsource_frame_t *frame);
 
 void *ga_server(void *arg);
 int ga_hook_get_resolution(int width, int height);
 int ga_hook_video_rate_control();
+int ga_hook_ioctl(int command, int argsize, void *arg);
 int ga_hook_init();
 #ifndef WIN32
 void * ga_hook_lookup(void *handle, const char *name);
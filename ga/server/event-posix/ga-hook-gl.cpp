@@ -37,6 +37,7 @@
 
 #include "ga-hook-common.h"
 #include "ga-hook-gl.h"
+#include "ga-hook-glread.h"
 #ifndef WIN32
 #include "ga-hook-lib.h"
 #endif
@@ -64,13 +65,16 @@ void glXSwapBuffers( Display *dpy, GLXDrawable drawable );
 #endif
 
 // For duplicate frame generation (since OpenGL does not deliver updates if nothing changes)
-static struct timeval previous_frame_tv = { 0 };
+// The last frame is kept by holding a reference to its pipe buffer,
+// or by a copy if the pipe does not count references (shared-memory pipes)
+static long long previous_frame_time = 0;
+static dpipe_buffer_t *previous_data = NULL;
 static vsource_frame_t previous_frame = { 0 };
 pthread_cond_t new_frame_captured_cond = PTHREAD_COND_INITIALIZER;
 pthread_mutex_t new_frame_captured_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_mutex_t pipe_access_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-static struct timeval initialTv = { 0 };
+static long long initialTime = 0;
 static int frame_interval;
 static int pts = 0;
 
@@ -130,28 +134,29 @@ frame_injection_threadproc(void *arg)
 
 		int wait_result = pthread_cond_timedwait(&new_frame_captured_cond, &new_frame_captured_mutex, &to);
 
-		struct timeval now;
-		gettimeofday(&now, NULL);
+		long long now = ga_clock_ns();
 
 		if (wait_result == ETIMEDOUT &&
-			previous_frame_tv.tv_sec > 0 &&
-			tvdiff_us(&now, &previous_frame_tv) > 1000000 / minimum_frame_rate &&
-			previous_frame.realsize > 0)
+			previous_frame_time > 0 &&
+			(now - previous_frame_time) / 1000LL > 1000000 / minimum_frame_rate &&
+			(previous_data != NULL || previous_frame.realsize > 0))
 		{
 			pthread_mutex_lock(&pipe_access_mutex);
 			// Inject previous frame again
 			dpipe_buffer_t *data = dpipe_get(g_pipe[0]);
 			vsource_frame_t *frame = (vsource_frame_t *) data->pointer;
-			vsource_dup_frame(&previous_frame, frame);
+			if (previous_data != NULL)
+				vsource_dup_frame((vsource_frame_t *) previous_data->pointer, frame);
+			else
+				vsource_dup_frame(&previous_frame, frame);
 
 			// Generate presentation time stamp
-			struct timeval repeat_tv;
-			gettimeofday(&repeat_tv, NULL);
-			long long new_pts = tvdiff_us(&repeat_tv, &initialTv)/frame_interval;
+			long long repeat_time = ga_clock_ns();
+			long long new_pts = (repeat_time - initialTime) / 1000LL / frame_interval;
 			frame->imgpts = pts++; // new_pts
+			frame->timestamp = repeat_time;
 
-			// duplicate from channel 0 to other channels
-			ga_hook_capture_dupframe(frame);
+			// other channels subscribe to channel 0
 			dpipe_store(g_pipe[0], data);
 			pthread_mutex_unlock(&pipe_access_mutex);
 			// ga_error("Frame injected.\n");
@@ -314,15 +319,13 @@ void
 copyFrame() {
 #ifdef __linux__
 	static int frame_interval;
-	static struct timeval initialTv, captureTv;
+	static long long initialTime, captureTime;
 	static int frameLinesize;
-	static unsigned char *frameBuf;
 	static int sb_initialized = 0;
 	static int global_initialized = 0;
 	//
 	GLint vp[4];
 	int vp_x, vp_y, vp_width, vp_height;
-	int i;
 	//
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
@@ -352,16 +355,12 @@ copyFrame() {
 	if(sb_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		gettimeofday(&initialTv, NULL);
-		frameBuf = (unsigned char*) malloc(encoder_width * encoder_height * 4);
-		if(frameBuf == NULL) {
-			ga_error("allocate frame failed.\n");
-			return;
-		}
+		initialTime = captureTime = ga_clock_ns();
 		frameLinesize = game_width * 4;
+		ga_hook_glread_init();
 		sb_initialized = 1;
 	} else {
-		gettimeofday(&captureTv, NULL);
+		captureTime = ga_clock_ns();
 	}
 	//
 	if (enable_server_rate_control && ga_hook_video_rate_control() < 0) {
@@ -371,7 +370,6 @@ copyFrame() {
 	pthread_mutex_lock(&pipe_access_mutex);
 
 	do {
-		unsigned char *src, *dst;
 		//
 		frameLinesize = game_width<<2;
 		//
@@ -382,33 +380,43 @@ copyFrame() {
 		frame->realheight = game_height;
 		frame->realstride = frameLinesize;
 		frame->realsize = game_height * frameLinesize;
-		frame->linesize[0] = frameLinesize;/*frame->stride*/;
-		// read a block of pixels from the framebuffer (backbuffer)
-		glReadBuffer(GL_BACK);
-		glReadPixels(0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, frameBuf);
-		// image is upside down!
-		src = frameBuf + frameLinesize * (game_height - 1);
-		dst = frame->imgbuf;
-		for(i = 0; i < frame->realheight; i++) {
-			bcopy(src, dst, frameLinesize);
-			dst += frameLinesize/*frame->stride*/;
-			src -= frameLinesize;
+		// image is upside down: the converter reads it bottom-up
+		frame->linesize[0] = -frameLinesize;
+		// read a block of pixels from the framebuffer (backbuffer),
+		// or the one read N-1 frames ago in the asynchronous mode
+		if(ga_hook_glread(game_width, game_height, frame->imgbuf, &captureTime) <= 0) {
+			dpipe_put(g_pipe[0], data);
+			data = NULL;
+			break;
 		}
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
 	} while(0);
 
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
-	dpipe_store(g_pipe[0], data);
+	if (data == NULL) {
+		pthread_mutex_unlock(&pipe_access_mutex);
+		return;
+	}
 
-	previous_frame_tv = captureTv;
-	if (frame->imgbufsize > previous_frame.imgbufsize) {
-		free(previous_frame.imgbuf);
-		previous_frame.imgbuf = (unsigned char*)malloc(frame->imgbufsize);
-		previous_frame.imgbufsize = frame->imgbufsize;
+	// keep the new frame for duplicate frame generation
+	if (previous_data != NULL) {
+		dpipe_put(g_pipe[0], previous_data);
+		previous_data = NULL;
+	}
+	previous_frame_time = captureTime;
+	if (g_pipe[0]->spsc) {
+		// lock-free pipes do not count references: keep a copy
+		if (frame->imgbufsize > previous_frame.imgbufsize) {
+			free(previous_frame.imgbuf);
+			previous_frame.imgbuf = (unsigned char*)malloc(frame->imgbufsize);
+			previous_frame.imgbufsize = frame->imgbufsize;
+		}
+		vsource_dup_frame(frame, &previous_frame);
+		// other channels subscribe to channel 0
+		dpipe_store(g_pipe[0], data);
+	} else if (dpipe_store_hold(g_pipe[0], data) == 0) {
+		previous_data = data;
 	}
-	vsource_dup_frame(frame, &previous_frame);
 
 	pthread_mutex_unlock(&pipe_access_mutex);
 	pthread_cond_broadcast(&new_frame_captured_cond);
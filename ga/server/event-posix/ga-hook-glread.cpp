@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Back buffer readback for the OpenGL hooks.
+ *
+ * In the default synchronous mode, glReadPixels() blocks the rendering
+ * thread until the GPU finishes the frame. In the asynchronous (pbo) mode,
+ * the pixels are read into a ring of pixel pack buffers and the buffer
+ * issued N-1 frames ago is mapped and delivered, so the game does not wait
+ * for the current frame at the cost of N-1 frames of latency.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "ga-common.h"
+#include "ga-conf.h"
+
+#include "ga-hook-gl.h"
+#include "ga-hook-glread.h"
+
+#ifndef GL_PIXEL_PACK_BUFFER
+#define	GL_PIXEL_PACK_BUFFER		0x88EB
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER_BINDING
+#define	GL_PIXEL_PACK_BUFFER_BINDING	0x88ED
+#endif
+#ifndef GL_STREAM_READ
+#define	GL_STREAM_READ			0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define	GL_READ_ONLY			0x88B8
+#endif
+
+typedef void		(*t_glGenBuffers)(GLsizei, GLuint *);
+typedef void		(*t_glDeleteBuffers)(GLsizei, const GLuint *);
+typedef void		(*t_glBindBuffer)(GLenum, GLuint);
+typedef void		(*t_glBufferData)(GLenum, ptrdiff_t, const GLvoid *, GLenum);
+typedef GLvoid *	(*t_glMapBuffer)(GLenum, GLenum);
+typedef GLboolean	(*t_glUnmapBuffer)(GLenum);
+
+static t_glGenBuffers		p_glGenBuffers = NULL;
+static t_glDeleteBuffers	p_glDeleteBuffers = NULL;
+static t_glBindBuffer		p_glBindBuffer = NULL;
+static t_glBufferData		p_glBufferData = NULL;
+static t_glMapBuffer		p_glMapBuffer = NULL;
+static t_glUnmapBuffer		p_glUnmapBuffer = NULL;
+
+#ifdef __APPLE__
+#define	GLREAD_PROC(name)	((void*) name)
+#else
+#define	GLREAD_PROC(name)	((void*) glXGetProcAddressARB((const GLubyte*) #name))
+#endif
+
+static int glread_async = 0;		// 0: glReadPixels; 1: pixel pack buffer ring
+static int glread_nbuffers = 2;
+// the pixel pack buffer ring
+static GLuint pbo[GLREAD_MAX_BUFFERS];
+static long long pbo_captured[GLREAD_MAX_BUFFERS];
+static int pbo_pending[GLREAD_MAX_BUFFERS];
+static int pbo_width = 0, pbo_height = 0;
+static int pbo_next = 0;
+// readback time statistics
+static int stats_interval = 0;
+static int stats_frames = 0;
+static long long stats_start = 0, stats_last = 0;
+static long long stats_total = 0, stats_max = 0, stats_interframe = 0;
+
+/**
+ * Initialize the readback mode of the GL hooks.
+ *
+ * @return 0 on success, or -1 if the asynchronous mode is not available.
+ *
+ * The mode is selected by \em hook-gl-readback (sync or pbo),
+ * the ring size by \em hook-gl-readback-buffers (2 or 3), and
+ * \em hook-gl-readback-stats-interval prints the time the game thread
+ * spends in readback and the interval between frames every N seconds.
+ * This function must be called from the rendering thread,
+ * before the first call to ga_hook_glread().
+ */
+int
+ga_hook_glread_init() {
+	char mode[64];
+	glread_async = 0;
+	if(ga_conf_readv("hook-gl-readback", mode, sizeof(mode)) != NULL
+	&& strcasecmp(mode, "pbo") == 0) {
+		glread_async = 1;
+	}
+	if((glread_nbuffers = ga_conf_readint("hook-gl-readback-buffers")) < 2)
+		glread_nbuffers = 2;
+	if(glread_nbuffers > GLREAD_MAX_BUFFERS)
+		glread_nbuffers = GLREAD_MAX_BUFFERS;
+	stats_interval = ga_conf_readint("hook-gl-readback-stats-interval");
+	stats_start = stats_last = 0;
+	// also used to unbind the game's pack buffer in the synchronous mode
+	p_glGenBuffers = (t_glGenBuffers) GLREAD_PROC(glGenBuffers);
+	p_glDeleteBuffers = (t_glDeleteBuffers) GLREAD_PROC(glDeleteBuffers);
+	p_glBindBuffer = (t_glBindBuffer) GLREAD_PROC(glBindBuffer);
+	p_glBufferData = (t_glBufferData) GLREAD_PROC(glBufferData);
+	p_glMapBuffer = (t_glMapBuffer) GLREAD_PROC(glMapBuffer);
+	p_glUnmapBuffer = (t_glUnmapBuffer) GLREAD_PROC(glUnmapBuffer);
+	if(glread_async) {
+		if(p_glGenBuffers == NULL || p_glDeleteBuffers == NULL
+		|| p_glBindBuffer == NULL || p_glBufferData == NULL
+		|| p_glMapBuffer == NULL || p_glUnmapBuffer == NULL) {
+			ga_error("hook-gl: pixel pack buffers not supported, use synchronous readback.\n");
+			glread_async = 0;
+			return -1;
+		}
+	}
+	if(glread_async)
+		ga_error("hook-gl: asynchronous readback, %d pixel pack buffers.\n", glread_nbuffers);
+	else
+		ga_error("hook-gl: synchronous readback.\n");
+	return 0;
+}
+
+/* (Re)create the ring for frames of the given size */
+static int
+glread_pbo_setup(int width, int height) {
+	int i;
+	if(pbo_width > 0) {
+		p_glDeleteBuffers(glread_nbuffers, pbo);
+	}
+	pbo_width = pbo_height = 0;
+	pbo_next = 0;
+	bzero(pbo, sizeof(pbo));
+	bzero(pbo_pending, sizeof(pbo_pending));
+	p_glGenBuffers(glread_nbuffers, pbo);
+	for(i = 0; i < glread_nbuffers; i++) {
+		if(pbo[i] == 0) {
+			ga_error("hook-gl: create pixel pack buffers failed.\n");
+			return -1;
+		}
+		p_glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+		p_glBufferData(GL_PIXEL_PACK_BUFFER, (ptrdiff_t) width * height * 4, NULL, GL_STREAM_READ);
+	}
+	pbo_width = width;
+	pbo_height = height;
+	return 0;
+}
+
+/* Issue a read into the ring and deliver the eldest read, if any */
+static int
+glread_async_read(int width, int height, unsigned char *dst, long long *captured) {
+	void *ptr;
+	int curr, eldest;
+	//
+	if((width != pbo_width || height != pbo_height)
+	&& glread_pbo_setup(width, height) < 0) {
+		ga_error("hook-gl: switch to synchronous readback.\n");
+		glread_async = 0;
+		p_glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, dst);
+		return 1;
+	}
+	// the read is completed asynchronously by the GPU
+	curr = pbo_next;
+	p_glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[curr]);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (GLvoid*) 0);
+	pbo_captured[curr] = *captured;
+	pbo_pending[curr] = 1;
+	pbo_next = eldest = (curr + 1) % glread_nbuffers;
+	// the buffer issued N-1 frames ago
+	if(pbo_pending[eldest] == 0)
+		return 0;
+	pbo_pending[eldest] = 0;
+	p_glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[eldest]);
+	if((ptr = p_glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY)) == NULL) {
+		ga_error("hook-gl: map pixel pack buffer failed.\n");
+		return -1;
+	}
+	bcopy(ptr, dst, width * height * 4);
+	p_glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	*captured = pbo_captured[eldest];
+	return 1;
+}
+
+static void
+glread_stats(long long t0, long long t1) {
+	if(stats_interval <= 0)
+		return;
+	if(stats_start == 0) {
+		stats_start = stats_last = t0;
+		return;
+	}
+	stats_frames++;
+	stats_total += t1 - t0;
+	if(t1 - t0 > stats_max)
+		stats_max = t1 - t0;
+	stats_interframe += t0 - stats_last;
+	stats_last = t0;
+	if(t1 - stats_start < stats_interval * GA_NSEC_PER_SEC)
+		return;
+	ga_error("hook-gl: %s readback %d frames, readback avg %.3f ms, max %.3f ms, frame interval avg %.3f ms\n",
+		glread_async ? "pbo" : "sync", stats_frames,
+		0.000001 * stats_total / stats_frames,
+		0.000001 * stats_max,
+		0.000001 * stats_interframe / stats_frames);
+	stats_frames = 0;
+	stats_total = stats_max = stats_interframe = 0;
+	stats_start = t1;
+	return;
+}
+
+/**
+ * Read the back buffer of the current frame.
+ *
+ * @param width [in] Frame width.
+ * @param height [in] Frame height.
+ * @param dst [out] Pointer to the frame buffer, of at least \a width * \a height * 4 bytes.
+ *	The image is stored bottom-up in RGBA format.
+ * @param captured [in,out] The capture time of the current frame.
+ *	On return, it is the capture time of the frame stored in \a dst.
+ * @return 1 if a frame is stored in \a dst, 0 if no frame is ready yet,
+ *	or -1 on error.
+ *
+ * In the asynchronous mode, the frame stored in \a dst is the one
+ * read N-1 calls ago. The pixel store and buffer binding states
+ * of the game are preserved.
+ */
+int
+ga_hook_glread(int width, int height, unsigned char *dst, long long *captured) {
+	GLint pack_alignment = 4, pack_rowlength = 0;
+	GLint read_buffer = GL_BACK, pack_buffer = 0;
+	long long t0 = ga_clock_ns();
+	int ret = 1;
+	//
+	glGetIntegerv(GL_PACK_ALIGNMENT, &pack_alignment);
+	glGetIntegerv(GL_PACK_ROW_LENGTH, &pack_rowlength);
+	glGetIntegerv(GL_READ_BUFFER, &read_buffer);
+	glReadBuffer(GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	if(p_glBindBuffer != NULL)
+		glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+	if(glread_async) {
+		ret = glread_async_read(width, height, dst, captured);
+	} else {
+		if(pack_buffer != 0)
+			p_glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, dst);
+	}
+	if(glread_async || pack_buffer != 0)
+		p_glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, pack_alignment);
+	glPixelStorei(GL_PACK_ROW_LENGTH, pack_rowlength);
+	glReadBuffer(read_buffer);
+	//
+	glread_stats(t0, ga_clock_ns());
+	return ret;
+}
+
@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2013 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __GA_HOOK_GLREAD_H__
+#define __GA_HOOK_GLREAD_H__
+
+/** Maximum number of pixel pack buffers in the asynchronous readback ring */
+#define	GLREAD_MAX_BUFFERS	3
+
+int ga_hook_glread_init();
+int ga_hook_glread(int width, int height, unsigned char *dst, long long *captured);
+
+#endif	/* __GA_HOOK_GLREAD_H__ */
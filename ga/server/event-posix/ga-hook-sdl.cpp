@@ -842,7 +842,7 @@ err_quit:
 static void
 hook_SDL_capture_screen(const char *caller) {
 	static int frame_interval;
-	static struct timeval initialTv, captureTv;
+	static long long initialTime, captureTime;
 	static int sb_initialized = 0;
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
@@ -858,10 +858,10 @@ hook_SDL_capture_screen(const char *caller) {
 	if(sb_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		gettimeofday(&initialTv, NULL);
+		initialTime = captureTime = ga_clock_ns();
 		sb_initialized = 1;
 	} else {
-		gettimeofday(&captureTv, NULL);
+		captureTime = ga_clock_ns();
 	}
 	//
 	if (enable_server_rate_control && ga_hook_video_rate_control() < 0)
@@ -877,11 +877,10 @@ hook_SDL_capture_screen(const char *caller) {
 		frame->realsize = dupsurface->h * dupsurface->pitch;
 		frame->linesize[0] = dupsurface->pitch;
 		bcopy(dupsurface->pixels, frame->imgbuf, frame->realsize);
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
 	} while(0);
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
+	// other channels subscribe to channel 0
 	dpipe_store(g_pipe[0], data);
 	return;
 }
@@ -949,7 +948,7 @@ hook_SDL_UpdateRects(SDL12_Surface *screen, int numrects, SDL12_Rect *rects) {
 void
 hook_SDL_GL_SwapBuffers() {
 	static int frame_interval;
-	static struct timeval initialTv, captureTv;
+	static long long initialTime, captureTime;
 	static int frameLinesize;
 	static unsigned char *frameBuf;
 	static int sb_initialized = 0;
@@ -978,7 +977,7 @@ hook_SDL_GL_SwapBuffers() {
 	if(sb_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		gettimeofday(&initialTv, NULL);
+		initialTime = captureTime = ga_clock_ns();
 		frameBuf = (unsigned char*) malloc(encoder_width * encoder_height * 4);
 		if(frameBuf == NULL) {
 			ga_error("allocate frame failed.\n");
@@ -987,7 +986,7 @@ hook_SDL_GL_SwapBuffers() {
 		frameLinesize = game_width * 4;
 		sb_initialized = 1;
 	} else {
-		gettimeofday(&captureTv, NULL);
+		captureTime = ga_clock_ns();
 	}
 	
 	if (enable_server_rate_control && ga_hook_video_rate_control() < 0)
@@ -1018,12 +1017,11 @@ hook_SDL_GL_SwapBuffers() {
 			dst += frameLinesize/*frame->stride*/;
 			src -= frameLinesize;
 		}
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
 	} while(0);
 
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
+	// other channels subscribe to channel 0
 	dpipe_store(g_pipe[0], data);
 	
 	return;
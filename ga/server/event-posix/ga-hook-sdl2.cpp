@@ -35,6 +35,7 @@
 
 #include "ga-hook-common.h"
 #include "ga-hook-sdl2.h"
+#include "ga-hook-glread.h"
 #ifndef WIN32
 #include "ga-hook-lib.h"
 #endif
@@ -408,7 +409,7 @@ hook_SDL2_CreateTexture(SDL_Renderer* renderer, uint32_t format, int access, int
 static void
 hook_SDL2_capture_screen(const char *caller, SDL_Renderer *renderer) {
 	static int frame_interval;
-	static struct timeval initialTv, captureTv;
+	static long long initialTime, captureTime;
 	static int sb_initialized = 0;
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
@@ -422,10 +423,10 @@ hook_SDL2_capture_screen(const char *caller, SDL_Renderer *renderer) {
 	if(sb_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		gettimeofday(&initialTv, NULL);
+		initialTime = captureTime = ga_clock_ns();
 		sb_initialized = 1;
 	} else {
-		gettimeofday(&captureTv, NULL);
+		captureTime = ga_clock_ns();
 	}
 	//
 	if (enable_server_rate_control && ga_hook_video_rate_control() < 0)
@@ -444,11 +445,10 @@ hook_SDL2_capture_screen(const char *caller, SDL_Renderer *renderer) {
 		if(old_SDL2_RenderReadPixels(renderer, NULL, SDL_PIXELFORMAT_ARGB8888, frame->imgbuf, curr_width * 4) != 0) {
 			ga_error("hook_sdl2: read pixels failed: %s\n", SDL_GetError());
 		}
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
 	} while(0);
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
+	// other channels subscribe to channel 0
 	dpipe_store(g_pipe[0], data);
 	return;
 }
@@ -508,14 +508,12 @@ hook_SDL2_RenderPresent(SDL_Renderer *renderer) {
 static void
 GL_capture() {
 	static int frame_interval;
-	static struct timeval initialTv, captureTv;
+	static long long initialTime, captureTime;
 	static int frameLinesize;
-	static unsigned char *frameBuf;
 	static int sb_initialized = 0;
 	//
 	GLint vp[4];
 	int vp_x, vp_y, vp_width, vp_height;
-	int i;
 	dpipe_buffer_t *data;
 	vsource_frame_t *frame;
 	//
@@ -532,16 +530,12 @@ GL_capture() {
 	if(sb_initialized == 0) {
 		frame_interval = 1000000/video_fps; // in the unif of us
 		frame_interval++;
-		gettimeofday(&initialTv, NULL);
-		frameBuf = (unsigned char*) malloc(encoder_width * encoder_height * 4);
-		if(frameBuf == NULL) {
-			ga_error("allocate frame failed.\n");
-			return;
-		}
+		initialTime = captureTime = ga_clock_ns();
 		frameLinesize = game_width * 4;
+		ga_hook_glread_init();
 		sb_initialized = 1;
 	} else {
-		gettimeofday(&captureTv, NULL);
+		captureTime = ga_clock_ns();
 	}
 	
 	if (enable_server_rate_control && ga_hook_video_rate_control() < 0)
@@ -549,7 +543,6 @@ GL_capture() {
 
 	// copy screen
 	do {
-		unsigned char *src, *dst;
 		//
 		frameLinesize = game_width<<2;
 		//
@@ -560,25 +553,22 @@ GL_capture() {
 		frame->realheight = game_height;
 		frame->realstride = frameLinesize;
 		frame->realsize = game_height * frameLinesize;
-		frame->linesize[0] = frameLinesize;
-		// read a block of pixels from the framebuffer (backbuffer)
-		glReadBuffer(GL_BACK);
-		glReadPixels(0, 0, game_width, game_height, GL_RGBA, GL_UNSIGNED_BYTE, frameBuf);
-		// image is upside down!
-		src = frameBuf + frameLinesize * (game_height - 1);
-		dst = frame->imgbuf;
-		for(i = 0; i < frame->realheight; i++) {
-			bcopy(src, dst, frameLinesize);
-			dst += frameLinesize;
-			src -= frameLinesize;
+		// image is upside down: the converter reads it bottom-up
+		frame->linesize[0] = -frameLinesize;
+		// read a block of pixels from the framebuffer (backbuffer),
+		// or the one read N-1 frames ago in the asynchronous mode
+		if(ga_hook_glread(game_width, game_height, frame->imgbuf, &captureTime) <= 0) {
+			dpipe_put(g_pipe[0], data);
+			data = NULL;
+			break;
 		}
-		frame->imgpts = tvdiff_us(&captureTv, &initialTv)/frame_interval;
-		frame->timestamp = captureTv;
+		frame->imgpts = (captureTime - initialTime) / 1000LL / frame_interval;
+		frame->timestamp = captureTime;
 	} while(0);
 
-	// duplicate from channel 0 to other channels
-	ga_hook_capture_dupframe(frame);
-	dpipe_store(g_pipe[0], data);
+	// other channels subscribe to channel 0
+	if(data != NULL)
+		dpipe_store(g_pipe[0], data);
 	
 	return;
 }
@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #ifndef WIN32
 #include <unistd.h>
 #endif
@@ -50,7 +51,15 @@ static ga_module_t *m_vsource, *m_filter, *m_vencoder, *m_asource, *m_aencoder,
 
 int
 load_modules() {
-	if((m_vsource = ga_load_module("mod/vsource-desktop", "vsource_")) == NULL)
+	char vsource[64] = "vsource-desktop";
+	char module_path[128];
+	//
+	if(ga_conf_readv("video-source", vsource, sizeof(vsource)) == NULL
+	|| vsource[0] == '\0') {
+		strcpy(vsource, "vsource-desktop");
+	}
+	snprintf(module_path, sizeof(module_path), "mod/%s", vsource);
+	if((m_vsource = ga_load_module(module_path, "vsource_")) == NULL)
 		return -1;
 	if((m_filter = ga_load_module("mod/filter-rgb2yuv", "filter_RGB2YUV_")) == NULL)
 		return -1;
@@ -138,6 +147,7 @@ test_reconfig(void *) {
 	int s = 0, err;
 	int kbitrate[] = { 2000, 8000 };
 	int framerate[][2] = { { 12, 1 }, {30, 1}, {24, 1} };
+	int resolution[][2] = { { 1280, 720 }, { 1920, 1080 } };	// needs max-resolution
 	ga_error("reconfigure thread started ...\n");
 	while(1) {
 		ga_ioctl_reconfigure_t reconf;
@@ -162,6 +172,10 @@ test_reconfig(void *) {
 #endif
 		reconf.framerate_n = framerate[s%3][0];
 		reconf.framerate_d = framerate[s%3][1];
+#if 0
+		reconf.width = resolution[s%2][0];
+		reconf.height = resolution[s%2][1];
+#endif
 		// vsource
 		if(m_vsource->ioctl) {
 			err = m_vsource->ioctl(GA_IOCTL_RECONFIGURE, sizeof(reconf), &reconf);
@@ -178,9 +192,10 @@ test_reconfig(void *) {
 			if(err < 0) {
 				ga_error("reconfigure encoder failed, err = %d.\n", err);
 			} else {
-				ga_error("reconfigure encoder OK, bitrate=%d; bufsize=%d; framerate=%d/%d.\n",
+				ga_error("reconfigure encoder OK, bitrate=%d; bufsize=%d; framerate=%d/%d; resolution=%dx%d.\n",
 						reconf.bitrateKbps, reconf.bufsize,
-						reconf.framerate_n, reconf.framerate_d);
+						reconf.framerate_n, reconf.framerate_d,
+						reconf.width, reconf.height);
 			}
 		}
 		s = (s + 1) % 6;
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * dpipe micro benchmark: compare the mutex pipe and the lock-free spsc pipe
+ *
+ * Usage: bench-dpipe [frames [nframe [framesize]]]
+ *
+ * - throughput: the producer stores \a frames frames as fast as the
+ *   consumer returns them, i.e., without overwriting pending frames.
+ * - latency: the producer stores one frame at a time while the consumer
+ *   is blocked in dpipe_load(), so it measures the store-to-load wakeup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "ga-common.h"
+#include "dpipe.h"
+
+#define	DEF_FRAMES	1000000
+#define	DEF_NFRAME	8
+#define	DEF_FRAMESIZE	64
+#define	LATENCY_SAMPLES	20000
+
+typedef struct bench_frame_s {
+	long long seq;		/**< sequence number, -1 to stop the consumer */
+	long long tstore;	/**< time when the frame is stored, in ns */
+}	bench_frame_t;
+
+typedef struct bench_s {
+	dpipe_t *pipe;
+	long long loaded;	/**< frames loaded by the consumer */
+	long long *latency;	/**< latency samples, or NULL for the throughput test */
+	volatile long long acked;	/**< latency test: last sequence loaded */
+}	bench_t;
+
+static void *
+bench_consumer(void *arg) {
+	bench_t *b = (bench_t*) arg;
+	dpipe_buffer_t *data;
+	bench_frame_t *f;
+	long long seq;
+	//
+	while(true) {
+		if((data = dpipe_load(b->pipe, NULL)) == NULL)
+			continue;
+		f = (bench_frame_t*) data->pointer;
+		seq = f->seq;
+		if(b->latency != NULL && seq >= 0) {
+			b->latency[seq] = ga_clock_ns() - f->tstore;
+			__sync_synchronize();
+			b->acked = seq;
+		}
+		dpipe_put(b->pipe, data);
+		if(seq < 0)
+			break;
+		b->loaded++;
+	}
+	return NULL;
+}
+
+static void
+bench_store(dpipe_t *pipe, long long seq) {
+	dpipe_buffer_t *data = dpipe_get(pipe);
+	bench_frame_t *f = (bench_frame_t*) data->pointer;
+	f->seq = seq;
+	f->tstore = ga_clock_ns();
+	dpipe_store(pipe, data);
+	return;
+}
+
+static int
+cmp_ll(const void *a, const void *b) {
+	long long x = *(const long long*) a, y = *(const long long*) b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void
+bench_throughput(const char *mode, dpipe_t *pipe, long long frames) {
+	bench_t b;
+	pthread_t t;
+	long long i, t0, t1;
+	dpipe_stats_t stats;
+	//
+	bzero(&b, sizeof(b));
+	b.pipe = pipe;
+	pthread_create(&t, NULL, bench_consumer, &b);
+	t0 = ga_clock_ns();
+	for(i = 0; i < frames; i++) {
+		// wait for a free frame, so that no frame is overwritten
+		while(__atomic_load_n(&pipe->in_count, __ATOMIC_ACQUIRE) <= 0)
+			;
+		bench_store(pipe, i);
+	}
+	bench_store(pipe, -1);
+	pthread_join(t, NULL);
+	t1 = ga_clock_ns();
+	dpipe_stats(pipe, &stats);
+	printf("%-6s throughput: %lld stored, %lld loaded, %llu overwritten, %.2f Mframes/s, %.1f ns/frame\n",
+		mode, frames, b.loaded, stats.overwritten,
+		1000.0 * b.loaded / (t1 - t0),
+		b.loaded ? 1.0 * (t1 - t0) / b.loaded : 0.0);
+	return;
+}
+
+static void
+bench_latency(const char *mode, dpipe_t *pipe) {
+	bench_t b;
+	pthread_t t;
+	long long i, sum = 0;
+	//
+	bzero(&b, sizeof(b));
+	b.pipe = pipe;
+	b.acked = -1;
+	if((b.latency = (long long*) malloc(LATENCY_SAMPLES * sizeof(long long))) == NULL)
+		return;
+	pthread_create(&t, NULL, bench_consumer, &b);
+	for(i = 0; i < LATENCY_SAMPLES; i++) {
+		// let the consumer block in dpipe_load() before storing
+		ga_clock_usleep(50, 0);
+		bench_store(pipe, i);
+		while(b.acked != i)
+			;
+	}
+	bench_store(pipe, -1);
+	pthread_join(t, NULL);
+	for(i = 0; i < LATENCY_SAMPLES; i++)
+		sum += b.latency[i];
+	qsort(b.latency, LATENCY_SAMPLES, sizeof(long long), cmp_ll);
+	printf("%-6s latency: avg %.2f us, p50 %.2f us, p99 %.2f us, max %.2f us (%d samples)\n",
+		mode, 0.001 * sum / LATENCY_SAMPLES,
+		0.001 * b.latency[LATENCY_SAMPLES / 2],
+		0.001 * b.latency[LATENCY_SAMPLES * 99 / 100],
+		0.001 * b.latency[LATENCY_SAMPLES - 1],
+		LATENCY_SAMPLES);
+	free(b.latency);
+	return;
+}
+
+int
+main(int argc, char *argv[]) {
+	long long frames = DEF_FRAMES;
+	int nframe = DEF_NFRAME, framesize = DEF_FRAMESIZE;
+	dpipe_t *pipe;
+	//
+	if(argc > 1)	frames = strtoll(argv[1], NULL, 0);
+	if(argc > 2)	nframe = strtol(argv[2], NULL, 0);
+	if(argc > 3)	framesize = strtol(argv[3], NULL, 0);
+	if(frames <= 0 || nframe <= 0 || framesize < (int) sizeof(bench_frame_t)) {
+		fprintf(stderr, "usage: %s [frames [nframe [framesize]]]\n", argv[0]);
+		return -1;
+	}
+	printf("bench-dpipe: %lld frames, %d frames per pipe, framesize = %d\n",
+		frames, nframe, framesize);
+	//
+	if((pipe = dpipe_create(0, "bench-mutex", nframe, framesize)) == NULL)
+		return -1;
+	bench_throughput("mutex", pipe, frames);
+	dpipe_destroy(pipe);
+	if((pipe = dpipe_create_spsc(0, "bench-spsc", nframe, framesize)) == NULL)
+		return -1;
+	bench_throughput("spsc", pipe, frames);
+	dpipe_destroy(pipe);
+	//
+	if((pipe = dpipe_create(0, "bench-mutex", nframe, framesize)) == NULL)
+		return -1;
+	bench_latency("mutex", pipe);
+	dpipe_destroy(pipe);
+	if((pipe = dpipe_create_spsc(0, "bench-spsc", nframe, framesize)) == NULL)
+		return -1;
+	bench_latency("spsc", pipe);
+	dpipe_destroy(pipe);
+	return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Unscaled RGB to YUV conversion benchmark: kernels against swscale
+ *
+ * Usage: bench-vconverter [width height [frames]]
+ *
+ * Each available kernel and sws_scale() convert the same BGRA frame to
+ * YUV420P and NV12. The throughput counts the bytes read and written,
+ * i.e., 5.5 bytes per pixel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ga-common.h"
+#include "ga-avcodec.h"
+#include "vconverter.h"
+
+#define	DEF_WIDTH	1920
+#define	DEF_HEIGHT	1080
+#define	DEF_FRAMES	200
+
+static const char *isa[] = { "c", "sse2", "avx2", "neon", NULL };
+
+static void
+report(const char *name, const char *conv, int width, int height, int frames, long long ns) {
+	double bytes = (double) width * height * 5.5 * frames;
+	printf("%-8s %-8s %.3f ms/frame, %.2f GB/s\n", name, conv,
+		0.000001 * ns / frames, bytes / ns);
+	return;
+}
+
+int
+main(int argc, char *argv[]) {
+	static const struct {
+		const char *name;
+		PixelFormat fmt;
+	} conv[] = {
+		{ "yuv420p", PIX_FMT_YUV420P },
+		{ "nv12", PIX_FMT_NV12 },
+	};
+	int width = DEF_WIDTH, height = DEF_HEIGHT, frames = DEF_FRAMES;
+	int i, j, n, stride;
+	unsigned char *rgb, *yuv;
+	unsigned char *dst[4];
+	int dststride[4];
+	const unsigned char *src[4] = { NULL, NULL, NULL, NULL };
+	int srcstride[4] = { 0, 0, 0, 0 };
+	long long t0;
+	//
+	if(argc > 2) {
+		width = strtol(argv[1], NULL, 0);
+		height = strtol(argv[2], NULL, 0);
+	}
+	if(argc > 3)
+		frames = strtol(argv[3], NULL, 0);
+	if(width < 2 || height < 2 || frames <= 0) {
+		fprintf(stderr, "usage: %s [width height [frames]]\n", argv[0]);
+		return -1;
+	}
+	stride = width * 4;
+	if((rgb = (unsigned char*) malloc(stride * height)) == NULL
+	|| (yuv = (unsigned char*) malloc(width * height * 2)) == NULL)
+		return -1;
+	for(i = 0; i < stride * height; i++)
+		rgb[i] = rand() & 0xff;
+	src[0] = rgb;
+	srcstride[0] = stride;
+	printf("bench-vconverter: bgra %dx%d, %d frames\n", width, height, frames);
+	//
+	for(j = 0; j < (int) (sizeof(conv) / sizeof(conv[0])); j++) {
+		struct SwsContext *swsctx;
+		dst[0] = yuv;
+		dst[1] = yuv + width * height;
+		dststride[0] = width;
+		if(conv[j].fmt == PIX_FMT_NV12) {
+			dst[2] = dst[3] = NULL;
+			dststride[1] = (width + 1) & ~1;
+			dststride[2] = dststride[3] = 0;
+		} else {
+			dst[2] = dst[1] + ((width + 1) / 2) * ((height + 1) / 2);
+			dst[3] = NULL;
+			dststride[1] = dststride[2] = (width + 1) / 2;
+			dststride[3] = 0;
+		}
+		// kernels
+		for(i = 0; isa[i] != NULL; i++) {
+			vconv_kernel_t k = lookup_frame_kernel_isa(isa[i], PIX_FMT_BGRA, conv[j].fmt);
+			if(k == NULL)
+				continue;
+			k(rgb, stride, dst, dststride, width, height);	// warm up
+			t0 = ga_clock_ns();
+			for(n = 0; n < frames; n++)
+				k(rgb, stride, dst, dststride, width, height);
+			report(isa[i], conv[j].name, width, height, frames, ga_clock_ns() - t0);
+		}
+		// swscale, the converter used without the kernels
+		if((swsctx = create_frame_converter(width, height, PIX_FMT_BGRA,
+				width, height, conv[j].fmt)) == NULL) {
+			printf("%-8s %-8s cannot create converter\n", "swscale", conv[j].name);
+			continue;
+		}
+		sws_scale(swsctx, src, srcstride, 0, height, dst, dststride);
+		t0 = ga_clock_ns();
+		for(n = 0; n < frames; n++)
+			sws_scale(swsctx, src, srcstride, 0, height, dst, dststride);
+		report("swscale", conv[j].name, width, height, frames, ga_clock_ns() - t0);
+	}
+	free(yuv);
+	free(rgb);
+	return 0;
+}
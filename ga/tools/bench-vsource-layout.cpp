@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Video frame layout benchmark: packed planes against vsource_frame_layout()
+ *
+ * Usage: bench-vsource-layout [width height [frames]]
+ *
+ * A BGRA frame is converted to a YUV420P video frame, as done by
+ * filter-rgb2yuv, and the frame is then copied row by row to an encoder
+ * picture, as done by encoder-video. Each step is timed with
+ * - packed: planes stored back to back with linesizes equal to the width,
+ *   and a 16-byte aligned buffer, i.e., the layout before vsource_frame_layout();
+ * - aligned: the layout of vsource_frame_layout().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ga-common.h"
+#include "ga-avcodec.h"
+#include "vsource.h"
+#include "vconverter.h"
+
+#define	DEF_FRAMES	300
+
+static const int sizes[][2] = {
+	{ 1280, 720 }, { 1366, 768 }, { 1600, 900 }, { 1920, 1080 },
+	{ 0, 0 }
+};
+
+static const char *isa[] = { "c", "sse2", "avx2", "neon", NULL };
+
+/* Allocate a video frame with the room for a padded YUV420P frame */
+static vsource_frame_t *
+frame_alloc(int width, int height, void **internal) {
+	int size = vsource_frame_size(PIX_FMT_YUV420P, width, height);
+	vsource_frame_t *frame;
+	//
+	if(size < 0 || (*internal = malloc(size + VIDEO_SOURCE_ALIGNMENT)) == NULL)
+		return NULL;
+	frame = (vsource_frame_t*) ((unsigned char*) *internal
+		+ ga_alignment(*internal, VIDEO_SOURCE_ALIGNMENT));
+	bzero(frame, sizeof(vsource_frame_t));
+	frame->imgbufsize = size - sizeof(vsource_frame_t) - VIDEO_SOURCE_ALIGNMENT;
+	frame->imgbuf_internal = ((unsigned char*) frame) + sizeof(vsource_frame_t);
+	frame->alignment = ga_alignment(frame->imgbuf_internal, VIDEO_SOURCE_ALIGNMENT);
+	frame->imgbuf = frame->imgbuf_internal + frame->alignment;
+	memset(frame->imgbuf, 0, frame->imgbufsize);
+	return frame;
+}
+
+/* The layout before vsource_frame_layout(): 16-byte aligned, packed planes */
+static void
+frame_layout_packed(vsource_frame_t *frame, int width, int height) {
+	int cw = (width + 1) >> 1, ch = (height + 1) >> 1;
+	frame->alignment += 16;
+	frame->imgbuf += 16;
+	frame->pixelformat = PIX_FMT_YUV420P;
+	frame->realwidth = width;
+	frame->realheight = height;
+	frame->linesize[0] = width;
+	frame->linesize[1] = frame->linesize[2] = cw;
+	frame->planeoffset[0] = 0;
+	frame->planeoffset[1] = width * height;
+	frame->planeoffset[2] = frame->planeoffset[1] + cw * ch;
+	frame->realsize = frame->planeoffset[2] + cw * ch;
+	frame->realstride = width;
+	return;
+}
+
+/* Copy the frame to an encoder picture, see vencoder_threadproc() of encoder-video */
+static void
+frame_copy(const vsource_frame_t *frame, unsigned char **dst, const int *dststride) {
+	int i, j;
+	for(i = 0; i < 3; i++) {
+		int w = i == 0 ? frame->realwidth : (frame->realwidth + 1) >> 1;
+		int h = i == 0 ? frame->realheight : (frame->realheight + 1) >> 1;
+		const unsigned char *src = vsource_frame_plane(frame, i);
+		unsigned char *d = dst[i];
+		for(j = 0; j < h; j++) {
+			bcopy(src, d, w);
+			src += frame->linesize[i];
+			d += dststride[i];
+		}
+	}
+	return;
+}
+
+static long long
+time_convert(vconv_kernel_t k, const unsigned char *rgb, int stride,
+		vsource_frame_t *frame, int frames) {
+	unsigned char *dst[4];
+	int dststride[4] = { 0, 0, 0, 0 };
+	long long t0;
+	int i, n;
+	//
+	for(i = 0; i < 3; i++) {
+		dst[i] = vsource_frame_plane(frame, i);
+		dststride[i] = frame->linesize[i];
+	}
+	dst[3] = NULL;
+	k(rgb, stride, dst, dststride, frame->realwidth, frame->realheight);	// warm up
+	t0 = ga_clock_ns();
+	for(n = 0; n < frames; n++)
+		k(rgb, stride, dst, dststride, frame->realwidth, frame->realheight);
+	return ga_clock_ns() - t0;
+}
+
+static long long
+time_copy(const vsource_frame_t *frame, unsigned char **pic, const int *picstride, int frames) {
+	long long t0;
+	int n;
+	//
+	frame_copy(frame, pic, picstride);	// warm up
+	t0 = ga_clock_ns();
+	for(n = 0; n < frames; n++)
+		frame_copy(frame, pic, picstride);
+	return ga_clock_ns() - t0;
+}
+
+static int
+bench_one(int width, int height, int frames) {
+	int stride = width * 4, cw = (width + 1) >> 1, ch = (height + 1) >> 1;
+	int i, picstride[3];
+	unsigned char *rgb, *picbuf, *pic[3];
+	void *ipacked, *ialigned;
+	vsource_frame_t *packed, *aligned;
+	//
+	packed = frame_alloc(width, height, &ipacked);
+	aligned = frame_alloc(width, height, &ialigned);
+	rgb = (unsigned char*) malloc(stride * height);
+	// the encoder picture: avcodec pads linesizes to 32 bytes
+	picstride[0] = (width + 31) & ~31;
+	picstride[1] = picstride[2] = (cw + 31) & ~31;
+	picbuf = (unsigned char*) malloc(picstride[0] * height + 2 * picstride[1] * ch + 64);
+	if(packed == NULL || aligned == NULL || rgb == NULL || picbuf == NULL) {
+		fprintf(stderr, "bench-vsource-layout: out of memory\n");
+		return -1;
+	}
+	pic[0] = picbuf + ga_alignment(picbuf, 32);
+	pic[1] = pic[0] + picstride[0] * height;
+	pic[2] = pic[1] + picstride[1] * ch;
+	for(i = 0; i < stride * height; i++)
+		rgb[i] = rand() & 0xff;
+	frame_layout_packed(packed, width, height);
+	if(vsource_frame_layout(aligned, PIX_FMT_YUV420P, width, height) < 0) {
+		fprintf(stderr, "bench-vsource-layout: layout failed for %dx%d\n", width, height);
+		return -1;
+	}
+	//
+	for(i = 0; isa[i] != NULL; i++) {
+		vconv_kernel_t k = lookup_frame_kernel_isa(isa[i], PIX_FMT_BGRA, PIX_FMT_YUV420P);
+		long long tp, ta;
+		if(k == NULL)
+			continue;
+		tp = time_convert(k, rgb, stride, packed, frames);
+		ta = time_convert(k, rgb, stride, aligned, frames);
+		printf("%4dx%-4d convert %-6s packed %.3f ms/frame, aligned %.3f ms/frame (%+.1f%%)\n",
+			width, height, isa[i],
+			0.000001 * tp / frames, 0.000001 * ta / frames,
+			100.0 * (ta - tp) / tp);
+	}
+	{
+		long long tp = time_copy(packed, pic, picstride, frames);
+		long long ta = time_copy(aligned, pic, picstride, frames);
+		printf("%4dx%-4d copy           packed %.3f ms/frame, aligned %.3f ms/frame (%+.1f%%)\n",
+			width, height,
+			0.000001 * tp / frames, 0.000001 * ta / frames,
+			100.0 * (ta - tp) / tp);
+	}
+	free(picbuf);
+	free(rgb);
+	free(ialigned);
+	free(ipacked);
+	return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+	int width = 0, height = 0, frames = DEF_FRAMES;
+	int i;
+	//
+	if(argc > 2) {
+		width = strtol(argv[1], NULL, 0);
+		height = strtol(argv[2], NULL, 0);
+		if(width < 2 || height < 2) {
+			fprintf(stderr, "usage: %s [width height [frames]]\n", argv[0]);
+			return -1;
+		}
+	}
+	if(argc > 3)
+		frames = strtol(argv[3], NULL, 0);
+	if(frames <= 0) {
+		fprintf(stderr, "usage: %s [width height [frames]]\n", argv[0]);
+		return -1;
+	}
+	printf("bench-vsource-layout: bgra to yuv420p, %d frames\n", frames);
+	if(width > 0)
+		return bench_one(width, height, frames);
+	for(i = 0; sizes[i][0] > 0; i++) {
+		if(bench_one(sizes[i][0], sizes[i][1], frames) < 0)
+			return -1;
+	}
+	return 0;
+}
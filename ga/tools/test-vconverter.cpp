@@ -0,0 +1,423 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Test the unscaled RGB to YUV kernels of vconverter-simd.cpp
+ *
+ * Usage: test-vconverter
+ *
+ * Each kernel (C, SSE2, AVX2, or NEON, if supported by the CPU) converts
+ * RGBA and BGRA images of even and odd sizes to YUV420P and NV12, with
+ * smooth gradients and with sharp edges of saturated colors.
+ * - The C kernel must be within +-1 of an exact BT.601 conversion, where
+ *   chroma is computed from the 2x2 average of the pixels.
+ * - The C kernel must be within +-1 of sws_scale() on luma. Chroma is
+ *   within +-2 on smooth images only: swscale filters chroma with more
+ *   than the 2x2 pixels, which differs by far more across sharp edges.
+ * - The SIMD kernels must produce the same output as the C kernel.
+ * - Bottom-up images, i.e., the last row with a negative stride as sent by
+ *   the GL hooks, and images converted in bands, as done by filter-rgb2yuv
+ *   with filter-threads, must produce the same output as a whole top-down
+ *   image, with every kernel. Bands converted by swscale must be within
+ *   the swscale tolerances above.
+ *
+ * Return 0 if all the tests passed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ga-common.h"
+#include "ga-avcodec.h"
+#include "vconverter.h"
+
+#define	MAX_DIFF		1	/* to the exact conversion, and swscale luma */
+#define	MAX_DIFF_SWS_CHROMA	2	/* to swscale chroma, smooth images only */
+#define	MAX_BANDS		7
+
+static const char *isa[] = { "c", "sse2", "avx2", "neon", NULL };
+
+static const int sizes[][2] = {
+	{ 2, 2 }, { 3, 3 }, { 5, 2 }, { 2, 7 }, { 17, 9 }, { 31, 33 },
+	{ 64, 64 }, { 65, 63 }, { 127, 31 }, { 640, 480 }, { 1279, 719 },
+	{ 0, 0 }
+};
+
+/* A YUV420P or NV12 image in one buffer */
+typedef struct yuv_image_s {
+	unsigned char *buf;
+	unsigned char *plane[4];
+	int stride[4];
+	int cwidth;		/**< width of the chroma plane(s), in bytes */
+	int cheight;		/**< height of the chroma plane(s) */
+}	yuv_image_t;
+
+static int
+yuv_alloc(yuv_image_t *img, int width, int height, int nv12) {
+	int cw = (width + 1) / 2, ch = (height + 1) / 2;
+	// strides are padded, so that overwrites are detected as well
+	bzero(img, sizeof(yuv_image_t));
+	img->stride[0] = width + 64;
+	img->stride[1] = nv12 ? cw * 2 + 64 : cw + 64;
+	img->stride[2] = nv12 ? 0 : cw + 64;
+	img->cwidth = nv12 ? cw * 2 : cw;
+	img->cheight = ch;
+	if((img->buf = (unsigned char*) malloc(img->stride[0] * height
+			+ (img->stride[1] + img->stride[2]) * ch)) == NULL)
+		return -1;
+	memset(img->buf, 0xa5, img->stride[0] * height + (img->stride[1] + img->stride[2]) * ch);
+	img->plane[0] = img->buf;
+	img->plane[1] = img->plane[0] + img->stride[0] * height;
+	img->plane[2] = nv12 ? NULL : img->plane[1] + img->stride[1] * ch;
+	return 0;
+}
+
+/* Triangle wave of period 510: no discontinuity */
+static int
+wave(int v) {
+	v %= 510;
+	return v < 256 ? v : 510 - v;
+}
+
+/* Smooth gradients: at most one level per pixel in each direction */
+static void
+fill_smooth(unsigned char *rgb, int stride, int width, int height) {
+	int x, y;
+	for(y = 0; y < height; y++) {
+		unsigned char *p = rgb + y * stride;
+		for(x = 0; x < width; x++, p += 4) {
+			p[0] = wave(16 + x);
+			p[1] = wave(32 + y);
+			p[2] = wave(300 + (x + y) / 2);
+			p[3] = 0xff;
+		}
+	}
+	return;
+}
+
+/* Sharp edges: 3x3 blocks of saturated colors, which cross the 2x2 chroma
+ * blocks, and one-pixel lines of the complementary colors */
+static void
+fill_edges(unsigned char *rgb, int stride, int width, int height) {
+	int x, y, c;
+	for(y = 0; y < height; y++) {
+		unsigned char *p = rgb + y * stride;
+		for(x = 0; x < width; x++, p += 4) {
+			c = ((x + 1) / 3 * 5 + (y + 1) / 3 * 3) & 7;
+			if(x % 7 == 3 || y % 11 == 5)
+				c = 7 - c;
+			p[0] = (c & 1) ? 0xff : 0;
+			p[1] = (c & 2) ? 0xff : 0;
+			p[2] = (c & 4) ? 0xff : 0;
+			p[3] = 0xff;
+		}
+	}
+	return;
+}
+
+static const struct {
+	const char *name;
+	void (*fill)(unsigned char *rgb, int stride, int width, int height);
+	int sws_chroma;		/* tolerance to swscale chroma, or -1 */
+} patterns[] = {
+	{ "smooth", fill_smooth, MAX_DIFF_SWS_CHROMA },
+	{ "edges", fill_edges, -1 },
+	{ NULL, NULL, 0 }
+};
+
+/* Exact BT.601 conversion. Chroma is computed from the 2x2 average,
+ * the last row and column are repeated for odd sizes. */
+static void
+convert_exact(const unsigned char *rgb, int stride, int rgba, yuv_image_t *img,
+		int nv12, int width, int height) {
+	int x, y, i, r = rgba ? 0 : 2, b = rgba ? 2 : 0;
+	for(y = 0; y < height; y++) {
+		const unsigned char *p = rgb + y * stride;
+		for(x = 0; x < width; x++, p += 4) {
+			img->plane[0][y * img->stride[0] + x] =
+				(unsigned char) (16.5 + 0.257 * p[r] + 0.504 * p[1] + 0.098 * p[b]);
+		}
+	}
+	for(y = 0; y < img->cheight; y++) {
+		for(x = 0; x < (width + 1) / 2; x++) {
+			double sr = 0, sg = 0, sb = 0;
+			unsigned char u, v;
+			for(i = 0; i < 4; i++) {
+				int yy = 2 * y + i / 2 < height ? 2 * y + i / 2 : height - 1;
+				int xx = 2 * x + i % 2 < width ? 2 * x + i % 2 : width - 1;
+				const unsigned char *q = rgb + yy * stride + xx * 4;
+				sr += q[r] / 4.0;
+				sg += q[1] / 4.0;
+				sb += q[b] / 4.0;
+			}
+			u = (unsigned char) (128.5 - 0.148 * sr - 0.291 * sg + 0.439 * sb);
+			v = (unsigned char) (128.5 + 0.439 * sr - 0.368 * sg - 0.071 * sb);
+			if(nv12) {
+				img->plane[1][y * img->stride[1] + 2 * x] = u;
+				img->plane[1][y * img->stride[1] + 2 * x + 1] = v;
+			} else {
+				img->plane[1][y * img->stride[1] + x] = u;
+				img->plane[2][y * img->stride[2] + x] = v;
+			}
+		}
+	}
+	return;
+}
+
+/* Compare \a rows rows of \a cols bytes. Return the maximum difference,
+ * and its position in \a atx and \a aty. */
+static int
+compare(const unsigned char *a, int astride, const unsigned char *b, int bstride,
+		int cols, int rows, int *atx, int *aty) {
+	int x, y, d, maxd = 0;
+	for(y = 0; y < rows; y++) {
+		for(x = 0; x < cols; x++) {
+			d = abs(a[y * astride + x] - b[y * bstride + x]);
+			if(d > maxd) {
+				maxd = d;
+				*atx = x;
+				*aty = y;
+			}
+		}
+	}
+	return maxd;
+}
+
+/* Check that the padding of each row is not written */
+static int
+check_padding(const yuv_image_t *img, int width, int height) {
+	int y, x, p;
+	for(p = 0; p < 3 && img->plane[p] != NULL; p++) {
+		int cols = p == 0 ? width : img->cwidth;
+		int rows = p == 0 ? height : img->cheight;
+		for(y = 0; y < rows; y++) {
+			for(x = cols; x < img->stride[p]; x++) {
+				if(img->plane[p][y * img->stride[p] + x] != 0xa5)
+					return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Compare two images, chroma is not compared if \a maxchroma is negative */
+static int
+compare_image(const char *what, const yuv_image_t *a, const yuv_image_t *b,
+		int width, int height, int maxluma, int maxchroma) {
+	int p, d, x = 0, y = 0;
+	for(p = 0; p < 3 && a->plane[p] != NULL; p++) {
+		int maxdiff = p == 0 ? maxluma : maxchroma;
+		if(maxdiff < 0)
+			continue;
+		d = compare(a->plane[p], a->stride[p], b->plane[p], b->stride[p],
+			p == 0 ? width : a->cwidth, p == 0 ? height : a->cheight, &x, &y);
+		if(d > maxdiff) {
+			printf("FAIL: %s: plane %d differs by %d at (%d,%d)\n", what, p, d, x, y);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* Rows of a band, see filter_convert_band() of filter-rgb2yuv */
+static void
+band_rows(int height, int id, int nbands, int *y0, int *y1) {
+	*y0 = (int) ((long long) height * id / nbands) & ~1;
+	*y1 = id == nbands - 1 ? height :
+		(int) ((long long) height * (id + 1) / nbands) & ~1;
+	return;
+}
+
+/* Planes of an image, from row \a y0 */
+static void
+band_planes(const yuv_image_t *img, int y0, unsigned char **dst) {
+	dst[0] = img->plane[0] + y0 * img->stride[0];
+	dst[1] = img->plane[1] + (y0 >> 1) * img->stride[1];
+	dst[2] = img->plane[2] ? img->plane[2] + (y0 >> 1) * img->stride[2] : NULL;
+	dst[3] = NULL;
+	return;
+}
+
+/* Convert with a kernel, or with swscale if \a k is NULL,
+ * in \a nbands bands, or as a whole if \a nbands is 1 */
+static int
+convert(vconv_kernel_t k, PixelFormat srcfmt, PixelFormat dstfmt,
+		const unsigned char *rgb, int srcstride, yuv_image_t *img,
+		int width, int height, int nbands) {
+	int i, y0, y1;
+	unsigned char *dst[4];
+	for(i = 0; i < nbands; i++) {
+		band_rows(height, i, nbands, &y0, &y1);
+		if(y1 <= y0)
+			continue;
+		band_planes(img, y0, dst);
+		if(k != NULL) {
+			k(rgb + y0 * srcstride, srcstride, dst, img->stride, width, y1 - y0);
+		} else {
+			const unsigned char *src[4] = { rgb + y0 * srcstride, NULL, NULL, NULL };
+			int sstride[4] = { srcstride, 0, 0, 0 };
+			struct SwsContext *swsctx;
+			// converters are kept by vconverter.cpp
+			if((swsctx = create_frame_converter(width, y1 - y0, srcfmt,
+					width, y1 - y0, dstfmt)) == NULL)
+				return -1;
+			sws_scale(swsctx, src, sstride, 0, y1 - y0, dst, img->stride);
+		}
+	}
+	return 0;
+}
+
+/* Convert with a kernel, or swscale, top-down, bottom-up, and in bands.
+ * Each output is compared with \a ref within the given tolerances. */
+static int
+test_converter(const char *what, vconv_kernel_t k, PixelFormat srcfmt, PixelFormat dstfmt,
+		const unsigned char *rgb, const unsigned char *flipped, int srcstride,
+		const yuv_image_t *ref, int width, int height, int maxluma, int maxchroma) {
+	static const int bands[] = { 1, 2, 3, MAX_BANDS, 0 };
+	int nv12 = (dstfmt == PIX_FMT_NV12);
+	int i, bottomup, err = 0;
+	yuv_image_t out;
+	char desc[160];
+	//
+	for(i = 0; bands[i] > 0; i++) {
+		// bands of at least two rows
+		if(bands[i] > 1 && height < bands[i] * 2)
+			continue;
+		for(bottomup = 0; bottomup < 2; bottomup++) {
+			if(yuv_alloc(&out, width, height, nv12) < 0)
+				return -1;
+			// the last row of the flipped image is the first one of the image
+			if(convert(k, srcfmt, dstfmt,
+					bottomup ? flipped + (height - 1) * srcstride : rgb,
+					bottomup ? -srcstride : srcstride,
+					&out, width, height, bands[i]) < 0) {
+				printf("FAIL: %s: cannot create swscale converter\n", what);
+				free(out.buf);
+				return -1;
+			}
+			snprintf(desc, sizeof(desc), "%s%s, %d band%s", what,
+				bottomup ? " bottom-up" : "", bands[i], bands[i] > 1 ? "s" : "");
+			if(compare_image(desc, &out, ref, width, height, maxluma, maxchroma) < 0)
+				err = -1;
+			// swscale may write up to the padded linesize
+			if(k != NULL && check_padding(&out, width, height) < 0) {
+				printf("FAIL: %s: writes beyond the row\n", desc);
+				err = -1;
+			}
+			free(out.buf);
+		}
+	}
+	return err;
+}
+
+static int
+test_one(const char *name, PixelFormat srcfmt, PixelFormat dstfmt, int pattern,
+		int width, int height) {
+	int nv12 = (dstfmt == PIX_FMT_NV12);
+	int i, y, err = 0, srcstride = width * 4 + 32;
+	unsigned char *rgb, *flipped;
+	yuv_image_t exact, ref;
+	vconv_kernel_t kc;
+	char what[128];
+	//
+	if((rgb = (unsigned char*) malloc(srcstride * height)) == NULL)
+		return -1;
+	if((flipped = (unsigned char*) malloc(srcstride * height)) == NULL) {
+		free(rgb);
+		return -1;
+	}
+	patterns[pattern].fill(rgb, srcstride, width, height);
+	for(y = 0; y < height; y++)
+		bcopy(rgb + y * srcstride, flipped + (height - 1 - y) * srcstride, srcstride);
+	if((kc = lookup_frame_kernel_isa("c", srcfmt, dstfmt)) == NULL
+	|| yuv_alloc(&exact, width, height, nv12) < 0
+	|| yuv_alloc(&ref, width, height, nv12) < 0) {
+		free(flipped);
+		free(rgb);
+		return -1;
+	}
+	snprintf(what, sizeof(what), "%s %s %dx%d", name, patterns[pattern].name, width, height);
+	// the C kernel against the exact conversion
+	convert_exact(rgb, srcstride, srcfmt == PIX_FMT_RGBA, &exact, nv12, width, height);
+	kc(rgb, srcstride, ref.plane, ref.stride, width, height);
+	if(compare_image(what, &ref, &exact, width, height, MAX_DIFF, MAX_DIFF) < 0)
+		err = -1;
+	if(check_padding(&ref, width, height) < 0) {
+		printf("FAIL: %s c: writes beyond the row\n", what);
+		err = -1;
+	}
+	// all the kernels against the C kernel
+	for(i = 0; isa[i] != NULL; i++) {
+		vconv_kernel_t k = lookup_frame_kernel_isa(isa[i], srcfmt, dstfmt);
+		char desc[160];
+		if(k == NULL)
+			continue;
+		snprintf(desc, sizeof(desc), "%s %s/c", what, isa[i]);
+		if(test_converter(desc, k, srcfmt, dstfmt, rgb, flipped, srcstride,
+				&ref, width, height, 0, 0) < 0)
+			err = -1;
+	}
+	// swscale against the C kernel
+	{
+		char desc[160];
+		snprintf(desc, sizeof(desc), "%s swscale/c", what);
+		if(test_converter(desc, NULL, srcfmt, dstfmt, rgb, flipped, srcstride,
+				&ref, width, height, MAX_DIFF, patterns[pattern].sws_chroma) < 0)
+			err = -1;
+	}
+	free(exact.buf);
+	free(ref.buf);
+	free(flipped);
+	free(rgb);
+	return err;
+}
+
+int
+main(int argc, char *argv[]) {
+	static const struct {
+		const char *name;
+		PixelFormat srcfmt, dstfmt;
+	} conv[] = {
+		{ "rgba->yuv420p", PIX_FMT_RGBA, PIX_FMT_YUV420P },
+		{ "bgra->yuv420p", PIX_FMT_BGRA, PIX_FMT_YUV420P },
+		{ "rgba->nv12", PIX_FMT_RGBA, PIX_FMT_NV12 },
+		{ "bgra->nv12", PIX_FMT_BGRA, PIX_FMT_NV12 },
+	};
+	int i, j, p, tests = 0, failed = 0;
+	//
+	printf("test-vconverter: kernels");
+	for(i = 0; isa[i] != NULL; i++) {
+		if(lookup_frame_kernel_isa(isa[i], PIX_FMT_RGBA, PIX_FMT_YUV420P) != NULL)
+			printf(" %s", isa[i]);
+	}
+	printf("\n");
+	for(i = 0; i < (int) (sizeof(conv) / sizeof(conv[0])); i++) {
+		for(p = 0; patterns[p].name != NULL; p++) {
+			for(j = 0; sizes[j][0] > 0; j++) {
+				tests++;
+				if(test_one(conv[i].name, conv[i].srcfmt, conv[i].dstfmt, p,
+						sizes[j][0], sizes[j][1]) < 0)
+					failed++;
+			}
+		}
+	}
+	printf("test-vconverter: %d tests, %d failed\n", tests, failed);
+	return failed > 0 ? 1 : 0;
+}
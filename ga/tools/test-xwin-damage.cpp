@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2013-2015 Chun-Ying Huang
+ *
+ * This file is part of GamingAnywhere (GA).
+ *
+ * GA is free software; you can redistribute it and/or modify it
+ * under the terms of the 3-clause BSD License as published by the
+ * Free Software Foundation: http://directory.fsf.org/wiki/License:BSD_3Clause
+ *
+ * GA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * You should have received a copy of the 3-clause BSD License along with GA;
+ * if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/**
+ * @file
+ * Test the damaged region capture of ga-xwin.cpp (vsource-desktop)
+ *
+ * Usage: test-xwin-damage [frames]
+ *
+ * Run on a headless X server with the DAMAGE extension, e.g.,
+ *	xvfb-run -a -s "-screen 0 640x480x24" ./test-xwin-damage
+ *
+ * Random rectangles are drawn on the root window before each frame,
+ * and the frame assembled by ga_xwin_capture() from the damaged regions
+ * must match a full capture of the screen taken with XGetImage().
+ * The frames are captured into
+ * - heap buffers reused in turn, as the frames of a pipe, with some
+ *   buffers left behind for more than the damage history;
+ * - heap buffers of a crop rectangle;
+ * - XShm buffers from ga_xwin_alloc_buffer(), which are released and
+ *   allocated again half-way;
+ * - the heap buffers again, after the XShm buffers are released.
+ *
+ * Return 0 if all the tests passed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ga-common.h"
+#include "ga-xwin.h"
+
+#define	DEF_FRAMES	200
+#define	NBUFFERS	4	/* as many as the frames of a pipe */
+#define	STALE_EVERY	40	/* buffer 0 is only captured every N frames */
+
+static Display *display = NULL;	/* drawing connection */
+static Window root;
+static GC gc;
+static int width, height;
+
+/* Draw random rectangles: nothing, a few small ones, or a large one */
+static void
+draw_random() {
+	int i, n, x, y, w, h, kind = rand() % 10;
+	if(kind == 0)
+		return;
+	n = kind == 1 ? 1 : 1 + rand() % 8;
+	for(i = 0; i < n; i++) {
+		if(kind == 1) {
+			// more than a quarter of the screen: fetched as a whole
+			w = width / 2 + rand() % (width / 2);
+			h = height / 2 + rand() % (height / 2);
+		} else {
+			w = 1 + rand() % (width / 8);
+			h = 1 + rand() % (height / 8);
+		}
+		// partially off the screen, sometimes
+		x = rand() % (width + w) - w / 2;
+		y = rand() % (height + h) - h / 2;
+		XSetForeground(display, gc, rand() & 0xffffff);
+		XFillRectangle(display, root, gc, x, y, w, h);
+	}
+	XSync(display, False);
+	return;
+}
+
+/* Compare a captured frame with a full capture of the screen.
+ * Only the color channels are compared, the padding byte is undefined. */
+static int
+compare_frame(const char *what, int frame, const char *buf, int linesize, struct gaRect *rect) {
+	XImage *ref;
+	int x, y, left = 0, top = 0, w = width, h = height;
+	if(rect != NULL) {
+		left = rect->left;
+		top = rect->top;
+		w = rect->width;
+		h = rect->height;
+	}
+	if((ref = XGetImage(display, root, left, top, w, h, AllPlanes, ZPixmap)) == NULL) {
+		printf("FAIL: %s: XGetImage failed\n", what);
+		return -1;
+	}
+	for(y = 0; y < h; y++) {
+		const unsigned char *a = (const unsigned char*) buf + y * linesize;
+		const unsigned char *b = (const unsigned char*) ref->data + y * ref->bytes_per_line;
+		for(x = 0; x < w; x++, a += 4, b += 4) {
+			if(a[0] != b[0] || a[1] != b[1] || a[2] != b[2]) {
+				printf("FAIL: %s: frame %d differs at (%d,%d): %02x%02x%02x, expected %02x%02x%02x\n",
+					what, frame, x + left, y + top,
+					a[2], a[1], a[0], b[2], b[1], b[0]);
+				XDestroyImage(ref);
+				return -1;
+			}
+		}
+	}
+	XDestroyImage(ref);
+	return 0;
+}
+
+/* Capture \a frames frames into \a bufs in turn, see the file description */
+static int
+test_capture(const char *what, char **bufs, int nbufs, int linesize, int bufsize,
+		struct gaRect *rect, int frames) {
+	int i, b;
+	for(i = 0; i < frames; i++) {
+		draw_random();
+		ga_xwin_update();
+		// buffer 0 is left behind for more than the damage history
+		b = 1 + i % (nbufs - 1);
+		if(i % STALE_EVERY == 0)
+			b = 0;
+		ga_xwin_capture(bufs[b], bufsize, rect);
+		if(compare_frame(what, i, bufs[b], linesize, rect) < 0)
+			return -1;
+	}
+	printf("test-xwin-damage: %s: %d frames ok\n", what, frames);
+	return 0;
+}
+
+static int
+test_xshm(struct gaRect *rect, int frames) {
+	char *bufs[NBUFFERS];
+	int i, round, stride = 0;
+	const char *what[] = { "xshm", "xshm reallocated" };
+	for(round = 0; round < 2; round++) {
+		for(i = 0; i < NBUFFERS; i++) {
+			if((bufs[i] = ga_xwin_alloc_buffer(rect, &stride)) == NULL) {
+				printf("FAIL: xshm: cannot allocate buffers\n");
+				ga_xwin_free_buffers();
+				return -1;
+			}
+		}
+		if(test_capture(what[round], bufs, NBUFFERS, stride,
+				stride * (rect ? rect->height : height), rect, frames / 2) < 0) {
+			ga_xwin_free_buffers();
+			return -1;
+		}
+		ga_xwin_free_buffers();
+	}
+	return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+	gaImage image;
+	struct gaRect crop;
+	char *heap[NBUFFERS], *cropped[NBUFFERS];
+	int i, frames = DEF_FRAMES, failed = 0;
+	//
+	if(argc > 1 && (frames = strtol(argv[1], NULL, 0)) <= 0) {
+		fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+		return -1;
+	}
+	if((display = XOpenDisplay(NULL)) == NULL) {
+		printf("FAIL: cannot open display, run with xvfb-run\n");
+		return 1;
+	}
+	root = XDefaultRootWindow(display);
+	gc = XCreateGC(display, root, 0, NULL);
+	if(ga_xwin_init(NULL, &image) < 0) {
+		printf("FAIL: ga_xwin_init failed\n");
+		return 1;
+	}
+	if(ga_xwin_damage_enabled() == 0) {
+		printf("FAIL: damage is not tracked, build with HAVE_XDAMAGE and run on a server with DAMAGE\n");
+		return 1;
+	}
+	width = image.width;
+	height = image.height;
+	srand(1);
+	// the buffers are kept, see ga_xwin_damage_enabled(), and
+	// ga_xwin_capture() wants room for the whole screen, even if cropped
+	ga_fillrect(&crop, width / 8 + 1, height / 8 + 1, width * 3 / 4, height * 3 / 4);
+	for(i = 0; i < NBUFFERS; i++) {
+		heap[i] = (char*) calloc(1, image.bytes_per_line * height);
+		cropped[i] = (char*) calloc(1, image.bytes_per_line * height);
+		if(heap[i] == NULL || cropped[i] == NULL) {
+			printf("FAIL: out of memory\n");
+			return 1;
+		}
+	}
+	//
+	printf("test-xwin-damage: screen %dx%d, %d frames\n", width, height, frames);
+	if(test_capture("heap", heap, NBUFFERS, image.bytes_per_line,
+			image.bytes_per_line * height, NULL, frames) < 0)
+		failed++;
+	if(test_capture("heap cropped", cropped, NBUFFERS, crop.linesize,
+			image.bytes_per_line * height, &crop, frames) < 0)
+		failed++;
+	if(test_xshm(NULL, frames) < 0)
+		failed++;
+	if(test_capture("heap after xshm", heap, NBUFFERS, image.bytes_per_line,
+			image.bytes_per_line * height, NULL, frames) < 0)
+		failed++;
+	//
+	for(i = 0; i < NBUFFERS; i++) {
+		free(heap[i]);
+		free(cropped[i]);
+	}
+	ga_xwin_deinit();
+	XFreeGC(display, gc);
+	XCloseDisplay(display);
+	printf("test-xwin-damage: %s\n", failed > 0 ? "FAILED" : "passed");
+	return failed > 0 ? 1 : 0;
+}